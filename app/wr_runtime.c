@@ -547,14 +547,31 @@ void action_mkdir_c(const cJSON *action_obj, const void *context) {
         syslog(LOG_ERR, "[MKDIR_C] Missing or empty path parameter.");
         return;
     }
-    char command[1024]; 
-    snprintf(command, sizeof(command), "mkdir -p '%s'", path_str);
-    syslog(LOG_INFO, "[MKDIR_C] Attempting to execute: %s", command);
-    int ret = system(command);
+    // Native mkdir -p: create each prefix in turn, no shell.
+    char path[1024];
+    if (strlen(path_str) >= sizeof(path)) {
+        syslog(LOG_ERR, "[MKDIR_C] Path too long: %s", path_str);
+        return;
+    }
+    strcpy(path, path_str);
+    int ret = 0;
+    for (char *p = path + 1; ret == 0; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char saved = *p;
+        *p = '\0';
+        struct stat st;
+        if (mkdir(path, 0755) != 0) {
+            if (errno != EEXIST) ret = errno;
+            else if (stat(path, &st) != 0) ret = errno;
+            else if (!S_ISDIR(st.st_mode)) ret = ENOTDIR; // An existing file in the way, as mkdir -p reports it
+        }
+        *p = saved;
+        if (saved == '\0') break;
+    }
     if (ret == 0) {
         syslog(LOG_INFO, "[MKDIR_C] Path '%s' created or already exists.", path_str);
     } else {
-        syslog(LOG_ERR, "[MKDIR_C] Failed to create path '%s'. System command returned %d.", path_str, ret);
+        syslog(LOG_ERR, "[MKDIR_C] Failed to create path '%s': %s", path_str, strerror(ret));
     }
 }
 
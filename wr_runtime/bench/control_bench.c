@@ -0,0 +1,426 @@
+// Control socket benchmark: starts the daemon and pushes N pipelined NDJSON requests with
+// ids over one connection, reading results as they come; then the same through a
+// submission ring, and as files dropped into the spool directory. Reports the sustained rate and the submit-to-result latency, for
+// "validate" (ingestion only: parse, validate, compile) and "run" (a one-shot with one
+// native mkdir action). Prints one JSON document.
+//
+// Usage: wr_bench_control [--daemon PATH] [--requests N]
+//   PATH: the daemon (default ./wr_runtime); N: requests per operation (default 20000).
+#define _GNU_SOURCE // For mkdtemp, nftw, memmem
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "cJSON.h"
+#include "submit_ring.h"
+
+#define CONNECT_TIMEOUT_SECONDS 10
+#define RESULT_TIMEOUT_MS 10000    // Give up when no result arrives for this long
+#define RING_KB 4096               // Per queue
+#define SPOOL_WINDOW 4096          // Files dropped but not yet recorded, kept under the backlog limit
+
+enum { TRANSPORT_SOCKET, TRANSPORT_RING, TRANSPORT_SPOOL };
+static const char *transport_names[] = { "socket", "ring", "spool" };
+
+typedef struct {
+    int fd;
+    const char *op;
+    const char *work_dir;
+    int requests;
+    uint64_t *sent_ns;  // Per id
+    int failed;         // The writer could not send everything
+    submit_ring_t *ring; // Submit through this instead of the socket
+    const char *spool;   // Or drop files into this spool directory
+    _Atomic int results; // Results read so far (spool: the writer waits on it)
+} writer_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_seconds(double s) {
+    struct timespec ts = { (time_t)s, (long)((s - (double)(time_t)s) * 1e9) };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static pid_t start_daemon(const char *daemon, const char *dir) {
+    char services[4096], control[4096], metrics[4096], notify[4096], log[4096], spool[4096], shm[64];
+    snprintf(services, sizeof(services), "%s/services", dir);
+    snprintf(control, sizeof(control), "%s/control.sock", dir);
+    snprintf(metrics, sizeof(metrics), "%s/metrics.sock", dir);
+    snprintf(notify, sizeof(notify), "%s/notify.sock", dir);
+    snprintf(log, sizeof(log), "%s/daemon.log", dir);
+    snprintf(spool, sizeof(spool), "%s/spool", dir);
+    snprintf(shm, sizeof(shm), "/wr_bench_control.%d", (int)getpid());
+    if (mkdir(services, 0755) != 0) return -1;
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    setenv("WR_CONTROL_SOCKET", control, 1);
+    setenv("WR_METRICS_SOCKET", metrics, 1);
+    setenv("WR_NOTIFY_SOCKET", notify, 1);
+    setenv("WR_STATS_SHM", shm, 1);
+    setenv("WR_LOG", log, 1);
+    setenv("WR_SPOOL_DIR", spool, 1);
+    setenv("WR_LOG_LEVEL", "warn", 1); // Every one-shot would log a line otherwise
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+    }
+    execl(daemon, daemon, "--services-dir", services, (char *)NULL);
+    _exit(127);
+}
+
+static int connect_control(const char *dir) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/control.sock", dir);
+    for (int tries = 0; tries < CONNECT_TIMEOUT_SECONDS * 100; tries++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+        close(fd);
+        sleep_seconds(0.01);
+    }
+    return -1;
+}
+
+static int format_request(char *line, size_t size, const writer_t *w, int i) {
+    return snprintf(line, size,
+                    "{\"id\":%d,\"op\":\"%s\",\"service\":{\"name\":\"bench_%d\",\"condition\":\"always_true\","
+                    "\"actions\":[{\"type\":\"mkdir\",\"path\":\"%s/work\"}]}}\n",
+                    i, w->op, i, w->work_dir);
+}
+
+// Submits the requests to the ring, ringing the doorbell after every few.
+static void *ring_writer_main(void *arg) {
+    writer_t *w = arg;
+    for (int i = 0; i < w->requests; i++) {
+        char line[512];
+        int n = format_request(line, sizeof(line), w, i);
+        w->sent_ns[i] = now_ns();
+        while (SubmitRing_submit(w->ring, SUBMIT_RING_JSON, (uint64_t)i, line, (uint32_t)n - 1) != 0) {
+            if (errno != EAGAIN) {
+                w->failed = 1;
+                return NULL;
+            }
+            SubmitRing_notify(w->ring);
+            sched_yield();
+        }
+        if (i % 64 == 63) SubmitRing_notify(w->ring);
+    }
+    SubmitRing_notify(w->ring);
+    return NULL;
+}
+
+// Drops each request as a file: written to tmp/, renamed into new/.
+static void *spool_writer_main(void *arg) {
+    writer_t *w = arg;
+    for (int i = 0; i < w->requests; i++) {
+        char line[512], tmp[4200], dest[4200];
+        int n = format_request(line, sizeof(line), w, i);
+        snprintf(tmp, sizeof(tmp), "%s/tmp/bench.%08d", w->spool, i);
+        snprintf(dest, sizeof(dest), "%s/new/bench.%08d", w->spool, i);
+        while (i - atomic_load(&w->results) >= SPOOL_WINDOW) sleep_seconds(0.0001);
+        w->sent_ns[i] = now_ns();
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        int ok = fd >= 0 && write(fd, line, (size_t)n) == n;
+        if (fd >= 0) close(fd);
+        if (!ok || rename(tmp, dest) != 0) {
+            w->failed = 1;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Writes the requests in batches, as a busy producer would.
+static void *writer_main(void *arg) {
+    writer_t *w = arg;
+    char batch[65536];
+    size_t len = 0;
+    int first = 0; // First id in the batch
+    for (int i = 0; i <= w->requests; i++) {
+        char line[512];
+        int n = 0;
+        if (i < w->requests) n = format_request(line, sizeof(line), w, i);
+        if (i == w->requests || len + (size_t)n > sizeof(batch)) {
+            uint64_t t = now_ns();
+            for (int k = first; k < i; k++) w->sent_ns[k] = t;
+            for (size_t off = 0; off < len;) {
+                ssize_t s = write(w->fd, batch + off, len - off);
+                if (s < 0 && errno == EINTR) continue;
+                if (s <= 0) {
+                    w->failed = 1;
+                    return NULL;
+                }
+                off += (size_t)s;
+            }
+            len = 0;
+            first = i;
+        }
+        memcpy(batch + len, line, (size_t)n);
+        len += (size_t)n;
+    }
+    return NULL;
+}
+
+// Ask for a submission ring and map it. Returns the mapping, or NULL.
+static void *attach_ring(int fd, submit_ring_t *ring, size_t *size) {
+    char req[64];
+    int n = snprintf(req, sizeof(req), "{\"op\":\"ring\",\"sq_kb\":%d,\"cq_kb\":%d}\n", RING_KB, RING_KB);
+    if (write(fd, req, (size_t)n) != n) return NULL;
+    char reply[256];
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { reply, sizeof(reply) - 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t got = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (got <= 0 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        return NULL;
+    }
+    reply[got] = '\0';
+    int fds[3];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    char *size_field = strstr(reply, "\"size\":");
+    *size = size_field != NULL ? (size_t)strtoull(size_field + 7, NULL, 10) : 0;
+    void *base = *size > 0 ? mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0) : MAP_FAILED;
+    close(fds[0]);
+    if (base == MAP_FAILED || SubmitRing_init(ring, base, *size, fds[1], fds[2]) != 0) return NULL;
+    return base;
+}
+
+// Reads the results from the completion ring into 'latency'. Returns how many.
+static int read_ring_results(submit_ring_t *ring, const writer_t *w, uint64_t *latency, int *errors) {
+    int received = 0;
+    while (received < w->requests) {
+        const submit_ring_record_t *rec = SubmitRing_complete_peek(ring);
+        if (rec == NULL) {
+            if (!SubmitRing_wait(ring, RESULT_TIMEOUT_MS)) break;
+            continue;
+        }
+        uint64_t t = now_ns();
+        uint32_t len = atomic_load_explicit(&((submit_ring_record_t *)rec)->len, memory_order_relaxed);
+        if (rec->user_data < (uint64_t)w->requests) latency[received++] = t - w->sent_ns[rec->user_data];
+        if (memmem(rec + 1, len, "\"ok\":false", 10) != NULL) (*errors)++;
+        SubmitRing_complete_next(ring, rec);
+    }
+    return received;
+}
+
+// Follows outcomes.log from 'offset' (its size before the run). Returns how many results.
+static int read_spool_results(writer_t *w, off_t offset, uint64_t *latency, int *errors) {
+    char path[4200];
+    snprintf(path, sizeof(path), "%s/outcomes.log", w->spool);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    char buf[65536];
+    size_t have = 0;
+    int received = 0;
+    uint64_t last_progress = now_ns();
+    while (received < w->requests && now_ns() - last_progress < (uint64_t)RESULT_TIMEOUT_MS * 1000000u) {
+        ssize_t n = pread(fd, buf + have, sizeof(buf) - have, offset);
+        if (n <= 0) {
+            sleep_seconds(0.0005);
+            continue;
+        }
+        uint64_t t = now_ns();
+        offset += n;
+        have += (size_t)n;
+        char *line = buf, *nl;
+        while ((nl = memchr(line, '\n', have - (size_t)(line - buf))) != NULL) {
+            // {"spool_file":"bench.NNNNNNNN","ok":...}
+            int id = atoi(line + 21);
+            if (strncmp(line, "{\"spool_file\":\"bench.", 21) == 0 && id >= 0 && id < w->requests) {
+                latency[received++] = t - w->sent_ns[id];
+            }
+            if (memmem(line, (size_t)(nl - line), "\"ok\":false", 10) != NULL) (*errors)++;
+            line = nl + 1;
+        }
+        have -= (size_t)(line - buf);
+        memmove(buf, line, have);
+        atomic_store(&w->results, received);
+        last_progress = t;
+    }
+    close(fd);
+    return received;
+}
+
+static cJSON *run(const char *dir, const char *op, int requests, int transport) {
+    cJSON *r = cJSON_CreateObject();
+    cJSON_AddStringToObject(r, "op", op);
+    cJSON_AddStringToObject(r, "transport", transport_names[transport]);
+    cJSON_AddNumberToObject(r, "requests", requests);
+    int fd = connect_control(dir); // Also waits for the daemon to be up
+    if (fd < 0) {
+        cJSON_AddStringToObject(r, "error", "cannot connect to the control socket");
+        return r;
+    }
+    submit_ring_t ring;
+    size_t ring_size = 0;
+    void *ring_map = NULL;
+    if (transport == TRANSPORT_RING && (ring_map = attach_ring(fd, &ring, &ring_size)) == NULL) {
+        cJSON_AddStringToObject(r, "error", "cannot attach a submission ring");
+        close(fd);
+        return r;
+    }
+    char work_dir[4096], spool[4096];
+    snprintf(work_dir, sizeof(work_dir), "%s", dir);
+    snprintf(spool, sizeof(spool), "%s/spool", dir);
+    writer_t w = { fd, op, work_dir, requests, calloc((size_t)requests, sizeof(uint64_t)), 0,
+                   transport == TRANSPORT_RING ? &ring : NULL, transport == TRANSPORT_SPOOL ? spool : NULL, 0 };
+    uint64_t *latency = calloc((size_t)requests, sizeof(uint64_t));
+    if (w.sent_ns == NULL || latency == NULL) {
+        cJSON_AddStringToObject(r, "error", "out of memory");
+        free(w.sent_ns);
+        free(latency);
+        if (ring_map != NULL) munmap(ring_map, ring_size);
+        close(fd);
+        return r;
+    }
+
+    char log_path[4200];
+    struct stat st;
+    snprintf(log_path, sizeof(log_path), "%s/outcomes.log", spool);
+    off_t log_offset = stat(log_path, &st) == 0 ? st.st_size : 0;
+    uint64_t started = now_ns();
+    pthread_t writer;
+    pthread_create(&writer, NULL, transport == TRANSPORT_RING ? ring_writer_main
+                                  : transport == TRANSPORT_SPOOL ? spool_writer_main : writer_main, &w);
+    int received = 0, errors = 0;
+    char buf[65536];
+    size_t have = 0;
+    if (transport == TRANSPORT_RING) received = read_ring_results(&ring, &w, latency, &errors);
+    if (transport == TRANSPORT_SPOOL) received = read_spool_results(&w, log_offset, latency, &errors);
+    while (transport == TRANSPORT_SOCKET && received < requests) {
+        ssize_t n = read(fd, buf + have, sizeof(buf) - have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        uint64_t t = now_ns();
+        have += (size_t)n;
+        char *line = buf, *nl;
+        while ((nl = memchr(line, '\n', have - (size_t)(line - buf))) != NULL) {
+            // Results are small and flat: {"id":N,"ok":true|false,...}
+            int id = atoi(line + 6);
+            if (strncmp(line, "{\"id\":", 6) == 0 && id >= 0 && id < requests) {
+                latency[received++] = t - w.sent_ns[id];
+            }
+            if (memmem(line, (size_t)(nl - line), "\"ok\":false", 10) != NULL) errors++;
+            line = nl + 1;
+        }
+        have -= (size_t)(line - buf);
+        memmove(buf, line, have);
+    }
+    double seconds = (double)(now_ns() - started) / 1e9;
+    pthread_join(writer, NULL);
+    if (ring_map != NULL) {
+        munmap(ring_map, ring_size);
+        close(ring.sq_fd);
+        close(ring.cq_fd);
+    }
+    close(fd);
+
+    qsort(latency, (size_t)received, sizeof(*latency), compare_u64);
+    cJSON_AddNumberToObject(r, "results", received);
+    cJSON_AddNumberToObject(r, "errors", errors);
+    cJSON_AddNumberToObject(r, "seconds", seconds);
+    cJSON_AddNumberToObject(r, "requests_per_second", (double)received / seconds);
+    if (received > 0) {
+        cJSON_AddNumberToObject(r, "latency_p50_ms", (double)latency[received / 2] / 1e6);
+        cJSON_AddNumberToObject(r, "latency_p99_ms", (double)latency[(size_t)received * 99 / 100] / 1e6);
+        cJSON_AddNumberToObject(r, "latency_max_ms", (double)latency[received - 1] / 1e6);
+    }
+    if (w.failed) cJSON_AddStringToObject(r, "error", "the daemon stopped taking requests");
+    free(w.sent_ns);
+    free(latency);
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    const char *daemon = "./wr_runtime";
+    int requests = 20000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--daemon") == 0 && i + 1 < argc) {
+            daemon = argv[++i];
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            requests = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--daemon PATH] [--requests N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    char dir[] = "/tmp/wr_bench_control.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    pid_t pid = start_daemon(daemon, dir);
+    if (pid < 0) {
+        perror("start_daemon");
+        return 1;
+    }
+
+    cJSON *doc = cJSON_CreateObject();
+    cJSON_AddStringToObject(doc, "benchmark", "control");
+    cJSON_AddNumberToObject(doc, "timestamp", (double)time(NULL));
+    cJSON_AddNumberToObject(doc, "cpus", (double)sysconf(_SC_NPROCESSORS_ONLN));
+    cJSON *results = cJSON_AddArrayToObject(doc, "results");
+    static const char *ops[] = { "validate", "run" };
+    for (int transport = TRANSPORT_SOCKET; transport <= TRANSPORT_SPOOL; transport++) {
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            fprintf(stderr, "Submitting %d '%s' requests through the %s...\n", requests, ops[i],
+                    transport_names[transport]);
+            cJSON_AddItemToArray(results, run(dir, ops[i], requests, transport));
+        }
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    char *text = cJSON_Print(doc);
+    printf("%s\n", text);
+    free(text);
+    cJSON_Delete(doc);
+    return 0;
+}
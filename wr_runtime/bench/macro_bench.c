@@ -0,0 +1,290 @@
+// Macrobenchmark: runs the daemon against N generated services and reports load time,
+// memory, tick cost and how many of the expected service runs happened, read back from
+// its metrics socket. Prints one JSON document.
+//
+// Usage: wr_bench_macro [--daemon PATH] [--seconds S] [--interval I] N...
+//   PATH: the daemon (default ./wr_runtime); S: measuring window after load (default 5);
+//   I: interval of the generated services (default 1); N: service counts (default 10 100 1000).
+#define _GNU_SOURCE // For mkdtemp, nftw
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "cJSON.h"
+
+#define LOAD_TIMEOUT_SECONDS 300
+
+typedef struct {
+    uint64_t count;
+    double sum;
+    double p50, p99, max;
+} summary_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void sleep_seconds(double s) {
+    struct timespec ts = { (time_t)s, (long)((s - (double)(time_t)s) * 1e9) };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+// --- Metrics socket client ---
+
+// The daemon's metrics as JSON, or NULL while it is not answering yet.
+static cJSON *fetch_metrics(const char *sock_path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || write(fd, "json\n", 5) != 5) {
+        close(fd);
+        return NULL;
+    }
+    size_t len = 0, cap = 65536;
+    char *buf = malloc(cap);
+    ssize_t n;
+    while (buf != NULL && (n = read(fd, buf + len, cap - len - 1)) > 0) {
+        len += (size_t)n;
+        if (cap - len < 4096) {
+            char *grown = realloc(buf, cap *= 2);
+            if (grown == NULL) free(buf);
+            buf = grown;
+        }
+    }
+    close(fd);
+    if (buf == NULL) return NULL;
+    buf[len] = '\0';
+    cJSON *doc = cJSON_Parse(buf);
+    free(buf);
+    return doc;
+}
+
+// The "series" array of a family.
+static cJSON *family_series(const cJSON *doc, const char *family) {
+    const cJSON *f = cJSON_GetObjectItemCaseSensitive(doc, family);
+    return cJSON_GetObjectItemCaseSensitive(f, "series");
+}
+
+static double gauge(const cJSON *doc, const char *family) {
+    const cJSON *s;
+    double total = 0;
+    cJSON_ArrayForEach(s, family_series(doc, family)) {
+        total += cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(s, "value"));
+    }
+    return total;
+}
+
+// Count and sum over every label; quantiles of the first (or only) series.
+static summary_t summary(const cJSON *doc, const char *family) {
+    summary_t out = { 0, 0, 0, 0, 0 };
+    const cJSON *s;
+    int first = 1;
+    cJSON_ArrayForEach(s, family_series(doc, family)) {
+        out.count += (uint64_t)cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(s, "count"));
+        out.sum += cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(s, "sum"));
+        if (first) {
+            const cJSON *q = cJSON_GetObjectItemCaseSensitive(s, "quantiles");
+            out.p50 = cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(q, "0.5"));
+            out.p99 = cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(q, "0.99"));
+            out.max = cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(q, "1"));
+            first = 0;
+        }
+    }
+    return out;
+}
+
+// VmRSS / VmHWM of 'pid', in KiB.
+static long proc_status_kb(pid_t pid, const char *field) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    long kb = -1;
+    size_t flen = strlen(field);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, flen) == 0 && line[flen] == ':') {
+            kb = strtol(line + flen + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// --- One run ---
+
+static int write_services(const char *dir, int count, int interval) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/services", dir);
+    if (mkdir(path, 0755) != 0) return -1;
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/services/svc_%06d.json", dir, i);
+        FILE *f = fopen(path, "w");
+        if (f == NULL) return -1;
+        fprintf(f,
+                "{\n  \"name\": \"svc_%06d\",\n  \"condition\": \"always_true\",\n  \"interval\": %d,\n"
+                "  \"actions\": [ { \"type\": \"mkdir\", \"path\": \"%s/work\" } ]\n}\n",
+                i, interval, dir);
+        if (fclose(f) != 0) return -1;
+    }
+    return 0;
+}
+
+static pid_t start_daemon(const char *daemon, const char *dir) {
+    char services[4096], metrics[4096], notify[4096], log[4096], control[4096], shm[64];
+    snprintf(services, sizeof(services), "%s/services", dir);
+    snprintf(metrics, sizeof(metrics), "%s/metrics.sock", dir);
+    snprintf(notify, sizeof(notify), "%s/notify.sock", dir);
+    snprintf(log, sizeof(log), "%s/daemon.log", dir);
+    snprintf(control, sizeof(control), "%s/control.sock", dir);
+    snprintf(shm, sizeof(shm), "/wr_bench_macro.%d", (int)getpid());
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    setenv("WR_METRICS_SOCKET", metrics, 1);
+    setenv("WR_NOTIFY_SOCKET", notify, 1);
+    setenv("WR_CONTROL_SOCKET", control, 1);
+    setenv("WR_STATS_SHM", shm, 1);
+    setenv("WR_LOG", log, 1);
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+    }
+    execl(daemon, daemon, "--services-dir", services, (char *)NULL);
+    _exit(127);
+}
+
+static cJSON *run(const char *daemon, int count, int interval, double seconds) {
+    char dir[] = "/tmp/wr_bench_macro.XXXXXX";
+    if (mkdtemp(dir) == NULL || write_services(dir, count, interval) != 0) {
+        fprintf(stderr, "Cannot generate %d services in %s: %s\n", count, dir, strerror(errno));
+        return NULL;
+    }
+    char sock[4096];
+    snprintf(sock, sizeof(sock), "%s/metrics.sock", dir);
+
+    double started = now_seconds();
+    pid_t pid = start_daemon(daemon, dir);
+    if (pid < 0) {
+        perror("fork");
+        return NULL;
+    }
+
+    // Loaded once the first tick has published the service count.
+    cJSON *metrics = NULL;
+    double load_seconds = -1;
+    while (now_seconds() - started < LOAD_TIMEOUT_SECONDS && waitpid(pid, NULL, WNOHANG) == 0) {
+        metrics = fetch_metrics(sock);
+        if (metrics != NULL && gauge(metrics, "wr_services_loaded") >= count) {
+            load_seconds = now_seconds() - started;
+            break;
+        }
+        cJSON_Delete(metrics);
+        metrics = NULL;
+        sleep_seconds(0.002);
+    }
+    cJSON *r = cJSON_CreateObject();
+    cJSON_AddNumberToObject(r, "services", count);
+    if (metrics == NULL) {
+        cJSON_AddStringToObject(r, "error", "services did not load");
+    } else {
+        long rss_loaded = proc_status_kb(pid, "VmRSS");
+        uint64_t runs_before = summary(metrics, "wr_service_run_seconds").count;
+        cJSON_Delete(metrics);
+        sleep_seconds(seconds);
+        metrics = fetch_metrics(sock);
+        summary_t runs = summary(metrics, "wr_service_run_seconds");
+        summary_t tick = summary(metrics, "wr_tick_seconds");
+        summary_t lag = summary(metrics, "wr_loop_lag_seconds");
+        double expected = (double)count * seconds / (interval > 0 ? interval : 1);
+
+        cJSON_AddNumberToObject(r, "load_seconds", load_seconds);
+        cJSON_AddNumberToObject(r, "rss_kb_loaded", (double)rss_loaded);
+        cJSON_AddNumberToObject(r, "rss_kb_peak", (double)proc_status_kb(pid, "VmHWM"));
+        cJSON_AddNumberToObject(r, "ticks", (double)tick.count);
+        cJSON_AddNumberToObject(r, "tick_mean_seconds", tick.count ? tick.sum / (double)tick.count : 0);
+        cJSON_AddNumberToObject(r, "tick_p50_seconds", tick.p50);
+        cJSON_AddNumberToObject(r, "tick_p99_seconds", tick.p99);
+        cJSON_AddNumberToObject(r, "tick_max_seconds", tick.max);
+        cJSON_AddNumberToObject(r, "loop_lag_p50_seconds", lag.p50);
+        cJSON_AddNumberToObject(r, "loop_lag_max_seconds", lag.max);
+        cJSON_AddNumberToObject(r, "runs", (double)(runs.count - runs_before));
+        cJSON_AddNumberToObject(r, "expected_runs", expected);
+        cJSON_AddNumberToObject(r, "fire_ratio", (double)(runs.count - runs_before) / expected);
+        cJSON_Delete(metrics);
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    const char *daemon = "./wr_runtime";
+    double seconds = 5;
+    int interval = 1;
+    int counts[64], ncounts = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--daemon") == 0 && i + 1 < argc) {
+            daemon = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval = atoi(argv[++i]);
+        } else if (atoi(argv[i]) > 0 && ncounts < 64) {
+            counts[ncounts++] = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--daemon PATH] [--seconds S] [--interval I] N...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (ncounts == 0) {
+        counts[ncounts++] = 10;
+        counts[ncounts++] = 100;
+        counts[ncounts++] = 1000;
+    }
+
+    cJSON *doc = cJSON_CreateObject();
+    cJSON_AddStringToObject(doc, "benchmark", "macro");
+    cJSON_AddNumberToObject(doc, "timestamp", (double)time(NULL));
+    cJSON_AddNumberToObject(doc, "cpus", (double)sysconf(_SC_NPROCESSORS_ONLN));
+    cJSON_AddNumberToObject(doc, "seconds", seconds);
+    cJSON_AddNumberToObject(doc, "interval", interval);
+    cJSON *results = cJSON_AddArrayToObject(doc, "results");
+    for (int i = 0; i < ncounts; i++) {
+        fprintf(stderr, "Running %d services...\n", counts[i]);
+        cJSON *r = run(daemon, counts[i], interval, seconds);
+        if (r != NULL) cJSON_AddItemToArray(results, r);
+    }
+    char *text = cJSON_Print(doc);
+    printf("%s\n", text);
+    free(text);
+    cJSON_Delete(doc);
+    return 0;
+}
@@ -0,0 +1,204 @@
+// Microbenchmarks for the per-tick hot paths: parsing (JSON and CBOR) and validating a service file,
+// evaluating a condition, dispatching an action and starting a child.
+// Links against the daemon's objects (everything but main.o); prints one JSON document.
+//
+// Usage: wr_bench_micro [--seconds S]   (S: minimum time per benchmark, default 1)
+#define _GNU_SOURCE // For mkdtemp, setenv
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "cJSON.h"
+#include "service_loader.h"
+#include "cbor.h"
+#include "condition.h"
+#include "dispatcher.h"
+#include "spawn.h"
+#include "spawn_helper.h"
+#include "logger.h"
+
+#define MAX_SAMPLES 20000
+#define BATCH_TARGET_NS 20000 // Fast operations are timed in batches of about this long
+
+static const char *sample_service =
+    "{\n"
+    "  \"name\": \"bench_service\",\n"
+    "  \"condition\": \"no_activity(300)\",\n"
+    "  \"interval\": 60,\n"
+    "  \"actions\": [\n"
+    "    { \"type\": \"mkdir\", \"path\": \"/tmp/wr_bench_unused\" },\n"
+    "    { \"type\": \"shell\", \"command\": \"uptime\", \"on_change\": true },\n"
+    "    { \"type\": \"notify\", \"message\": \"Load average changed\" }\n"
+    "  ]\n"
+    "}\n";
+
+typedef void (bench_fn)(void *arg);
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Runs 'fn' for at least 'seconds' and adds {name, iterations, mean/min/p50/p99 ns per op}
+// to 'results'. Each sample is the mean of one batch.
+static void bench(cJSON *results, const char *name, bench_fn *fn, void *arg, double seconds) {
+    static double samples[MAX_SAMPLES];
+    fn(arg); // Warm up
+    uint64_t t = now_ns();
+    for (int i = 0; i < 8; i++) fn(arg); // Size the batches
+    uint64_t one = (now_ns() - t) / 8;
+    unsigned long batch = one >= BATCH_TARGET_NS ? 1 : BATCH_TARGET_NS / (one > 0 ? one : 1);
+
+    size_t n = 0;
+    unsigned long iterations = 0;
+    uint64_t total_ns = 0, deadline = now_ns() + (uint64_t)(seconds * 1e9);
+    while (n < MAX_SAMPLES && (n < 10 || now_ns() < deadline)) {
+        t = now_ns();
+        for (unsigned long i = 0; i < batch; i++) fn(arg);
+        uint64_t took = now_ns() - t;
+        samples[n++] = (double)took / (double)batch;
+        iterations += batch;
+        total_ns += took;
+    }
+    qsort(samples, n, sizeof(samples[0]), compare_double);
+
+    cJSON *r = cJSON_CreateObject();
+    cJSON_AddStringToObject(r, "name", name);
+    cJSON_AddNumberToObject(r, "iterations", (double)iterations);
+    cJSON_AddNumberToObject(r, "mean_ns", (double)total_ns / (double)iterations);
+    cJSON_AddNumberToObject(r, "min_ns", samples[0]);
+    cJSON_AddNumberToObject(r, "p50_ns", samples[n / 2]);
+    cJSON_AddNumberToObject(r, "p99_ns", samples[(n * 99) / 100]);
+    cJSON_AddItemToArray(results, r);
+}
+
+// --- Benchmarked operations ---
+
+static void op_parse(void *arg) {
+    cJSON_Delete(cJSON_Parse((const char *)arg));
+}
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+} encoded_t;
+
+static void op_cbor_decode(void *arg) {
+    const encoded_t *e = arg;
+    char err[128];
+    cJSON_Delete(Cbor_decode(e->data, e->len, err, sizeof(err)));
+}
+
+static void op_validate(void *arg) {
+    validate_json_with_hardcoded_schema((const cJSON *)arg, "bench_service");
+}
+
+static void op_condition(void *arg) {
+    evaluate_service_condition((const char *)arg, "bench_service");
+}
+
+static void op_dispatch(void *arg) {
+    const cJSON *params = arg;
+    action_ctx_t ctx = { .service_name = "bench_service", .action_idx = -1, .exit_status = -1,
+                         .stdin_fd = -1, .stdout_fd = -1 };
+    dispatch_action(cJSON_GetObjectItemCaseSensitive(params, "type")->valuestring, params, &ctx);
+}
+
+static void op_spawn(void *arg) {
+    int status;
+    Spawn_run_shell((const char *)arg, NULL, -1, -1, "bench_service", NULL, &status);
+}
+
+static cJSON *action(const char *json) {
+    cJSON *a = cJSON_Parse(json);
+    if (a == NULL) {
+        fprintf(stderr, "Bad action: %s\n", json);
+        exit(1);
+    }
+    return a;
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = 1.0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--seconds S]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Actions print to stdout and log; keep only the results on stdout.
+    setenv("WR_LOG", "/dev/null", 1);
+    Logger_start();
+    int out_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (out_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+        perror("Redirecting stdout");
+        return 1;
+    }
+    close(null_fd);
+    FILE *out = fdopen(out_fd, "w");
+
+    char dir[] = "/tmp/wr_bench.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char json[512];
+    snprintf(json, sizeof(json), "{\"type\":\"mkdir\",\"path\":\"%s/existing\"}", dir);
+    cJSON *mkdir_action = action(json);
+    cJSON *notify_action = action("{\"type\":\"notify\",\"message\":\"bench\"}");
+    cJSON *shell_action = action("{\"type\":\"shell\",\"command\":\"true\"}");
+    cJSON *service = action(sample_service);
+
+    cJSON *doc = cJSON_CreateObject();
+    cJSON_AddStringToObject(doc, "benchmark", "micro");
+    cJSON_AddNumberToObject(doc, "timestamp", (double)time(NULL));
+    cJSON_AddNumberToObject(doc, "cpus", (double)sysconf(_SC_NPROCESSORS_ONLN));
+    cJSON *results = cJSON_AddArrayToObject(doc, "results");
+
+    bench(results, "cjson_parse_service", op_parse, (void *)sample_service, seconds);
+    encoded_t encoded;
+    encoded.data = Cbor_encode(service, &encoded.len);
+    if (encoded.data != NULL) bench(results, "cbor_decode_service", op_cbor_decode, &encoded, seconds);
+    bench(results, "validate_service", op_validate, service, seconds);
+    bench(results, "condition_always_true", op_condition, "always_true", seconds);
+    bench(results, "condition_no_activity", op_condition, "no_activity(300)", seconds);
+    bench(results, "dispatch_mkdir", op_dispatch, mkdir_action, seconds);
+    bench(results, "dispatch_notify", op_dispatch, notify_action, seconds);
+    // The spawn path, first forking from this process, then through the spawn helper.
+    bench(results, "spawn_fork", op_spawn, "true", seconds);
+    if (SpawnHelper_start() == 0) {
+        bench(results, "spawn_helper", op_spawn, "true", seconds);
+        bench(results, "dispatch_shell", op_dispatch, shell_action, seconds);
+        SpawnHelper_stop();
+    }
+
+    char *text = cJSON_Print(doc);
+    fprintf(out, "%s\n", text);
+    fclose(out);
+    free(text);
+    cJSON_Delete(doc);
+    free((void *)encoded.data);
+    cJSON_Delete(service);
+    cJSON_Delete(shell_action);
+    cJSON_Delete(notify_action);
+    cJSON_Delete(mkdir_action);
+    snprintf(json, sizeof(json), "%s/existing", dir);
+    rmdir(json);
+    rmdir(dir);
+    Logger_stop();
+    return 0;
+}
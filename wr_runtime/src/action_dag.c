@@ -0,0 +1,436 @@
+#define _GNU_SOURCE // For pipe2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "action_dag.h"
+#include "logger.h"
+
+#define LOG_DAG_ERROR(fmt, ...) WR_LOG_ERROR("action_dag", fmt, ##__VA_ARGS__)
+
+struct action_dag {
+    int count;
+    int sequential;
+    const cJSON **actions;  // Borrowed from the service's config_json
+    int *head;              // First action of the pipeline each action belongs to (itself if unpiped)
+    int *pipe_to;           // Action reading this one's stdout, -1 if none
+    int *indegree;          // Per pipeline head: dependencies of the whole pipeline
+    int *edge_start;        // Pipelines released by action i: edges[edge_start[i] .. edge_start[i + 1])
+    int *edges;
+};
+
+// Per-run scheduling state, shared by the workers under 'lock'.
+typedef struct {
+    const action_dag_t *dag;
+    action_dag_run_fn *run;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int *waiting;           // Unfinished dependencies per pipeline head
+    char *skip;             // Per pipeline head: a dependency asked to skip its follow-ups
+    int *ready;             // FIFO of runnable pipeline heads
+    int ready_head;
+    int ready_tail;
+    int finished;           // Actions (not pipelines) done
+} dag_run_t;
+
+// One member of a running pipeline.
+typedef struct {
+    dag_run_t *r;
+    int idx;
+    action_stdio_t io;
+    int result;
+} stage_t;
+
+static const char *string_field(const cJSON *action, const char *name) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(action, name);
+    return cJSON_IsString(item) ? item->valuestring : NULL;
+}
+
+static int find_action(const action_dag_t *dag, const char *id) {
+    for (int i = 0; i < dag->count; i++) {
+        const char *other = string_field(dag->actions[i], "id");
+        if (other != NULL && strcmp(other, id) == 0) return i;
+    }
+    return -1;
+}
+
+static int type_in(const cJSON *action, const char *const *types) {
+    const char *type = string_field(action, "type");
+    for (; type != NULL && *types != NULL; types++) {
+        if (strcmp(type, *types) == 0) return 1;
+    }
+    return 0;
+}
+
+// Resolve 'pipe_from' into pipe_to links and pipeline heads.
+static int link_pipes(action_dag_t *dag, char *err, size_t err_len) {
+    static const char *const producers[] = { "shell", "run_command", NULL };
+    static const char *const consumers[] = { "shell", "run_command", "write_file", "append_file", NULL };
+    int *pipe_from = dag->head; // Reused: holds the source of each action until heads are known
+    for (int i = 0; i < dag->count; i++) {
+        pipe_from[i] = -1;
+        dag->pipe_to[i] = -1;
+    }
+    for (int i = 0; i < dag->count; i++) {
+        const char *src_id = string_field(dag->actions[i], "pipe_from");
+        if (src_id == NULL) continue;
+        int src = find_action(dag, src_id);
+        if (src < 0 || src == i) {
+            snprintf(err, err_len, "Action #%d: 'pipe_from' names %s '%s'.", i,
+                     src < 0 ? "unknown action" : "the action itself", src_id);
+            return -1;
+        }
+        if (!type_in(dag->actions[src], producers) || !type_in(dag->actions[i], consumers)) {
+            snprintf(err, err_len, "Action #%d: 'pipe_from' needs a shell/run_command source and a shell, "
+                     "run_command, write_file or append_file reader.", i);
+            return -1;
+        }
+        if (dag->pipe_to[src] >= 0) {
+            snprintf(err, err_len, "Action #%d: '%s' is already piped to action #%d.", i, src_id, dag->pipe_to[src]);
+            return -1;
+        }
+        dag->pipe_to[src] = i;
+        pipe_from[i] = src;
+    }
+    // Walk each chain back to its first producer; more steps than actions means a loop.
+    int *heads = calloc((size_t)dag->count + 1, sizeof(int));
+    if (heads == NULL) {
+        snprintf(err, err_len, "%s", "Out of memory.");
+        return -1;
+    }
+    for (int i = 0; i < dag->count; i++) {
+        int h = i, steps = 0;
+        while (pipe_from[h] >= 0 && steps++ <= dag->count) h = pipe_from[h];
+        if (pipe_from[h] >= 0) {
+            snprintf(err, err_len, "Action #%d: 'pipe_from' forms a cycle.", i);
+            free(heads);
+            return -1;
+        }
+        heads[i] = h;
+    }
+    memcpy(dag->head, heads, (size_t)dag->count * sizeof(int));
+    free(heads);
+    return 0;
+}
+
+// Call 'fn' for each id in the action's depends_on (a string or an array of strings).
+// Stops and returns -1 as soon as 'fn' does.
+static int for_each_dependency(action_dag_t *dag, int idx, char *err, size_t err_len,
+                               int (*fn)(action_dag_t *, int, int, void *), void *data) {
+    const cJSON *deps = cJSON_GetObjectItemCaseSensitive(dag->actions[idx], "depends_on");
+    if (deps == NULL) return 0;
+    const cJSON *one = deps;
+    if (cJSON_IsArray(deps)) one = deps->child;
+    for (; one != NULL; one = cJSON_IsArray(deps) ? one->next : NULL) {
+        if (!cJSON_IsString(one) || one->valuestring == NULL) continue; // Rejected by the validator
+        int dep = find_action(dag, one->valuestring);
+        if (dep < 0 || dep == idx) {
+            snprintf(err, err_len, "Action #%d: 'depends_on' names %s '%s'.", idx,
+                     dep < 0 ? "unknown action" : "the action itself", one->valuestring);
+            return -1;
+        }
+        if (dag->head[dep] == dag->head[idx]) {
+            // Piped actions run together: waiting for one another would never finish.
+            snprintf(err, err_len, "Action #%d: 'depends_on' names '%s', which is in the same pipeline.",
+                     idx, one->valuestring);
+            return -1;
+        }
+        if (fn(dag, idx, dep, data) != 0) return -1;
+    }
+    return 0;
+}
+
+// Dependencies are tracked per pipeline: an edge runs from the dependency to the head
+// of the dependent's pipeline.
+static int count_edge(action_dag_t *dag, int idx, int dep, void *data) {
+    (void)data;
+    dag->indegree[dag->head[idx]]++;
+    dag->edge_start[dep + 1]++;
+    return 0;
+}
+
+static int add_edge(action_dag_t *dag, int idx, int dep, void *data) {
+    int *fill = data;
+    dag->edges[fill[dep]++] = dag->head[idx];
+    return 0;
+}
+
+// Pipeline heads released when the pipeline starting at 'h' finishes: push them on
+// 'queue' as their last dependency goes. Returns the number of actions in the pipeline.
+// 'skip' (may be NULL) marks the released pipelines when 'skip_followups' is set.
+static int release_pipeline(const action_dag_t *dag, int h, int *waiting, int *queue, int *tail,
+                            char *skip, int skip_followups) {
+    int members = 0;
+    for (int m = h; m >= 0; m = dag->pipe_to[m]) {
+        for (int e = dag->edge_start[m]; e < dag->edge_start[m + 1]; e++) {
+            if (skip != NULL && skip_followups) skip[dag->edges[e]] = 1;
+            if (--waiting[dag->edges[e]] == 0) queue[(*tail)++] = dag->edges[e];
+        }
+        members++;
+    }
+    return members;
+}
+
+action_dag_t *ActionDag_compile(const cJSON *actions, char *err, size_t err_len) {
+    action_dag_t *dag = calloc(1, sizeof(*dag));
+    if (dag == NULL) {
+        snprintf(err, err_len, "%s", "Out of memory.");
+        return NULL;
+    }
+    dag->count = cJSON_GetArraySize(actions);
+    size_t n = (size_t)dag->count + 1;
+    dag->actions = calloc(n, sizeof(*dag->actions));
+    dag->head = calloc(n, sizeof(int));
+    dag->pipe_to = calloc(n, sizeof(int));
+    dag->indegree = calloc(n, sizeof(int));
+    dag->edge_start = calloc(n, sizeof(int));
+    int *fill = calloc(n, sizeof(int));
+    if (dag->actions == NULL || dag->head == NULL || dag->pipe_to == NULL || dag->indegree == NULL ||
+        dag->edge_start == NULL || fill == NULL) {
+        snprintf(err, err_len, "%s", "Out of memory.");
+        goto fail;
+    }
+
+    int i = 0;
+    int has_deps = 0;
+    const cJSON *action;
+    cJSON_ArrayForEach(action, actions) {
+        dag->actions[i] = action;
+        const char *id = string_field(action, "id");
+        if (id != NULL && find_action(dag, id) != i) {
+            snprintf(err, err_len, "Action #%d: duplicate id '%s'.", i, id);
+            goto fail;
+        }
+        if (cJSON_GetObjectItemCaseSensitive(action, "depends_on") != NULL ||
+            cJSON_GetObjectItemCaseSensitive(action, "pipe_from") != NULL) {
+            has_deps = 1;
+        }
+        i++;
+    }
+    if (!has_deps) {
+        dag->sequential = 1;
+        free(fill);
+        return dag;
+    }
+    if (link_pipes(dag, err, err_len) != 0) goto fail;
+
+    // Count edges per dependency, then lay the dependents out contiguously (CSR).
+    for (i = 0; i < dag->count; i++) {
+        if (for_each_dependency(dag, i, err, err_len, count_edge, NULL) != 0) goto fail;
+    }
+    for (i = 0; i < dag->count; i++) {
+        dag->edge_start[i + 1] += dag->edge_start[i];
+        fill[i] = dag->edge_start[i];
+    }
+    dag->edges = calloc((size_t)dag->edge_start[dag->count] + 1, sizeof(int));
+    if (dag->edges == NULL) {
+        snprintf(err, err_len, "%s", "Out of memory.");
+        goto fail;
+    }
+    for (i = 0; i < dag->count; i++) {
+        for_each_dependency(dag, i, err, err_len, add_edge, fill);
+    }
+
+    // Kahn's algorithm over pipelines: if not every action can be reached, some depend
+    // on each other.
+    int *waiting = fill;
+    int *queue = calloc(n, sizeof(int));
+    if (queue == NULL) {
+        snprintf(err, err_len, "%s", "Out of memory.");
+        goto fail;
+    }
+    int head = 0, tail = 0, reached = 0;
+    for (i = 0; i < dag->count; i++) {
+        waiting[i] = dag->indegree[i];
+        if (dag->head[i] == i && waiting[i] == 0) queue[tail++] = i;
+    }
+    while (head < tail) {
+        reached += release_pipeline(dag, queue[head++], waiting, queue, &tail, NULL, 0);
+    }
+    free(queue);
+    if (reached != dag->count) {
+        for (i = 0; i < dag->count && waiting[dag->head[i]] == 0; i++) {}
+        snprintf(err, err_len, "Action #%d: 'depends_on' is part of or leads into a cycle.", i);
+        goto fail;
+    }
+    free(fill);
+    return dag;
+
+fail:
+    free(fill);
+    ActionDag_free(dag);
+    return NULL;
+}
+
+int ActionDag_count(const action_dag_t *dag) {
+    return dag != NULL ? dag->count : 0;
+}
+
+int ActionDag_is_sequential(const action_dag_t *dag) {
+    return dag->sequential;
+}
+
+static void *stage_main(void *arg) {
+    stage_t *st = arg;
+    st->result = st->r->run(st->r->dag->actions[st->idx], st->idx, &st->io, st->r->arg);
+    // Closing our pipe ends is what lets the neighbours see EOF / EPIPE.
+    if (st->io.in_fd >= 0) close(st->io.in_fd);
+    if (st->io.out_fd >= 0) close(st->io.out_fd);
+    return NULL;
+}
+
+// Run the pipeline starting at 'h': one pipe per link, every member on its own thread
+// (the caller's included) so that producers and consumers make progress together.
+// Backpressure is the pipe's capacity; the data never passes through the daemon.
+// Returns ACTION_DAG_SKIP_FOLLOWUPS if any member asked for it.
+static int run_pipeline(dag_run_t *r, int h) {
+    const action_dag_t *dag = r->dag;
+    int members = 0;
+    for (int m = h; m >= 0; m = dag->pipe_to[m]) members++;
+    stage_t *stages = calloc((size_t)members, sizeof(*stages));
+    pthread_t *tids = calloc((size_t)members, sizeof(*tids));
+    int *started = calloc((size_t)members, sizeof(int));
+    if (stages == NULL || tids == NULL || started == NULL) {
+        LOG_DAG_ERROR("Out of memory, skipping the pipeline starting at action #%d.", h);
+        free(stages);
+        free(tids);
+        free(started);
+        return 0;
+    }
+
+    int k = 0;
+    for (int m = h; m >= 0; m = dag->pipe_to[m], k++) {
+        stages[k].r = r;
+        stages[k].idx = m;
+        stages[k].io.in_fd = -1;
+        stages[k].io.out_fd = -1;
+        if (k > 0) {
+            int p[2];
+            if (pipe2(p, O_CLOEXEC) != 0) {
+                LOG_DAG_ERROR("Cannot create the pipe into action #%d, it reads nothing.", m);
+                continue;
+            }
+            stages[k - 1].io.out_fd = p[1];
+            stages[k].io.in_fd = p[0];
+        }
+    }
+    for (k = 1; k < members; k++) {
+        started[k] = pthread_create(&tids[k], NULL, stage_main, &stages[k]) == 0;
+        if (!started[k]) {
+            LOG_DAG_ERROR("Cannot start a thread for action #%d, skipping it.", stages[k].idx);
+            if (stages[k].io.in_fd >= 0) close(stages[k].io.in_fd);
+            if (stages[k].io.out_fd >= 0) close(stages[k].io.out_fd);
+        }
+    }
+    stage_main(&stages[0]);
+    int result = stages[0].result;
+    for (k = 1; k < members; k++) {
+        if (started[k]) {
+            pthread_join(tids[k], NULL);
+            if (stages[k].result == ACTION_DAG_SKIP_FOLLOWUPS) result = ACTION_DAG_SKIP_FOLLOWUPS;
+        }
+    }
+    free(stages);
+    free(tids);
+    free(started);
+    return result;
+}
+
+static void *dag_worker(void *arg) {
+    static const action_stdio_t no_stdio = { -1, -1 };
+    dag_run_t *r = arg;
+    const action_dag_t *dag = r->dag;
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (r->ready_head == r->ready_tail && r->finished < dag->count) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        if (r->ready_head == r->ready_tail) break; // Everything finished
+        int h = r->ready[r->ready_head++];
+        pthread_mutex_unlock(&r->lock);
+
+        // A skipped pipeline does not run, and its own follow-ups are skipped in turn.
+        int result = ACTION_DAG_SKIP_FOLLOWUPS;
+        if (!r->skip[h]) {
+            result = dag->pipe_to[h] < 0 ? r->run(dag->actions[h], h, &no_stdio, r->arg) : run_pipeline(r, h);
+        }
+
+        pthread_mutex_lock(&r->lock);
+        int before = r->ready_tail;
+        r->finished += release_pipeline(dag, h, r->waiting, r->ready, &r->ready_tail,
+                                        r->skip, result == ACTION_DAG_SKIP_FOLLOWUPS);
+        if (r->ready_tail != before || r->finished == dag->count) pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+void ActionDag_run(const action_dag_t *dag, int parallelism, action_dag_run_fn *run, void *arg) {
+    static const action_stdio_t no_stdio = { -1, -1 };
+    if (dag->sequential) {
+        for (int i = 0; i < dag->count; i++) {
+            if (run(dag->actions[i], i, &no_stdio, arg) == ACTION_DAG_SKIP_FOLLOWUPS) break;
+        }
+        return;
+    }
+    if (parallelism < 1) parallelism = 1; // A DAG at parallelism 1 runs in topological order
+    if (parallelism > ACTION_DAG_MAX_PARALLELISM) parallelism = ACTION_DAG_MAX_PARALLELISM;
+    if (parallelism > dag->count) parallelism = dag->count;
+
+    dag_run_t r;
+    memset(&r, 0, sizeof(r));
+    r.dag = dag;
+    r.run = run;
+    r.arg = arg;
+    r.waiting = malloc(((size_t)dag->count + 1) * sizeof(int));
+    r.ready = malloc(((size_t)dag->count + 1) * sizeof(int));
+    r.skip = calloc((size_t)dag->count + 1, 1);
+    if (r.waiting == NULL || r.ready == NULL || r.skip == NULL) {
+        LOG_DAG_ERROR("%s", "Out of memory, skipping this run.");
+        free(r.waiting);
+        free(r.ready);
+        free(r.skip);
+        return;
+    }
+    for (int i = 0; i < dag->count; i++) {
+        r.waiting[i] = dag->indegree[i];
+        if (dag->head[i] == i && r.waiting[i] == 0) r.ready[r.ready_tail++] = i;
+    }
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.cond, NULL);
+
+    pthread_t tids[ACTION_DAG_MAX_PARALLELISM];
+    int started = 0;
+    for (int i = 1; i < parallelism; i++) {
+        if (pthread_create(&tids[started], NULL, dag_worker, &r) != 0) {
+            LOG_DAG_ERROR("Could only start %d of %d workers.", started + 1, parallelism);
+            break;
+        }
+        started++;
+    }
+    dag_worker(&r); // The calling thread works too
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    pthread_cond_destroy(&r.cond);
+    pthread_mutex_destroy(&r.lock);
+    free(r.waiting);
+    free(r.ready);
+    free(r.skip);
+}
+
+void ActionDag_free(action_dag_t *dag) {
+    if (dag == NULL) return;
+    free(dag->actions);
+    free(dag->head);
+    free(dag->pipe_to);
+    free(dag->indegree);
+    free(dag->edge_start);
+    free(dag->edges);
+    free(dag);
+}
@@ -0,0 +1,54 @@
+#ifndef ACTION_DAG_H
+#define ACTION_DAG_H
+
+#include <stddef.h> // For size_t
+
+#include "cJSON.h"
+
+#define ACTION_DAG_DEFAULT_PARALLELISM 4
+#define ACTION_DAG_MAX_PARALLELISM 32
+
+// Execution plan for a service's 'actions' array, compiled once at load.
+// Actions may carry an "id" and a "depends_on" (id or array of ids). When no action
+// declares depends_on or pipe_from the plan is sequential: actions run one after another
+// in array order, as they always have. Otherwise every action whose dependencies have
+// finished is eligible to run, concurrently with the others, up to the service's
+// parallelism.
+// An action runs once its dependencies have finished, whatever their outcome.
+// "pipe_from": id feeds the action's stdin from that shell/run_command action's stdout.
+// Piped actions form a pipeline that is scheduled as one unit (it counts once against
+// the parallelism) and whose members all run at the same time, joined by kernel pipes.
+typedef struct action_dag action_dag_t;
+
+// Pipe ends for an action in a pipeline (-1: not piped on that side). They belong to
+// the executor, which closes them when the action returns.
+typedef struct {
+    int in_fd;
+    int out_fd;
+} action_stdio_t;
+
+// Returns 0, or ACTION_DAG_SKIP_FOLLOWUPS when the actions that follow this one should not
+// run this time (an "on_change" action whose result did not change): in a sequential plan
+// the rest of the array, otherwise everything that depends on it, directly or not.
+// A pipeline skips its dependents when any member asks to.
+#define ACTION_DAG_SKIP_FOLLOWUPS 1
+typedef int (action_dag_run_fn)(const cJSON *action, int index, const action_stdio_t *stdio, void *arg);
+
+// Build the plan. Returns NULL and describes the problem in 'err' on an unknown or
+// duplicate id, a dependency or pipe cycle, or an invalid pipe_from.
+action_dag_t *ActionDag_compile(const cJSON *actions, char *err, size_t err_len);
+
+// Number of actions in the plan (0 for NULL).
+int ActionDag_count(const action_dag_t *dag);
+
+// 1 if the plan is plain array order.
+int ActionDag_is_sequential(const action_dag_t *dag);
+
+// Run every action through 'run' and return when all have finished. Up to 'parallelism'
+// actions run at once (the calling thread is one of the workers). 'run' must be
+// thread-safe unless the plan is sequential.
+void ActionDag_run(const action_dag_t *dag, int parallelism, action_dag_run_fn *run, void *arg);
+
+void ActionDag_free(action_dag_t *dag);
+
+#endif // ACTION_DAG_H
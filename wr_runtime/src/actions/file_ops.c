@@ -0,0 +1,127 @@
+#define _DEFAULT_SOURCE // For mode_t and other POSIX features
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h> // For mode_t
+#include "cJSON.h" // Found via CFLAGS -I deps/cJSON
+#include "../condition.h" // For record_activity()
+#include "../fs_files.h"  // Native copy/move/atomic write engine
+#include "../dispatcher.h" // For action_ctx_t
+#include "../logger.h"
+
+#define LOG_FILE_INFO(fmt, ...) WR_LOG_INFO("file_ops", fmt, ##__VA_ARGS__)
+#define LOG_FILE_ERROR(fmt, ...) WR_LOG_ERROR("file_ops", fmt, ##__VA_ARGS__)
+
+#define FILE_DEFAULT_MODE 0644
+
+static const char *string_param(const cJSON *params, const char *name) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(params, name);
+    if (cJSON_IsString(item) && item->valuestring != NULL && item->valuestring[0] != '\0') {
+        return item->valuestring;
+    }
+    return NULL;
+}
+
+// Same accepted forms as mkdir: octal string ("0600") or plain number.
+static int parse_mode(const cJSON *mode_json, mode_t *mode) {
+    if (mode_json == NULL) {
+        *mode = FILE_DEFAULT_MODE;
+        return 0;
+    }
+    if (cJSON_IsNumber(mode_json) && mode_json->valueint >= 0 && mode_json->valueint <= 07777) {
+        *mode = (mode_t)mode_json->valueint;
+        return 0;
+    }
+    if (cJSON_IsString(mode_json) && mode_json->valuestring != NULL) {
+        char *end = NULL;
+        long value = strtol(mode_json->valuestring, &end, 8);
+        if (end != mode_json->valuestring && *end == '\0' && value >= 0 && value <= 07777) {
+            *mode = (mode_t)value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void app_action_copy(const cJSON *action_params, action_ctx_t *ctx) {
+    (void)ctx; // copy reports through the log only
+    const char *src = string_param(action_params, "src");
+    const char *dest = string_param(action_params, "dest");
+    if (src == NULL || dest == NULL) {
+        LOG_FILE_ERROR("%s", "copy: Missing or invalid 'src' / 'dest' parameter.");
+        return;
+    }
+
+    fs_copy_method_t method;
+    if (FsFile_copy(src, dest, &method) != 0) {
+        LOG_FILE_ERROR("copy: '%s' -> '%s' failed: %s", src, dest, strerror(errno));
+        return;
+    }
+    LOG_FILE_INFO("Copied '%s' -> '%s' (%s).", src, dest, FsFile_copy_method_name(method));
+    record_activity();
+}
+
+void app_action_move(const cJSON *action_params, action_ctx_t *ctx) {
+    (void)ctx;
+    const char *src = string_param(action_params, "src");
+    const char *dest = string_param(action_params, "dest");
+    if (src == NULL || dest == NULL) {
+        LOG_FILE_ERROR("%s", "move: Missing or invalid 'src' / 'dest' parameter.");
+        return;
+    }
+
+    int copied = 0;
+    if (FsFile_move(src, dest, &copied) != 0) {
+        LOG_FILE_ERROR("move: '%s' -> '%s' failed: %s", src, dest, strerror(errno));
+        return;
+    }
+    LOG_FILE_INFO("Moved '%s' -> '%s' (%s).", src, dest, copied ? "copied across filesystems" : "rename");
+    record_activity();
+}
+
+// write_file and append_file share parameter handling; only the engine call differs.
+// With 'pipe_from' the data is the upstream action's stdout (ctx->stdin_fd), not 'content'.
+static void write_common(const cJSON *action_params, action_ctx_t *ctx, int append) {
+    const char *op = append ? "append_file" : "write_file";
+    const char *path = string_param(action_params, "path");
+    const cJSON *content_json = cJSON_GetObjectItemCaseSensitive(action_params, "content");
+    int streamed = ctx->stdin_fd >= 0;
+    if (path == NULL || (!streamed && (!cJSON_IsString(content_json) || content_json->valuestring == NULL))) {
+        LOG_FILE_ERROR("%s: Missing or invalid 'path' / 'content' parameter.", op);
+        return;
+    }
+    mode_t mode;
+    if (parse_mode(cJSON_GetObjectItemCaseSensitive(action_params, "mode"), &mode) != 0) {
+        LOG_FILE_ERROR("%s: Invalid 'mode' parameter (expected octal string like \"0644\").", op);
+        return;
+    }
+
+    // Appends are not fsync'ed unless asked: log-style files favour throughput.
+    int do_fsync = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(action_params, "fsync"));
+    long long written;
+    if (streamed) {
+        written = append ? FsFile_append_fd(path, ctx->stdin_fd, mode, do_fsync)
+                         : FsFile_write_atomic_fd(path, ctx->stdin_fd, mode);
+    } else {
+        const char *content = content_json->valuestring;
+        size_t len = strlen(content);
+        int rc = append ? FsFile_append(path, content, len, mode, do_fsync)
+                        : FsFile_write_atomic(path, content, len, mode);
+        written = rc == 0 ? (long long)len : -1;
+    }
+    if (written < 0) {
+        LOG_FILE_ERROR("%s: '%s' failed: %s", op, path, strerror(errno));
+        return;
+    }
+    LOG_FILE_INFO("%s: %lld bytes to '%s'%s.", op, written, path, streamed ? " (streamed)" : "");
+    record_activity();
+}
+
+void app_action_write_file(const cJSON *action_params, action_ctx_t *ctx) {
+    write_common(action_params, ctx, 0);
+}
+
+void app_action_append_file(const cJSON *action_params, action_ctx_t *ctx) {
+    write_common(action_params, ctx, 1);
+}
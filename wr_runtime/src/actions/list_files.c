@@ -2,67 +2,224 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h> // For WIFEXITED, WEXITSTATUS etc.
+#include <errno.h>
+#include <fnmatch.h>
 #include "cJSON.h" // Found via CFLAGS -I deps/cJSON
 #include "../condition.h" // For record_activity()
+#include "../fs_list.h"   // Native getdents64/statx directory walker
+#include "../dir_snapshot.h" // inotify-maintained listings for repeated non-recursive listings
+#include "../dispatcher.h"   // For action_ctx_t / action_emit_output()
+#include "../logger.h"
 
-#define LOG_LF_INFO(fmt, ...) printf("INFO: list_files: " fmt "\n", ##__VA_ARGS__)
-#define LOG_LF_ERROR(fmt, ...) fprintf(stderr, "ERROR: list_files: " fmt "\n", ##__VA_ARGS__)
-#define MAX_LS_OUTPUT_LEN 4096
+#define LOG_LF_INFO(fmt, ...) WR_LOG_INFO("list_files", fmt, ##__VA_ARGS__)
+#define LOG_LF_ERROR(fmt, ...) WR_LOG_ERROR("list_files", fmt, ##__VA_ARGS__)
 
+#define LIST_FAILED_STATUS (1 << 8) // Like a command that exited 1: the run counts a failed action
+#define LIST_TEXT_LINE_MAX 64 // Fixed columns per text line, excluding the path itself
 
-void app_action_list_files(const cJSON *action_params) {
-    const cJSON *path_json = cJSON_GetObjectItemCaseSensitive(action_params, "path");
-    if (!cJSON_IsString(path_json) || (path_json->valuestring == NULL)) {
+static int param_bool(const cJSON *params, const char *key, int fallback) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(params, key);
+    return cJSON_IsBool(item) ? cJSON_IsTrue(item) : fallback;
+}
+
+static int param_int(const cJSON *params, const char *key, int fallback) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(params, key);
+    return cJSON_IsNumber(item) ? item->valueint : fallback;
+}
+
+static const char *param_string(const cJSON *params, const char *key) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(params, key);
+    return (cJSON_IsString(item) && item->valuestring != NULL) ? item->valuestring : NULL;
+}
+
+// Snapshot listings are unfiltered; apply the glob/hidden filters at render time.
+static int entry_visible(const fs_list_opts_t *opts, const char *name) {
+    if (!opts->show_hidden && name[0] == '.') return 0;
+    return opts->glob == NULL || fnmatch(opts->glob, name, 0) == 0;
+}
+
+static void add_entries_json(cJSON *array, const fs_listing_t *listing, const fs_list_opts_t *opts, int filter) {
+    for (size_t i = 0; array && i < listing->count; i++) {
+        const fs_entry_t *e = &listing->entries[i];
+        const char *name = FsList_entry_path(listing, e);
+        if (filter && !entry_visible(opts, name)) continue;
+        cJSON *obj = cJSON_CreateObject();
+        if (!obj) break;
+        cJSON_AddStringToObject(obj, "name", name);
+        cJSON_AddStringToObject(obj, "type", FsList_type_name(e->type));
+        if (opts->stat_entries) {
+            char mode_str[8];
+            snprintf(mode_str, sizeof(mode_str), "%04o", (unsigned)(e->mode & 07777));
+            cJSON_AddStringToObject(obj, "mode", mode_str);
+            cJSON_AddNumberToObject(obj, "size", (double)e->size);
+            cJSON_AddNumberToObject(obj, "mtime", (double)e->mtime_sec);
+        }
+        cJSON_AddItemToArray(array, obj);
+    }
+}
+
+// {"path": "...", "count": N, "entries": [{"name", "type", "mode", "size", "mtime"}, ...]}
+static char *render_json(const char *root, const fs_listing_t *listing, const fs_list_opts_t *opts, int filter) {
+    cJSON *doc = cJSON_CreateObject();
+    if (!doc) return NULL;
+    cJSON_AddStringToObject(doc, "path", root);
+    cJSON *entries = cJSON_AddArrayToObject(doc, "entries");
+    add_entries_json(entries, listing, opts, filter);
+    cJSON_AddNumberToObject(doc, "count", entries ? (double)cJSON_GetArraySize(entries) : 0);
+    char *out = cJSON_PrintUnformatted(doc);
+    cJSON_Delete(doc);
+    return out;
+}
+
+// {"path": "...", "added": [...], "removed": [...], "modified": [...]}
+static char *render_diff_json(const char *root, const fs_listing_t *added, const fs_listing_t *removed,
+                              const fs_listing_t *modified, const fs_list_opts_t *opts) {
+    cJSON *doc = cJSON_CreateObject();
+    if (!doc) return NULL;
+    cJSON_AddStringToObject(doc, "path", root);
+    add_entries_json(cJSON_AddArrayToObject(doc, "added"), added, opts, 1);
+    add_entries_json(cJSON_AddArrayToObject(doc, "removed"), removed, opts, 1);
+    add_entries_json(cJSON_AddArrayToObject(doc, "modified"), modified, opts, 1);
+    char *out = cJSON_PrintUnformatted(doc);
+    cJSON_Delete(doc);
+    return out;
+}
+
+// One "type mode size mtime path" line per entry, built into a single buffer.
+// Diff output uses the same layout with a leading '+', '-' or '~'.
+static int append_text(char **out, size_t *len, size_t *cap, const fs_listing_t *listing,
+                       const fs_list_opts_t *opts, int filter, const char *prefix) {
+    for (size_t i = 0; i < listing->count; i++) {
+        const fs_entry_t *e = &listing->entries[i];
+        const char *name = FsList_entry_path(listing, e);
+        if (filter && !entry_visible(opts, name)) continue;
+        size_t need = LIST_TEXT_LINE_MAX + strlen(name) + 2;
+        if (*len + need > *cap) {
+            size_t new_cap = *cap ? *cap * 2 : 4096;
+            while (new_cap < *len + need) new_cap *= 2;
+            char *grown = realloc(*out, new_cap);
+            if (!grown) return -1;
+            *out = grown;
+            *cap = new_cap;
+        }
+        *len += (size_t)snprintf(*out + *len, *cap - *len, "%s%-7s %04o %12llu %lld %s\n", prefix,
+                                 FsList_type_name(e->type), (unsigned)(e->mode & 07777),
+                                 (unsigned long long)e->size, (long long)e->mtime_sec, name);
+    }
+    return 0;
+}
+
+static void emit(action_ctx_t *ctx, char *rendered, const char *path, int is_json) {
+    if (rendered) {
+        action_emit_output(ctx, rendered, strlen(rendered));
+        if (is_json) action_emit_output(ctx, "\n", 1);
+        free(rendered);
+    } else {
+        LOG_LF_ERROR("Out of memory rendering listing of '%s'.", path);
+        ctx->exit_status = LIST_FAILED_STATUS;
+    }
+}
+
+static void list_diff(action_ctx_t *ctx, const char *path, const fs_list_opts_t *opts, int as_text) {
+    fs_listing_t added, removed, modified;
+    if (DirSnap_diff(ctx->service_name, ctx->action_idx, path, &added, &removed, &modified) != 0) {
+        LOG_LF_ERROR("Cannot diff '%s': %s", path, strerror(errno));
+        ctx->exit_status = LIST_FAILED_STATUS;
+        return;
+    }
+    char *rendered = NULL;
+    if (as_text) {
+        size_t len = 0, cap = 0;
+        if (append_text(&rendered, &len, &cap, &added, opts, 1, "+ ") != 0 ||
+            append_text(&rendered, &len, &cap, &removed, opts, 1, "- ") != 0 ||
+            append_text(&rendered, &len, &cap, &modified, opts, 1, "~ ") != 0) {
+            free(rendered);
+            rendered = NULL;
+        } else if (!rendered) {
+            rendered = strdup(""); // Nothing changed
+        }
+    } else {
+        rendered = render_diff_json(path, &added, &removed, &modified, opts);
+    }
+    emit(ctx, rendered, path, !as_text);
+    if (ctx->change == NULL) LOG_LF_INFO("Diff of '%s': %zu added, %zu removed, %zu modified.", path, added.count, removed.count, modified.count);
+    FsList_free(&added);
+    FsList_free(&removed);
+    FsList_free(&modified);
+}
+
+void app_action_list_files(const cJSON *action_params, action_ctx_t *ctx) {
+    const char *path = param_string(action_params, "path");
+    if (path == NULL) {
         LOG_LF_ERROR("%s", "Missing or invalid 'path' parameter.");
+        ctx->exit_status = LIST_FAILED_STATUS;
         return;
     }
-    const char *path = path_json->valuestring;
 
-    char cmd_buffer[512];
-    // Basic sanitization: prevent command injection if path were to contain ` ;` etc.
-    // For robust solution, validate path characters or use non-shell based listing.
-    // This simple snprintf is okay if path is trusted or simple.
-    snprintf(cmd_buffer, sizeof(cmd_buffer), "ls -la \"%s\" 2>&1", path); 
+    fs_list_opts_t opts;
+    FsList_default_opts(&opts);
+    opts.recursive = param_bool(action_params, "recursive", 0);
+    opts.max_depth = param_int(action_params, "max_depth", -1);
+    opts.glob = param_string(action_params, "glob");
+    opts.show_hidden = param_bool(action_params, "hidden", 1);
+    opts.stat_entries = param_bool(action_params, "stat", 1);
+    opts.threads = param_int(action_params, "threads", 1);
 
-    LOG_LF_INFO("Executing: %s", cmd_buffer);
+    const char *format = param_string(action_params, "format");
+    int as_text = format != NULL && strcmp(format, "text") == 0;
+    if (format != NULL && !as_text && strcmp(format, "json") != 0) {
+        LOG_LF_ERROR("Unknown 'format' value '%s' (expected 'json' or 'text').", format);
+        ctx->exit_status = LIST_FAILED_STATUS;
+        return;
+    }
+    const char *output = param_string(action_params, "output");
+    int diff_mode = output != NULL && strcmp(output, "diff") == 0;
+    if (output != NULL && !diff_mode && strcmp(output, "full") != 0) {
+        LOG_LF_ERROR("Unknown 'output' value '%s' (expected 'full' or 'diff').", output);
+        ctx->exit_status = LIST_FAILED_STATUS;
+        return;
+    }
+    // Non-recursive listings are served from an inotify-maintained snapshot unless "cache": false.
+    int use_cache = !opts.recursive && param_bool(action_params, "cache", 1);
+    if (diff_mode && !use_cache) {
+        LOG_LF_ERROR("%s", "'output': 'diff' requires a cached, non-recursive listing.");
+        ctx->exit_status = LIST_FAILED_STATUS;
+        return;
+    }
+
+    if (ctx->change == NULL) { // on_change: the dispatcher reports changes
+        LOG_LF_INFO("Listing '%s'%s%s%s", path, opts.recursive ? " (recursive)" : "",
+                    opts.glob ? " glob=" : "", opts.glob ? opts.glob : "");
+    }
 
-    FILE *fp = popen(cmd_buffer, "r");
-    if (fp == NULL) {
-        LOG_LF_ERROR("popen() failed for command: %s", cmd_buffer);
+    if (diff_mode) {
+        list_diff(ctx, path, &opts, as_text);
+        record_activity();
         return;
     }
 
-    char output_buffer[MAX_LS_OUTPUT_LEN + 1]; // +1 for null terminator
-    size_t total_read = 0;
-    char line_buffer[256];
-    output_buffer[0] = '\0'; // Initialize buffer for strcat
-
-    LOG_LF_INFO("Output of '%s':", cmd_buffer);
-    while (fgets(line_buffer, sizeof(line_buffer), fp) != NULL) {
-        // For now, just print to our stdout. Later, this might go to syslog.
-        printf("%s", line_buffer); 
-        if (total_read + strlen(line_buffer) < MAX_LS_OUTPUT_LEN) {
-            strcat(output_buffer + total_read, line_buffer); // Concatenate to buffer
-            total_read += strlen(line_buffer);
-        } else {
-            // Buffer full, stop copying to prevent overflow if we were storing it all
-        }
+    fs_listing_t listing;
+    int rc = use_cache ? DirSnap_list(path, &listing) : FsList_list(path, &opts, &listing);
+    if (rc != 0) {
+        LOG_LF_ERROR("Cannot list '%s': %s", path, strerror(errno));
+        ctx->exit_status = LIST_FAILED_STATUS;
+        return;
     }
-    // output_buffer[total_read] = '\0'; // Null-terminate the combined output // Already handled by initial output_buffer[0] = '\0' and strcat
 
-    int status = pclose(fp);
-    if (status == -1) {
-        LOG_LF_ERROR("%s", "pclose() failed.");
-    } else {
-        if (WIFEXITED(status)) {
-            LOG_LF_INFO("Command '%s' (popen) exited with status %d.", cmd_buffer, WEXITSTATUS(status));
-        } else if (WIFSIGNALED(status)) {
-            LOG_LF_INFO("Command '%s' (popen) killed by signal %d.", cmd_buffer, WTERMSIG(status));
+    char *rendered = NULL;
+    if (as_text) {
+        size_t len = 0, cap = 0;
+        if (append_text(&rendered, &len, &cap, &listing, &opts, use_cache, "") != 0) {
+            free(rendered);
+            rendered = NULL;
+        } else if (!rendered) {
+            rendered = strdup("");
         }
-        // If output_buffer were to be sent to syslog, truncate if total_read >= MAX_LS_OUTPUT_LEN
-        // For now, we just printed line by line.
-        // syslog(LOG_INFO, "list_files output for %s: %s", path, output_buffer_truncated);
+    } else {
+        rendered = render_json(path, &listing, &opts, use_cache);
     }
+    emit(ctx, rendered, path, !as_text);
+    if (ctx->change == NULL) LOG_LF_INFO("Listed %zu entries under '%s'.", listing.count, path);
+    FsList_free(&listing);
     record_activity();
 }
@@ -1,91 +1,97 @@
 #define _DEFAULT_SOURCE // For mode_t and other POSIX features
 #include <stdio.h>
-#include <stdlib.h> // For system()
+#include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h> // For POSIX mkdir
-#include <errno.h>    // For errno
+#include <sys/stat.h> // For mode_t
 #include "cJSON.h" // Found via CFLAGS -I deps/cJSON
 #include "../condition.h" // For record_activity()
+#include "../fs_mkdir.h"  // Batched, fd-relative mkdir -p engine
+#include "../dispatcher.h" // For action_ctx_t
+#include "../logger.h"
 
-#define LOG_MKDIR_INFO(fmt, ...) printf("INFO: mkdir: " fmt "\n", ##__VA_ARGS__)
-#define LOG_MKDIR_ERROR(fmt, ...) fprintf(stderr, "ERROR: mkdir: " fmt "\n", ##__VA_ARGS__)
+#define LOG_MKDIR_INFO(fmt, ...) WR_LOG_INFO("mkdir", fmt, ##__VA_ARGS__)
+#define LOG_MKDIR_ERROR(fmt, ...) WR_LOG_ERROR("mkdir", fmt, ##__VA_ARGS__)
 
-// More robust mkdir -p implementation (iterative)
-static int mkdir_p(const char *path, mode_t mode) {
-    char *p, *temp_path;
-    int result = 0;
+#define MKDIR_DEFAULT_MODE 0755
+#define MKDIR_FAILED_STATUS (1 << 8) // Like a command that exited 1: the run counts a failed action
 
-    // Make a copy of the path string, as strtok will modify it
-    temp_path = strdup(path);
-    if (temp_path == NULL) {
-        LOG_MKDIR_ERROR("strdup failed for path: %s", path);
-        return -1;
+// "mode" may be given as an octal string ("0750") or a plain number (488).
+static int parse_mode(const cJSON *mode_json, mode_t *mode) {
+    if (mode_json == NULL) {
+        *mode = MKDIR_DEFAULT_MODE;
+        return 0;
     }
-
-    // Iterate through the path components
-    for (p = temp_path + 1; *p; p++) {
-        if (*p == '/') {
-            *p = '\0'; // Temporarily terminate the string
-            if (mkdir(temp_path, mode) == -1) {
-                if (errno != EEXIST) {
-                    LOG_MKDIR_ERROR("mkdir failed for %s: %s", temp_path, strerror(errno));
-                    result = -1;
-                    break;
-                }
-            }
-            *p = '/'; // Restore the slash
-        }
+    if (cJSON_IsNumber(mode_json) && mode_json->valueint >= 0 && mode_json->valueint <= 07777) {
+        *mode = (mode_t)mode_json->valueint;
+        return 0;
     }
-
-    // Create the final directory component
-    if (result == 0) {
-        if (mkdir(temp_path, mode) == -1) {
-            if (errno != EEXIST) {
-                LOG_MKDIR_ERROR("mkdir failed for %s: %s", temp_path, strerror(errno));
-                result = -1;
-            }
+    if (cJSON_IsString(mode_json) && mode_json->valuestring != NULL) {
+        char *end = NULL;
+        long value = strtol(mode_json->valuestring, &end, 8);
+        if (end != mode_json->valuestring && *end == '\0' && value >= 0 && value <= 07777) {
+            *mode = (mode_t)value;
+            return 0;
         }
     }
-    
-    free(temp_path);
-    if (result == 0 || errno == EEXIST) { // Consider EEXIST as success for -p logic
-      LOG_MKDIR_INFO("Directory path '%s' ensured (or already existed).", path);
-      return 0;
-    }
-    return result;
+    return -1;
 }
 
-
-void app_action_mkdir(const cJSON *action_params) {
+void app_action_mkdir(const cJSON *action_params, action_ctx_t *ctx) {
     const cJSON *path_json = cJSON_GetObjectItemCaseSensitive(action_params, "path");
-    if (!cJSON_IsString(path_json) || (path_json->valuestring == NULL)) {
-        LOG_MKDIR_ERROR("%s", "Missing or invalid 'path' parameter.");
+    const cJSON *paths_json = cJSON_GetObjectItemCaseSensitive(action_params, "paths");
+
+    int count = 0;
+    if (cJSON_IsString(path_json) && path_json->valuestring != NULL) count++;
+    if (cJSON_IsArray(paths_json)) count += cJSON_GetArraySize(paths_json);
+    if (count == 0) {
+        LOG_MKDIR_ERROR("%s", "Missing or invalid 'path' / 'paths' parameter.");
+        ctx->exit_status = MKDIR_FAILED_STATUS;
         return;
     }
-    const char *path = path_json->valuestring;
 
-    LOG_MKDIR_INFO("Ensuring directory exists (mkdir -p equivalent): %s", path);
-    
-    // Using the iterative C mkdir approach
-    // mode_t mode = S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH; // 0775
-    mode_t mode = 0755; // More common default
-    if (mkdir_p(path, mode) == 0) {
-        LOG_MKDIR_INFO("Successfully ensured directory: %s", path);
-        record_activity();
+    mode_t mode;
+    if (parse_mode(cJSON_GetObjectItemCaseSensitive(action_params, "mode"), &mode) != 0) {
+        LOG_MKDIR_ERROR("%s", "Invalid 'mode' parameter (expected octal string like \"0755\").");
+        ctx->exit_status = MKDIR_FAILED_STATUS;
+        return;
+    }
+
+    // The engine only borrows the strings, which stay owned by the action's cJSON tree.
+    const char **paths = malloc((size_t)count * sizeof(char *));
+    if (paths == NULL) {
+        LOG_MKDIR_ERROR("%s", "Out of memory collecting paths.");
+        ctx->exit_status = MKDIR_FAILED_STATUS;
+        return;
+    }
+    size_t n = 0;
+    if (cJSON_IsString(path_json) && path_json->valuestring != NULL) {
+        paths[n++] = path_json->valuestring;
+    }
+    const cJSON *item;
+    cJSON_ArrayForEach(item, paths_json) {
+        if (cJSON_IsString(item) && item->valuestring != NULL && item->valuestring[0] != '\0') {
+            paths[n++] = item->valuestring;
+        } else {
+            LOG_MKDIR_ERROR("%s", "Ignoring non-string or empty entry in 'paths'.");
+        }
+    }
+
+    if (n == 1) {
+        LOG_MKDIR_INFO("Ensuring directory exists (mkdir -p equivalent): %s", paths[0]);
     } else {
-        // Error already logged by mkdir_p
-        // LOG_MKDIR_ERROR("Failed to ensure directory: %s", path);
+        LOG_MKDIR_INFO("Ensuring %zu directories exist (mkdir -p equivalent).", n);
     }
 
-    /* // Alternative using system("mkdir -p ...") - simpler but less secure / controlled
-    char cmd_buffer[512];
-    snprintf(cmd_buffer, sizeof(cmd_buffer), "mkdir -p "%s"", path);
-    int ret = system(cmd_buffer);
-    if (ret == 0) {
-        LOG_MKDIR_INFO("Successfully created directory (or it already existed): %s", path);
+    fs_mkdir_stats_t stats;
+    int rc = FsMkdir_batch(paths, n, mode, &stats);
+    free(paths);
+
+    LOG_MKDIR_INFO("Created %d, already present %d, failed %d (%ld syscalls).",
+                   stats.created, stats.existed, stats.failed, stats.syscalls);
+    if (rc == 0) {
         record_activity();
-    } else {
-        LOG_MKDIR_ERROR("system('mkdir -p %s') failed with status %d.", path, ret);
     }
-    */
+    if (rc != 0 || stats.failed > 0) {
+        ctx->exit_status = MKDIR_FAILED_STATUS; // Per-path errors are logged by the engine
+    }
 }
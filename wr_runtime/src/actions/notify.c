@@ -1,13 +1,15 @@
-#include <stdio.h>
 #include <string.h>
 #include "cJSON.h" // Found via CFLAGS -I deps/cJSON
 #include "../condition.h" // For record_activity()
-// #include <syslog.h> // For future syslog integration
+#include "../dispatcher.h" // For action_ctx_t
+#include "../notify_bus.h"
+#include "../logger.h"
 
-#define LOG_NOTIFY_INFO(fmt, ...) printf("INFO: notify: " fmt "\n", ##__VA_ARGS__)
-#define LOG_NOTIFY_ERROR(fmt, ...) fprintf(stderr, "ERROR: notify: " fmt "\n", ##__VA_ARGS__)
+#define LOG_NOTIFY_INFO(fmt, ...) WR_LOG_INFO("notify", fmt, ##__VA_ARGS__)
+#define LOG_NOTIFY_DEBUG(fmt, ...) WR_LOG_DEBUG("notify", fmt, ##__VA_ARGS__)
+#define LOG_NOTIFY_ERROR(fmt, ...) WR_LOG_ERROR("notify", fmt, ##__VA_ARGS__)
 
-void app_action_notify(const cJSON *action_params) {
+void app_action_notify(const cJSON *action_params, action_ctx_t *ctx) {
     const cJSON *msg_json = cJSON_GetObjectItemCaseSensitive(action_params, "message");
     if (!cJSON_IsString(msg_json) || (msg_json->valuestring == NULL)) {
         LOG_NOTIFY_ERROR("%s", "Missing or invalid 'message' parameter.");
@@ -15,9 +17,12 @@ void app_action_notify(const cJSON *action_params) {
     }
     const char *message = msg_json->valuestring;
 
-    // For now, print to stdout. Later, this will go to syslog.
-    // syslog(LOG_NOTICE, "User Notification: %s", message);
-    printf("NOTIFICATION: %s\n", message); 
-    LOG_NOTIFY_INFO("Notification action executed with message: %s", message);
+    // Subscribers get it from the bus, coalesced with repeats and batched; the bus logs
+    // each window's batch, so only a notification it did not take is logged here.
+    if (NotifyBus_publish(ctx != NULL ? ctx->service_name : NULL, message) != 0) {
+        LOG_NOTIFY_INFO("Notification: %s", message);
+    } else {
+        LOG_NOTIFY_DEBUG("Notification action executed with message: %s", message);
+    }
     record_activity();
 }
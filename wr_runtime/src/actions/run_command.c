@@ -1,55 +1,48 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 #include <sys/wait.h>
 #include <errno.h>
 #include "cJSON.h" // Found via CFLAGS -I deps/cJSON
-// Assuming dispatcher.h declares app_action_run_command, or ensure signature matches
-// For action_fn: #include "dispatcher.h" 
 #include "../condition.h" // For record_activity()
+#include "../dispatcher.h" // For action_ctx_t
+#include "../spawn.h"      // Shared fork/exec + output capture
+#include "../proc_limits.h" // timeout_ms, max_rss, cpu_seconds, nice, ioprio
+#include "../logger.h"
 
 // Temporary logging macros (replace with syslog later)
-#define LOG_RC_INFO(fmt, ...) printf("INFO: run_command: " fmt "\n", ##__VA_ARGS__)
-#define LOG_RC_ERROR(fmt, ...) fprintf(stderr, "ERROR: run_command: " fmt "\n", ##__VA_ARGS__)
+#define LOG_RC_INFO(fmt, ...) WR_LOG_INFO("run_command", fmt, ##__VA_ARGS__)
+#define LOG_RC_ERROR(fmt, ...) WR_LOG_ERROR("run_command", fmt, ##__VA_ARGS__)
 
-void app_action_run_command(const cJSON *action_params) {
+void app_action_run_command(const cJSON *action_params, action_ctx_t *ctx) {
     const cJSON *cmd_json = cJSON_GetObjectItemCaseSensitive(action_params, "command");
     if (!cJSON_IsString(cmd_json) || (cmd_json->valuestring == NULL)) {
         LOG_RC_ERROR("%s", "Missing or invalid 'command' parameter.");
         return;
     }
     const char *cmd = cmd_json->valuestring;
-    LOG_RC_INFO("Executing command: %s", cmd);
+    if (ctx->change == NULL) LOG_RC_INFO("Executing command: %s", cmd); // on_change: the dispatcher reports changes
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        LOG_RC_ERROR("Failed to fork: %s", strerror(errno)); // %m prints strerror(errno)
+    proc_limits_t limits;
+    if (ProcLimits_from_json(action_params, &limits) != 0) {
+        LOG_RC_ERROR("Not running '%s': invalid limits.", cmd);
         return;
-    } else if (pid == 0) { // Child process
-        if (setsid() == -1) { // Create new session and detach from terminal
-            LOG_RC_ERROR("Child setsid failed: %s", strerror(errno));
-            _exit(EXIT_FAILURE);
-        }
-        // Close standard file descriptors (optional, good for daemons)
-        // close(STDIN_FILENO); close(STDOUT_FILENO); close(STDERR_FILENO);
-        
-        execl("/bin/sh", "sh", "-c", cmd, (char *)0);
-        LOG_RC_ERROR("execl failed for /bin/sh -c '%s': %s", cmd, strerror(errno)); // Log if execl fails
-        _exit(EXIT_FAILURE); // Exit child if execl fails
-    } else { // Parent process
-        int status;
-        if (waitpid(pid, &status, 0) == -1) {
-            LOG_RC_ERROR("waitpid failed: %s", strerror(errno));
-        } else {
-            if (WIFEXITED(status)) {
-                LOG_RC_INFO("Command '%s' exited with status %d", cmd, WEXITSTATUS(status));
-            } else if (WIFSIGNALED(status)) {
-                LOG_RC_INFO("Command '%s' killed by signal %d", cmd, WTERMSIG(status));
-            } else {
-                LOG_RC_INFO("Command '%s' ended with unknown status", cmd);
-            }
-            record_activity(); // Record activity if command execution attempt was made
-        }
     }
+
+    int status;
+    if (Spawn_run_shell(cmd, ctx->output, ctx->stdin_fd, ctx->stdout_fd, ctx->service_name, &limits, &status) != 0) {
+        LOG_RC_ERROR("Failed to run '%s': %s", cmd, strerror(errno));
+        return;
+    }
+    ctx->exit_status = status;
+    if (ctx->change != NULL) {
+        // Quiet: the exit status is part of the on_change result
+    } else if (WIFEXITED(status)) {
+        LOG_RC_INFO("Command '%s' exited with status %d", cmd, WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        LOG_RC_INFO("Command '%s' killed by signal %d", cmd, WTERMSIG(status));
+    } else {
+        LOG_RC_INFO("Command '%s' ended with unknown status", cmd);
+    }
+    record_activity(); // Record activity if command execution attempt was made
 }
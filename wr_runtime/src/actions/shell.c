@@ -1,49 +1,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 #include <sys/wait.h>
 #include <errno.h>
 #include "cJSON.h" // Found via CFLAGS -I deps/cJSON
 #include "../condition.h" // For record_activity()
+#include "../dispatcher.h" // For action_ctx_t
+#include "../spawn.h"      // Shared fork/exec + output capture
+#include "../proc_limits.h" // timeout_ms, max_rss, cpu_seconds, nice, ioprio
+#include "../logger.h"
 
-#define LOG_SHELL_INFO(fmt, ...) printf("INFO: shell: " fmt "\n", ##__VA_ARGS__)
-#define LOG_SHELL_ERROR(fmt, ...) fprintf(stderr, "ERROR: shell: " fmt "\n", ##__VA_ARGS__)
+#define LOG_SHELL_INFO(fmt, ...) WR_LOG_INFO("shell", fmt, ##__VA_ARGS__)
+#define LOG_SHELL_ERROR(fmt, ...) WR_LOG_ERROR("shell", fmt, ##__VA_ARGS__)
 
-void app_action_shell(const cJSON *action_params) {
+void app_action_shell(const cJSON *action_params, action_ctx_t *ctx) {
     const cJSON *cmd_json = cJSON_GetObjectItemCaseSensitive(action_params, "command");
     if (!cJSON_IsString(cmd_json) || (cmd_json->valuestring == NULL)) {
         LOG_SHELL_ERROR("%s", "Missing or invalid 'command' parameter for shell action.");
         return;
     }
     const char *cmd = cmd_json->valuestring;
-    LOG_SHELL_INFO("Executing shell command: %s", cmd);
+    if (ctx->change == NULL) LOG_SHELL_INFO("Executing shell command: %s", cmd); // on_change: the dispatcher reports changes
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        LOG_SHELL_ERROR("Failed to fork for shell command: %s", strerror(errno));
+    proc_limits_t limits;
+    if (ProcLimits_from_json(action_params, &limits) != 0) {
+        LOG_SHELL_ERROR("Not running '%s': invalid limits.", cmd);
         return;
-    } else if (pid == 0) { // Child process
-        if (setsid() == -1) {
-            LOG_SHELL_ERROR("Child setsid failed for shell command: %s", strerror(errno));
-            _exit(EXIT_FAILURE);
-        }
-        execl("/bin/sh", "sh", "-c", cmd, (char *)0);
-        LOG_SHELL_ERROR("execl failed for /bin/sh -c '%s' (shell): %s", cmd, strerror(errno));
-        _exit(EXIT_FAILURE);
-    } else { // Parent process
-        int status;
-        if (waitpid(pid, &status, 0) == -1) {
-            LOG_SHELL_ERROR("waitpid failed for shell command: %s", strerror(errno));
-        } else {
-            if (WIFEXITED(status)) {
-                LOG_SHELL_INFO("Shell command '%s' exited with status %d", cmd, WEXITSTATUS(status));
-            } else if (WIFSIGNALED(status)) {
-                LOG_SHELL_INFO("Shell command '%s' killed by signal %d", cmd, WTERMSIG(status));
-            } else {
-                LOG_SHELL_INFO("Shell command '%s' ended with unknown status", cmd);
-            }
-            record_activity();
-        }
     }
+
+    int status;
+    if (Spawn_run_shell(cmd, ctx->output, ctx->stdin_fd, ctx->stdout_fd, ctx->service_name, &limits, &status) != 0) {
+        LOG_SHELL_ERROR("Failed to run shell command '%s': %s", cmd, strerror(errno));
+        return;
+    }
+    ctx->exit_status = status;
+    if (ctx->change != NULL) {
+        // Quiet: the exit status is part of the on_change result
+    } else if (WIFEXITED(status)) {
+        LOG_SHELL_INFO("Shell command '%s' exited with status %d", cmd, WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        LOG_SHELL_INFO("Shell command '%s' killed by signal %d", cmd, WTERMSIG(status));
+    } else {
+        LOG_SHELL_INFO("Shell command '%s' ended with unknown status", cmd);
+    }
+    record_activity();
 }
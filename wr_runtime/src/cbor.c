@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>   // For isfinite (a macro: no libm)
+
+#include "cbor.h"
+
+#define CBOR_BREAK 0xff
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    int more;          // Ran out of input: the item may still be completed
+    char *err;         // NULL when only measuring
+    size_t err_len;
+} reader_t;
+
+static int fail(reader_t *r, const char *reason) {
+    if (r->err != NULL && r->err[0] == '\0') snprintf(r->err, r->err_len, "%s", reason);
+    return -1;
+}
+
+static int truncated(reader_t *r) {
+    r->more = 1;
+    return fail(r, "truncated");
+}
+
+// An item's head: major type, additional information and its argument (a count, a
+// length, an integer or the bits of a float). 'ai' 31: indefinite length or break.
+static int read_head(reader_t *r, unsigned *major, unsigned *ai, uint64_t *arg) {
+    if (r->p >= r->end) return truncated(r);
+    unsigned ib = *r->p++;
+    *major = ib >> 5;
+    *ai = ib & 31;
+    *arg = *ai;
+    if (*ai < 24 || *ai == 31) return 0;
+    if (*ai > 27) return fail(r, "reserved additional information");
+    size_t n = (size_t)1 << (*ai - 24);
+    if ((size_t)(r->end - r->p) < n) return truncated(r);
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) v = (v << 8) | *r->p++;
+    *arg = v;
+    return 0;
+}
+
+static int at_break(reader_t *r) {
+    if (r->p < r->end && *r->p == CBOR_BREAK) {
+        r->p++;
+        return 1;
+    }
+    return 0;
+}
+
+// Append 'len' bytes at 'from' to the string being built in '*out' (NULL: measuring).
+static int append_text(reader_t *r, char **out, size_t *out_len, const unsigned char *from, uint64_t len) {
+    if (out == NULL) return 0;
+    if (memchr(from, '\0', (size_t)len) != NULL) return fail(r, "text with a NUL byte");
+    char *grown = cJSON_malloc(*out_len + (size_t)len + 1);
+    if (grown == NULL) return fail(r, "out of memory");
+    if (*out != NULL) memcpy(grown, *out, *out_len);
+    cJSON_free(*out);
+    memcpy(grown + *out_len, from, (size_t)len);
+    *out_len += (size_t)len;
+    grown[*out_len] = '\0';
+    *out = grown;
+    return 0;
+}
+
+// A text string whose head was read; definite, or indefinite (definite chunks up to a
+// break). '*out' gets a cJSON_malloc()ed copy, unless 'out' is NULL.
+static int read_text(reader_t *r, unsigned ai, uint64_t arg, char **out) {
+    size_t len = 0;
+    if (out != NULL) *out = NULL;
+    for (int chunks = 0;; chunks++) {
+        if (ai != 31 || chunks > 0) {
+            if (arg > (uint64_t)(r->end - r->p)) return truncated(r);
+            if (append_text(r, out, &len, r->p, arg) != 0) return -1;
+            r->p += arg;
+            if (ai != 31) break;
+        }
+        if (at_break(r)) break;
+        unsigned major, chunk_ai;
+        if (read_head(r, &major, &chunk_ai, &arg) != 0) return -1;
+        if (major != 3 || chunk_ai == 31) return fail(r, "bad chunk in an indefinite-length text string");
+    }
+    if (out != NULL && *out == NULL && append_text(r, out, &len, r->p, 0) != 0) return -1; // Empty
+    return 0;
+}
+
+static double half_to_double(uint16_t h) {
+    int exp = (h >> 10) & 0x1f;
+    double v = exp == 0 ? (double)(h & 0x3ff) : (double)((h & 0x3ff) | 0x400);
+    for (int e = exp == 0 ? -24 : exp - 25; e < 0; e++) v /= 2;
+    for (int e = exp - 25; e > 0; e--) v *= 2;
+    if (exp == 31) v = NAN;
+    return (h & 0x8000) ? -v : v;
+}
+
+static double bits_to_double(unsigned ai, uint64_t arg) {
+    if (ai == 25) return half_to_double((uint16_t)arg);
+    if (ai == 26) {
+        uint32_t bits = (uint32_t)arg;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+    double d;
+    memcpy(&d, &arg, sizeof(d));
+    return d;
+}
+
+// Read one item; build it into '*out' unless 'out' is NULL. Frees what it built on error.
+static int read_item(reader_t *r, int depth, cJSON **out) {
+    unsigned major, ai;
+    uint64_t arg;
+    if (depth > CBOR_MAX_DEPTH) return fail(r, "nested too deeply");
+    if (read_head(r, &major, &ai, &arg) != 0) return -1;
+    if (ai == 31 && (major < 2 || major == 6)) return fail(r, "indefinite length on an integer or a tag");
+    cJSON *node = NULL;
+    switch (major) {
+    case 0:
+    case 1:
+        if (out != NULL) node = cJSON_CreateNumber(major == 0 ? (double)arg : -1.0 - (double)arg);
+        break;
+    case 2:
+        return fail(r, "byte strings are not supported");
+    case 3: {
+        char *text = NULL;
+        if (read_text(r, ai, arg, out != NULL ? &text : NULL) != 0) return -1;
+        if (out != NULL && (node = cJSON_CreateNull()) == NULL) cJSON_free(text);
+        if (node != NULL) {
+            node->type = cJSON_String; // Takes the decoded text as is, no second copy
+            node->valuestring = text;
+        }
+        break;
+    }
+    case 4:
+    case 5:
+        if (out != NULL && (node = major == 4 ? cJSON_CreateArray() : cJSON_CreateObject()) == NULL) break;
+        for (uint64_t i = 0; ai == 31 ? !at_break(r) : i < arg; i++) {
+            char *key = NULL;
+            if (major == 5) {
+                unsigned key_major, key_ai;
+                uint64_t key_arg;
+                int ok = read_head(r, &key_major, &key_ai, &key_arg) == 0;
+                if (ok && key_major != 3) ok = fail(r, "map key that is not a text string") == 0;
+                if (!ok || read_text(r, key_ai, key_arg, out != NULL ? &key : NULL) != 0) {
+                    cJSON_Delete(node);
+                    return -1;
+                }
+            }
+            cJSON *child = NULL;
+            if (read_item(r, depth + 1, out != NULL ? &child : NULL) != 0) {
+                cJSON_free(key);
+                cJSON_Delete(node);
+                return -1;
+            }
+            if (child != NULL) {
+                child->string = key; // Owned by the child, as cJSON_AddItemToObject() would copy it
+                cJSON_AddItemToArray(node, child);
+            }
+        }
+        break;
+    case 6:
+        if (arg != CBOR_SELF_DESCRIBE) return fail(r, "tags are not supported");
+        return read_item(r, depth + 1, out); // A level each, or a run of tags would recurse unbounded
+    default: // 7: simple values and floats
+        if (ai == 20 || ai == 21) {
+            if (out != NULL) node = cJSON_CreateBool(ai == 21);
+        } else if (ai == 22) {
+            if (out != NULL) node = cJSON_CreateNull();
+        } else if (ai >= 25 && ai <= 27) {
+            double v = bits_to_double(ai, arg);
+            if (!isfinite(v)) return fail(r, "infinite or NaN number");
+            if (out != NULL) node = cJSON_CreateNumber(v);
+        } else {
+            return fail(r, ai == 31 ? "unexpected break" : "unsupported simple value");
+        }
+        break;
+    }
+    if (out != NULL) {
+        if (node == NULL) return fail(r, "out of memory");
+        *out = node;
+    }
+    return 0;
+}
+
+long Cbor_item_length(const unsigned char *data, size_t len) {
+    reader_t r = { data, data + len, 0, NULL, 0 };
+    if (read_item(&r, 0, NULL) != 0) return r.more ? 0 : -1;
+    return (long)(r.p - data);
+}
+
+cJSON *Cbor_decode(const unsigned char *data, size_t len, char *err, size_t err_len) {
+    err[0] = '\0';
+    reader_t r = { data, data + len, 0, err, err_len };
+    cJSON *item = NULL;
+    if (read_item(&r, 0, &item) != 0) return NULL;
+    if (r.p != r.end) {
+        cJSON_Delete(item);
+        snprintf(err, err_len, "%s", "trailing bytes after the item");
+        return NULL;
+    }
+    return item;
+}
+
+static void put_item(cbor_writer_t *w, const cJSON *item) {
+    const cJSON *child;
+    size_t count = 0;
+    switch (item->type & 0xff) {
+    case cJSON_False:
+    case cJSON_True:
+        Cbor_put_bool(w, cJSON_IsTrue(item));
+        break;
+    case cJSON_Number: {
+        double d = item->valuedouble;
+        if (d >= -9.2e18 && d <= 9.2e18 && d == (double)(int64_t)d) Cbor_put_int(w, (int64_t)d);
+        else Cbor_put_double(w, d);
+        break;
+    }
+    case cJSON_String:
+    case cJSON_Raw:
+        Cbor_put_text(w, item->valuestring != NULL ? item->valuestring : "");
+        break;
+    case cJSON_Array:
+    case cJSON_Object:
+        cJSON_ArrayForEach(child, item) count++;
+        if (cJSON_IsArray(item)) Cbor_put_array(w, count);
+        else Cbor_put_map(w, count);
+        cJSON_ArrayForEach(child, item) {
+            if (cJSON_IsObject(item)) Cbor_put_text(w, child->string != NULL ? child->string : "");
+            put_item(w, child);
+        }
+        break;
+    default:
+        Cbor_put_null(w);
+        break;
+    }
+}
+
+unsigned char *Cbor_encode(const cJSON *item, size_t *len) {
+    cbor_writer_t w = { NULL, 0, 0 };
+    put_item(&w, item); // Measure
+    w.data = malloc(w.len > 0 ? w.len : 1);
+    if (w.data == NULL) return NULL;
+    w.cap = w.len;
+    w.len = 0;
+    put_item(&w, item);
+    *len = w.len;
+    return w.data;
+}
@@ -0,0 +1,110 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cJSON.h" // Found via CFLAGS -I deps/cJSON
+
+#define CBOR_MAX_DEPTH 64              // Nesting the decoder accepts
+#define CBOR_SELF_DESCRIBE 55799       // Tag d9 d9 f7: optional marker in front of a document
+
+// Compact binary encoding of services and control requests: CBOR (RFC 8949), limited to
+// what JSON can say: maps with text keys, arrays, text strings, integers, floats, true,
+// false and null. A CBOR document means the same as the JSON object with the same keys
+// and values. It is accepted wherever JSON is:
+//   - on the control socket, as a document starting with a map (or the self-describe tag)
+//     instead of '{'; results are still JSON lines;
+//   - in submission ring records of type SUBMIT_RING_CBOR;
+//   - as service files named *.cbor.
+// Decoding goes straight from the binary values to the cJSON tree that validation, the
+// plan and the actions read, with no text to tokenize, unescape or convert to numbers.
+// Rejected: byte strings, non-text map keys, tags other than self-describe, undefined
+// and other simple values. Producers can use any CBOR library, 'wr_cbor' to convert
+// JSON, or the writer functions at the end of this header.
+
+// Size of the complete item at the start of 'data', without decoding it: > 0, 0 if more
+// bytes are needed, or -1 if it is not well-formed.
+long Cbor_item_length(const unsigned char *data, size_t len);
+
+// 1 if 'byte' can start a CBOR document (a map, or the self-describe tag), which no JSON
+// document can.
+static inline int Cbor_is_start(unsigned char byte) {
+    return (byte >= 0xa0 && byte <= 0xbb) || byte == 0xbf || byte == 0xd9;
+}
+
+// Decode the one item that makes up 'data'. Returns NULL with the reason in 'err'.
+cJSON *Cbor_decode(const unsigned char *data, size_t len, char *err, size_t err_len);
+
+// Encode 'item' (integral numbers as integers) into a malloc()ed buffer. NULL: out of memory.
+unsigned char *Cbor_encode(const cJSON *item, size_t *len);
+
+// Writer: appends to a caller's buffer. 'len' keeps counting past 'cap', so a first pass
+// with cap 0 measures; the output is complete if len <= cap at the end.
+typedef struct {
+    unsigned char *data;
+    size_t cap;
+    size_t len;
+} cbor_writer_t;
+
+static inline void Cbor_put_bytes(cbor_writer_t *w, const void *data, size_t len) {
+    if (w->len + len <= w->cap) memcpy(w->data + w->len, data, len);
+    w->len += len;
+}
+
+static inline void Cbor_put_head(cbor_writer_t *w, unsigned major, uint64_t value) {
+    unsigned char head[9];
+    size_t n;
+    head[0] = (unsigned char)(major << 5);
+    if (value < 24) {
+        head[0] |= (unsigned char)value;
+        n = 1;
+    } else {
+        int bytes = value <= 0xff ? 1 : value <= 0xffff ? 2 : value <= 0xffffffffu ? 4 : 8;
+        head[0] |= (unsigned char)(bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27);
+        for (int i = 0; i < bytes; i++) head[1 + i] = (unsigned char)(value >> (8 * (bytes - 1 - i)));
+        n = 1 + (size_t)bytes;
+    }
+    Cbor_put_bytes(w, head, n);
+}
+
+// A map of 'pairs' key/value pairs follows (keys with Cbor_put_text()).
+static inline void Cbor_put_map(cbor_writer_t *w, size_t pairs) {
+    Cbor_put_head(w, 5, pairs);
+}
+
+static inline void Cbor_put_array(cbor_writer_t *w, size_t items) {
+    Cbor_put_head(w, 4, items);
+}
+
+static inline void Cbor_put_text(cbor_writer_t *w, const char *text) {
+    size_t len = strlen(text);
+    Cbor_put_head(w, 3, len);
+    Cbor_put_bytes(w, text, len);
+}
+
+static inline void Cbor_put_int(cbor_writer_t *w, int64_t value) {
+    if (value >= 0) Cbor_put_head(w, 0, (uint64_t)value);
+    else Cbor_put_head(w, 1, (uint64_t)(-1 - value));
+}
+
+static inline void Cbor_put_double(cbor_writer_t *w, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    unsigned char out[9] = { 0xfb };
+    for (int i = 0; i < 8; i++) out[1 + i] = (unsigned char)(bits >> (8 * (7 - i)));
+    Cbor_put_bytes(w, out, sizeof(out));
+}
+
+static inline void Cbor_put_bool(cbor_writer_t *w, int value) {
+    unsigned char b = value ? 0xf5 : 0xf4;
+    Cbor_put_bytes(w, &b, 1);
+}
+
+static inline void Cbor_put_null(cbor_writer_t *w) {
+    unsigned char b = 0xf6;
+    Cbor_put_bytes(w, &b, 1);
+}
+
+#endif // CBOR_H
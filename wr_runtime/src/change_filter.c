@@ -0,0 +1,332 @@
+#define _POSIX_C_SOURCE 200809L // For regcomp
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <regex.h>
+#include <pthread.h>
+
+#include "change_filter.h"
+#include "logger.h"
+
+#define LOG_CHANGE_ERROR(fmt, ...) WR_LOG_ERROR("change_filter", fmt, ##__VA_ARGS__)
+
+struct change_filter {
+    regex_t masks[CHANGE_FILTER_MAX_MASKS];
+    int nmasks;
+    output_ring_t *staging;  // Created on first use
+    char *buf;               // Staged output, CHANGE_FILTER_CAPTURE_KB
+    char *line;              // NUL-terminated copy of one line for regexec()
+    size_t line_cap;
+    uint64_t key;            // Of the remembered hash, 0: not remembered
+    uint64_t last_hash;
+    int has_last;
+};
+
+// Remembered last hashes, open addressing by key; key 0 marks a free slot.
+typedef struct {
+    uint64_t key;
+    uint64_t hash;
+} remembered_t;
+
+static remembered_t remembered[CHANGE_FILTER_REMEMBERED];
+static pthread_mutex_t remembered_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --- XXH64, streaming ---
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char mem[32];
+    size_t memsize;
+} xxh64_t;
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    return rotl64(acc, 31) * XXH_P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_init(xxh64_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->v[0] = XXH_P1 + XXH_P2;
+    s->v[1] = XXH_P2;
+    s->v[2] = 0;
+    s->v[3] = (uint64_t)0 - XXH_P1;
+}
+
+static void xxh64_stripe(xxh64_t *s, const unsigned char *p) {
+    for (int i = 0; i < 4; i++) s->v[i] = xxh_round(s->v[i], read64(p + 8 * i));
+}
+
+static void xxh64_update(xxh64_t *s, const void *data, size_t len) {
+    const unsigned char *p = data;
+    s->total += len;
+    if (s->memsize + len < 32) {
+        memcpy(s->mem + s->memsize, p, len);
+        s->memsize += len;
+        return;
+    }
+    if (s->memsize > 0) {
+        size_t fill = 32 - s->memsize;
+        memcpy(s->mem + s->memsize, p, fill);
+        xxh64_stripe(s, s->mem);
+        p += fill;
+        len -= fill;
+        s->memsize = 0;
+    }
+    for (; len >= 32; p += 32, len -= 32) xxh64_stripe(s, p);
+    memcpy(s->mem, p, len);
+    s->memsize = len;
+}
+
+static uint64_t xxh64_digest(const xxh64_t *s) {
+    uint64_t h;
+    if (s->total >= 32) {
+        h = rotl64(s->v[0], 1) + rotl64(s->v[1], 7) + rotl64(s->v[2], 12) + rotl64(s->v[3], 18);
+        for (int i = 0; i < 4; i++) h = xxh_merge(h, s->v[i]);
+    } else {
+        h = s->v[2] + XXH_P5; // v[2] is the seed
+    }
+    h += s->total;
+    const unsigned char *p = s->mem;
+    size_t len = s->memsize;
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--) {
+        h ^= *p * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+    }
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// --- Remembered hashes ---
+
+static uint64_t filter_key(const char *service, int action_idx, const cJSON *action) {
+    char *text = cJSON_PrintUnformatted(action);
+    if (text == NULL) return 0;
+    unsigned char idx[4] = { (unsigned char)action_idx, (unsigned char)(action_idx >> 8),
+                             (unsigned char)(action_idx >> 16), (unsigned char)(action_idx >> 24) };
+    xxh64_t h;
+    xxh64_init(&h);
+    xxh64_update(&h, service, strlen(service) + 1);
+    xxh64_update(&h, idx, sizeof(idx));
+    xxh64_update(&h, text, strlen(text));
+    cJSON_free(text);
+    uint64_t key = xxh64_digest(&h);
+    return key != 0 ? key : 1;
+}
+
+// Slot holding 'key', else the free slot for it; when the table is full, the slot it
+// would start at (its hash is forgotten).
+static remembered_t *remembered_slot(uint64_t key) {
+    size_t start = (size_t)(key % CHANGE_FILTER_REMEMBERED);
+    for (size_t i = 0; i < CHANGE_FILTER_REMEMBERED; i++) {
+        remembered_t *r = &remembered[(start + i) % CHANGE_FILTER_REMEMBERED];
+        if (r->key == key || r->key == 0) return r;
+    }
+    return &remembered[start];
+}
+
+static int recall(uint64_t key, uint64_t *hash) {
+    pthread_mutex_lock(&remembered_lock);
+    remembered_t *r = remembered_slot(key);
+    int found = r->key == key;
+    if (found) *hash = r->hash;
+    pthread_mutex_unlock(&remembered_lock);
+    return found;
+}
+
+static void remember(uint64_t key, uint64_t hash) {
+    pthread_mutex_lock(&remembered_lock);
+    remembered_t *r = remembered_slot(key);
+    r->key = key;
+    r->hash = hash;
+    pthread_mutex_unlock(&remembered_lock);
+}
+
+// --- Filter ---
+
+static int add_mask(change_filter_t *f, const cJSON *item, char *err, size_t err_len) {
+    if (!cJSON_IsString(item) || item->valuestring == NULL || item->valuestring[0] == '\0') {
+        snprintf(err, err_len, "%s", "'on_change' masks must be non-empty regex strings.");
+        return -1;
+    }
+    if (f->nmasks == CHANGE_FILTER_MAX_MASKS) {
+        snprintf(err, err_len, "'on_change' takes at most %d masks.", CHANGE_FILTER_MAX_MASKS);
+        return -1;
+    }
+    int rc = regcomp(&f->masks[f->nmasks], item->valuestring, REG_EXTENDED);
+    if (rc != 0) {
+        char msg[96];
+        regerror(rc, &f->masks[f->nmasks], msg, sizeof(msg));
+        snprintf(err, err_len, "'on_change' mask '%s': %s.", item->valuestring, msg);
+        return -1;
+    }
+    f->nmasks++;
+    return 0;
+}
+
+int ChangeFilter_from_json(const char *service, int action_idx, const cJSON *action, change_filter_t **out,
+                           char *err, size_t err_len) {
+    *out = NULL;
+    const cJSON *on_change = cJSON_GetObjectItemCaseSensitive(action, "on_change");
+    if (on_change == NULL || cJSON_IsFalse(on_change)) return 0;
+    if (!cJSON_IsTrue(on_change) && !cJSON_IsObject(on_change)) {
+        snprintf(err, err_len, "%s", "'on_change' must be a boolean or an object.");
+        return -1;
+    }
+    change_filter_t *f = calloc(1, sizeof(*f));
+    if (f == NULL) {
+        snprintf(err, err_len, "%s", "Out of memory.");
+        return -1;
+    }
+    const cJSON *mask = cJSON_IsObject(on_change) ? cJSON_GetObjectItemCaseSensitive(on_change, "mask") : NULL;
+    if (cJSON_IsArray(mask)) {
+        const cJSON *item;
+        cJSON_ArrayForEach(item, mask) {
+            if (add_mask(f, item, err, err_len) != 0) {
+                ChangeFilter_free(f);
+                return -1;
+            }
+        }
+    } else if (mask != NULL && add_mask(f, mask, err, err_len) != 0) {
+        ChangeFilter_free(f);
+        return -1;
+    }
+    f->key = filter_key(service, action_idx, action);
+    if (f->key != 0) f->has_last = recall(f->key, &f->last_hash);
+    *out = f;
+    return 0;
+}
+
+output_ring_t *ChangeFilter_begin(change_filter_t *f) {
+    if (f->staging == NULL) {
+        f->buf = malloc((size_t)CHANGE_FILTER_CAPTURE_KB * 1024);
+        f->staging = f->buf != NULL ? OutRing_new("on_change", CHANGE_FILTER_CAPTURE_KB) : NULL;
+        if (f->staging == NULL) {
+            LOG_CHANGE_ERROR("%s", "Cannot allocate the staging ring, output is not filtered.");
+            free(f->buf);
+            f->buf = NULL;
+            return NULL;
+        }
+    }
+    OutRing_clear(f->staging);
+    return f->staging;
+}
+
+// Hash one line (without its newline) minus every mask match.
+static int hash_masked_line(change_filter_t *f, xxh64_t *h, const char *line, size_t len) {
+    if (len + 1 > f->line_cap) {
+        char *p = realloc(f->line, len + 1);
+        if (p == NULL) return -1;
+        f->line = p;
+        f->line_cap = len + 1;
+    }
+    memcpy(f->line, line, len);
+    f->line[len] = '\0';
+    size_t text_len = strlen(f->line); // regexec() stops at an embedded NUL; the rest is hashed as is
+    size_t pos = 0;
+    while (pos < text_len) {
+        // Earliest match of any mask from 'pos' on.
+        regmatch_t best = { -1, -1 };
+        for (int i = 0; i < f->nmasks; i++) {
+            regmatch_t m;
+            if (regexec(&f->masks[i], f->line + pos, 1, &m, pos > 0 ? REG_NOTBOL : 0) == 0 &&
+                (best.rm_so < 0 || m.rm_so < best.rm_so || (m.rm_so == best.rm_so && m.rm_eo > best.rm_eo))) {
+                best = m;
+            }
+        }
+        if (best.rm_so < 0) break;
+        xxh64_update(h, f->line + pos, (size_t)best.rm_so);
+        // An empty match removes nothing: step over one character so the scan advances.
+        size_t skip = best.rm_eo > best.rm_so ? (size_t)best.rm_eo : (size_t)best.rm_so + 1;
+        if (best.rm_eo == best.rm_so) xxh64_update(h, f->line + pos + best.rm_so, 1);
+        pos += skip;
+    }
+    if (pos < len) xxh64_update(h, f->line + pos, len - pos);
+    return 0;
+}
+
+int ChangeFilter_commit(change_filter_t *f, output_ring_t *dest, int exit_status) {
+    if (f->staging == NULL) return 1; // begin() failed: the output went straight to 'dest'
+    size_t n = OutRing_tail(f->staging, f->buf, (size_t)CHANGE_FILTER_CAPTURE_KB * 1024);
+
+    xxh64_t h;
+    xxh64_init(&h);
+    if (f->nmasks == 0) {
+        xxh64_update(&h, f->buf, n);
+    } else {
+        size_t start = 0;
+        while (start < n) {
+            const char *nl = memchr(f->buf + start, '\n', n - start);
+            size_t len = nl != NULL ? (size_t)(nl - (f->buf + start)) : n - start;
+            if (hash_masked_line(f, &h, f->buf + start, len) != 0) {
+                xxh64_update(&h, f->buf + start, len); // Out of memory: compare the line unmasked
+            }
+            xxh64_update(&h, "\n", 1);
+            start += len + 1;
+        }
+    }
+    unsigned char status[4] = { (unsigned char)exit_status, (unsigned char)(exit_status >> 8),
+                                (unsigned char)(exit_status >> 16), (unsigned char)(exit_status >> 24) };
+    xxh64_update(&h, status, sizeof(status));
+    uint64_t hash = xxh64_digest(&h);
+
+    if (f->has_last && hash == f->last_hash) return 0;
+    f->last_hash = hash;
+    f->has_last = 1;
+    if (f->key != 0) remember(f->key, hash);
+    if (dest != NULL) {
+        OutRing_write(dest, f->buf, n);
+    } else {
+        fwrite(f->buf, 1, n, stdout);
+    }
+    return 1;
+}
+
+void ChangeFilter_free(change_filter_t *f) {
+    if (f == NULL) return;
+    for (int i = 0; i < f->nmasks; i++) regfree(&f->masks[i]);
+    OutRing_free(f->staging);
+    free(f->buf);
+    free(f->line);
+    free(f);
+}
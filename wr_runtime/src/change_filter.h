@@ -0,0 +1,40 @@
+#ifndef CHANGE_FILTER_H
+#define CHANGE_FILTER_H
+
+#include <stddef.h> // For size_t
+
+#include "cJSON.h"
+#include "output_ring.h"
+
+#define CHANGE_FILTER_CAPTURE_KB 256 // Output staged per run; only its tail is compared
+#define CHANGE_FILTER_MAX_MASKS 8
+
+// Change-only output for an action ("on_change"). The action's output is staged in a
+// private ring; once it finishes, the output is normalised (every match of the "mask"
+// regexes is removed, line by line), hashed with XXH64 together with the exit status,
+// and compared with the previous run. Only a changed result reaches the service's ring
+// (and the daemon's stdout); an unchanged one is dropped. The first run always counts
+// as changed.
+// The last hash outlives the filter: it is remembered (up to CHANGE_FILTER_REMEMBERED)
+// by service name, action index and action JSON, so reloading or registering the same
+// service again does not report an unchanged result once more; editing the action does.
+typedef struct change_filter change_filter_t;
+
+#define CHANGE_FILTER_REMEMBERED 4096
+
+// Build the filter for action #'action_idx' of 'service' from its "on_change": true, or
+// {"mask": regex | [regex, ...]}. Stores NULL when the action has no (or a false)
+// on_change. Returns 0, or -1 with the problem (e.g. a bad regex) described in 'err'.
+int ChangeFilter_from_json(const char *service, int action_idx, const cJSON *action, change_filter_t **out,
+                           char *err, size_t err_len);
+
+// Ring the action should write its output to for this run (emptied), NULL on failure.
+output_ring_t *ChangeFilter_begin(change_filter_t *filter);
+
+// Finish the run: returns 1 and copies the staged output to 'dest' (NULL: stdout) when
+// the result changed, 0 when it is the same as last time.
+int ChangeFilter_commit(change_filter_t *filter, output_ring_t *dest, int exit_status);
+
+void ChangeFilter_free(change_filter_t *filter);
+
+#endif // CHANGE_FILTER_H
@@ -0,0 +1,66 @@
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "clock_source.h"
+
+// --- Real clock ---
+
+static void real_now(struct timespec *ts) {
+    clock_gettime(CLOCK_REALTIME, ts);
+}
+
+static void real_sleep(unsigned int seconds) {
+    while (seconds > 0) seconds = sleep(seconds); // Signals (e.g. the profiler's) cut it short
+}
+
+static const clock_source_t real_clock = { real_now, real_sleep, NULL };
+
+// --- Virtual clock ---
+
+static _Atomic uint64_t virtual_ns = 0; // Nanoseconds since the epoch
+
+static void virtual_now(struct timespec *ts) {
+    uint64_t ns = atomic_load_explicit(&virtual_ns, memory_order_relaxed);
+    ts->tv_sec = (time_t)(ns / 1000000000u);
+    ts->tv_nsec = (long)(ns % 1000000000u);
+}
+
+static void virtual_advance(uint64_t ns) {
+    atomic_fetch_add_explicit(&virtual_ns, ns, memory_order_relaxed);
+}
+
+static void virtual_sleep(unsigned int seconds) {
+    virtual_advance((uint64_t)seconds * 1000000000u);
+}
+
+static const clock_source_t virtual_clock = { virtual_now, virtual_sleep, virtual_advance };
+
+static const clock_source_t *current = &real_clock;
+
+void Clock_set(const clock_source_t *source) {
+    current = source != NULL ? source : &real_clock;
+}
+
+void Clock_use_virtual(time_t start) {
+    atomic_store(&virtual_ns, (uint64_t)start * 1000000000u);
+    Clock_set(&virtual_clock);
+}
+
+time_t Clock_now(void) {
+    struct timespec ts;
+    current->now(&ts);
+    return ts.tv_sec;
+}
+
+void Clock_now_ts(struct timespec *ts) {
+    current->now(ts);
+}
+
+void Clock_sleep(unsigned int seconds) {
+    current->sleep(seconds);
+}
+
+void Clock_advance_ns(uint64_t ns) {
+    if (current->advance != NULL) current->advance(ns);
+}
@@ -0,0 +1,30 @@
+#ifndef CLOCK_SOURCE_H
+#define CLOCK_SOURCE_H
+
+#include <stdint.h> // For uint64_t
+#include <time.h>   // For time_t, struct timespec
+
+// Wall clock and sleeping for the scheduler and time-based conditions. By default these
+// are time() / sleep(); a simulation installs a virtual clock that only moves when the
+// scheduler sleeps or Clock_advance_ns() is called, so days of scheduling run as fast as
+// the CPU allows. Measurements of real cost (metrics, trace, logs) keep the real clocks.
+typedef struct {
+    void (*now)(struct timespec *ts);   // Current wall-clock time
+    void (*sleep)(unsigned int seconds);
+    void (*advance)(uint64_t ns);       // Let time pass without sleeping; may be NULL
+} clock_source_t;
+
+// Install 'source' (NULL: the real clock). Call before other threads use the clock.
+void Clock_set(const clock_source_t *source);
+
+// Switch to the virtual clock, starting at 'start'.
+void Clock_use_virtual(time_t start);
+
+time_t Clock_now(void);
+void Clock_now_ts(struct timespec *ts);
+void Clock_sleep(unsigned int seconds);
+
+// Move a virtual clock forward, e.g. by the modelled cost of an action. No-op on the real clock.
+void Clock_advance_ns(uint64_t ns);
+
+#endif // CLOCK_SOURCE_H
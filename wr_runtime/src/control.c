@@ -0,0 +1,935 @@
+#define _GNU_SOURCE // For accept4, SOCK_CLOEXEC, eventfd, struct ucred, mkstemp, SCM_RIGHTS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>  // For mkdir, chmod
+#include <sys/time.h>  // For struct timeval (SO_SNDTIMEO)
+#include <sys/un.h>
+
+#include "control.h"
+#include "submit_ring.h"
+#include "cbor.h"
+#include "service_loader.h"
+#include "service_run.h"
+#include "condition.h"
+#include "output_ring.h"
+#include "metrics.h"
+#include "trace.h"
+#include "logger.h"
+
+#define LOG_CTL_INFO(fmt, ...) WR_LOG_INFO("control", fmt, ##__VA_ARGS__)
+#define LOG_CTL_WARN(fmt, ...) WR_LOG_WARN("control", fmt, ##__VA_ARGS__)
+#define LOG_CTL_ERROR(fmt, ...) WR_LOG_ERROR("control", fmt, ##__VA_ARGS__)
+
+#define SEND_TIMEOUT_S 5       // A client that stops reading its results is dropped
+#define STOP_WAIT_MS 2000      // How long Control_stop() waits for running requests
+#define PRINT_BUF_MIN 4096     // Initial size of a thread's result rendering buffer
+#define RING_BATCH 256         // Ring submissions taken before the socket is looked at again
+
+// A service registered by a client, waiting for the scheduler to pick it up.
+typedef struct pending_service {
+    service_config_t svc;
+    struct pending_service *next;
+} pending_service_t;
+
+static pthread_t server_thread;
+static int server_running = 0;
+static int wake_fd = -1;   // eventfd: stop was requested (stays readable once written)
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static char services_dir[1024];
+static _Atomic int active_clients = 0;
+
+static pending_service_t *pending = NULL; // Newest first
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// One client connection. Its thread reads and frames the input; results come from that
+// thread (requests without an "id") and from the workers, appended to 'out' under 'lock'.
+typedef struct {
+    int fd;
+    char *buf;      // Input, reused from one document to the next
+    size_t len;
+    size_t cap;
+    size_t scan;    // Bytes of buf already scanned
+    size_t start;   // Offset of the document being scanned (valid while depth > 0)
+    int depth;      // Nesting of objects and arrays; 0 between documents
+    int in_string;
+    int escaped;
+    int cbor;       // The document at 'start' is CBOR, not yet complete
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;   // A worker finished one of this connection's requests
+    int in_flight;         // Requests queued or running on workers
+    char *out;             // Results waiting to be sent
+    size_t out_len;
+    size_t out_cap;
+    char *spare;           // The other output buffer, swapped in while 'out' is sent
+    size_t spare_cap;
+    int flushing;          // A thread is sending; others only append
+    int broken;            // Sending failed: results are dropped
+
+    submit_ring_owner_t *ring;  // Attached with {"op":"ring"}, NULL if none
+    char *ring_buf;             // The submission being handled
+    size_t ring_cap;
+    _Atomic int ring_failed;    // A completion could not be posted: the ring is dropped
+} conn_t;
+
+// A pipelined request waiting for a worker.
+typedef struct job {
+    conn_t *conn;
+    cJSON *request;
+    int via_ring;          // Its result goes to the completion ring, for 'user_data'
+    uint64_t user_data;
+    struct job *next;
+} job_t;
+
+// Growable buffer for rendering results, one per thread.
+typedef struct {
+    char *data;
+    size_t cap;
+} print_buf_t;
+
+static pthread_t workers[CONTROL_WORKERS];
+static int worker_count = 0;
+static job_t *queue_head = NULL, *queue_tail = NULL;
+static int queue_stop = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+
+// --- Results ---
+
+// A result object, starting with the request's "id" when it has one.
+static cJSON *new_result(const cJSON *id, int ok) {
+    cJSON *res = cJSON_CreateObject();
+    if (id != NULL) cJSON_AddItemToObject(res, "id", cJSON_Duplicate(id, 1));
+    cJSON_AddBoolToObject(res, "ok", ok);
+    return res;
+}
+
+static cJSON *error_result(const cJSON *id, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static cJSON *error_result(const cJSON *id, const char *fmt, ...) {
+    char msg[320];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    cJSON *res = new_result(id, 0);
+    cJSON_AddStringToObject(res, "error", msg);
+    return res;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1; // Gone, or stopped reading (SO_SNDTIMEO)
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Render 'res' as one line into the thread's buffer (which grows as needed) and free it.
+static const char *render_result(cJSON *res, print_buf_t *pb, size_t *len) {
+    static const char oom[] = "{\"ok\":false,\"error\":\"out of memory\"}\n";
+    int rendered = 0;
+    while (res != NULL && !rendered) {
+        if (pb->cap == 0 || !(rendered = cJSON_PrintPreallocated(res, pb->data, (int)pb->cap - 1, 0))) {
+            size_t cap = pb->cap > 0 ? pb->cap * 2 : PRINT_BUF_MIN;
+            char *grown = cap <= INT32_MAX ? realloc(pb->data, cap) : NULL;
+            if (grown == NULL) break;
+            pb->data = grown;
+            pb->cap = cap;
+        }
+    }
+    cJSON_Delete(res);
+    if (!rendered) {
+        *len = sizeof(oom) - 1;
+        return oom;
+    }
+    *len = strlen(pb->data);
+    pb->data[(*len)++] = '\n'; // PrintPreallocated was given one byte less for this
+    return pb->data;
+}
+
+// Queue a result for the client and send what is queued, unless another thread is
+// already sending: results that arrive meanwhile go out with its next write.
+static void emit_result(conn_t *c, cJSON *res, print_buf_t *pb) {
+    size_t len;
+    const char *text = render_result(res, pb, &len);
+    pthread_mutex_lock(&c->lock);
+    if (!c->broken && c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap > 0 ? c->out_cap : PRINT_BUF_MIN;
+        while (cap < c->out_len + len) cap *= 2;
+        char *grown = realloc(c->out, cap);
+        if (grown == NULL) {
+            c->broken = 1; // A result would be lost: the client could wait for it forever
+        } else {
+            c->out = grown;
+            c->out_cap = cap;
+        }
+    }
+    if (!c->broken) {
+        memcpy(c->out + c->out_len, text, len);
+        c->out_len += len;
+    }
+    while (!c->flushing && !c->broken && c->out_len > 0) {
+        char *data = c->out;
+        size_t data_len = c->out_len, data_cap = c->out_cap;
+        c->out = c->spare;
+        c->out_cap = c->spare_cap;
+        c->out_len = 0;
+        c->spare = NULL;
+        c->spare_cap = 0;
+        c->flushing = 1;
+        pthread_mutex_unlock(&c->lock);
+        int sent = send_all(c->fd, data, data_len) == 0;
+        pthread_mutex_lock(&c->lock);
+        c->flushing = 0;
+        if (!sent) c->broken = 1;
+        c->spare = data;
+        c->spare_cap = data_cap;
+    }
+    if (c->broken) c->out_len = 0;
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Post a result to the connection's completion ring (without the newline). A consumer
+// that stops taking results gets its ring, and its connection, dropped.
+static void complete_ring(conn_t *c, cJSON *res, uint64_t user_data, print_buf_t *pb) {
+    size_t len;
+    const char *text = render_result(res, pb, &len);
+    int posted = SubmitRing_complete(c->ring, user_data, text, (uint32_t)len - 1, SEND_TIMEOUT_S * 1000) == 0;
+    if (!posted && errno == EMSGSIZE) {
+        text = render_result(error_result(NULL, "%s", "result larger than the completion ring"), pb, &len);
+        posted = SubmitRing_complete(c->ring, user_data, text, (uint32_t)len - 1, SEND_TIMEOUT_S * 1000) == 0;
+    }
+    if (!posted && !atomic_exchange(&c->ring_failed, 1)) {
+        LOG_CTL_WARN("Cannot post to a completion ring (%s), detaching it.", strerror(errno));
+    }
+}
+
+// --- Requests ---
+
+// Write the service to <services_dir>/<name>.json, atomically.
+static int persist_service(const cJSON *service, const char *name, char *path, size_t path_len) {
+    char file[MAX_SERVICE_NAME_LEN];
+    size_t i;
+    for (i = 0; name[i] != '\0' && i < sizeof(file) - 1; i++) {
+        char ch = name[i];
+        int safe = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '-' ||
+                   ch == '_' || (ch == '.' && i > 0);
+        file[i] = safe ? ch : '_';
+    }
+    file[i] = '\0';
+    char tmp[1200];
+    snprintf(path, path_len, "%s/%s.json", services_dir, file);
+    snprintf(tmp, sizeof(tmp), "%s/.%s.XXXXXX", services_dir, file);
+
+    char *text = cJSON_Print(service);
+    if (text == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        cJSON_free(text);
+        return -1;
+    }
+    size_t len = strlen(text);
+    int ok = fchmod(fd, 0644) == 0 && write(fd, text, len) == (ssize_t)len && write(fd, "\n", 1) == 1 &&
+             fsync(fd) == 0;
+    int saved_errno = errno;
+    cJSON_free(text);
+    if (close(fd) != 0 && ok) {
+        ok = 0;
+        saved_errno = errno;
+    }
+    if (!ok || rename(tmp, path) != 0) {
+        if (ok) saved_errno = errno;
+        unlink(tmp);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+static cJSON *register_service(service_config_t *svc, const cJSON *id) {
+    char path[1200];
+    if (persist_service(svc->config_json, svc->name, path, sizeof(path)) != 0) {
+        cJSON *res = error_result(id, "cannot write the service to %s: %s", services_dir, strerror(errno));
+        SvcLoader_release(svc);
+        return res;
+    }
+    pending_service_t *p = malloc(sizeof(*p));
+    if (p == NULL) {
+        SvcLoader_release(svc); // Still loaded from the file at the next reload
+        return error_result(id, "%s", "out of memory");
+    }
+    p->svc = *svc;
+    pthread_mutex_lock(&pending_lock);
+    p->next = pending;
+    pending = p;
+    pthread_mutex_unlock(&pending_lock);
+    LOG_CTL_INFO("Registered service '%s' (%s).", svc->name, path);
+
+    cJSON *res = new_result(id, 1);
+    cJSON_AddStringToObject(res, "op", "register");
+    cJSON_AddStringToObject(res, "name", svc->name);
+    cJSON_AddStringToObject(res, "file", path);
+    return res;
+}
+
+static cJSON *run_once(service_config_t *svc, const cJSON *id) {
+    int condition = evaluate_service_condition(svc->condition_str, svc->name);
+    if (condition < 0) return error_result(id, "cannot evaluate condition '%s'", svc->condition_str);
+    cJSON *res = new_result(id, 1);
+    cJSON_AddStringToObject(res, "op", "run");
+    cJSON_AddStringToObject(res, "name", svc->name);
+    if (condition == 0) {
+        cJSON_AddStringToObject(res, "status", "condition_not_met");
+        return res;
+    }
+
+    // Output goes to a private ring, returned to the client instead of kept by name.
+    output_ring_t *output = OutRing_new(svc->name, svc->output_ring_kb);
+    service_run_stats_t stats;
+    uint64_t started = Metrics_now_ns();
+    ServiceRun_execute(svc, output, &stats);
+    uint64_t run_ns = Metrics_now_ns() - started;
+    Metrics_observe(METRIC_SERVICE_RUN_SECONDS, svc->name, run_ns);
+    TRACE_SPAN("control", "run", svc->name, started);
+    record_activity();
+    LOG_CTL_INFO("Ran submitted service '%s': %d actions, %d failed.", svc->name, stats.actions, stats.failed);
+
+    cJSON_AddStringToObject(res, "status", "done");
+    cJSON_AddNumberToObject(res, "actions", stats.actions);
+    cJSON_AddNumberToObject(res, "failed", stats.failed);
+    cJSON_AddNumberToObject(res, "duration_ms", (double)run_ns / 1e6);
+    if (output != NULL) {
+        size_t max = (size_t)svc->output_ring_kb * 1024;
+        char *text = malloc(max + 1);
+        if (text != NULL) {
+            size_t n = OutRing_tail(output, text, max);
+            text[n] = '\0';
+            cJSON_AddStringToObject(res, "output", text);
+            free(text);
+        }
+        OutRing_free(output);
+    }
+    return res;
+}
+
+// Tail of a scheduled service's output ring, newest last.
+static cJSON *service_output(const cJSON *request, const cJSON *id) {
+    const cJSON *name = cJSON_GetObjectItemCaseSensitive(request, "name");
+    if (!cJSON_IsString(name) || name->valuestring[0] == '\0') {
+        return error_result(id, "%s", "'name' must be a service name");
+    }
+    const cJSON *bytes = cJSON_GetObjectItemCaseSensitive(request, "bytes");
+    size_t max = (size_t)OUTPUT_RING_MAX_KB * 1024;
+    if (bytes != NULL) {
+        if (!cJSON_IsNumber(bytes) || bytes->valuedouble < 0) {
+            return error_result(id, "%s", "'bytes' must be a non-negative number");
+        }
+        if (bytes->valuedouble < (double)max) max = (size_t)bytes->valuedouble;
+    }
+    output_ring_t *ring = OutRing_find(name->valuestring);
+    if (ring == NULL) return error_result(id, "no output kept for service '%s'", name->valuestring);
+    char *text = malloc(max + 1);
+    if (text == NULL) return error_result(id, "%s", "out of memory");
+    size_t n = OutRing_tail(ring, text, max);
+    text[n] = '\0';
+    cJSON *res = new_result(id, 1);
+    cJSON_AddStringToObject(res, "op", "output");
+    cJSON_AddStringToObject(res, "name", name->valuestring);
+    cJSON_AddStringToObject(res, "output", text);
+    free(text);
+    return res;
+}
+
+cJSON *Control_handle_request(cJSON *request) {
+    if (!cJSON_IsObject(request)) return error_result(NULL, "%s", "expected a JSON object");
+    const cJSON *id = cJSON_GetObjectItemCaseSensitive(request, "id");
+    if (id != NULL && !cJSON_IsString(id) && !cJSON_IsNumber(id)) {
+        return error_result(NULL, "%s", "'id' must be a string or a number");
+    }
+    cJSON *op_json = cJSON_GetObjectItemCaseSensitive(request, "op");
+    cJSON *service = cJSON_GetObjectItemCaseSensitive(request, "service");
+    const char *op = "run";
+    int envelope = op_json != NULL || service != NULL;
+    if (cJSON_IsString(op_json) && strcmp(op_json->valuestring, "output") == 0) {
+        return service_output(request, id);
+    }
+    if (envelope) {
+        if (op_json != NULL && (!cJSON_IsString(op_json) || (strcmp(op_json->valuestring, "run") != 0 &&
+                                                             strcmp(op_json->valuestring, "register") != 0 &&
+                                                             strcmp(op_json->valuestring, "validate") != 0))) {
+            if (cJSON_IsString(op_json) && strcmp(op_json->valuestring, "ring") == 0) {
+                return error_result(id, "%s", "'op' \"ring\" is only available on the control socket");
+            }
+            return error_result(id, "%s", "'op' must be \"run\", \"register\", \"validate\" or \"output\"");
+        }
+        if (!cJSON_IsObject(service)) return error_result(id, "%s", "'service' must be a service object");
+        if (op_json != NULL) op = op_json->valuestring;
+        service = cJSON_DetachItemViaPointer(request, service);
+    } else {
+        service = request; // A bare service: stays the caller's
+    }
+
+    const cJSON *name = cJSON_GetObjectItemCaseSensitive(service, "name");
+    const char *name_for_log = cJSON_IsString(name) && name->valuestring[0] != '\0' ? name->valuestring : "(submitted)";
+    service_config_t svc;
+    char err[256];
+    if (SvcLoader_compile(service, name_for_log, &svc, err, sizeof(err)) != 0) {
+        if (envelope) cJSON_Delete(service);
+        return error_result(id, "%s", err);
+    }
+    if (strcmp(op, "register") == 0) return register_service(&svc, id);
+    cJSON *res;
+    if (strcmp(op, "validate") == 0) {
+        res = new_result(id, 1);
+        cJSON_AddStringToObject(res, "op", "validate");
+        cJSON_AddStringToObject(res, "name", svc.name);
+    } else {
+        res = run_once(&svc, id);
+    }
+    if (!envelope) svc.config_json = NULL; // Not ours to free
+    SvcLoader_release(&svc);
+    return res;
+}
+
+int Control_apply_pending(void) {
+    pthread_mutex_lock(&pending_lock);
+    pending_service_t *list = pending;
+    pending = NULL;
+    pthread_mutex_unlock(&pending_lock);
+
+    // Oldest first, so that a later registration of the same name wins.
+    pending_service_t *ordered = NULL;
+    while (list != NULL) {
+        pending_service_t *next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    int added = 0;
+    while (ordered != NULL) {
+        pending_service_t *next = ordered->next;
+        if (SvcLoader_add(&ordered->svc) < 0) {
+            LOG_CTL_ERROR("Service table full, '%s' is not scheduled until the next reload.", ordered->svc.name);
+            SvcLoader_release(&ordered->svc);
+        } else {
+            added++;
+        }
+        free(ordered);
+        ordered = next;
+    }
+    return added;
+}
+
+// --- Workers ---
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    print_buf_t pb = { NULL, 0 };
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_head == NULL && !queue_stop) pthread_cond_wait(&queue_ready, &queue_lock);
+        job_t *job = queue_head;
+        if (job != NULL) {
+            queue_head = job->next;
+            if (queue_head == NULL) queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&queue_lock);
+        if (job == NULL) break; // Stopping, and nothing left
+
+        conn_t *c = job->conn;
+        if (job->via_ring) complete_ring(c, Control_handle_request(job->request), job->user_data, &pb);
+        else emit_result(c, Control_handle_request(job->request), &pb);
+        cJSON_Delete(job->request);
+        free(job);
+        pthread_mutex_lock(&c->lock);
+        c->in_flight--;
+        pthread_cond_signal(&c->done);
+        pthread_mutex_unlock(&c->lock);
+    }
+    free(pb.data);
+    return NULL;
+}
+
+// Hand a request with an "id", or from the ring, to the workers. Blocks while the
+// connection already has CONTROL_MAX_IN_FLIGHT requests out (the client is then not
+// read, which pushes back).
+static int dispatch(conn_t *c, cJSON *request, int via_ring, uint64_t user_data) {
+    job_t *job = malloc(sizeof(*job));
+    if (job == NULL) return -1;
+    job->conn = c;
+    job->request = request;
+    job->via_ring = via_ring;
+    job->user_data = user_data;
+    job->next = NULL;
+    pthread_mutex_lock(&c->lock);
+    while (c->in_flight >= CONTROL_MAX_IN_FLIGHT) pthread_cond_wait(&c->done, &c->lock);
+    c->in_flight++;
+    pthread_mutex_unlock(&c->lock);
+
+    pthread_mutex_lock(&queue_lock);
+    if (queue_tail != NULL) queue_tail->next = job;
+    else queue_head = job;
+    queue_tail = job;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+    return 0;
+}
+
+// --- Connections ---
+
+// The CBOR document at 'start': its end offset, 0 if incomplete, -1 if malformed.
+static long cbor_document(conn_t *c) {
+    long n = Cbor_item_length((const unsigned char *)c->buf + c->start, c->len - c->start);
+    if (n <= 0) {
+        c->scan = c->len;
+        return n;
+    }
+    c->cbor = 0;
+    c->scan = c->start + (size_t)n;
+    return (long)c->scan;
+}
+
+// End offset of the next complete top-level document, 0 if more input is needed, or -1
+// if the input is neither a JSON object or array nor a CBOR map.
+static long next_document(conn_t *c) {
+    if (c->cbor) return cbor_document(c);
+    for (; c->scan < c->len; c->scan++) {
+        char ch = c->buf[c->scan];
+        if (c->depth == 0) {
+            if (ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t') continue;
+            if (Cbor_is_start((unsigned char)ch)) {
+                c->start = c->scan;
+                c->cbor = 1;
+                return cbor_document(c);
+            }
+            if (ch != '{' && ch != '[') return -1;
+            c->start = c->scan;
+            c->depth = 1;
+        } else if (c->in_string) {
+            if (c->escaped) c->escaped = 0;
+            else if (ch == '\\') c->escaped = 1;
+            else if (ch == '"') c->in_string = 0;
+        } else if (ch == '"') {
+            c->in_string = 1;
+        } else if (ch == '{' || ch == '[') {
+            c->depth++;
+        } else if ((ch == '}' || ch == ']') && --c->depth == 0) {
+            return (long)++c->scan;
+        }
+    }
+    return 0;
+}
+
+// Drop the first 'n' bytes of the buffer (a handled document, or whitespace).
+static void consume(conn_t *c, size_t n) {
+    memmove(c->buf, c->buf + n, c->len - n);
+    c->len -= n;
+    c->scan -= n;
+    c->start = 0;
+}
+
+static int peer_allowed(int fd) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return 0;
+    return cred.uid == 0 || cred.uid == geteuid();
+}
+
+cJSON *Control_parse_request(const char *text, size_t len, int cbor, char *err, size_t err_len) {
+    if (!cbor) {
+        cJSON *request = cJSON_ParseWithLength(text, len);
+        if (request == NULL) snprintf(err, err_len, "%s", "invalid JSON");
+        return request;
+    }
+    char reason[128];
+    cJSON *request = Cbor_decode((const unsigned char *)text, len, reason, sizeof(reason));
+    if (request == NULL) snprintf(err, err_len, "invalid CBOR: %s", reason);
+    return request;
+}
+
+// Send 'len' bytes with the descriptors 'fds' attached to the first of them.
+static int send_with_fds(int fd, const char *data, size_t len, const int *fds, int nfds) {
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { (void *)data, len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE((size_t)nfds * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN((size_t)nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, (size_t)nfds * sizeof(int));
+    ssize_t n;
+    while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    if (n <= 0) return -1;
+    return send_all(fd, data + n, len - (size_t)n);
+}
+
+// A queue size from the request (0: the default); SubmitRing_create() rounds it.
+static uint32_t ring_kb(const cJSON *kb) {
+    if (kb == NULL) return 0;
+    return kb->valuedouble >= SUBMIT_RING_MAX_KB ? SUBMIT_RING_MAX_KB : (uint32_t)kb->valuedouble;
+}
+
+// {"op":"ring", "sq_kb":N, "cq_kb":N}: create a submission ring for this connection and
+// send its memfd and eventfds along with the result.
+static void attach_ring(conn_t *c, const cJSON *request, print_buf_t *pb) {
+    const cJSON *id = cJSON_GetObjectItemCaseSensitive(request, "id");
+    if (id != NULL && !cJSON_IsString(id) && !cJSON_IsNumber(id)) id = NULL;
+    const cJSON *sq_kb = cJSON_GetObjectItemCaseSensitive(request, "sq_kb");
+    const cJSON *cq_kb = cJSON_GetObjectItemCaseSensitive(request, "cq_kb");
+    if ((sq_kb != NULL && (!cJSON_IsNumber(sq_kb) || sq_kb->valuedouble < 0)) ||
+        (cq_kb != NULL && (!cJSON_IsNumber(cq_kb) || cq_kb->valuedouble < 0))) {
+        emit_result(c, error_result(id, "%s", "'sq_kb' and 'cq_kb' must be non-negative numbers"), pb);
+        return;
+    }
+    if (c->ring != NULL) {
+        emit_result(c, error_result(id, "%s", "this connection already has a ring"), pb);
+        return;
+    }
+    int fds[3];
+    size_t size;
+    c->ring = SubmitRing_create(ring_kb(sq_kb), ring_kb(cq_kb), fds, &size);
+    if (c->ring == NULL) {
+        emit_result(c, error_result(id, "cannot create a ring: %s", strerror(errno)), pb);
+        return;
+    }
+
+    // The descriptors travel with this result, so nothing else may be sent meanwhile:
+    // once no worker has a request of this connection, no one else is sending.
+    pthread_mutex_lock(&c->lock);
+    while (c->in_flight > 0) pthread_cond_wait(&c->done, &c->lock);
+    int broken = c->broken;
+    pthread_mutex_unlock(&c->lock);
+    cJSON *res = new_result(id, 1);
+    cJSON_AddStringToObject(res, "op", "ring");
+    cJSON_AddNumberToObject(res, "size", (double)size);
+    size_t len;
+    const char *text = render_result(res, pb, &len);
+    if (broken || send_with_fds(c->fd, text, len, fds, 3) != 0) {
+        SubmitRing_destroy(c->ring);
+        c->ring = NULL;
+        pthread_mutex_lock(&c->lock);
+        c->broken = 1;
+        pthread_mutex_unlock(&c->lock);
+        return;
+    }
+    LOG_CTL_INFO("Attached a submission ring of %zu KB.", size / 1024);
+}
+
+// Take up to RING_BATCH submissions from the ring. Each is validated and handed to the
+// workers; its result goes to the completion ring. Returns 1 if more may be waiting, 0
+// if the ring is empty, -1 if it was corrupted.
+static int drain_ring(conn_t *c, print_buf_t *pb) {
+    for (int taken = 0; taken < RING_BATCH; taken++) {
+        uint32_t type;
+        uint64_t user_data;
+        size_t len;
+        int got = SubmitRing_take(c->ring, &type, &user_data, &c->ring_buf, &c->ring_cap, &len);
+        if (got <= 0) return got;
+        cJSON *request = NULL;
+        char err[160];
+        if (type != SUBMIT_RING_JSON && type != SUBMIT_RING_CBOR) {
+            complete_ring(c, error_result(NULL, "unknown record type %u", type), user_data, pb);
+        } else if (len > CONTROL_MAX_REQUEST) {
+            complete_ring(c, error_result(NULL, "request larger than %d bytes", CONTROL_MAX_REQUEST), user_data, pb);
+        } else if ((request = Control_parse_request(c->ring_buf, len, type == SUBMIT_RING_CBOR, err,
+                                                    sizeof(err))) == NULL) {
+            complete_ring(c, error_result(NULL, "%s", err), user_data, pb);
+        } else if (worker_count == 0 || dispatch(c, request, 1, user_data) != 0) {
+            complete_ring(c, Control_handle_request(request), user_data, pb);
+            cJSON_Delete(request);
+        }
+    }
+    return 1;
+}
+
+// A document with an "id" goes to the workers; one without is handled here, so results
+// of requests without ids keep their order.
+static void handle_document(conn_t *c, const char *text, size_t len, print_buf_t *pb) {
+    char err[160];
+    cJSON *request = Control_parse_request(text, len, Cbor_is_start((unsigned char)text[0]), err, sizeof(err));
+    if (request == NULL) {
+        emit_result(c, error_result(NULL, "%s", err), pb);
+        return;
+    }
+    const cJSON *op = cJSON_GetObjectItemCaseSensitive(request, "op");
+    if (cJSON_IsString(op) && strcmp(op->valuestring, "ring") == 0) {
+        attach_ring(c, request, pb);
+        cJSON_Delete(request);
+        return;
+    }
+    if (worker_count > 0 && cJSON_GetObjectItemCaseSensitive(request, "id") != NULL &&
+        dispatch(c, request, 0, 0) == 0) {
+        return;
+    }
+    emit_result(c, Control_handle_request(request), pb);
+    cJSON_Delete(request);
+}
+
+static void *client_main(void *arg) {
+    conn_t *c = arg;
+    print_buf_t pb = { NULL, 0 };
+    struct pollfd fds[3] = { { c->fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 }, { -1, POLLIN, 0 } };
+    for (;;) {
+        long end;
+        while ((end = next_document(c)) > 0) {
+            handle_document(c, c->buf + c->start, (size_t)end - c->start, &pb);
+            consume(c, (size_t)end);
+        }
+        int ring_busy = 0;
+        if (c->ring != NULL) {
+            ring_busy = atomic_load(&c->ring_failed) ? -1 : drain_ring(c, &pb);
+            if (ring_busy < 0) {
+                LOG_CTL_WARN("%s", "Submission ring corrupted or its completions not taken, detaching it.");
+                emit_result(c, error_result(NULL, "%s", "submission ring corrupted or not consumed, detached"), &pb);
+                break;
+            }
+            fds[2].fd = SubmitRing_doorbell(c->ring);
+        }
+        if (end < 0) {
+            char err[160] = "expected a JSON object or a CBOR map";
+            if (c->cbor) { // For the reason
+                cJSON_Delete(Control_parse_request(c->buf + c->start, c->len - c->start, 1, err, sizeof(err)));
+            }
+            emit_result(c, error_result(NULL, "%s", err), &pb);
+            break;
+        }
+        if (c->depth == 0 && !c->cbor) consume(c, c->len); // Only whitespace left
+        else if (c->start > 0) consume(c, c->start);
+        if (c->len >= CONTROL_MAX_REQUEST) {
+            emit_result(c, error_result(NULL, "request larger than %d bytes", CONTROL_MAX_REQUEST), &pb);
+            break;
+        }
+        if (c->len == c->cap) {
+            size_t cap = c->cap > 0 ? c->cap * 2 : 65536;
+            if (cap > CONTROL_MAX_REQUEST) cap = CONTROL_MAX_REQUEST;
+            char *grown = realloc(c->buf, cap);
+            if (grown == NULL) {
+                emit_result(c, error_result(NULL, "%s", "out of memory"), &pb);
+                break;
+            }
+            c->buf = grown;
+            c->cap = cap;
+        }
+        // With a ring the connection is never idle, and the ring is polled too: unless it
+        // has more, or a submission slipped in while the doorbell was being armed.
+        int timeout = c->ring == NULL ? CONTROL_IDLE_TIMEOUT_MS : -1;
+        if (ring_busy || (c->ring != NULL && SubmitRing_sleep(c->ring))) timeout = 0;
+        int ready = poll(fds, 3, timeout);
+        if (c->ring != NULL && timeout != 0) SubmitRing_wake(c->ring);
+        if (ready < 0 && errno == EINTR) continue;
+        if ((ready == 0 && timeout != 0) || ready < 0 || (fds[1].revents & POLLIN)) break; // Idle, or stopping
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) continue; // Only the ring
+        ssize_t n = recv(c->fd, c->buf + c->len, c->cap - c->len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0 && (c->depth > 0 || c->cbor)) {
+                emit_result(c, error_result(NULL, "%s", c->cbor ? "incomplete CBOR document" : "incomplete JSON document"), &pb);
+            }
+            break;
+        }
+        c->len += (size_t)n;
+    }
+
+    // Every result is sent before the connection closes.
+    pthread_mutex_lock(&c->lock);
+    while (c->in_flight > 0) pthread_cond_wait(&c->done, &c->lock);
+    pthread_mutex_unlock(&c->lock);
+    free(pb.data);
+    SubmitRing_destroy(c->ring);
+    free(c->ring_buf);
+    free(c->buf);
+    free(c->out);
+    free(c->spare);
+    close(c->fd);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->done);
+    free(c);
+    atomic_fetch_sub(&active_clients, 1);
+    return NULL;
+}
+
+// Reply to a connection that is not served, and close it.
+static void refuse(int fd, const char *reason) {
+    char line[160];
+    int n = snprintf(line, sizeof(line), "{\"ok\":false,\"error\":\"%s\"}\n", reason);
+    send_all(fd, line, (size_t)n);
+    close(fd);
+}
+
+static void *server_main(void *arg) {
+    (void)arg;
+    struct pollfd fds[2] = { { wake_fd, POLLIN, 0 }, { listen_fd, POLLIN, 0 } };
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            LOG_CTL_ERROR("poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) break; // Stop requested
+        if (!(fds[1].revents & POLLIN)) continue;
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        struct timeval tv = { SEND_TIMEOUT_S, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (!peer_allowed(fd)) {
+            refuse(fd, "permission denied");
+            continue;
+        }
+        // Each connection gets a reader thread, which also runs the requests without an id.
+        if (atomic_fetch_add(&active_clients, 1) >= CONTROL_MAX_CLIENTS) {
+            atomic_fetch_sub(&active_clients, 1);
+            refuse(fd, "busy: too many connections");
+            continue;
+        }
+        conn_t *c = calloc(1, sizeof(*c));
+        pthread_t tid;
+        if (c != NULL) {
+            c->fd = fd;
+            pthread_mutex_init(&c->lock, NULL);
+            pthread_cond_init(&c->done, NULL);
+        }
+        if (c == NULL || pthread_create(&tid, &attr, client_main, c) != 0) {
+            atomic_fetch_sub(&active_clients, 1);
+            if (c != NULL) {
+                pthread_mutex_destroy(&c->lock);
+                pthread_cond_destroy(&c->done);
+                free(c);
+            }
+            refuse(fd, "cannot serve the connection");
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return NULL;
+}
+
+int Control_start(const char *path, const char *dir_path) {
+    if (server_running) return 0;
+    if (path == NULL) path = getenv("WR_CONTROL_SOCKET");
+    if (path == NULL || path[0] == '\0') path = CONTROL_DEFAULT_SOCKET;
+    if (strlen(path) >= sizeof(socket_path)) {
+        LOG_CTL_ERROR("Socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(socket_path, path);
+    snprintf(services_dir, sizeof(services_dir), "%s", dir_path != NULL ? dir_path : DEFAULT_SERVICE_DIR);
+
+    // Create the parent directory (one level, e.g. /run/whiterails) if it is missing.
+    char dir[sizeof(socket_path)];
+    strcpy(dir, socket_path);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL && slash != dir) {
+        *slash = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            LOG_CTL_ERROR("Cannot create %s: %s", dir, strerror(errno));
+            return -1;
+        }
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOG_CTL_ERROR("socket failed: %s", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path); // Stale socket from a previous run
+    mode_t old_umask = umask(0077); // No window in which others could connect
+    int bound = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_umask);
+    if (bound != 0 || listen(listen_fd, 64) != 0) {
+        LOG_CTL_ERROR("Cannot listen on %s: %s", socket_path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    chmod(socket_path, 0600);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0 || pthread_create(&server_thread, NULL, server_main, NULL) != 0) {
+        LOG_CTL_ERROR("%s", "Cannot start the control thread.");
+        if (wake_fd >= 0) close(wake_fd);
+        close(listen_fd);
+        wake_fd = listen_fd = -1;
+        unlink(socket_path);
+        return -1;
+    }
+    queue_stop = 0;
+    for (worker_count = 0; worker_count < CONTROL_WORKERS; worker_count++) {
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0) break;
+    }
+    if (worker_count == 0) LOG_CTL_WARN("%s", "No worker threads: requests with an id run one at a time.");
+    server_running = 1;
+    LOG_CTL_INFO("Accepting submissions on %s", socket_path);
+    return 0;
+}
+
+void Control_stop(void) {
+    if (!server_running) return;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) { /* Thread is awake anyway */ }
+    pthread_join(server_thread, NULL);
+    server_running = 0;
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+
+    // Idle connections leave at once; one running actions finishes them first.
+    for (int waited = 0; atomic_load(&active_clients) > 0 && waited < STOP_WAIT_MS; waited += 10) {
+        usleep(10 * 1000);
+    }
+    if (atomic_load(&active_clients) > 0) {
+        // Their threads (and the workers running their requests) are left to the exit.
+        LOG_CTL_WARN("%d control connections still running at shutdown.", atomic_load(&active_clients));
+    } else {
+        close(wake_fd); // Still polled by the remaining connections otherwise
+        wake_fd = -1;
+        pthread_mutex_lock(&queue_lock);
+        queue_stop = 1;
+        pthread_cond_broadcast(&queue_ready);
+        pthread_mutex_unlock(&queue_lock);
+        for (int i = 0; i < worker_count; i++) pthread_join(workers[i], NULL);
+        worker_count = 0;
+    }
+
+    pthread_mutex_lock(&pending_lock);
+    while (pending != NULL) {
+        pending_service_t *next = pending->next;
+        SvcLoader_release(&pending->svc);
+        free(pending);
+        pending = next;
+    }
+    pthread_mutex_unlock(&pending_lock);
+}
@@ -0,0 +1,62 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "cJSON.h" // Found via CFLAGS -I deps/cJSON
+
+#define CONTROL_DEFAULT_SOCKET "/run/whiterails/control.sock"
+#define CONTROL_MAX_CLIENTS 16              // Connections served at once; more are refused
+#define CONTROL_MAX_REQUEST (1024 * 1024)   // Larger documents close the connection
+#define CONTROL_IDLE_TIMEOUT_MS 30000       // A connection that sends nothing for this long is closed
+#define CONTROL_WORKERS 8                   // Threads running pipelined requests, for all connections
+#define CONTROL_MAX_IN_FLIGHT 1024          // Pipelined requests per connection before reading pauses
+
+// Control socket: submits semantic JSON (what api_bridge.py produces) to the running
+// daemon instead of dropping a file into the services directory. A client connects to
+// a Unix stream socket ($WR_CONTROL_SOCKET or CONTROL_DEFAULT_SOCKET) and sends JSON
+// documents (pretty-printed or NDJSON, back to back) or their CBOR form (cbor.h), in any
+// mix; each gets one result line of JSON.
+// A document is either a bare service object, which is run once right away, or
+//   {"id": ..., "op": "run" | "register" | "validate", "service": {...}}
+// "register" validates the service, writes it to the services directory (so it survives
+// reloads and restarts) and hands it to the scheduler, which adds or replaces it by name
+// at its next tick. "validate" only checks and compiles it. Results:
+//   {"id":...,"ok":true,"op":"run","name":...,"status":"done","actions":N,"failed":N,
+//    "duration_ms":...,"output":"..."}  (or "status":"condition_not_met")
+//   {"id":...,"ok":true,"op":"register","name":...,"file":...}
+//   {"id":...,"ok":false,"error":"..."}
+// {"op":"output","name":...,"bytes":N} returns the last N bytes (default and at most
+// OUTPUT_RING_MAX_KB) kept in a scheduled service's output ring:
+//   {"id":...,"ok":true,"op":"output","name":...,"output":"..."}
+// A one-shot evaluates the service's condition once, runs its actions and returns the
+// tail of their output (up to its output_ring_kb).
+//
+// Pipelining: a document with an "id" (a string or a number, also allowed on a bare
+// service) is handed to a pool of CONTROL_WORKERS threads and the connection goes on
+// reading, so many requests can be in flight; their results carry the id and arrive in
+// completion order. Documents without an id are handled one after another on the
+// connection's own thread, so their results keep the order of the requests.
+// Results that complete while one is being sent are coalesced into the next write.
+// {"op":"ring"} instead attaches a shared-memory submission ring to the connection, for
+// producers that submit continuously (see submit_ring.h).
+// The socket is mode 0600 and only the daemon's user and root may connect.
+
+// Bind the socket ('socket_path' NULL: $WR_CONTROL_SOCKET or CONTROL_DEFAULT_SOCKET) and
+// start accepting; registered services are written to 'services_dir'. Returns 0 or -1.
+int Control_start(const char *socket_path, const char *services_dir);
+
+// Stop accepting, wait briefly for running requests and remove the socket.
+void Control_stop(void);
+
+// Parse a document in JSON, or in CBOR if 'cbor' is set. Returns NULL with the reason in
+// 'err'.
+cJSON *Control_parse_request(const char *text, size_t len, int cbor, char *err, size_t err_len);
+
+// Handle one parsed document as described above and return its result object (never
+// NULL unless out of memory). May take the service out of 'request'. Thread-safe.
+cJSON *Control_handle_request(cJSON *request);
+
+// Add the services registered since the last call to the scheduler's table. Scheduler
+// thread only. Returns how many were added.
+int Control_apply_pending(void);
+
+#endif // CONTROL_H
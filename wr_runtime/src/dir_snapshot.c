@@ -0,0 +1,424 @@
+#define _GNU_SOURCE // For O_DIRECTORY, IN_* flags
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "dir_snapshot.h"
+#include "logger.h"
+
+#define LOG_SNAP_ERROR(fmt, ...) WR_LOG_ERROR("dir_snapshot", fmt, ##__VA_ARGS__)
+#define LOG_SNAP_DEBUG(fmt, ...) WR_LOG_DEBUG("dir_snapshot", fmt, ##__VA_ARGS__)
+
+#define SNAP_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | \
+                         IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+#define SNAP_EVENT_BUF_SIZE 16384
+
+// One snapshot per directory inode: inotify watches inodes, so "/srv", "/srv/" and a
+// symlink to it share one snapshot (and its one watch descriptor).
+typedef struct {
+    char *path;          // Spelling it was first listed under
+    dev_t dev;
+    ino_t ino;
+    int in_use;
+    int wd;              // inotify watch descriptor, -1 when not watched
+    int dirfd;           // Directory handle used to re-stat changed names
+    int needs_rescan;    // Listing must be rebuilt from scratch (first use, overflow, dir moved)
+    fs_listing_t current;
+    char **dirty;        // Names inotify reported since the last refresh
+    size_t dirty_len;
+    size_t dirty_cap;
+    unsigned long last_used;
+} dir_snapshot_t;
+
+// Listing reported by the last DirSnap_diff() of one action for one path.
+typedef struct {
+    char *key;           // "<service>#<action index>:<path>", NULL when free
+    fs_listing_t listing;
+    unsigned long last_used;
+} diff_baseline_t;
+
+static dir_snapshot_t snapshots[MAX_DIR_SNAPSHOTS];
+static diff_baseline_t baselines[MAX_DIR_BASELINES];
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+static int inotify_fd = -1;
+static int inotify_unavailable = 0;
+static unsigned long use_clock = 0;
+
+static int listing_copy(fs_listing_t *dst, const fs_listing_t *src) {
+    memset(dst, 0, sizeof(*dst));
+    if (src->count == 0) return 0;
+    dst->entries = malloc(src->count * sizeof(*dst->entries));
+    dst->arena = malloc(src->arena_len);
+    if (!dst->entries || !dst->arena) {
+        FsList_free(dst);
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(dst->entries, src->entries, src->count * sizeof(*dst->entries));
+    memcpy(dst->arena, src->arena, src->arena_len);
+    dst->count = dst->capacity = src->count;
+    dst->arena_len = dst->arena_cap = src->arena_len;
+    return 0;
+}
+
+static void clear_dirty(dir_snapshot_t *snap) {
+    for (size_t i = 0; i < snap->dirty_len; i++) free(snap->dirty[i]);
+    snap->dirty_len = 0;
+}
+
+static int wd_shared(const dir_snapshot_t *snap);
+
+static void release_snapshot(dir_snapshot_t *snap) {
+    if (snap->wd >= 0 && inotify_fd >= 0 && !wd_shared(snap)) inotify_rm_watch(inotify_fd, snap->wd);
+    if (snap->dirfd >= 0) close(snap->dirfd);
+    clear_dirty(snap);
+    free(snap->dirty);
+    free(snap->path);
+    FsList_free(&snap->current);
+    memset(snap, 0, sizeof(*snap));
+    snap->wd = -1;
+    snap->dirfd = -1;
+}
+
+static void mark_dirty(dir_snapshot_t *snap, const char *name) {
+    if (snap->needs_rescan) return; // A rescan will pick the change up anyway
+    if (snap->dirty_len == snap->dirty_cap) {
+        size_t cap = snap->dirty_cap ? snap->dirty_cap * 2 : 16;
+        char **dirty = realloc(snap->dirty, cap * sizeof(*dirty));
+        if (!dirty) {
+            snap->needs_rescan = 1;
+            return;
+        }
+        snap->dirty = dirty;
+        snap->dirty_cap = cap;
+    }
+    char *copy = strdup(name);
+    if (!copy) {
+        snap->needs_rescan = 1;
+        return;
+    }
+    snap->dirty[snap->dirty_len++] = copy;
+}
+
+// Another snapshot uses the same watch (the directory was replaced under one of them).
+static int wd_shared(const dir_snapshot_t *snap) {
+    for (int i = 0; i < MAX_DIR_SNAPSHOTS; i++) {
+        if (&snapshots[i] != snap && snapshots[i].in_use && snapshots[i].wd == snap->wd) return 1;
+    }
+    return 0;
+}
+
+// Apply all pending inotify events to the snapshot table. Never blocks.
+static void drain_events(void) {
+    if (inotify_fd < 0) return;
+    char buf[SNAP_EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0) break; // EAGAIN: queue empty
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                for (int i = 0; i < MAX_DIR_SNAPSHOTS; i++) {
+                    if (snapshots[i].in_use) snapshots[i].needs_rescan = 1;
+                }
+                continue;
+            }
+            for (int i = 0; i < MAX_DIR_SNAPSHOTS; i++) {
+                dir_snapshot_t *snap = &snapshots[i];
+                if (!snap->in_use || snap->wd != ev->wd) continue;
+                if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    if (ev->mask & IN_IGNORED) snap->wd = -1; // Kernel already dropped the watch
+                    snap->needs_rescan = 1;
+                } else if (ev->len > 0) {
+                    mark_dirty(snap, ev->name);
+                }
+            }
+        }
+    }
+}
+
+static int init_inotify(void) {
+    if (inotify_fd >= 0) return 0;
+    if (inotify_unavailable) return -1;
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        LOG_SNAP_ERROR("inotify_init1 failed, listings will not be cached: %s", strerror(errno));
+        inotify_unavailable = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static dir_snapshot_t *acquire_snapshot(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return NULL;
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        return NULL;
+    }
+    dir_snapshot_t *victim = NULL;
+    for (int i = 0; i < MAX_DIR_SNAPSHOTS; i++) {
+        dir_snapshot_t *snap = &snapshots[i];
+        if (snap->in_use && snap->dev == st.st_dev && snap->ino == st.st_ino) {
+            if (strcmp(snap->path, path) != 0) { // Rescan through the spelling just checked
+                char *copy = strdup(path);
+                if (!copy) return NULL;
+                free(snap->path);
+                snap->path = copy;
+            }
+            snap->last_used = ++use_clock;
+            return snap;
+        }
+        if (!snap->in_use) {
+            if (!victim || victim->in_use) victim = snap;
+        } else if (!victim || (victim->in_use && snap->last_used < victim->last_used)) {
+            victim = snap;
+        }
+    }
+    if (victim->in_use) {
+        LOG_SNAP_DEBUG("Evicting snapshot of '%s'", victim->path);
+        release_snapshot(victim);
+    }
+    victim->wd = -1;
+    victim->dirfd = -1;
+    victim->path = strdup(path);
+    if (!victim->path) return NULL;
+    victim->dev = st.st_dev;
+    victim->ino = st.st_ino;
+    victim->in_use = 1;
+    victim->needs_rescan = 1;
+    victim->last_used = ++use_clock;
+    return victim;
+}
+
+static int rescan(dir_snapshot_t *snap) {
+    // Watch first so changes made while we read the directory are not lost.
+    if (snap->wd < 0) {
+        snap->wd = inotify_add_watch(inotify_fd, snap->path, SNAP_WATCH_MASK);
+        if (snap->wd < 0) return -1;
+    }
+    if (snap->dirfd >= 0) close(snap->dirfd);
+    snap->dirfd = open(snap->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (snap->dirfd < 0) return -1;
+    struct stat st;
+    if (fstat(snap->dirfd, &st) != 0) return -1;
+    if (st.st_dev != snap->dev || st.st_ino != snap->ino) { // 'path' now names another directory
+        errno = ESTALE;
+        return -1;
+    }
+
+    fs_list_opts_t opts;
+    FsList_default_opts(&opts);
+    fs_listing_t fresh;
+    if (FsList_list(snap->path, &opts, &fresh) != 0) return -1;
+    FsList_free(&snap->current);
+    snap->current = fresh;
+    clear_dirty(snap);
+    snap->needs_rescan = 0;
+    return 0;
+}
+
+static int cmp_name_ptr(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Rebuild the listing keeping untouched entries and re-stating only the dirty names.
+static int apply_dirty(dir_snapshot_t *snap) {
+    qsort(snap->dirty, snap->dirty_len, sizeof(char *), cmp_name_ptr);
+    size_t unique = 0;
+    for (size_t i = 0; i < snap->dirty_len; i++) {
+        if (unique > 0 && strcmp(snap->dirty[unique - 1], snap->dirty[i]) == 0) {
+            free(snap->dirty[i]);
+            continue;
+        }
+        snap->dirty[unique++] = snap->dirty[i];
+    }
+    snap->dirty_len = unique;
+
+    fs_listing_t next;
+    memset(&next, 0, sizeof(next));
+    for (size_t i = 0; i < snap->current.count; i++) {
+        const fs_entry_t *e = &snap->current.entries[i];
+        const char *name = FsList_entry_path(&snap->current, e);
+        if (bsearch(&name, snap->dirty, snap->dirty_len, sizeof(char *), cmp_name_ptr)) continue;
+        if (FsList_append(&next, name, e) != 0) goto fail;
+    }
+    for (size_t i = 0; i < snap->dirty_len; i++) {
+        fs_entry_t e;
+        memset(&e, 0, sizeof(e));
+        if (FsList_stat_entry(snap->dirfd, snap->dirty[i], &e) != 0) {
+            if (errno == ENOENT) continue; // Removed (or renamed away)
+            goto fail;
+        }
+        if (FsList_append(&next, snap->dirty[i], &e) != 0) goto fail;
+    }
+    FsList_sort(&next);
+    LOG_SNAP_DEBUG("Refreshed '%s': re-stat %zu of %zu entries", snap->path, snap->dirty_len, next.count);
+    FsList_free(&snap->current);
+    snap->current = next;
+    clear_dirty(snap);
+    return 0;
+
+fail:
+    FsList_free(&next);
+    snap->needs_rescan = 1;
+    return -1;
+}
+
+// Bring the snapshot of 'path' up to date. Caller holds snap_lock.
+static dir_snapshot_t *refresh(const char *path) {
+    if (init_inotify() != 0) return NULL;
+    drain_events();
+    dir_snapshot_t *snap = acquire_snapshot(path);
+    if (!snap) return NULL;
+    if (!snap->needs_rescan && snap->dirty_len > 0) {
+        apply_dirty(snap); // On failure it flags a rescan below
+    }
+    if (snap->needs_rescan && rescan(snap) != 0) {
+        int saved = errno;
+        release_snapshot(snap);
+        errno = saved;
+        return NULL;
+    }
+    return snap;
+}
+
+// Copy of the snapshot of 'path', or a fresh listing when it cannot be kept. Caller
+// holds snap_lock.
+static int current_listing(const char *path, fs_listing_t *out) {
+    dir_snapshot_t *snap = refresh(path);
+    if (snap) return listing_copy(out, &snap->current);
+    if (!inotify_unavailable) LOG_SNAP_DEBUG("Cannot watch '%s', listing it uncached: %s", path, strerror(errno));
+    fs_list_opts_t opts;
+    FsList_default_opts(&opts);
+    return FsList_list(path, &opts, out);
+}
+
+int DirSnap_list(const char *path, fs_listing_t *out) {
+    pthread_mutex_lock(&snap_lock);
+    int rc = current_listing(path, out);
+    pthread_mutex_unlock(&snap_lock);
+    return rc;
+}
+
+static diff_baseline_t *acquire_baseline(const char *key) {
+    diff_baseline_t *victim = &baselines[0];
+    for (int i = 0; i < MAX_DIR_BASELINES; i++) {
+        diff_baseline_t *b = &baselines[i];
+        if (b->key && strcmp(b->key, key) == 0) {
+            b->last_used = ++use_clock;
+            return b;
+        }
+        if (victim->key && (!b->key || b->last_used < victim->last_used)) victim = b;
+    }
+    char *copy = strdup(key);
+    if (!copy) return NULL;
+    free(victim->key);
+    FsList_free(&victim->listing);
+    victim->key = copy;
+    victim->last_used = ++use_clock;
+    return victim;
+}
+
+static int entry_changed(const fs_entry_t *a, const fs_entry_t *b) {
+    return a->type != b->type || a->mode != b->mode || a->size != b->size || a->mtime_sec != b->mtime_sec;
+}
+
+int DirSnap_diff(const char *service, int action_idx, const char *path, fs_listing_t *added, fs_listing_t *removed,
+                 fs_listing_t *modified) {
+    memset(added, 0, sizeof(*added));
+    memset(removed, 0, sizeof(*removed));
+    memset(modified, 0, sizeof(*modified));
+
+    size_t key_len = strlen(service) + strlen(path) + 16;
+    char *key = malloc(key_len);
+    if (!key) {
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(key, key_len, "%s#%d:%s", service, action_idx, path);
+
+    pthread_mutex_lock(&snap_lock);
+    fs_listing_t current;
+    if (current_listing(path, &current) != 0) {
+        int saved = errno;
+        pthread_mutex_unlock(&snap_lock);
+        free(key);
+        errno = saved;
+        return -1;
+    }
+    diff_baseline_t *baseline = acquire_baseline(key);
+    free(key);
+    if (!baseline) {
+        pthread_mutex_unlock(&snap_lock);
+        FsList_free(&current);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Both listings are sorted by name: one merge pass classifies every entry.
+    const fs_listing_t *old = &baseline->listing;
+    const fs_listing_t *cur = &current;
+    size_t i = 0, j = 0;
+    int rc = 0;
+    while (rc == 0 && (i < old->count || j < cur->count)) {
+        int cmp;
+        if (i == old->count) cmp = 1;
+        else if (j == cur->count) cmp = -1;
+        else cmp = strcmp(FsList_entry_path(old, &old->entries[i]), FsList_entry_path(cur, &cur->entries[j]));
+
+        if (cmp < 0) {
+            rc = FsList_append(removed, FsList_entry_path(old, &old->entries[i]), &old->entries[i]);
+            i++;
+        } else if (cmp > 0) {
+            rc = FsList_append(added, FsList_entry_path(cur, &cur->entries[j]), &cur->entries[j]);
+            j++;
+        } else {
+            if (entry_changed(&old->entries[i], &cur->entries[j])) {
+                rc = FsList_append(modified, FsList_entry_path(cur, &cur->entries[j]), &cur->entries[j]);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    if (rc == 0) {
+        FsList_free(&baseline->listing);
+        baseline->listing = current; // Becomes the next call's baseline
+    } else {
+        FsList_free(&current);
+    }
+    pthread_mutex_unlock(&snap_lock);
+
+    if (rc != 0) {
+        FsList_free(added);
+        FsList_free(removed);
+        FsList_free(modified);
+        errno = ENOMEM;
+    }
+    return rc;
+}
+
+void DirSnap_shutdown(void) {
+    pthread_mutex_lock(&snap_lock);
+    for (int i = 0; i < MAX_DIR_SNAPSHOTS; i++) {
+        if (snapshots[i].in_use) release_snapshot(&snapshots[i]);
+    }
+    for (int i = 0; i < MAX_DIR_BASELINES; i++) {
+        free(baselines[i].key);
+        FsList_free(&baselines[i].listing);
+        memset(&baselines[i], 0, sizeof(baselines[i]));
+    }
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    pthread_mutex_unlock(&snap_lock);
+}
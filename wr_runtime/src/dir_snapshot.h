@@ -0,0 +1,28 @@
+#ifndef DIR_SNAPSHOT_H
+#define DIR_SNAPSHOT_H
+
+#include "fs_list.h"
+
+#define MAX_DIR_SNAPSHOTS 32 // Watched directories kept in memory; least recently used is evicted
+#define MAX_DIR_BASELINES 64 // Listings kept for DirSnap_diff(); least recently used is evicted
+
+// In-memory snapshots of (non-recursive) directory listings, kept fresh with inotify.
+// The first listing of a path reads the whole directory; later listings only re-stat
+// the names inotify reported as changed. Snapshots are per directory inode, so every
+// spelling of a directory (trailing slash, symlinks) shares one. Falls back to a full listing per call when a
+// directory cannot be watched (no inotify, watch limit reached, unsupported filesystem).
+
+// Copy the current listing of 'path' into 'out' (unfiltered, with stat data, sorted).
+// Returns 0 on success, -1 with errno on failure.
+int DirSnap_list(const char *path, fs_listing_t *out);
+
+// Compare the current listing of 'path' with the one seen by the previous DirSnap_diff()
+// call from the same action (service name and action index) for the same path, filling
+// the three listings. The first call reports everything as added.
+int DirSnap_diff(const char *service, int action_idx, const char *path, fs_listing_t *added, fs_listing_t *removed,
+                 fs_listing_t *modified);
+
+// Drop all snapshots and close the inotify instance.
+void DirSnap_shutdown(void);
+
+#endif // DIR_SNAPSHOT_H
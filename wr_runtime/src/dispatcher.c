@@ -1,6 +1,13 @@
-#include <stdio.h>  // For printf/fprintf (temporary, will be syslog)
+#include <stdio.h>  // For fwrite
 #include <string.h> // For strcmp
 #include "dispatcher.h" // Includes cJSON.h and action function declarations
+#include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define LOG_DISPATCH_INFO(fmt, ...) WR_LOG_INFO("dispatch", fmt, ##__VA_ARGS__)
+#define LOG_DISPATCH_DEBUG(fmt, ...) WR_LOG_DEBUG("dispatch", fmt, ##__VA_ARGS__)
+#define LOG_DISPATCH_ERROR(fmt, ...) WR_LOG_ERROR("dispatch", fmt, ##__VA_ARGS__)
 
 // Action table mapping action names to function pointers
 static const struct {
@@ -12,34 +19,66 @@ static const struct {
     {"run_command",   app_action_run_command},
     {"notify",        app_action_notify},
     {"shell",         app_action_shell},
+    {"copy",          app_action_copy},
+    {"move",          app_action_move},
+    {"write_file",    app_action_write_file},
+    {"append_file",   app_action_append_file},
     // Future actions can be added here
     {NULL, NULL} // Sentinel to mark the end of the table
 };
 
 // Dispatch an action based on its type
-void dispatch_action(const char *type, const cJSON *params) {
+void action_emit_output(action_ctx_t *ctx, const char *data, size_t len) {
+    if (ctx != NULL && ctx->output != NULL) {
+        OutRing_write(ctx->output, data, len);
+    } else {
+        fwrite(data, 1, len, stdout);
+    }
+}
+
+void dispatch_action(const char *type, const cJSON *params, action_ctx_t *ctx) {
     if (type == NULL) {
-        fprintf(stderr, "dispatch_action: Error - action type is NULL.\n");
-        // Later: syslog(LOG_ERR, "dispatch_action: Error - action type is NULL.");
+        LOG_DISPATCH_ERROR("%s", "Action type is NULL.");
         return;
     }
 
     for (int i = 0; action_table[i].name != NULL; i++) {
         if (strcmp(type, action_table[i].name) == 0) {
             if (action_table[i].fn != NULL) {
-                // Log intent to run action (temporarily to stdout)
-                printf("Dispatching action '%s'\n", type); 
-                // Later: syslog(LOG_INFO, "Dispatching action '%s'", type);
-                action_table[i].fn(params); // Call the action function
+                // Log intent to run action; on_change actions stay quiet unless their result changed.
+                if (ctx == NULL || ctx->change == NULL) LOG_DISPATCH_DEBUG("Dispatching action '%s'", type); // Actions log their own work
+                action_ctx_t fallback_ctx = { .service_name = "(none)", .action_idx = -1, .exit_status = -1,
+                                              .stdin_fd = -1, .stdout_fd = -1 };
+                if (ctx == NULL) {
+                    ctx = &fallback_ctx; // One-off dispatch without a service
+                }
+                ctx->exit_status = -1;
+                ctx->unchanged = 0;
+                uint64_t started = Metrics_now_ns();
+                Metrics_add(METRIC_ACTIONS_IN_FLIGHT, NULL, 1);
+                if (ctx->change == NULL) {
+                    action_table[i].fn(params, ctx); // Call the action function
+                } else {
+                    // on_change: stage the output and let it through only if the result changed.
+                    output_ring_t *dest = ctx->output;
+                    output_ring_t *staging = ChangeFilter_begin(ctx->change);
+                    if (staging != NULL) ctx->output = staging;
+                    action_table[i].fn(params, ctx);
+                    ctx->output = dest;
+                    ctx->unchanged = !ChangeFilter_commit(ctx->change, dest, ctx->exit_status);
+                    if (!ctx->unchanged) LOG_DISPATCH_INFO("Action '%s': result changed", type);
+                }
+                Metrics_add(METRIC_ACTIONS_IN_FLIGHT, NULL, -1);
+                Metrics_observe(METRIC_ACTION_SECONDS, action_table[i].name, Metrics_now_ns() - started);
+                TRACE_SPAN("action", action_table[i].name, ctx->service_name, started);
+                if (ctx->exit_status > 0) Metrics_add(METRIC_ACTION_FAILURES, action_table[i].name, 1);
                 return;
             } else {
-                fprintf(stderr, "dispatch_action: Error - action '%s' has a NULL function pointer.\n", type);
-                // Later: syslog(LOG_ERR, "dispatch_action: Error - action '%s' has a NULL function pointer.", type);
+                LOG_DISPATCH_ERROR("Action '%s' has a NULL function pointer.", type);
                 return;
             }
         }
     }
 
-    fprintf(stderr, "dispatch_action: Error - Unknown action type '%s'.\n", type);
-    // Later: syslog(LOG_ERR, "dispatch_action: Error - Unknown action type '%s'.", type);
+    LOG_DISPATCH_ERROR("Unknown action type '%s'.", type);
 }
@@ -2,11 +2,25 @@
 #define DISPATCHER_H
 
 #include "cJSON.h" // For cJSON type - found via CFLAGS -I deps/cJSON
+#include "output_ring.h" // For output_ring_t in action_ctx_t
+#include "change_filter.h" // For change_filter_t in action_ctx_t
 
 // Forward declaration if cJSON is used as pointer, otherwise full include
 // struct cJSON; // Or use #include "deps/cJSON/cJSON.h" if cJSON objects are passed by value or members accessed
 
-typedef void (action_fn)(const cJSON *action_params);
+// Per-invocation context handed to every action.
+typedef struct {
+    const char *service_name;  // Owning service, for logs and per-service state
+    int action_idx;            // Position in the service's "actions", -1 if none
+    output_ring_t *output;     // Capture ring for the service's output; NULL writes to the daemon's stdout
+    int exit_status;           // waitpid() status of the last command an action ran, -1 if none
+    int stdin_fd;              // Read end of the pipe from the 'pipe_from' action, -1 if none
+    int stdout_fd;             // Write end of the pipe to the action piped from this one, -1 if none
+    change_filter_t *change;   // "on_change" state of the action, NULL if it always reports
+    int unchanged;             // Set by dispatch_action(): the on_change result did not change
+} action_ctx_t;
+
+typedef void (action_fn)(const cJSON *action_params, action_ctx_t *ctx);
 
 // Declare action functions
 action_fn app_action_list_files;
@@ -14,8 +28,15 @@ action_fn app_action_mkdir;
 action_fn app_action_run_command;
 action_fn app_action_notify;
 action_fn app_action_shell;
+action_fn app_action_copy;
+action_fn app_action_move;
+action_fn app_action_write_file;
+action_fn app_action_append_file;
 
 // Declare the dispatcher function itself
-void dispatch_action(const char *type, const cJSON *params);
+void dispatch_action(const char *type, const cJSON *params, action_ctx_t *ctx);
+
+// Write action-generated output to the context's ring (or stdout when there is none).
+void action_emit_output(action_ctx_t *ctx, const char *data, size_t len);
 
 #endif // DISPATCHER_H
@@ -0,0 +1,341 @@
+#define _GNU_SOURCE // For copy_file_range, O_CLOEXEC, O_DIRECTORY
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>        // For basename/dirname on copies of the path
+#include <sys/ioctl.h>     // For FICLONE
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "fs_files.h"
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int) // From <linux/fs.h>, which clashes with <sys/mount.h> on some libcs
+#endif
+
+#define COPY_CHUNK_MAX (1L << 30)   // copy_file_range/sendfile are asked for at most 1 GiB per call
+#define RW_BUF_SIZE 65536
+#define STREAM_CHUNK (1 << 20)      // Bytes asked of one splice() from a pipe
+#define TMP_NAME_MAX 4096
+
+const char *FsFile_copy_method_name(fs_copy_method_t method) {
+    switch (method) {
+        case FS_COPY_REFLINK:    return "reflink";
+        case FS_COPY_FILE_RANGE: return "copy_file_range";
+        case FS_COPY_SENDFILE:   return "sendfile";
+        default:                 return "read/write";
+    }
+}
+
+// Open the directory that will contain 'path' (for fsync after rename).
+static int open_parent_dir(const char *path) {
+    char *copy = strdup(path);
+    if (!copy) return -1;
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int saved = errno;
+    free(copy);
+    errno = saved;
+    return fd;
+}
+
+// Create a unique temporary file in the same directory as 'path' (so rename() stays atomic).
+static int create_temp_beside(const char *path, char *tmp_path, size_t tmp_size, mode_t mode) {
+    char *copy = strdup(path);
+    if (!copy) return -1;
+    char *dir_copy = strdup(path);
+    if (!dir_copy) {
+        free(copy);
+        return -1;
+    }
+    int n = snprintf(tmp_path, tmp_size, "%s/.%s.wrtmp.XXXXXX", dirname(dir_copy), basename(copy));
+    free(copy);
+    free(dir_copy);
+    if (n < 0 || (size_t)n >= tmp_size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = mkostemp(tmp_path, O_CLOEXEC);
+    if (fd >= 0 && fchmod(fd, mode) != 0) {
+        int saved = errno;
+        close(fd);
+        unlink(tmp_path);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// fsync the temp file, rename it over 'dest' and fsync the directory entry.
+static int commit_temp(int fd, const char *tmp_path, const char *dest) {
+    if (fsync(fd) != 0 || close(fd) != 0) {
+        int saved = errno;
+        unlink(tmp_path);
+        errno = saved;
+        return -1;
+    }
+    if (rename(tmp_path, dest) != 0) {
+        int saved = errno;
+        unlink(tmp_path);
+        errno = saved;
+        return -1;
+    }
+    int dirfd = open_parent_dir(dest);
+    if (dirfd >= 0) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+    return 0;
+}
+
+static int abort_temp(int fd, const char *tmp_path) {
+    int saved = errno;
+    close(fd);
+    unlink(tmp_path);
+    errno = saved;
+    return -1;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Copy 'size' bytes from in_fd to out_fd using the cheapest mechanism the kernel accepts.
+static int copy_data(int in_fd, int out_fd, off_t size, fs_copy_method_t *method) {
+    if (ioctl(out_fd, FICLONE, in_fd) == 0) {
+        *method = FS_COPY_REFLINK;
+        return 0;
+    }
+
+    off_t done = 0;
+    *method = FS_COPY_FILE_RANGE;
+    while (done < size) {
+        size_t want = (size - done) > COPY_CHUNK_MAX ? (size_t)COPY_CHUNK_MAX : (size_t)(size - done);
+        ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, want, 0);
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+        if (n == 0) break; // Source shrank underneath us
+        if (errno == EINTR) continue;
+        if (done == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+            break; // Unsupported for this pair of files: try sendfile
+        }
+        return -1;
+    }
+    if (done > 0 || size == 0) return 0; // Finished (or the source shrank mid-copy)
+
+    *method = FS_COPY_SENDFILE;
+    while (done < size) {
+        size_t want = (size - done) > COPY_CHUNK_MAX ? (size_t)COPY_CHUNK_MAX : (size_t)(size - done);
+        ssize_t n = sendfile(out_fd, in_fd, NULL, want);
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+        if (n == 0) return 0;
+        if (errno == EINTR) continue;
+        if (done == 0 && (errno == EINVAL || errno == ENOSYS)) break;
+        return -1;
+    }
+    if (done == size) return 0;
+
+    *method = FS_COPY_READ_WRITE;
+    char *buf = malloc(RW_BUF_SIZE);
+    if (!buf) return -1;
+    for (;;) {
+        ssize_t n = read(in_fd, buf, RW_BUF_SIZE);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return -1;
+        }
+        if (write_all(out_fd, buf, (size_t)n) != 0) {
+            free(buf);
+            return -1;
+        }
+    }
+    free(buf);
+    return 0;
+}
+
+// "cp file dir/" semantics, shared by copy and move: an existing directory 'dest' means
+// 'dest'/basename('src').
+static int resolve_target(const char *src, const char *dest, char *target, size_t target_len) {
+    struct stat dst_st;
+    int n;
+    if (stat(dest, &dst_st) == 0 && S_ISDIR(dst_st.st_mode)) {
+        char *src_copy = strdup(src);
+        if (!src_copy) return -1;
+        n = snprintf(target, target_len, "%s/%s", dest, basename(src_copy));
+        free(src_copy);
+    } else {
+        n = snprintf(target, target_len, "%s", dest);
+    }
+    if (n < 0 || (size_t)n >= target_len) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int FsFile_copy(const char *src, const char *dest, fs_copy_method_t *method_used) {
+    int in_fd = open(src, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) return -1;
+    struct stat st;
+    if (fstat(in_fd, &st) != 0) {
+        int saved = errno;
+        close(in_fd);
+        errno = saved;
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) { // Directories and devices are out of scope for a file copy
+        close(in_fd);
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+        return -1;
+    }
+
+    char target[TMP_NAME_MAX];
+    if (resolve_target(src, dest, target, sizeof(target)) != 0) {
+        int saved = errno;
+        close(in_fd);
+        errno = saved;
+        return -1;
+    }
+
+    char tmp_path[TMP_NAME_MAX];
+    int out_fd = create_temp_beside(target, tmp_path, sizeof(tmp_path), st.st_mode & 07777);
+    if (out_fd < 0) {
+        int saved = errno;
+        close(in_fd);
+        errno = saved;
+        return -1;
+    }
+
+    fs_copy_method_t method = FS_COPY_READ_WRITE;
+    int rc = copy_data(in_fd, out_fd, st.st_size, &method);
+    int saved = errno;
+    close(in_fd);
+    if (rc != 0) {
+        errno = saved;
+        return abort_temp(out_fd, tmp_path);
+    }
+    if (method_used) *method_used = method;
+    return commit_temp(out_fd, tmp_path, target);
+}
+
+int FsFile_move(const char *src, const char *dest, int *copied) {
+    *copied = 0;
+    char target[TMP_NAME_MAX];
+    if (resolve_target(src, dest, target, sizeof(target)) != 0) return -1;
+    if (rename(src, target) == 0) {
+        int dirfd = open_parent_dir(target);
+        if (dirfd >= 0) {
+            fsync(dirfd);
+            close(dirfd);
+        }
+        return 0;
+    }
+    if (errno != EXDEV) return -1;
+
+    // Different filesystem: durable copy first, only then drop the source.
+    fs_copy_method_t method;
+    if (FsFile_copy(src, target, &method) != 0) return -1;
+    *copied = 1;
+    return unlink(src);
+}
+
+// Move 'in_fd' to 'out_fd' until EOF. splice() moves pipe pages without a userspace copy;
+// it refuses non-pipe sources and O_APPEND targets, which then use read()/write().
+static long long stream_data(int in_fd, int out_fd) {
+    long long total = 0;
+    int use_splice = 1;
+    char *buf = NULL;
+    for (;;) {
+        ssize_t n;
+        if (use_splice) {
+            n = splice(in_fd, NULL, out_fd, NULL, STREAM_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && errno == EINVAL) {
+                use_splice = 0;
+                continue;
+            }
+        } else {
+            if (buf == NULL && (buf = malloc(RW_BUF_SIZE)) == NULL) return -1;
+            n = read(in_fd, buf, RW_BUF_SIZE);
+            if (n > 0 && write_all(out_fd, buf, (size_t)n) != 0) n = -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int saved = errno;
+            free(buf);
+            errno = saved;
+            return -1;
+        }
+        if (n == 0) break;
+        total += n;
+    }
+    free(buf);
+    return total;
+}
+
+int FsFile_write_atomic(const char *path, const char *data, size_t len, mode_t mode) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        mode = st.st_mode & 07777; // Replacing a file must not change its permissions
+    }
+    char tmp_path[TMP_NAME_MAX];
+    int fd = create_temp_beside(path, tmp_path, sizeof(tmp_path), mode);
+    if (fd < 0) return -1;
+    if (write_all(fd, data, len) != 0) return abort_temp(fd, tmp_path);
+    return commit_temp(fd, tmp_path, path);
+}
+
+long long FsFile_write_atomic_fd(const char *path, int in_fd, mode_t mode) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        mode = st.st_mode & 07777;
+    }
+    char tmp_path[TMP_NAME_MAX];
+    int fd = create_temp_beside(path, tmp_path, sizeof(tmp_path), mode);
+    if (fd < 0) return -1;
+    long long total = stream_data(in_fd, fd);
+    if (total < 0) return abort_temp(fd, tmp_path);
+    return commit_temp(fd, tmp_path, path) == 0 ? total : -1;
+}
+
+int FsFile_append(const char *path, const char *data, size_t len, mode_t mode, int do_fsync) {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, mode);
+    if (fd < 0) return -1;
+    if (write_all(fd, data, len) != 0 || (do_fsync && fdatasync(fd) != 0)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return close(fd);
+}
+
+long long FsFile_append_fd(const char *path, int in_fd, mode_t mode, int do_fsync) {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, mode);
+    if (fd < 0) return -1;
+    long long total = stream_data(in_fd, fd);
+    if (total < 0 || (do_fsync && fdatasync(fd) != 0)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return close(fd) == 0 ? total : -1;
+}
@@ -0,0 +1,40 @@
+#ifndef FS_FILES_H
+#define FS_FILES_H
+
+#include <stddef.h>     // For size_t
+#include <sys/types.h>  // For mode_t
+
+// How the bytes of a copy were moved, for logs and benchmarks.
+typedef enum {
+    FS_COPY_REFLINK,          // FICLONE: extents shared, no data moved
+    FS_COPY_FILE_RANGE,       // copy_file_range(): in-kernel (possibly server-side) copy
+    FS_COPY_SENDFILE,         // sendfile(): in-kernel page cache copy
+    FS_COPY_READ_WRITE        // Plain read()/write() fallback
+} fs_copy_method_t;
+
+const char *FsFile_copy_method_name(fs_copy_method_t method);
+
+// Copy the regular file 'src' to 'dest' (if 'dest' is a directory, into it under the same
+// name). Data is written to a temporary file next to the destination, fsync'ed, renamed
+// over 'dest' and the directory fsync'ed, so readers never see a partial file.
+// Returns 0 on success, -1 with errno set.
+int FsFile_copy(const char *src, const char *dest, fs_copy_method_t *method_used);
+
+// rename() 'src' to 'dest' (atomic within one filesystem; into it under the same name if
+// 'dest' is a directory, as FsFile_copy()). Across filesystems the file is copied with
+// FsFile_copy() and the source unlinked afterwards. *copied tells which happened.
+int FsFile_move(const char *src, const char *dest, int *copied);
+
+// Replace 'path' with 'data' atomically: write a temp file, fsync, rename, fsync the directory.
+// 'mode' applies to newly created files; existing files keep their permissions.
+int FsFile_write_atomic(const char *path, const char *data, size_t len, mode_t mode);
+
+// Append 'data' to 'path' (created with 'mode' if missing), optionally fsync'ing it.
+int FsFile_append(const char *path, const char *data, size_t len, mode_t mode, int do_fsync);
+
+// Streaming variants: the data is everything read from 'in_fd' until EOF, moved with
+// splice() when 'in_fd' is a pipe. Return the byte count, or -1 with errno set.
+long long FsFile_write_atomic_fd(const char *path, int in_fd, mode_t mode);
+long long FsFile_append_fd(const char *path, int in_fd, mode_t mode, int do_fsync);
+
+#endif // FS_FILES_H
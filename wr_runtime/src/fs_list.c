@@ -0,0 +1,585 @@
+#define _GNU_SOURCE // For statx, O_DIRECTORY/O_NOFOLLOW, DT_* and SYS_getdents64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>      // For open, openat
+#include <unistd.h>     // For close, syscall
+#include <dirent.h>     // For DT_* constants
+#include <fnmatch.h>    // For glob filtering
+#include <pthread.h>    // For the parallel walker
+#include <sys/stat.h>   // For statx, fstatat
+#include <sys/syscall.h>
+#include <linux/openat2.h> // For RESOLVE_*
+
+#include "fs_list.h"
+#include "uring.h"
+#include "logger.h"
+
+#define LOG_FSL_ERROR(fmt, ...) WR_LOG_ERROR("fs_list", fmt, ##__VA_ARGS__)
+
+#define GETDENTS_BUF_SIZE 32768 // One getdents64 call returns several hundred entries
+#define MAX_WALK_THREADS 16
+
+// Kernel record layout for getdents64; declared here because musl and older glibc do not export it.
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Queued directories are opened only when a walker takes them, so a wide tree does not
+// hold one fd per directory waiting in the queue.
+typedef struct {
+    char *relpath; // "" for the root
+    int depth;
+} walk_item_t;
+
+typedef struct {
+    const fs_list_opts_t *opts;
+    int rootfd;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    walk_item_t *queue;
+    size_t queue_len;
+    size_t queue_cap;
+    int active;    // Workers currently processing an item
+    int failed;    // Set on allocation failure or fd exhaustion; workers drain and exit
+    int error;     // errno reported for 'failed'
+} walk_state_t;
+
+// Entries of one getdents64 buffer, collected so their statx() calls can be batched.
+typedef struct {
+    const char *name;     // Points into the getdents buffer
+    fs_entry_t entry;
+    int matches;
+    int need_stat;
+    int stat_res;         // Result of the batched statx: 0 or -errno
+} pending_entry_t;
+
+// Per-thread scratch space, reused across the directories one walker visits.
+typedef struct {
+    pending_entry_t *pending;
+    struct statx *stx;
+    size_t cap;
+    uring_t *ring;        // Created on the first directory big enough to benefit
+    int ring_failed;      // Stop retrying io_uring after a failure
+} walk_scratch_t;
+
+void FsList_default_opts(fs_list_opts_t *opts) {
+    opts->recursive = 0;
+    opts->max_depth = -1;
+    opts->glob = NULL;
+    opts->show_hidden = 1;
+    opts->stat_entries = 1;
+    opts->threads = 1;
+}
+
+const char *FsList_type_name(unsigned char type) {
+    switch (type) {
+        case DT_REG:  return "file";
+        case DT_DIR:  return "dir";
+        case DT_LNK:  return "link";
+        case DT_CHR:  return "char";
+        case DT_BLK:  return "block";
+        case DT_FIFO: return "fifo";
+        case DT_SOCK: return "socket";
+        default:      return "unknown";
+    }
+}
+
+static unsigned char mode_to_dtype(uint32_t mode) {
+    switch (mode & S_IFMT) {
+        case S_IFREG:  return DT_REG;
+        case S_IFDIR:  return DT_DIR;
+        case S_IFLNK:  return DT_LNK;
+        case S_IFCHR:  return DT_CHR;
+        case S_IFBLK:  return DT_BLK;
+        case S_IFIFO:  return DT_FIFO;
+        case S_IFSOCK: return DT_SOCK;
+        default:       return DT_UNKNOWN;
+    }
+}
+
+#define ENTRY_STATX_FLAGS (AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC)
+#define ENTRY_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME)
+
+static void entry_from_statx(fs_entry_t *entry, const struct statx *stx) {
+    entry->mode = stx->stx_mode;
+    entry->size = stx->stx_size;
+    entry->mtime_sec = stx->stx_mtime.tv_sec;
+    if (entry->type == DT_UNKNOWN) entry->type = mode_to_dtype(entry->mode);
+}
+
+// statx() relative to the directory fd, falling back to fstatat() on kernels/libcs without it.
+int FsList_stat_entry(int dirfd, const char *name, fs_entry_t *entry) {
+    struct statx stx;
+    if (statx(dirfd, name, ENTRY_STATX_FLAGS, ENTRY_STATX_MASK, &stx) == 0) {
+        entry_from_statx(entry, &stx);
+        return 0;
+    }
+    if (errno != ENOSYS) {
+        return -1;
+    }
+    struct stat st;
+    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return -1;
+    }
+    entry->mode = st.st_mode;
+    entry->size = (uint64_t)st.st_size;
+    entry->mtime_sec = st.st_mtime;
+    if (entry->type == DT_UNKNOWN) entry->type = mode_to_dtype(entry->mode);
+    return 0;
+}
+
+static int listing_push(fs_listing_t *l, const char *relpath, size_t rel_len, const char *name, const fs_entry_t *proto) {
+    size_t name_len = strlen(name);
+    size_t need = rel_len + (rel_len ? 1 : 0) + name_len + 1;
+    if (l->arena_len + need > l->arena_cap) {
+        size_t cap = l->arena_cap ? l->arena_cap * 2 : 4096;
+        while (cap < l->arena_len + need) cap *= 2;
+        char *arena = realloc(l->arena, cap);
+        if (!arena) return -1;
+        l->arena = arena;
+        l->arena_cap = cap;
+    }
+    if (l->count == l->capacity) {
+        size_t cap = l->capacity ? l->capacity * 2 : 64;
+        fs_entry_t *entries = realloc(l->entries, cap * sizeof(*entries));
+        if (!entries) return -1;
+        l->entries = entries;
+        l->capacity = cap;
+    }
+    fs_entry_t *e = &l->entries[l->count++];
+    *e = *proto;
+    e->path_off = l->arena_len;
+    char *dst = l->arena + l->arena_len;
+    if (rel_len) {
+        memcpy(dst, relpath, rel_len);
+        dst[rel_len] = '/';
+        dst += rel_len + 1;
+    }
+    memcpy(dst, name, name_len + 1);
+    l->arena_len += need;
+    return 0;
+}
+
+static char *join_relpath(const char *relpath, const char *name) {
+    size_t rel_len = strlen(relpath);
+    size_t name_len = strlen(name);
+    char *out = malloc(rel_len + name_len + 2);
+    if (!out) return NULL;
+    if (rel_len) {
+        memcpy(out, relpath, rel_len);
+        out[rel_len] = '/';
+        rel_len++;
+    }
+    memcpy(out + rel_len, name, name_len + 1);
+    return out;
+}
+
+static int queue_push_locked(walk_state_t *w, char *relpath, int depth) {
+    if (w->queue_len == w->queue_cap) {
+        size_t cap = w->queue_cap ? w->queue_cap * 2 : 32;
+        walk_item_t *q = realloc(w->queue, cap * sizeof(*q));
+        if (!q) return -1;
+        w->queue = q;
+        w->queue_cap = cap;
+    }
+    w->queue[w->queue_len].relpath = relpath;
+    w->queue[w->queue_len].depth = depth;
+    w->queue_len++;
+    return 0;
+}
+
+// Abandon the walk: FsList_list() fails with 'error'.
+static void walk_fail(walk_state_t *w, int threaded, int error) {
+    if (threaded) pthread_mutex_lock(&w->lock);
+    if (!w->failed) w->error = error;
+    w->failed = 1;
+    if (threaded) pthread_mutex_unlock(&w->lock);
+}
+
+// Open a queued directory below the root without following symlinks on the way, as
+// walking down fd by fd would not.
+static int open_subdir(int rootfd, const char *relpath) {
+    int fd;
+#ifdef SYS_openat2
+    struct open_how how = { .flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+                            .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS };
+    fd = (int)syscall(SYS_openat2, rootfd, relpath, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS) return fd;
+#endif
+    // No openat2 (before Linux 5.6): one component at a time.
+    char *copy = strdup(relpath);
+    if (!copy) return -1;
+    fd = rootfd;
+    char *save = NULL;
+    for (char *part = strtok_r(copy, "/", &save); part != NULL; part = strtok_r(NULL, "/", &save)) {
+        int next = openat(fd, part, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int saved = errno;
+        if (fd != rootfd) close(fd);
+        fd = next;
+        if (fd == -1) {
+            errno = saved;
+            break;
+        }
+    }
+    free(copy);
+    return fd;
+}
+
+// Lost to fd exhaustion or memory, not to the tree: the listing would be incomplete.
+static int resource_error(int error) {
+    return error == EMFILE || error == ENFILE || error == ENOMEM;
+}
+
+static void stat_done(void *arg, uint64_t user_data, int res) {
+    walk_scratch_t *scratch = arg;
+    scratch->pending[user_data].stat_res = res;
+}
+
+// statx() every pending entry that needs it: through io_uring when the batch is large
+// enough (one io_uring_enter per URING_DEFAULT_ENTRIES entries), synchronously otherwise.
+static void stat_pending(walk_scratch_t *scratch, int dirfd, size_t count, size_t nstat) {
+    if (nstat >= URING_MIN_BATCH && !scratch->ring_failed && Uring_supported(URING_OP_STATX)) {
+        if (scratch->ring == NULL) {
+            scratch->ring = Uring_create(URING_DEFAULT_ENTRIES);
+        }
+        int ok = scratch->ring != NULL;
+        for (size_t i = 0; ok && i < count; i++) {
+            pending_entry_t *p = &scratch->pending[i];
+            if (!p->need_stat) continue;
+            p->stat_res = -EINPROGRESS;
+            if (Uring_space(scratch->ring) == 0 && Uring_run(scratch->ring, stat_done, scratch) != 0) {
+                ok = 0;
+            } else if (Uring_queue_statx(scratch->ring, dirfd, p->name, ENTRY_STATX_FLAGS, ENTRY_STATX_MASK,
+                                         &scratch->stx[i], i) != 0) {
+                ok = 0;
+            }
+        }
+        if (ok && Uring_run(scratch->ring, stat_done, scratch) != 0) ok = 0;
+        if (ok) {
+            for (size_t i = 0; i < count; i++) {
+                pending_entry_t *p = &scratch->pending[i];
+                if (p->need_stat && p->stat_res == 0) {
+                    entry_from_statx(&p->entry, &scratch->stx[i]);
+                    p->need_stat = 0;
+                } else if (p->need_stat && p->stat_res != -EINVAL && p->stat_res != -EINPROGRESS) {
+                    p->need_stat = 0; // A real error (usually ENOENT): nothing to retry
+                }
+            }
+        } else {
+            scratch->ring_failed = 1; // Finish this and later directories synchronously
+        }
+    }
+    // Whatever io_uring did not settle (or everything, on the synchronous path).
+    for (size_t i = 0; i < count; i++) {
+        pending_entry_t *p = &scratch->pending[i];
+        if (!p->need_stat) continue;
+        p->stat_res = FsList_stat_entry(dirfd, p->name, &p->entry) == 0 ? 0 : -errno;
+        p->need_stat = 0;
+    }
+}
+
+// Read one directory with getdents64, stat the batch, and queue subdirectories.
+// 'threaded' controls whether the shared queue must be locked.
+static void walk_dir(walk_state_t *w, fs_listing_t *out, walk_item_t *item, int threaded, walk_scratch_t *scratch) {
+    const fs_list_opts_t *opts = w->opts;
+    int dirfd = item->relpath[0] ? open_subdir(w->rootfd, item->relpath) : w->rootfd;
+    if (dirfd == -1) {
+        LOG_FSL_ERROR("Cannot open '%s': %s", item->relpath, strerror(errno));
+        if (resource_error(errno)) walk_fail(w, threaded, errno);
+        return;
+    }
+    char *buf = malloc(GETDENTS_BUF_SIZE);
+    if (!buf) {
+        LOG_FSL_ERROR("Out of memory reading directory '%s'", item->relpath[0] ? item->relpath : ".");
+        walk_fail(w, threaded, ENOMEM);
+        if (dirfd != w->rootfd) close(dirfd);
+        return;
+    }
+    size_t rel_len = strlen(item->relpath);
+    int descend = opts->recursive && (opts->max_depth < 0 || item->depth < opts->max_depth);
+
+    for (;;) {
+        long nread = syscall(SYS_getdents64, dirfd, buf, GETDENTS_BUF_SIZE);
+        if (nread == -1) {
+            LOG_FSL_ERROR("getdents64 failed in '%s': %s", item->relpath[0] ? item->relpath : ".", strerror(errno));
+            break;
+        }
+        if (nread == 0) {
+            break;
+        }
+
+        // Pass 1: filter the buffer and note which entries need a statx.
+        size_t count = 0, nstat = 0;
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            if (!opts->show_hidden && name[0] == '.') {
+                continue;
+            }
+
+            int matches = (opts->glob == NULL) || (fnmatch(opts->glob, name, 0) == 0);
+            int need_type = descend && d->d_type == DT_UNKNOWN;
+            if (!matches && !(descend && (d->d_type == DT_DIR || need_type))) {
+                continue; // Neither listed nor descended into
+            }
+            if (count == scratch->cap) {
+                size_t cap = scratch->cap ? scratch->cap * 2 : 256;
+                pending_entry_t *pending = realloc(scratch->pending, cap * sizeof(*pending));
+                if (pending) scratch->pending = pending;
+                struct statx *stx = pending ? realloc(scratch->stx, cap * sizeof(*stx)) : NULL;
+                if (!stx) {
+                    LOG_FSL_ERROR("%s", "Out of memory while collecting entries.");
+                    walk_fail(w, threaded, ENOMEM);
+                    goto out;
+                }
+                scratch->stx = stx;
+                scratch->cap = cap;
+            }
+            pending_entry_t *p = &scratch->pending[count++];
+            p->name = name;
+            p->entry = (fs_entry_t){ .type = d->d_type, .depth = item->depth };
+            p->matches = matches;
+            p->need_stat = (matches && opts->stat_entries) || need_type;
+            p->stat_res = 0;
+            nstat += (size_t)p->need_stat;
+        }
+
+        stat_pending(scratch, dirfd, count, nstat);
+
+        // Pass 2: record entries and queue subdirectories.
+        for (size_t i = 0; i < count; i++) {
+            pending_entry_t *p = &scratch->pending[i];
+            if (p->stat_res != 0 && p->stat_res != -ENOENT) { // Entries can vanish between getdents and statx
+                LOG_FSL_ERROR("statx failed for '%s/%s': %s", item->relpath[0] ? item->relpath : ".", p->name, strerror(-p->stat_res));
+            }
+
+            if (p->matches && listing_push(out, item->relpath, rel_len, p->name, &p->entry) != 0) {
+                LOG_FSL_ERROR("%s", "Out of memory while collecting entries.");
+                walk_fail(w, threaded, ENOMEM);
+                goto out;
+            }
+
+            if (descend && p->entry.type == DT_DIR) {
+                char *subpath = join_relpath(item->relpath, p->name);
+                int rc = -1;
+                if (subpath) {
+                    if (threaded) pthread_mutex_lock(&w->lock);
+                    rc = queue_push_locked(w, subpath, item->depth + 1);
+                    if (threaded) {
+                        pthread_cond_signal(&w->cond);
+                        pthread_mutex_unlock(&w->lock);
+                    }
+                }
+                if (rc != 0) {
+                    free(subpath);
+                    walk_fail(w, threaded, ENOMEM);
+                }
+            }
+        }
+    }
+out:
+    free(buf);
+    if (dirfd != w->rootfd) close(dirfd);
+}
+
+static void scratch_free(walk_scratch_t *scratch) {
+    Uring_destroy(scratch->ring);
+    free(scratch->pending);
+    free(scratch->stx);
+    memset(scratch, 0, sizeof(*scratch));
+}
+
+typedef struct {
+    walk_state_t *w;
+    fs_listing_t local;
+    walk_scratch_t scratch;
+} walk_worker_t;
+
+static void *walk_worker_main(void *arg) {
+    walk_worker_t *self = arg;
+    walk_state_t *w = self->w;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->queue_len == 0 && w->active > 0) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        if (w->queue_len == 0) { // Queue drained and nobody can add more: walk complete
+            pthread_cond_broadcast(&w->cond);
+            break;
+        }
+        walk_item_t item = w->queue[--w->queue_len];
+        int failed = w->failed;
+        w->active++;
+        pthread_mutex_unlock(&w->lock);
+
+        if (!failed) {
+            walk_dir(w, &self->local, &item, 1, &self->scratch);
+        }
+        free(item.relpath);
+
+        pthread_mutex_lock(&w->lock);
+        w->active--;
+        if (w->active == 0 && w->queue_len == 0) {
+            pthread_cond_broadcast(&w->cond);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    scratch_free(&self->scratch);
+    return NULL;
+}
+
+// Append 'src' to 'dst', rebasing arena offsets. Frees 'src'.
+static int listing_merge(fs_listing_t *dst, fs_listing_t *src) {
+    if (src->count == 0) {
+        FsList_free(src);
+        return 0;
+    }
+    if (dst->count == 0) {
+        FsList_free(dst);
+        *dst = *src;
+        memset(src, 0, sizeof(*src));
+        return 0;
+    }
+    char *arena = realloc(dst->arena, dst->arena_len + src->arena_len);
+    fs_entry_t *entries = arena ? realloc(dst->entries, (dst->count + src->count) * sizeof(*entries)) : NULL;
+    if (arena) dst->arena = arena;
+    if (!arena || !entries) {
+        FsList_free(src);
+        return -1;
+    }
+    dst->arena_cap = dst->arena_len + src->arena_len;
+    dst->entries = entries;
+    dst->capacity = dst->count + src->count;
+    memcpy(dst->arena + dst->arena_len, src->arena, src->arena_len);
+    for (size_t i = 0; i < src->count; i++) {
+        fs_entry_t e = src->entries[i];
+        e.path_off += dst->arena_len;
+        dst->entries[dst->count++] = e;
+    }
+    dst->arena_len += src->arena_len;
+    FsList_free(src);
+    return 0;
+}
+
+typedef struct {
+    const char *path;
+    fs_entry_t entry;
+} sort_slot_t;
+
+static int sort_slot_cmp(const void *a, const void *b) {
+    return strcmp(((const sort_slot_t *)a)->path, ((const sort_slot_t *)b)->path);
+}
+
+int FsList_append(fs_listing_t *listing, const char *path, const fs_entry_t *entry) {
+    return listing_push(listing, "", 0, path, entry);
+}
+
+void FsList_sort(fs_listing_t *l) {
+    if (l->count < 2) return;
+    sort_slot_t *slots = malloc(l->count * sizeof(*slots));
+    if (!slots) return; // Unsorted output is still correct output
+    for (size_t i = 0; i < l->count; i++) {
+        slots[i].path = l->arena + l->entries[i].path_off;
+        slots[i].entry = l->entries[i];
+    }
+    qsort(slots, l->count, sizeof(*slots), sort_slot_cmp);
+    for (size_t i = 0; i < l->count; i++) {
+        l->entries[i] = slots[i].entry;
+    }
+    free(slots);
+}
+
+int FsList_list(const char *root, const fs_list_opts_t *opts, fs_listing_t *out) {
+    memset(out, 0, sizeof(*out));
+    int rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootfd == -1) {
+        return -1;
+    }
+
+    walk_state_t w;
+    memset(&w, 0, sizeof(w));
+    w.opts = opts;
+    w.rootfd = rootfd;
+
+    char *root_rel = strdup("");
+    if (!root_rel || queue_push_locked(&w, root_rel, 0) != 0) {
+        free(root_rel);
+        close(rootfd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int nthreads = opts->recursive ? opts->threads : 1;
+    if (nthreads > MAX_WALK_THREADS) nthreads = MAX_WALK_THREADS;
+
+    if (nthreads <= 1) {
+        walk_scratch_t scratch;
+        memset(&scratch, 0, sizeof(scratch));
+        while (w.queue_len > 0) {
+            walk_item_t item = w.queue[--w.queue_len];
+            if (!w.failed) {
+                walk_dir(&w, out, &item, 0, &scratch);
+            }
+            free(item.relpath);
+        }
+        scratch_free(&scratch);
+    } else {
+        walk_worker_t workers[MAX_WALK_THREADS];
+        pthread_t tids[MAX_WALK_THREADS];
+        int started = 0;
+        pthread_mutex_init(&w.lock, NULL);
+        pthread_cond_init(&w.cond, NULL);
+        for (int i = 0; i < nthreads; i++) {
+            memset(&workers[i], 0, sizeof(workers[i]));
+            workers[i].w = &w;
+            if (pthread_create(&tids[i], NULL, walk_worker_main, &workers[i]) != 0) {
+                break;
+            }
+            started++;
+        }
+        if (started == 0) { // Could not spawn any worker; walk inline instead
+            walk_worker_main(&workers[0]);
+            started = 1;
+        } else {
+            for (int i = 0; i < started; i++) {
+                pthread_join(tids[i], NULL);
+            }
+        }
+        for (int i = 0; i < started; i++) {
+            if (listing_merge(out, &workers[i].local) != 0 && !w.failed) {
+                w.failed = 1;
+                w.error = ENOMEM;
+            }
+        }
+        pthread_cond_destroy(&w.cond);
+        pthread_mutex_destroy(&w.lock);
+    }
+    free(w.queue);
+    close(rootfd);
+
+    if (w.failed) {
+        FsList_free(out);
+        errno = w.error;
+        return -1;
+    }
+    FsList_sort(out);
+    return 0;
+}
+
+void FsList_free(fs_listing_t *listing) {
+    if (!listing) return;
+    free(listing->entries);
+    free(listing->arena);
+    memset(listing, 0, sizeof(*listing));
+}
@@ -0,0 +1,57 @@
+#ifndef FS_LIST_H
+#define FS_LIST_H
+
+#include <stddef.h>   // For size_t
+#include <stdint.h>   // For uint32_t, uint64_t, int64_t
+
+// A single directory entry produced by the native lister.
+// Names live in the owning listing's string arena; use FsList_entry_path() to read them.
+typedef struct {
+    size_t path_off;     // Offset of the path (relative to the listing root) in the arena
+    unsigned char type;  // DT_* value (DT_UNKNOWN if neither getdents nor statx told us)
+    int depth;           // 0 for direct children of the root
+    uint32_t mode;       // st_mode bits (0 if stat_entries is off)
+    uint64_t size;
+    int64_t mtime_sec;
+} fs_entry_t;
+
+typedef struct {
+    fs_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    char *arena;         // NUL-terminated paths, referenced by fs_entry_t.path_off
+    size_t arena_len;
+    size_t arena_cap;
+} fs_listing_t;
+
+typedef struct {
+    int recursive;       // Descend into subdirectories
+    int max_depth;       // Deepest depth to descend into when recursive, -1 for unlimited
+    const char *glob;    // fnmatch() pattern applied to entry names, NULL matches everything
+    int show_hidden;     // Include dotfiles (ls -a behaviour)
+    int stat_entries;    // statx() each entry for mode/size/mtime
+    int threads;         // Worker threads for recursive walks (<= 1 walks inline)
+} fs_list_opts_t;
+
+void FsList_default_opts(fs_list_opts_t *opts);
+
+// List 'root' into 'out' (which must be zero-initialised or freed). Entries are sorted by path.
+// Returns 0 on success, -1 if the root could not be opened (errno is preserved) or the
+// listing would be incomplete for lack of fds or memory (errno EMFILE, ENFILE, ENOMEM).
+// Other errors on nested directories (e.g. EACCES) are logged and skipped.
+int FsList_list(const char *root, const fs_list_opts_t *opts, fs_listing_t *out);
+void FsList_free(fs_listing_t *listing);
+
+// Building blocks shared with the snapshot cache (dir_snapshot.c).
+int FsList_stat_entry(int dirfd, const char *name, fs_entry_t *entry); // 0 or -1 with errno
+int FsList_append(fs_listing_t *listing, const char *path, const fs_entry_t *entry); // Copies 'path'
+void FsList_sort(fs_listing_t *listing);
+
+static inline const char *FsList_entry_path(const fs_listing_t *listing, const fs_entry_t *entry) {
+    return listing->arena + entry->path_off;
+}
+
+// Short type tag for an entry ("file", "dir", "link", ...).
+const char *FsList_type_name(unsigned char type);
+
+#endif // FS_LIST_H
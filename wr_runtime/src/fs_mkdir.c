@@ -0,0 +1,400 @@
+#define _GNU_SOURCE // For O_PATH, O_DIRECTORY
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>     // For PATH_MAX
+#include <fcntl.h>      // For openat, O_PATH
+#include <unistd.h>     // For close
+#include <sys/stat.h>   // For mkdirat, fstatat
+
+#include "fs_mkdir.h"
+#include "uring.h"
+#include "logger.h"
+
+#define LOG_FSM_INFO(fmt, ...) WR_LOG_INFO("fs_mkdir", fmt, ##__VA_ARGS__)
+#define LOG_FSM_ERROR(fmt, ...) WR_LOG_ERROR("fs_mkdir", fmt, ##__VA_ARGS__)
+
+#define MAX_DIR_FRAMES 64 // Deeper paths still work, their extra parents are just not cached
+
+// An open directory covering path[0..len) of the path being processed.
+typedef struct {
+    size_t len;
+    int fd;
+} dir_frame_t;
+
+typedef struct {
+    dir_frame_t frames[MAX_DIR_FRAMES];
+    int depth;
+    int root_fd;        // O_PATH handle on "/" shared by all absolute paths, -1 until needed
+    mode_t mode;
+    fs_mkdir_stats_t *stats;
+} mkdir_walk_t;
+
+// Collapse repeated slashes, drop "." components and trailing slashes.
+static char *normalize_path(const char *path) {
+    size_t len = strlen(path);
+    char *out = malloc(len + 1);
+    if (!out) return NULL;
+    size_t o = 0;
+    const char *p = path;
+    if (*p == '/') out[o++] = '/';
+    while (*p) {
+        while (*p == '/') p++;
+        const char *start = p;
+        while (*p && *p != '/') p++;
+        size_t comp_len = (size_t)(p - start);
+        if (comp_len == 0 || (comp_len == 1 && start[0] == '.')) continue;
+        if (o > 0 && out[o - 1] != '/') out[o++] = '/';
+        memcpy(out + o, start, comp_len);
+        o += comp_len;
+    }
+    out[o] = '\0';
+    return out;
+}
+
+// strcmp() with '/' ordered before every other byte, so a directory's subtree sorts
+// immediately after it ("a/b", "a/b/c", "a/b-c") and siblings share parent frames.
+static int path_cmp(const void *a, const void *b) {
+    const unsigned char *x = *(const unsigned char *const *)a;
+    const unsigned char *y = *(const unsigned char *const *)b;
+    while (*x && *x == *y) {
+        x++;
+        y++;
+    }
+    unsigned cx = (*x == '/') ? 1 : (*x ? *x + 1u : 0);
+    unsigned cy = (*y == '/') ? 1 : (*y ? *y + 1u : 0);
+    return (int)cx - (int)cy;
+}
+
+// True if 'prefix' names 'path' itself or one of its ancestors.
+static int is_path_prefix(const char *prefix, const char *path) {
+    size_t n = strlen(prefix);
+    if (strncmp(prefix, path, n) != 0) return 0;
+    return path[n] == '\0' || path[n] == '/' || (n > 0 && prefix[n - 1] == '/');
+}
+
+static void pop_frames(mkdir_walk_t *w, int keep) {
+    while (w->depth > keep) {
+        w->depth--;
+        close(w->frames[w->depth].fd);
+    }
+}
+
+static int push_frame(mkdir_walk_t *w, size_t len, int fd) {
+    if (w->depth == MAX_DIR_FRAMES) return -1;
+    w->frames[w->depth].len = len;
+    w->frames[w->depth].fd = fd;
+    w->depth++;
+    return 0;
+}
+
+// Open (creating if missing) one directory component relative to 'parent_fd'.
+static int open_or_create_dir(mkdir_walk_t *w, int parent_fd, const char *name) {
+    w->stats->syscalls++;
+    int fd = openat(parent_fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0 || errno != ENOENT) return fd;
+    w->stats->syscalls++;
+    if (mkdirat(parent_fd, name, w->mode) != 0 && errno != EEXIST) return -1;
+    w->stats->syscalls++;
+    return openat(parent_fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+// Return an fd for path[0..parent_end), pushing frames for what had to be opened.
+// The returned fd is owned by the frame stack unless *owned is set.
+static int parent_fd_for(mkdir_walk_t *w, char *path, size_t parent_end, int *owned) {
+    *owned = 0;
+    int base_fd;
+    size_t base_len;
+    if (w->depth > 0) {
+        base_fd = w->frames[w->depth - 1].fd;
+        base_len = w->frames[w->depth - 1].len;
+    } else if (path[0] == '/') {
+        if (w->root_fd < 0) {
+            w->stats->syscalls++;
+            w->root_fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+            if (w->root_fd < 0) return -1;
+        }
+        base_fd = w->root_fd;
+        base_len = 0;
+    } else {
+        base_fd = AT_FDCWD;
+        base_len = 0;
+    }
+    if (base_len == parent_end || parent_end == 0) {
+        return base_fd; // Parent already open (or the leaf sits directly under the base)
+    }
+
+    size_t rel_start = base_len;
+    while (path[rel_start] == '/') rel_start++;
+
+    // Common case: the parent exists. One openat() resolves all remaining components.
+    char saved = path[parent_end];
+    path[parent_end] = '\0';
+    w->stats->syscalls++;
+    int fd = openat(base_fd, path + rel_start, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    path[parent_end] = saved;
+    if (fd >= 0) {
+        if (push_frame(w, parent_end, fd) != 0) *owned = 1;
+        return fd;
+    }
+    if (errno != ENOENT) return -1;
+
+    // Some parent is missing: walk component by component, creating as we go.
+    int cur_fd = base_fd;
+    int cur_owned = 0;
+    size_t pos = rel_start;
+    while (pos < parent_end) {
+        size_t end = pos;
+        while (end < parent_end && path[end] != '/') end++;
+        saved = path[end];
+        path[end] = '\0';
+        int next_fd = open_or_create_dir(w, cur_fd, path + pos);
+        path[end] = saved;
+        if (cur_owned) close(cur_fd);
+        if (next_fd < 0) return -1;
+        cur_fd = next_fd;
+        cur_owned = push_frame(w, end, next_fd) != 0;
+        pos = end + 1;
+    }
+    *owned = cur_owned;
+    return cur_fd;
+}
+
+static int ensure_one(mkdir_walk_t *w, char *path) {
+    size_t len = strlen(path);
+    if (len == 0 || strcmp(path, "/") == 0) {
+        w->stats->existed++;
+        return 0;
+    }
+    char *slash = strrchr(path, '/');
+    size_t parent_end = slash ? (size_t)(slash - path) : 0;
+    const char *leaf = slash ? slash + 1 : path;
+
+    int owned = 0;
+    int parent_fd = parent_fd_for(w, path, parent_end, &owned);
+    if (parent_fd < 0 && parent_fd != AT_FDCWD) {
+        LOG_FSM_ERROR("Cannot open parent of '%s': %s", path, strerror(errno));
+        return -1;
+    }
+
+    int rc = 0;
+    w->stats->syscalls++;
+    if (mkdirat(parent_fd, leaf, w->mode) == 0) {
+        w->stats->created++;
+    } else if (errno == EEXIST) {
+        struct stat st;
+        w->stats->syscalls++;
+        if (fstatat(parent_fd, leaf, &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+            w->stats->existed++;
+        } else {
+            LOG_FSM_ERROR("'%s' exists and is not a directory.", path);
+            rc = -1;
+        }
+    } else {
+        LOG_FSM_ERROR("mkdirat failed for '%s': %s", path, strerror(errno));
+        rc = -1;
+    }
+    if (owned) close(parent_fd);
+    return rc;
+}
+
+// --- io_uring path ---
+// Round 1 queues one mkdirat() per leaf, assuming its parent exists (the common case).
+// Leaves that fail with ENOENT are retried in round 2 as one hardlinked chain that
+// creates their missing parents first; the chain runs in order, so parents shared by
+// consecutive leaves are only issued once. Round 3 statx()es every EEXIST leaf to check
+// it is a directory. Each round is usually a single io_uring_enter().
+
+#define LEAF_PENDING 1
+#define UD_PARENT UINT64_MAX // Parent mkdirs in a chain: their result shows up in the leaf's
+
+typedef struct {
+    int *res;                 // Per leaf: LEAF_PENDING, 0, or -errno
+    struct statx *stx;        // Per leaf, for round 3
+} uring_batch_t;
+
+static void leaf_done(void *arg, uint64_t user_data, int res) {
+    uring_batch_t *b = arg;
+    if (user_data != UD_PARENT) b->res[user_data] = res;
+}
+
+static int queue_mkdir(uring_t *ring, uring_batch_t *b, const char *path, mode_t mode, uint64_t ud, int flags) {
+    if (Uring_queue_mkdirat(ring, AT_FDCWD, path, mode, ud, flags) == 0) return 0;
+    if (Uring_run(ring, leaf_done, b) != 0) return -1;
+    return Uring_queue_mkdirat(ring, AT_FDCWD, path, mode, ud, flags);
+}
+
+static int batch_uring(char **leaves, size_t n, mode_t mode, fs_mkdir_stats_t *stats) {
+    uring_t *ring = Uring_create(URING_DEFAULT_ENTRIES);
+    if (ring == NULL) return -1;
+    uring_batch_t b = { calloc(n, sizeof(int)), NULL };
+    char *prefix = malloc(PATH_MAX);
+    int rc = -1;
+    if (b.res == NULL || prefix == NULL) goto out;
+
+    for (size_t i = 0; i < n; i++) {
+        b.res[i] = LEAF_PENDING;
+        if (queue_mkdir(ring, &b, leaves[i], mode, i, 0) != 0) goto out;
+    }
+    if (Uring_run(ring, leaf_done, &b) != 0) goto out;
+
+    // Round 2. Parent prefixes must outlive the run, so they are strdup'ed into 'owned'.
+    char **owned = NULL;
+    size_t owned_count = 0;
+    const char *prev = NULL;
+    for (size_t i = 0; i < n; i++) {
+        if (b.res[i] != -ENOENT) continue;
+        const char *path = leaves[i];
+        size_t len = strlen(path);
+        if (len >= PATH_MAX) continue; // Reported as ENOENT below
+        for (size_t pos = 1; pos < len; pos++) {
+            if (path[pos] != '/') continue;
+            memcpy(prefix, path, pos);
+            prefix[pos] = '\0';
+            if (prev && is_path_prefix(prefix, prev)) continue; // Issued (or known) for the previous leaf
+            char **grown = realloc(owned, (owned_count + 1) * sizeof(char *));
+            char *copy = grown ? strdup(prefix) : NULL;
+            if (grown) owned = grown;
+            if (copy == NULL || queue_mkdir(ring, &b, copy, mode, UD_PARENT, URING_HARDLINK) != 0) {
+                free(copy);
+                goto chain_out;
+            }
+            owned[owned_count++] = copy;
+        }
+        b.res[i] = LEAF_PENDING;
+        if (queue_mkdir(ring, &b, path, mode, i, URING_HARDLINK) != 0) goto chain_out;
+        prev = path;
+    }
+    rc = Uring_run(ring, leaf_done, &b);
+chain_out:
+    for (size_t i = 0; i < owned_count; i++) free(owned[i]);
+    free(owned);
+    if (rc != 0) goto out;
+
+    // Round 3: an existing leaf only counts if it is a directory.
+    rc = -1;
+    b.stx = calloc(n, sizeof(struct statx)); // stx_mask stays 0 for leaves that were not checked
+    if (b.stx == NULL) goto out;
+    for (size_t i = 0; i < n; i++) {
+        if (b.res[i] != -EEXIST) continue;
+        if (Uring_space(ring) == 0 && Uring_run(ring, leaf_done, &b) != 0) goto out;
+        b.res[i] = LEAF_PENDING;
+        if (Uring_queue_statx(ring, AT_FDCWD, leaves[i], 0, STATX_TYPE, &b.stx[i], i) != 0) goto out;
+    }
+    if (Uring_run(ring, leaf_done, &b) != 0) goto out;
+    rc = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (b.res[i] == 0) {
+            // Round 1/2 mkdirat success, or round 3 statx success on an EEXIST leaf.
+            if (b.stx[i].stx_mask & STATX_TYPE) {
+                if (S_ISDIR(b.stx[i].stx_mode)) {
+                    stats->existed++;
+                } else {
+                    LOG_FSM_ERROR("'%s' exists and is not a directory.", leaves[i]);
+                    stats->failed++;
+                }
+            } else {
+                stats->created++;
+            }
+        } else {
+            LOG_FSM_ERROR("mkdirat failed for '%s': %s", leaves[i], strerror(-b.res[i]));
+            stats->failed++;
+        }
+    }
+
+out:
+    stats->syscalls += Uring_syscalls(ring);
+    Uring_destroy(ring);
+    free(prefix);
+    free(b.stx);
+    free(b.res);
+    return rc;
+}
+
+int FsMkdir_batch(const char *const *paths, size_t count, mode_t mode, fs_mkdir_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (count == 0) return 0;
+
+    char **norm = calloc(count, sizeof(char *));
+    if (!norm) {
+        LOG_FSM_ERROR("%s", "Out of memory normalising paths.");
+        stats->failed = (int)count;
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        char *p = normalize_path(paths[i]);
+        if (!p) {
+            LOG_FSM_ERROR("Out of memory normalising '%s'.", paths[i]);
+            stats->failed++;
+            continue;
+        }
+        norm[n++] = p;
+    }
+    qsort(norm, n, sizeof(char *), path_cmp);
+
+    // Skip exact duplicates and paths implied by the next one (its ancestors).
+    char **leaves = malloc((n ? n : 1) * sizeof(char *));
+    if (!leaves) {
+        LOG_FSM_ERROR("%s", "Out of memory collecting paths.");
+        for (size_t i = 0; i < n; i++) free(norm[i]);
+        free(norm);
+        stats->failed = (int)count;
+        return -1;
+    }
+    size_t nleaves = 0;
+    for (size_t i = 0; i < n; i++) {
+        if ((nleaves > 0 && strcmp(leaves[nleaves - 1], norm[i]) == 0) || (i + 1 < n && is_path_prefix(norm[i], norm[i + 1]))) {
+            continue;
+        }
+        if (norm[i][0] == '\0') { // "." and friends: the current directory always exists
+            stats->existed++;
+            continue;
+        }
+        leaves[nleaves++] = norm[i];
+    }
+
+    int done = 0;
+    if (nleaves >= URING_MIN_BATCH && Uring_supported(URING_OP_MKDIRAT) && Uring_supported(URING_OP_STATX)) {
+        fs_mkdir_stats_t before = *stats;
+        if (batch_uring(leaves, nleaves, mode, stats) == 0) {
+            done = 1;
+        } else {
+            // mkdir -p is idempotent: whatever the ring managed shows up as "existed" below.
+            LOG_FSM_INFO("io_uring batch failed (%s), retrying synchronously.", strerror(errno));
+            before.syscalls = stats->syscalls;
+            *stats = before;
+        }
+    }
+
+    mkdir_walk_t w;
+    memset(&w, 0, sizeof(w));
+    w.root_fd = -1;
+    w.mode = mode;
+    w.stats = stats;
+
+    const char *prev = NULL;
+    for (size_t i = 0; i < nleaves && !done; i++) {
+        char *path = leaves[i];
+        // Keep only the frames that are ancestors of this path.
+        int keep = 0;
+        while (keep < w.depth && prev && (path[0] == '/') == (prev[0] == '/')) {
+            size_t flen = w.frames[keep].len;
+            if (strncmp(path, prev, flen) != 0 || (path[flen] != '/' && path[flen] != '\0')) break;
+            keep++;
+        }
+        pop_frames(&w, keep);
+
+        if (ensure_one(&w, path) != 0) stats->failed++;
+        prev = path;
+    }
+    pop_frames(&w, 0);
+    if (w.root_fd >= 0) close(w.root_fd);
+
+    free(leaves);
+    for (size_t i = 0; i < n; i++) free(norm[i]);
+    free(norm);
+    return stats->failed ? -1 : 0;
+}
@@ -0,0 +1,24 @@
+#ifndef FS_MKDIR_H
+#define FS_MKDIR_H
+
+#include <stddef.h>     // For size_t
+#include <sys/types.h>  // For mode_t
+
+typedef struct {
+    int created;        // Leaf directories newly created
+    int existed;        // Leaf directories that were already present
+    int failed;         // Paths that could not be ensured (logged individually)
+    long syscalls;      // Filesystem syscalls issued, for diagnostics and benchmarks
+} fs_mkdir_stats_t;
+
+// Ensure every path in 'paths' exists as a directory (mkdir -p semantics).
+// Paths are normalised, sorted so that siblings are adjacent, and de-duplicated
+// (a path that is a prefix of another is implied by it). Parents are walked with
+// O_PATH directory fds kept on a stack, so each directory costs roughly one mkdirat()
+// relative to an already-open parent instead of one mkdir() per prefix from '/'.
+// With io_uring enabled, batches of URING_MIN_BATCH or more paths are instead issued as
+// mkdirat() SQEs, with parents created by hardlinked chains only where they are missing.
+// Returns 0 if all paths were ensured, -1 if any failed.
+int FsMkdir_batch(const char *const *paths, size_t count, mode_t mode, fs_mkdir_stats_t *stats);
+
+#endif // FS_MKDIR_H
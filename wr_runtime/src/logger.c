@@ -0,0 +1,646 @@
+#define _GNU_SOURCE // For gmtime_r, pthread_atfork
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "logger.h"
+
+#define MAX_RECORD 8192   // Header plus encoded arguments of one call
+#define MAX_LINE 8192     // One formatted line
+
+enum { SINK_STDIO, SINK_STDERR, SINK_SYSLOG, SINK_FILE };
+enum { RING_OWNED, RING_ORPHANED, RING_FREE };
+
+#define LEVEL_PAD 0xffff  // Record that only fills the space up to the ring's end
+
+// One log call as stored in a ring. Records are 8-byte aligned; the encoded arguments
+// follow the header in the order the format string consumes them.
+typedef struct {
+    uint32_t size;        // Whole record, header included
+    uint16_t level;
+    uint16_t reserved;
+    uint64_t ts_ns;       // CLOCK_REALTIME
+    const char *fmt;
+    const char *module;
+} record_t;
+
+// Single-producer (the owning thread) / single-consumer (whoever holds drain_lock) ring.
+typedef struct log_ring {
+    struct log_ring *next;
+    _Atomic uint64_t head;    // Bytes ever written
+    _Atomic uint64_t tail;    // Bytes ever consumed
+    _Atomic unsigned long dropped;
+    _Atomic int state;
+    uint64_t drained_to;      // Consumer only: end of the records in the current batch
+    unsigned char data[LOGGER_RING_BYTES];
+} log_ring_t;
+
+// A record picked for the current batch.
+typedef struct {
+    uint64_t ts_ns;
+    size_t seq;
+    const record_t *rec;
+} batch_entry_t;
+
+static _Atomic(log_ring_t *) rings = NULL;
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static _Thread_local log_ring_t *my_ring = NULL;
+
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER; // Consumer side of every ring
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic int wake_pending = 0;
+static pthread_t flusher;
+static _Atomic int running = 0;     // Records go to the rings (else: written directly)
+static int stopping = 0;            // Under wake_lock
+static _Atomic int in_child = 0;    // Forked child: the flusher does not exist here
+static _Atomic int min_level = WR_LOG_MIN_LEVEL;
+
+static int sink = SINK_STDIO;
+static int file_fd = -1;
+static batch_entry_t *batch = NULL;
+static size_t batch_cap = 0;
+
+static const char *level_name(int level) {
+    switch (level) {
+        case WR_LOG_LEVEL_DEBUG: return "DEBUG";
+        case WR_LOG_LEVEL_INFO: return "INFO";
+        case WR_LOG_LEVEL_WARN: return "WARNING";
+        default: return "ERROR";
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts); // vDSO: no syscall
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// --- Format string walking, shared by the encoder and the decoder ---
+
+typedef struct {
+    const char *start;    // The whole conversion, '%' included
+    size_t len;
+    int width_star;
+    int prec_star;
+    char length[3];       // "", "hh", "h", "l", "ll", "z", "j", "t" or "L"
+    char conv;            // 0 at the end of the format
+} spec_t;
+
+// Return the literal text before the next conversion in *lit / *lit_len and parse the
+// conversion into 'spec'; advances *p past it.
+static void next_spec(const char **p, const char **lit, size_t *lit_len, spec_t *spec) {
+    const char *s = *p;
+    *lit = s;
+    while (*s && *s != '%') s++;
+    *lit_len = (size_t)(s - *lit);
+    memset(spec, 0, sizeof(*spec));
+    if (*s == '\0') {
+        *p = s;
+        return;
+    }
+    spec->start = s++;
+    while (*s && strchr("-+ #0'", *s)) s++;
+    if (*s == '*') {
+        spec->width_star = 1;
+        s++;
+    }
+    while (*s >= '0' && *s <= '9') s++;
+    if (*s == '.') {
+        s++;
+        if (*s == '*') {
+            spec->prec_star = 1;
+            s++;
+        }
+        while (*s >= '0' && *s <= '9') s++;
+    }
+    size_t n = 0;
+    while (*s && strchr("hlzjtL", *s) && n < 2) spec->length[n++] = *s++;
+    spec->conv = *s;
+    if (*s) s++;
+    spec->len = (size_t)(s - spec->start);
+    *p = s;
+}
+
+static int is_unsigned_conv(char c) {
+    return c == 'u' || c == 'o' || c == 'x' || c == 'X';
+}
+
+static int is_float_conv(char c) {
+    return c != '\0' && strchr("fFeEgGaA", c) != NULL;
+}
+
+// --- Encoding (caller's thread) ---
+
+typedef struct {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+} enc_t;
+
+static void put_u64(enc_t *e, uint64_t v) {
+    if (e->len + 8 <= e->cap) memcpy(e->buf + e->len, &v, 8);
+    e->len += 8;
+}
+
+static void put_string(enc_t *e, const char *s) {
+    if (s == NULL) s = "(null)";
+    size_t n = strnlen(s, LOGGER_MAX_STRING);
+    size_t room = e->cap > e->len + 8 ? e->cap - e->len - 8 : 0;
+    if (n > room) n = room;
+    uint64_t len64 = n;
+    put_u64(e, len64);
+    if (n > 0) memcpy(e->buf + e->len, s, n);
+    e->len += (n + 7) & ~(size_t)7;
+}
+
+static uint64_t get_signed(const char *length, va_list *ap) {
+    if (strcmp(length, "l") == 0) return (uint64_t)va_arg(*ap, long);
+    if (strcmp(length, "ll") == 0) return (uint64_t)va_arg(*ap, long long);
+    if (strcmp(length, "z") == 0) return (uint64_t)va_arg(*ap, ssize_t);
+    if (strcmp(length, "j") == 0) return (uint64_t)va_arg(*ap, intmax_t);
+    if (strcmp(length, "t") == 0) return (uint64_t)va_arg(*ap, ptrdiff_t);
+    return (uint64_t)va_arg(*ap, int); // hh, h and none are promoted to int
+}
+
+static uint64_t get_unsigned(const char *length, va_list *ap) {
+    if (strcmp(length, "l") == 0) return va_arg(*ap, unsigned long);
+    if (strcmp(length, "ll") == 0) return va_arg(*ap, unsigned long long);
+    if (strcmp(length, "z") == 0) return va_arg(*ap, size_t);
+    if (strcmp(length, "j") == 0) return va_arg(*ap, uintmax_t);
+    if (strcmp(length, "t") == 0) return (uint64_t)va_arg(*ap, ptrdiff_t);
+    return va_arg(*ap, unsigned int);
+}
+
+// Arguments only, in binary; no number is converted to text here.
+static void encode_args(enc_t *e, const char *fmt, va_list *ap) {
+    const char *p = fmt, *lit;
+    size_t lit_len;
+    spec_t spec;
+    for (;;) {
+        next_spec(&p, &lit, &lit_len, &spec);
+        if (spec.conv == '\0') break;
+        if (spec.width_star) put_u64(e, (uint64_t)va_arg(*ap, int));
+        if (spec.prec_star) put_u64(e, (uint64_t)va_arg(*ap, int));
+        if (spec.conv == 'd' || spec.conv == 'i') {
+            put_u64(e, get_signed(spec.length, ap));
+        } else if (is_unsigned_conv(spec.conv)) {
+            put_u64(e, get_unsigned(spec.length, ap));
+        } else if (spec.conv == 'c') {
+            put_u64(e, (uint64_t)va_arg(*ap, int));
+        } else if (spec.conv == 's') {
+            put_string(e, va_arg(*ap, const char *));
+        } else if (spec.conv == 'p' || spec.conv == 'n') {
+            put_u64(e, (uint64_t)(uintptr_t)va_arg(*ap, void *));
+        } else if (is_float_conv(spec.conv)) {
+            double d = strcmp(spec.length, "L") == 0 ? (double)va_arg(*ap, long double) : va_arg(*ap, double);
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            put_u64(e, bits);
+        }
+    }
+}
+
+// --- Decoding and formatting (flusher) ---
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} dec_t;
+
+static uint64_t get_u64(dec_t *d) {
+    uint64_t v = 0;
+    if (d->p + 8 <= d->end) memcpy(&v, d->p, 8);
+    d->p += 8;
+    return v;
+}
+
+static void out_append(char *line, size_t *len, const char *s, size_t n) {
+    if (*len + n >= MAX_LINE) n = MAX_LINE - 1 - *len;
+    memcpy(line + *len, s, n);
+    *len += n;
+}
+
+// snprintf() one conversion, passing the star arguments in front of the value.
+#define FORMAT_ONE(value) \
+    (spec.width_star && spec.prec_star ? snprintf(tmp, sizeof(tmp), fmt1, width, prec, value) : \
+     spec.width_star ? snprintf(tmp, sizeof(tmp), fmt1, width, value) : \
+     spec.prec_star ? snprintf(tmp, sizeof(tmp), fmt1, prec, value) : \
+     snprintf(tmp, sizeof(tmp), fmt1, value))
+
+static void format_record(const record_t *rec, char *line, size_t *len) {
+    dec_t d = { (const unsigned char *)(rec + 1), (const unsigned char *)rec + rec->size };
+    const char *p = rec->fmt, *lit;
+    size_t lit_len;
+    spec_t spec;
+    char tmp[LOGGER_MAX_STRING + 64];
+    char str[LOGGER_MAX_STRING + 1];
+    for (;;) {
+        next_spec(&p, &lit, &lit_len, &spec);
+        out_append(line, len, lit, lit_len);
+        if (spec.conv == '\0') break;
+        if (spec.conv == '%') {
+            out_append(line, len, "%", 1);
+            continue;
+        }
+        int width = spec.width_star ? (int)get_u64(&d) : 0;
+        int prec = spec.prec_star ? (int)get_u64(&d) : 0;
+        char fmt1[32];
+        size_t flen = spec.len < sizeof(fmt1) - 1 ? spec.len : sizeof(fmt1) - 1;
+        memcpy(fmt1, spec.start, flen);
+        fmt1[flen] = '\0';
+        int n = 0;
+        const char *l = spec.length;
+        if (spec.conv == 'd' || spec.conv == 'i') {
+            int64_t v = (int64_t)get_u64(&d);
+            if (strcmp(l, "l") == 0) n = FORMAT_ONE((long)v);
+            else if (strcmp(l, "ll") == 0) n = FORMAT_ONE((long long)v);
+            else if (strcmp(l, "z") == 0) n = FORMAT_ONE((ssize_t)v);
+            else if (strcmp(l, "j") == 0) n = FORMAT_ONE((intmax_t)v);
+            else if (strcmp(l, "t") == 0) n = FORMAT_ONE((ptrdiff_t)v);
+            else n = FORMAT_ONE((int)v);
+        } else if (is_unsigned_conv(spec.conv)) {
+            uint64_t v = get_u64(&d);
+            if (strcmp(l, "l") == 0) n = FORMAT_ONE((unsigned long)v);
+            else if (strcmp(l, "ll") == 0) n = FORMAT_ONE((unsigned long long)v);
+            else if (strcmp(l, "z") == 0) n = FORMAT_ONE((size_t)v);
+            else if (strcmp(l, "j") == 0) n = FORMAT_ONE((uintmax_t)v);
+            else if (strcmp(l, "t") == 0) n = FORMAT_ONE((ptrdiff_t)v);
+            else n = FORMAT_ONE((unsigned int)v);
+        } else if (spec.conv == 'c') {
+            n = FORMAT_ONE((int)get_u64(&d));
+        } else if (spec.conv == 's') {
+            size_t slen = (size_t)get_u64(&d);
+            if (slen > LOGGER_MAX_STRING || d.p + slen > d.end) slen = 0;
+            memcpy(str, d.p, slen); // Records are not NUL-terminated
+            str[slen] = '\0';
+            d.p += (slen + 7) & ~(size_t)7;
+            n = FORMAT_ONE(str);
+        } else if (spec.conv == 'p') {
+            n = FORMAT_ONE((void *)(uintptr_t)get_u64(&d));
+        } else if (is_float_conv(spec.conv)) {
+            uint64_t bits = get_u64(&d);
+            double v;
+            memcpy(&v, &bits, sizeof(v));
+            if (strcmp(l, "L") == 0) { // Stored as a double: drop the 'L'
+                char *L = strchr(fmt1, 'L');
+                if (L != NULL) memmove(L, L + 1, strlen(L));
+            }
+            n = FORMAT_ONE(v);
+        } else {
+            get_u64(&d); // %n and unknown conversions print nothing
+            continue;
+        }
+        if (n > 0) out_append(line, len, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+    }
+}
+
+// --- Sinks ---
+
+static void write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return; // Logging is best effort
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static int sink_fd(int level) {
+    switch (sink) {
+        case SINK_FILE: return file_fd;
+        case SINK_STDERR: return STDERR_FILENO;
+        default: return level >= WR_LOG_LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO;
+    }
+}
+
+// Render one record as a full line (newline included) into 'line'.
+static size_t render(const record_t *rec, char *line) {
+    size_t len = 0;
+    if (sink == SINK_FILE) {
+        time_t secs = (time_t)(rec->ts_ns / 1000000000ULL);
+        struct tm tm;
+        gmtime_r(&secs, &tm);
+        len = strftime(line, 32, "%Y-%m-%dT%H:%M:%S", &tm);
+        len += (size_t)snprintf(line + len, 16, ".%03uZ ", (unsigned)(rec->ts_ns / 1000000 % 1000));
+    }
+    if (sink != SINK_SYSLOG) {
+        const char *name = level_name(rec->level);
+        out_append(line, &len, name, strlen(name));
+        out_append(line, &len, ": ", 2);
+    }
+    out_append(line, &len, rec->module, strlen(rec->module));
+    out_append(line, &len, ": ", 2);
+    format_record(rec, line, &len);
+    line[len++] = '\n';
+    return len;
+}
+
+static void emit_syslog(const record_t *rec, char *line) {
+    static const int prio[] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR };
+    size_t len = render(rec, line);
+    line[len - 1] = '\0';
+    syslog(prio[rec->level <= WR_LOG_LEVEL_ERROR ? rec->level : WR_LOG_LEVEL_ERROR], "%s", line);
+}
+
+// Synchronous path: no flusher (not started, stopped, or a forked child).
+static void write_direct(const record_t *rec) {
+    char line[MAX_LINE];
+    if (sink == SINK_SYSLOG) {
+        emit_syslog(rec, line);
+        return;
+    }
+    size_t len = render(rec, line);
+    int fd = sink_fd(rec->level);
+    if (fd >= 0) write_all(fd, line, len);
+}
+
+// --- Rings ---
+
+static void ring_orphan(void *arg) {
+    atomic_store_explicit(&((log_ring_t *)arg)->state, RING_ORPHANED, memory_order_release);
+}
+
+static log_ring_t *ring_acquire(void) {
+    // Threads come and go (DAG workers, pipeline stages): reuse a drained ring first.
+    for (log_ring_t *r = atomic_load_explicit(&rings, memory_order_acquire); r != NULL; r = r->next) {
+        int expected = RING_FREE;
+        if (atomic_compare_exchange_strong(&r->state, &expected, RING_OWNED)) return r;
+    }
+    log_ring_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) return NULL;
+    atomic_init(&r->state, RING_OWNED);
+    pthread_mutex_lock(&register_lock);
+    r->next = atomic_load_explicit(&rings, memory_order_relaxed);
+    atomic_store_explicit(&rings, r, memory_order_release);
+    pthread_mutex_unlock(&register_lock);
+    return r;
+}
+
+static void wake_flusher(void) {
+    if (!atomic_exchange_explicit(&wake_pending, 1, memory_order_relaxed)) {
+        pthread_cond_signal(&wake_cond);
+    }
+}
+
+static int ring_push(log_ring_t *r, const record_t *rec) {
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t pos = (size_t)(head % LOGGER_RING_BYTES);
+    size_t contig = LOGGER_RING_BYTES - pos;
+    size_t need = rec->size;
+    if (contig < rec->size) need += contig; // Records never wrap: skip to the start
+    if (head + need - tail > LOGGER_RING_BYTES) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+    if (contig < rec->size) {
+        if (contig >= sizeof(record_t)) {
+            record_t pad;
+            memset(&pad, 0, sizeof(pad));
+            pad.size = (uint32_t)contig;
+            pad.level = LEVEL_PAD;
+            memcpy(r->data + pos, &pad, sizeof(pad));
+        } // Less than a header left: the reader skips it implicitly
+        pos = 0;
+    }
+    memcpy(r->data + pos, rec, rec->size);
+    atomic_store_explicit(&r->head, head + need, memory_order_release);
+    if (head + need - tail > LOGGER_RING_BYTES / 2 || rec->level >= WR_LOG_LEVEL_ERROR) wake_flusher();
+    return 0;
+}
+
+void Logger_write(int level, const char *module, const char *fmt, ...) {
+    if (level < atomic_load_explicit(&min_level, memory_order_relaxed)) return;
+    _Alignas(8) unsigned char buf[MAX_RECORD];
+    record_t *rec = (record_t *)buf;
+    rec->level = (uint16_t)level;
+    rec->reserved = 0;
+    rec->ts_ns = now_ns();
+    rec->fmt = fmt;
+    rec->module = module;
+    enc_t e = { buf, sizeof(record_t), sizeof(buf) };
+    va_list ap;
+    va_start(ap, fmt);
+    encode_args(&e, fmt, &ap);
+    va_end(ap);
+    if (e.len > e.cap) e.len = e.cap; // Arguments past the end decode as zeros
+    rec->size = (uint32_t)((e.len + 7) & ~(size_t)7);
+
+    if (!atomic_load_explicit(&running, memory_order_acquire) || atomic_load_explicit(&in_child, memory_order_relaxed)) {
+        write_direct(rec);
+        return;
+    }
+    if (my_ring == NULL) {
+        my_ring = ring_acquire();
+        if (my_ring == NULL) {
+            write_direct(rec);
+            return;
+        }
+        pthread_setspecific(ring_key, my_ring);
+    }
+    ring_push(my_ring, rec);
+}
+
+// --- Flusher ---
+
+static int batch_cmp(const void *a, const void *b) {
+    const batch_entry_t *x = a, *y = b;
+    if (x->ts_ns != y->ts_ns) return x->ts_ns < y->ts_ns ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int batch_add(size_t *count, const record_t *rec) {
+    if (*count == batch_cap) {
+        size_t cap = batch_cap ? batch_cap * 2 : 256;
+        batch_entry_t *grown = realloc(batch, cap * sizeof(*batch));
+        if (grown == NULL) return -1;
+        batch = grown;
+        batch_cap = cap;
+    }
+    batch[*count].ts_ns = rec->ts_ns;
+    batch[*count].seq = *count;
+    batch[*count].rec = rec;
+    (*count)++;
+    return 0;
+}
+
+// Caller holds drain_lock. Formats every pending record, oldest first, and writes them
+// with one write() per run of lines going to the same descriptor.
+static void drain_all(void) {
+    static char out[64 * 1024];
+    static char line[MAX_LINE];
+    size_t count = 0;
+    unsigned long dropped = 0;
+
+    // Snapshot: records up to each ring's head at this point; the producers keep going.
+    log_ring_t *list = atomic_load_explicit(&rings, memory_order_acquire);
+    for (log_ring_t *r = list; r != NULL; r = r->next) {
+        uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        while (tail < head) {
+            size_t pos = (size_t)(tail % LOGGER_RING_BYTES);
+            if (LOGGER_RING_BYTES - pos < sizeof(record_t)) {
+                tail += LOGGER_RING_BYTES - pos;
+                continue;
+            }
+            const record_t *rec = (const record_t *)(r->data + pos);
+            if (rec->level != LEVEL_PAD && batch_add(&count, rec) != 0) {
+                write_direct(rec); // No memory to sort it in: out of order rather than lost
+            }
+            tail += rec->size;
+        }
+        r->drained_to = tail;
+        dropped += atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+    }
+    qsort(batch, count, sizeof(*batch), batch_cmp);
+
+    size_t used = 0;
+    int out_fd = -1;
+    for (size_t i = 0; i < count; i++) {
+        const record_t *rec = batch[i].rec;
+        if (sink == SINK_SYSLOG) {
+            emit_syslog(rec, line);
+            continue;
+        }
+        size_t len = render(rec, line);
+        int fd = sink_fd(rec->level);
+        if (used > 0 && (fd != out_fd || used + len > sizeof(out))) {
+            if (out_fd >= 0) write_all(out_fd, out, used);
+            used = 0;
+        }
+        out_fd = fd;
+        memcpy(out + used, line, len);
+        used += len;
+    }
+    if (used > 0 && out_fd >= 0) write_all(out_fd, out, used);
+
+    // Release the space only now: the batch pointed into the rings.
+    for (log_ring_t *r = list; r != NULL; r = r->next) {
+        atomic_store_explicit(&r->tail, r->drained_to, memory_order_release);
+        if (atomic_load_explicit(&r->state, memory_order_acquire) == RING_ORPHANED &&
+            atomic_load_explicit(&r->tail, memory_order_relaxed) == atomic_load_explicit(&r->head, memory_order_acquire)) {
+            atomic_store_explicit(&r->state, RING_FREE, memory_order_release);
+        }
+    }
+    if (dropped > 0) {
+        _Alignas(8) unsigned char buf[sizeof(record_t) + 8];
+        record_t *rec = (record_t *)buf;
+        *rec = (record_t){ sizeof(buf), WR_LOG_LEVEL_WARN, 0, now_ns(), "%lu messages dropped (log ring full)", "logger" };
+        uint64_t v = dropped;
+        memcpy(rec + 1, &v, sizeof(v));
+        write_direct(rec);
+    }
+}
+
+static void *flusher_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&wake_lock);
+    while (!stopping) {
+        if (!atomic_load_explicit(&wake_pending, memory_order_relaxed)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOGGER_FLUSH_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&wake_cond, &wake_lock, &deadline);
+        }
+        atomic_store_explicit(&wake_pending, 0, memory_order_relaxed);
+        pthread_mutex_unlock(&wake_lock);
+        pthread_mutex_lock(&drain_lock);
+        drain_all();
+        pthread_mutex_unlock(&drain_lock);
+        pthread_mutex_lock(&wake_lock);
+    }
+    pthread_mutex_unlock(&wake_lock);
+    return NULL;
+}
+
+static void after_fork_child(void) {
+    atomic_store(&in_child, 1);
+}
+
+int Logger_start(void) {
+    static int key_created = 0;
+    const char *level = getenv("WR_LOG_LEVEL");
+    if (level != NULL) {
+        if (strcmp(level, "debug") == 0) atomic_store(&min_level, WR_LOG_LEVEL_DEBUG);
+        else if (strcmp(level, "info") == 0) atomic_store(&min_level, WR_LOG_LEVEL_INFO);
+        else if (strcmp(level, "warn") == 0) atomic_store(&min_level, WR_LOG_LEVEL_WARN);
+        else if (strcmp(level, "error") == 0) atomic_store(&min_level, WR_LOG_LEVEL_ERROR);
+    }
+    const char *target = getenv("WR_LOG");
+    if (target == NULL || strcmp(target, "stdio") == 0) {
+        sink = SINK_STDIO;
+    } else if (strcmp(target, "stderr") == 0) {
+        sink = SINK_STDERR;
+    } else if (strcmp(target, "syslog") == 0) {
+        sink = SINK_SYSLOG;
+    } else if (target[0] == '/') {
+        file_fd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+        if (file_fd < 0) {
+            WR_LOG_ERROR("logger", "Cannot open log file '%s': %s, logging to stdout/stderr.", target, strerror(errno));
+        } else {
+            sink = SINK_FILE;
+        }
+    } else {
+        WR_LOG_ERROR("logger", "Unknown WR_LOG '%s', logging to stdout/stderr.", target);
+    }
+
+    if (!key_created) {
+        if (pthread_key_create(&ring_key, ring_orphan) != 0) return -1;
+        pthread_atfork(NULL, NULL, after_fork_child);
+        key_created = 1;
+    }
+    fflush(NULL); // Lines already printed with stdio must come out before ours
+    stopping = 0;
+    atomic_store(&running, 1);
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+        atomic_store(&running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+void Logger_flush(void) {
+    if (!atomic_load(&running) || atomic_load(&in_child)) return;
+    pthread_mutex_lock(&drain_lock);
+    drain_all();
+    pthread_mutex_unlock(&drain_lock);
+}
+
+void Logger_stop(void) {
+    if (!atomic_load(&running) || atomic_load(&in_child)) return;
+    pthread_mutex_lock(&wake_lock);
+    stopping = 1;
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+    pthread_join(flusher, NULL);
+    // Calls from here on are written directly; drain what is left behind them.
+    atomic_store(&running, 0);
+    pthread_mutex_lock(&drain_lock);
+    drain_all();
+    pthread_mutex_unlock(&drain_lock);
+    if (file_fd >= 0) {
+        close(file_fd);
+        file_fd = -1;
+        sink = SINK_STDIO;
+    }
+}
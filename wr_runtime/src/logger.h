@@ -0,0 +1,52 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#define WR_LOG_LEVEL_DEBUG 0
+#define WR_LOG_LEVEL_INFO  1
+#define WR_LOG_LEVEL_WARN  2
+#define WR_LOG_LEVEL_ERROR 3
+
+// Levels below this are compiled out: the call and its arguments cost nothing.
+// Set with 'make LOG_LEVEL=0' for a build that keeps DEBUG.
+#ifndef WR_LOG_MIN_LEVEL
+#define WR_LOG_MIN_LEVEL WR_LOG_LEVEL_INFO
+#endif
+
+#define LOGGER_RING_BYTES (256 * 1024) // Per-thread record ring
+#define LOGGER_FLUSH_MS 50            // Flusher period; a half-full ring or an ERROR wakes it early
+#define LOGGER_MAX_STRING 2048        // Longer %s arguments are truncated
+
+// Asynchronous logger. A log call does not format anything: it copies the format string
+// pointer (string literals only, which double as the message's id) and its arguments in
+// binary into a lock-free ring owned by the calling thread. A background thread drains
+// every ring, formats the records in timestamp order and writes them in batches to the
+// sink chosen by $WR_LOG:
+//   "stdio" (default)  DEBUG/INFO to stdout, WARN/ERROR to stderr, as "LEVEL: module: message"
+//   "stderr"           everything to stderr
+//   "syslog"           syslog(), with the ident set by the caller's openlog()
+//   "/path/to/file"    appended to that file, each line prefixed with a UTC timestamp
+// $WR_LOG_LEVEL ("debug", "info", "warn", "error") raises the runtime threshold.
+// A full ring drops records (counted and reported) rather than blocking the caller.
+// Before Logger_start(), after Logger_stop() and in forked children, calls write directly.
+
+#define WR_LOG(level, module, fmt, ...) \
+    do { if ((level) >= WR_LOG_MIN_LEVEL) Logger_write((level), (module), fmt, ##__VA_ARGS__); } while (0)
+#define WR_LOG_DEBUG(module, fmt, ...) WR_LOG(WR_LOG_LEVEL_DEBUG, module, fmt, ##__VA_ARGS__)
+#define WR_LOG_INFO(module, fmt, ...) WR_LOG(WR_LOG_LEVEL_INFO, module, fmt, ##__VA_ARGS__)
+#define WR_LOG_WARN(module, fmt, ...) WR_LOG(WR_LOG_LEVEL_WARN, module, fmt, ##__VA_ARGS__)
+#define WR_LOG_ERROR(module, fmt, ...) WR_LOG(WR_LOG_LEVEL_ERROR, module, fmt, ##__VA_ARGS__)
+
+// Pick the sink and start the flusher thread. Returns 0, or -1 (logging stays synchronous).
+int Logger_start(void);
+
+// Write out everything logged so far before returning.
+void Logger_flush(void);
+
+// Flush, stop the flusher and close the sink.
+void Logger_stop(void);
+
+// Use the macros above. 'fmt' must be a string literal (or otherwise live forever), and
+// 'module' too; %n is not supported.
+void Logger_write(int level, const char *module, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#endif // LOGGER_H
@@ -1,7 +1,8 @@
+#define _GNU_SOURCE // For setenv
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>   // For sleep, setsid, fork, STDIN_FILENO etc. (fork/setsid if daemonizing here)
-#include <syslog.h>   // For openlog, syslog, closelog
+#include <syslog.h>   // For openlog, closelog (the logger's syslog sink)
 #include <time.h>     // For time()
 #include <string.h>   // For strcmp
 #include <errno.h>    // For errno
@@ -10,12 +11,28 @@
 
 #include "cJSON.h" // Found via CFLAGS -I deps/cJSON
 #include "service_loader.h"
-#include "dispatcher.h"
+#include "service_run.h"
 #include "condition.h"
+#include "output_ring.h"
+#include "spawn_helper.h"
+#include "notify_bus.h"
+#include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+#include "clock_source.h"
+#include "simulate.h"
+#include "stats_page.h"
+#include "control.h"
+#include "spool.h"
 
 #define MAIN_LOOP_SLEEP_SECONDS 1
 #define SERVICE_RELOAD_INTERVAL_SECONDS 60
 
+#define LOG_MAIN_DEBUG(fmt, ...) WR_LOG_DEBUG("main", fmt, ##__VA_ARGS__)
+#define LOG_MAIN_INFO(fmt, ...) WR_LOG_INFO("main", fmt, ##__VA_ARGS__)
+#define LOG_MAIN_WARN(fmt, ...) WR_LOG_WARN("main", fmt, ##__VA_ARGS__)
+#define LOG_MAIN_ERROR(fmt, ...) WR_LOG_ERROR("main", fmt, ##__VA_ARGS__)
+
 // Simple daemonize function (optional, can be handled by init system too)
 // For a more robust daemon, consider double fork, proper signal handling, pid file etc.
 static void __attribute__((unused)) daemonize_basic() {
@@ -24,7 +41,7 @@ static void __attribute__((unused)) daemonize_basic() {
     // Fork off the parent process
     pid = fork();
     if (pid < 0) {
-        syslog(LOG_ERR, "fork failed during daemonize: %s", strerror(errno));
+        LOG_MAIN_ERROR("fork failed during daemonize: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
     if (pid > 0) { // Parent exits
@@ -33,7 +50,7 @@ static void __attribute__((unused)) daemonize_basic() {
 
     // Create a new session
     if (setsid() < 0) {
-        syslog(LOG_ERR, "setsid failed during daemonize: %s", strerror(errno));
+        LOG_MAIN_ERROR("setsid failed during daemonize: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
@@ -41,7 +58,7 @@ static void __attribute__((unused)) daemonize_basic() {
     /*
     pid = fork();
     if (pid < 0) {
-        syslog(LOG_ERR, "second fork failed during daemonize: %m");
+        LOG_MAIN_ERROR("second fork failed during daemonize: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
     if (pid > 0) { // First child exits
@@ -54,12 +71,12 @@ static void __attribute__((unused)) daemonize_basic() {
 
     // Change the current working directory to a safe place (optional)
     // if ((chdir("/")) < 0) {
-    //    syslog(LOG_ERR, "chdir failed during daemonize: %m");
+    //    LOG_MAIN_ERROR("chdir failed during daemonize: %s", strerror(errno));
     //    exit(EXIT_FAILURE);
     // }
 
     // Close standard file descriptors
-    syslog(LOG_INFO, "Daemonizing: Closing stdin, stdout, stderr.");
+    LOG_MAIN_INFO("%s", "Daemonizing: Closing stdin, stdout, stderr.");
     close(STDIN_FILENO);
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
@@ -76,19 +93,52 @@ static void __attribute__((unused)) daemonize_basic() {
             close(fd0);
         }
     } else {
-        syslog(LOG_ERR, "Failed to open /dev/null for redirection");
+        LOG_MAIN_ERROR("%s", "Failed to open /dev/null for redirection");
     }
 }
 
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--services-dir DIR] [--simulate DURATION [--simulate-action-ms MS]]\n", prog);
+    fprintf(stderr, "  --services-dir DIR        Load service files from DIR (default: %s)\n", DEFAULT_SERVICE_DIR);
+    fprintf(stderr, "  --simulate DURATION       Run the scheduler on a virtual clock for DURATION (e.g. 3600, 90m,\n"
+                    "                            12h, 7d) without running actions, then print a JSON report\n");
+    fprintf(stderr, "  --simulate-action-ms MS   Modelled cost of one action in a simulation (default 0)\n");
+}
+
 int main(int argc, char *argv[]) {
-    (void)argc; // Suppress unused warning
-    (void)argv; // Suppress unused warning
+    const char *services_dir = DEFAULT_SERVICE_DIR;
+    long simulate = 0;          // Seconds of virtual time to simulate; 0 runs for real
+    double sim_action_ms = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--services-dir") == 0 && i + 1 < argc) {
+            services_dir = argv[++i];
+        } else if (strncmp(argv[i], "--services-dir=", 15) == 0) {
+            services_dir = argv[i] + 15;
+        } else if (strcmp(argv[i], "--simulate") == 0 && i + 1 < argc && (simulate = Sim_parse_duration(argv[i + 1])) > 0) {
+            i++;
+        } else if (strcmp(argv[i], "--simulate-action-ms") == 0 && i + 1 < argc && atof(argv[i + 1]) >= 0) {
+            sim_action_ms = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+    }
+
+    if (simulate) {
+        // stdout carries the report; keep the per-run INFO lines out of the way.
+        setenv("WR_LOG", "stderr", 0);
+        setenv("WR_LOG_LEVEL", "warn", 0);
+    }
 
     // Initialize syslog
     // LOG_DAEMON is typical for daemons. LOG_PID includes PID in each message.
     openlog("wr_runtime", LOG_PID | LOG_PERROR, LOG_DAEMON); // LOG_PERROR also logs to stderr until daemonized/redirected
-    syslog(LOG_INFO, "WhiteRAILS Runtime starting up...");
+    // Log calls only queue the message; a background thread writes it (WR_LOG picks the sink).
+    if (Logger_start() != 0) {
+        LOG_MAIN_WARN("%s", "Asynchronous logger unavailable, logging synchronously.");
+    }
+    LOG_MAIN_INFO("%s", "WhiteRAILS Runtime starting up...");
 
     // Basic daemonization (can be commented out if init system handles it, e.g. OpenRC's start-stop-daemon)
     // The OpenRC script provided earlier uses start-stop-daemon, which handles daemonizing.
@@ -96,29 +146,75 @@ int main(int argc, char *argv[]) {
     // For testing without OpenRC, it can be useful. For now, let's assume OpenRC handles it.
     // If daemonize_basic() is called, LOG_PERROR in openlog will stop having an effect after redirection.
     // daemonize_basic(); 
-    // syslog(LOG_INFO, "Daemonized. Continuing startup."); // Log after potential daemonization
+    // LOG_MAIN_INFO("%s", "Daemonized. Continuing startup."); // Log after potential daemonization
+
+    // Start the spawn helper while the daemon is still small: every command action is
+    // forked from it, so spawn cost does not grow with the services we load.
+    // A simulation runs no actions and serves nothing, so it can run next to the daemon.
+    if (!simulate) {
+        if (SpawnHelper_start() != 0) {
+            LOG_MAIN_WARN("%s", "Spawn helper unavailable, command actions will fork directly.");
+        }
+
+        if (NotifyBus_start(NULL) != 0) {
+            LOG_MAIN_WARN("%s", "Notification bus unavailable, notifications are only logged.");
+        }
+
+        if (Metrics_start(NULL) != 0) {
+            LOG_MAIN_WARN("%s", "Metrics socket unavailable, metrics are collected but not served.");
+        }
+        Trace_init(); // SIGUSR2 toggles tracing
+
+        if (StatsPage_start(NULL) != 0) {
+            LOG_MAIN_WARN("%s", "Shared-memory stats page unavailable, wr_top will not work.");
+        }
+
+        if (Control_start(NULL, services_dir) != 0) {
+            LOG_MAIN_WARN("%s", "Control socket unavailable, services can only be added as files.");
+        }
+
+        if (Spool_start(NULL) != 0) {
+            LOG_MAIN_WARN("%s", "Spool directory unavailable, commands dropped there are not picked up.");
+        }
+    }
 
     SvcLoader_init();
-    SvcLoader_load_services(DEFAULT_SERVICE_DIR); // Load initial services
+    SvcLoader_load_services(services_dir); // Load initial services
+    StatsPage_publish();
+
+    // From here on the scheduler only reads time through the clock source.
+    if (simulate && Sim_start(SvcLoader_get_count(), simulate, (uint64_t)(sim_action_ms * 1e6)) != 0) {
+        return 1;
+    }
 
     record_activity(); // Record initial system activity after setup
 
-    time_t last_service_reload_time = time(NULL);
+    time_t last_service_reload_time = Clock_now();
 
-    syslog(LOG_INFO, "Entering main loop...");
-    while (1) {
-        time_t current_time = time(NULL);
+    LOG_MAIN_INFO("%s", "Entering main loop...");
+    while (!simulate || Sim_running()) {
+        uint64_t tick_started = Metrics_now_ns();
+        time_t current_time = Clock_now();
+        int fired = 0;
+        if (simulate) Sim_tick_begin();
 
-        // Periodically reload services
-        if (current_time - last_service_reload_time >= SERVICE_RELOAD_INTERVAL_SECONDS) {
-            syslog(LOG_INFO, "Reloading services list.");
-            SvcLoader_reload_services(DEFAULT_SERVICE_DIR); // This calls init then load
+        // Periodically reload services (a simulation keeps the set it started with)
+        if (!simulate && current_time - last_service_reload_time >= SERVICE_RELOAD_INTERVAL_SECONDS) {
+            LOG_MAIN_INFO("%s", "Reloading services list.");
+            SvcLoader_reload_services(services_dir); // This calls init then load
+            StatsPage_publish();
             last_service_reload_time = current_time;
             record_activity(); // Reloading services is an activity
         }
+        // Services registered through the control socket (also written to services_dir)
+        if (!simulate && Control_apply_pending() > 0) {
+            StatsPage_publish();
+        }
 
         int services_count = SvcLoader_get_count();
-        // syslog(LOG_DEBUG, "Main loop tick. Processing %d services.", services_count); // Too verbose for INFO
+        Metrics_set(METRIC_SERVICES_LOADED, NULL, services_count);
+        OutRing_reserve(services_count);
+        // LOG_MAIN_DEBUG("Main loop tick. Processing %d services.", services_count); // Too verbose for INFO
 
         for (int i = 0; i < services_count; i++) {
             service_config_t *svc = SvcLoader_get_service_by_index(i);
@@ -134,41 +230,65 @@ int main(int argc, char *argv[]) {
             // last_run_timestamp should not be updated, or a different logic is needed.
             // Current logic: interval 0 means it can run every loop cycle if condition met.
             if (svc->interval_seconds == 0 || (current_time >= (svc->last_run_timestamp + svc->interval_seconds))) {
-                syslog(LOG_DEBUG, "Service '%s': Interval met. Checking condition '%s'.", svc->name, svc->condition_str);
+                LOG_MAIN_DEBUG("Service '%s': Interval met. Checking condition '%s'.", svc->name, svc->condition_str);
                 
                 int condition_result = evaluate_service_condition(svc->condition_str, svc->name);
                 
                 if (condition_result == 1) { // Condition met
-                    syslog(LOG_INFO, "Service '%s': Condition '%s' MET. Executing actions.", svc->name, svc->condition_str);
+                    LOG_MAIN_INFO("Service '%s': Condition '%s' MET. Executing actions.", svc->name, svc->condition_str);
+                    fired++;
                     
-                    cJSON *actions_array = cJSON_GetObjectItemCaseSensitive(svc->config_json, "actions");
-                    cJSON *action_item_json;
-                    int action_idx = 0;
-                    cJSON_ArrayForEach(action_item_json, actions_array) {
-                        cJSON *action_type_json = cJSON_GetObjectItemCaseSensitive(action_item_json, "type");
-                        if (cJSON_IsString(action_type_json) && (action_type_json->valuestring != NULL)) {
-                            const char *action_type_str = action_type_json->valuestring;
-                            syslog(LOG_DEBUG, "Service '%s', Action #%d: Dispatching type '%s'.", svc->name, action_idx, action_type_str);
-                            dispatch_action(action_type_str, action_item_json); // Pass the whole action object as params
-                        } else {
-                            syslog(LOG_ERR, "Service '%s', Action #%d: 'type' is missing or not a string.", svc->name, action_idx);
-                        }
-                        action_idx++;
+                    if (simulate) {
+                        Sim_fire(i, svc); // Only charges the actions' modelled cost
+                    } else {
+                        // Output of every action in this run is captured into the service's ring.
+                        output_ring_t *output = OutRing_get(svc->name, svc->output_ring_kb, svc->forward_output);
+                        uint64_t run_started = Metrics_now_ns();
+                        StatsPage_run_begin(i, (int64_t)current_time);
+                        ServiceRun_execute(svc, output, NULL);
+                        uint64_t run_ns = Metrics_now_ns() - run_started;
+                        StatsPage_run_end(i, run_ns, (int64_t)current_time + svc->interval_seconds);
+                        Metrics_observe(METRIC_SERVICE_RUN_SECONDS, svc->name, run_ns);
+                        TRACE_SPAN("service", "run", svc->name, run_started);
                     }
                     svc->last_run_timestamp = current_time; // Update last run time for this service
                     record_activity(); // Record activity after a service's actions are run
                 } else if (condition_result == 0) { // Condition not met
-                    syslog(LOG_DEBUG, "Service '%s': Condition '%s' NOT MET.", svc->name, svc->condition_str);
+                    LOG_MAIN_DEBUG("Service '%s': Condition '%s' NOT MET.", svc->name, svc->condition_str);
                 } else { // Error evaluating condition
-                    syslog(LOG_ERR, "Service '%s': Error evaluating condition '%s'.", svc->name, svc->condition_str);
+                    LOG_MAIN_ERROR("Service '%s': Error evaluating condition '%s'.", svc->name, svc->condition_str);
                 }
             }
         }
-        sleep(MAIN_LOOP_SLEEP_SECONDS);
+        Metrics_observe(METRIC_TICK_SECONDS, NULL, Metrics_now_ns() - tick_started);
+        TRACE_SPAN("scheduler", "tick", NULL, tick_started);
+        if (simulate) {
+            Sim_tick_done(fired);
+            Clock_sleep(MAIN_LOOP_SLEEP_SECONDS);
+            continue;
+        }
+        // Loop lag: how much later than asked for the next tick starts.
+        uint64_t wake_at = Metrics_now_ns() + (uint64_t)MAIN_LOOP_SLEEP_SECONDS * 1000000000u;
+        Clock_sleep(MAIN_LOOP_SLEEP_SECONDS);
+        uint64_t woke = Metrics_now_ns();
+        Metrics_observe(METRIC_LOOP_LAG_SECONDS, NULL, woke > wake_at ? woke - wake_at : 0);
+        Trace_poll();
     }
 
-    syslog(LOG_INFO, "WhiteRAILS Runtime shutting down (main loop exited - unexpected).");
+    if (simulate) {
+        Sim_report(stdout);
+    } else {
+        LOG_MAIN_INFO("%s", "WhiteRAILS Runtime shutting down (main loop exited - unexpected).");
+    }
+    Spool_stop();
+    Control_stop();
     SvcLoader_free_all_services(); // Clean up
+    OutRing_free_all();
+    NotifyBus_stop();
+    Metrics_stop();
+    StatsPage_stop();
+    SpawnHelper_stop();
+    Logger_stop();
     closelog(); // Close syslog
     return 0; // Should not be reached in normal daemon operation
 }
@@ -0,0 +1,603 @@
+#define _GNU_SOURCE // For accept4, SOCK_CLOEXEC, eventfd, strdup
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>  // For mkdir, chmod
+#include <sys/time.h>  // For struct timeval (SO_SNDTIMEO)
+#include <sys/un.h>
+
+#include "cJSON.h" // Found via CFLAGS -I deps/cJSON
+#include "metrics.h"
+#include "logger.h"
+#include "profiler.h"
+
+#define LOG_METRICS_INFO(fmt, ...) WR_LOG_INFO("metrics", fmt, ##__VA_ARGS__)
+#define LOG_METRICS_ERROR(fmt, ...) WR_LOG_ERROR("metrics", fmt, ##__VA_ARGS__)
+
+#define SUB_COUNT (1u << METRICS_SUB_BITS)
+#define NBUCKETS ((METRICS_MAX_EXP - METRICS_SUB_BITS + 2) * SUB_COUNT)
+#define REQUEST_TIMEOUT_MS 200 // How long a client gets to send its request line
+#define SEND_TIMEOUT_S 1       // A client that stops reading is dropped
+
+typedef enum { KIND_SUMMARY, KIND_COUNTER, KIND_GAUGE } metric_kind_t;
+
+static const struct {
+    const char *name;
+    const char *help;
+    const char *label; // NULL: no label
+    metric_kind_t kind;
+} families[METRIC_FAMILY_COUNT] = {
+    [METRIC_CONDITION_SECONDS]   = { "wr_condition_eval_seconds", "Time to evaluate a service's condition.", "service", KIND_SUMMARY },
+    [METRIC_CONDITION_MET]       = { "wr_condition_met_total", "Condition evaluations that were met.", "service", KIND_COUNTER },
+    [METRIC_CONDITION_ERRORS]    = { "wr_condition_errors_total", "Condition evaluations that failed.", "service", KIND_COUNTER },
+    [METRIC_SERVICE_RUN_SECONDS] = { "wr_service_run_seconds", "Time to run the actions of a triggered service.", "service", KIND_SUMMARY },
+    [METRIC_ACTION_SECONDS]      = { "wr_action_seconds", "Time spent in an action, from dispatch to return.", "type", KIND_SUMMARY },
+    [METRIC_ACTION_FAILURES]     = { "wr_action_failures_total", "Actions whose command exited non-zero or was killed.", "type", KIND_COUNTER },
+    [METRIC_SPAWN_SECONDS]       = { "wr_spawn_seconds", "Time to start a child process.", "path", KIND_SUMMARY },
+    [METRIC_LOOP_LAG_SECONDS]    = { "wr_loop_lag_seconds", "How late the main loop woke up for its tick.", NULL, KIND_SUMMARY },
+    [METRIC_TICK_SECONDS]        = { "wr_tick_seconds", "Time to process one main loop tick.", NULL, KIND_SUMMARY },
+    [METRIC_ACTIONS_IN_FLIGHT]   = { "wr_actions_in_flight", "Actions currently running.", NULL, KIND_GAUGE },
+    [METRIC_SERVICES_LOADED]     = { "wr_services_loaded", "Services in the loaded configuration.", NULL, KIND_GAUGE },
+    [METRIC_SPOOL_BACKLOG]       = { "wr_spool_backlog", "Commands waiting in the spool.", NULL, KIND_GAUGE },
+    [METRIC_SPOOL_COMMANDS]      = { "wr_spool_commands_total", "Spool commands handled.", "outcome", KIND_COUNTER },
+};
+
+static const struct {
+    const char *name;
+    double q;
+} quantiles[] = { { "0.5", 0.5 }, { "0.9", 0.9 }, { "0.99", 0.99 }, { "0.999", 0.999 }, { "1", 1.0 } };
+
+typedef struct {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[NBUCKETS];
+} histogram_t;
+
+typedef struct series {
+    struct series *next;
+    metric_family_t family;
+    char *label;            // NULL for unlabelled families
+    _Atomic int64_t value;  // Counters and gauges
+    histogram_t *hist;      // Summaries
+} series_t;
+
+// Every series is on a list (for rendering) and in a hash table (for lookups). Both are
+// append-only, so readers use neither lock.
+#define SERIES_SLOTS 2048 // Power of two, well above METRIC_FAMILY_COUNT * METRICS_MAX_SERIES
+static _Atomic(series_t *) series_head = NULL;
+static _Atomic(series_t *) series_slots[SERIES_SLOTS];
+static int family_series[METRIC_FAMILY_COUNT]; // Under register_lock
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Server state
+static pthread_t server_thread;
+static int server_running = 0;
+static int wake_fd = -1;   // eventfd: stop was requested
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+uint64_t Metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// --- Histograms ---
+
+// Values below SUB_COUNT get a bucket each; above, every power of two is split into
+// SUB_COUNT equal buckets.
+static unsigned bucket_of(uint64_t v) {
+    if (v < SUB_COUNT) return (unsigned)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e > METRICS_MAX_EXP) return NBUCKETS - 1;
+    unsigned sub = (unsigned)(v >> (e - METRICS_SUB_BITS)) & (SUB_COUNT - 1);
+    return (unsigned)(e - METRICS_SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+// Highest value that lands in bucket 'b'.
+static uint64_t bucket_high(unsigned b) {
+    if (b < SUB_COUNT) return b;
+    int shift = (int)(b / SUB_COUNT) - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + b % SUB_COUNT) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+static void hist_record(histogram_t *h, uint64_t v) {
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_ns, v, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    while (v > max && !atomic_compare_exchange_weak_explicit(&h->max_ns, &max, v, memory_order_relaxed,
+                                                             memory_order_relaxed)) {
+    }
+}
+
+// Snapshot of a histogram, taken with relaxed loads while writers keep going.
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t values[sizeof(quantiles) / sizeof(quantiles[0])];
+} hist_view_t;
+
+static void hist_view(histogram_t *h, hist_view_t *v) {
+    static uint64_t counts[NBUCKETS]; // Only the server thread renders
+    uint64_t total = 0;
+    for (unsigned b = 0; b < NBUCKETS; b++) {
+        counts[b] = atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        total += counts[b];
+    }
+    v->count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    v->sum_ns = atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+    v->max_ns = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        v->values[i] = 0;
+        if (total == 0) continue;
+        uint64_t rank = (uint64_t)(quantiles[i].q * (double)total + 0.999999);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < NBUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank) {
+                v->values[i] = bucket_high(b);
+                break;
+            }
+        }
+        if (v->values[i] > v->max_ns) v->values[i] = v->max_ns; // The top bucket is wider than the data
+    }
+}
+
+// --- Registry ---
+
+static int label_matches(const series_t *s, const char *label) {
+    if (s->label == NULL || label == NULL) return s->label == label;
+    return strcmp(s->label, label) == 0;
+}
+
+static unsigned series_hash(metric_family_t family, const char *label) {
+    uint32_t h = 2166136261u ^ (uint32_t)family; // FNV-1a
+    for (const char *c = label != NULL ? label : ""; *c; c++) h = (h ^ (unsigned char)*c) * 16777619u;
+    return h & (SERIES_SLOTS - 1);
+}
+
+// Open addressing without deletion: readers probe without a lock.
+static series_t *series_find(metric_family_t family, const char *label, unsigned *free_slot) {
+    unsigned i = series_hash(family, label);
+    for (unsigned n = 0; n < SERIES_SLOTS; n++, i = (i + 1) & (SERIES_SLOTS - 1)) {
+        series_t *s = atomic_load_explicit(&series_slots[i], memory_order_acquire);
+        if (s == NULL) {
+            if (free_slot != NULL) *free_slot = i;
+            return NULL;
+        }
+        if (s->family == family && label_matches(s, label)) return s;
+    }
+    if (free_slot != NULL) *free_slot = SERIES_SLOTS;
+    return NULL;
+}
+
+static series_t *series_create(metric_family_t family, const char *label) {
+    unsigned slot;
+    series_t *s = series_find(family, label, &slot); // Someone may have added it meanwhile
+    if (s != NULL || slot == SERIES_SLOTS) return s;
+    s = calloc(1, sizeof(*s));
+    if (s == NULL) return NULL;
+    s->family = family;
+    s->label = label != NULL ? strdup(label) : NULL;
+    s->hist = families[family].kind == KIND_SUMMARY ? calloc(1, sizeof(*s->hist)) : NULL;
+    if ((label != NULL && s->label == NULL) || (families[family].kind == KIND_SUMMARY && s->hist == NULL)) {
+        free(s->label);
+        free(s->hist);
+        free(s);
+        return NULL;
+    }
+    s->next = atomic_load_explicit(&series_head, memory_order_relaxed);
+    atomic_store_explicit(&series_head, s, memory_order_release);
+    atomic_store_explicit(&series_slots[slot], s, memory_order_release);
+    family_series[family]++;
+    return s;
+}
+
+static series_t *series_get(metric_family_t family, const char *label) {
+    if ((unsigned)family >= METRIC_FAMILY_COUNT) return NULL;
+    if (families[family].label == NULL) label = NULL;
+    else if (label == NULL) label = "";
+    series_t *s = series_find(family, label, NULL);
+    if (s != NULL) return s;
+
+    pthread_mutex_lock(&register_lock);
+    if (label != NULL && family_series[family] >= METRICS_MAX_SERIES - 1) {
+        s = series_find(family, label, NULL);
+        if (s == NULL) s = series_create(family, METRICS_OVERFLOW_LABEL); // Keep a bounded registry
+    } else {
+        s = series_create(family, label);
+    }
+    pthread_mutex_unlock(&register_lock);
+    return s;
+}
+
+void Metrics_observe(metric_family_t family, const char *label, uint64_t duration_ns) {
+    series_t *s = series_get(family, label);
+    if (s != NULL && s->hist != NULL) hist_record(s->hist, duration_ns);
+}
+
+void Metrics_add(metric_family_t family, const char *label, int64_t delta) {
+    series_t *s = series_get(family, label);
+    if (s != NULL) atomic_fetch_add_explicit(&s->value, delta, memory_order_relaxed);
+}
+
+void Metrics_set(metric_family_t family, const char *label, int64_t value) {
+    series_t *s = series_get(family, label);
+    if (s != NULL) atomic_store_explicit(&s->value, value, memory_order_relaxed);
+}
+
+// --- Rendering ---
+
+// Unlabelled families always have their one series; labelled ones show up once used.
+static series_t *render_head(void) {
+    for (int f = 0; f < METRIC_FAMILY_COUNT; f++) {
+        if (families[f].label == NULL) series_get((metric_family_t)f, NULL);
+    }
+    return atomic_load_explicit(&series_head, memory_order_acquire);
+}
+
+static int family_used(const series_t *head, int family) {
+    for (const series_t *s = head; s != NULL; s = s->next) {
+        if (s->family == (metric_family_t)family) return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} text_t;
+
+static void __attribute__((format(printf, 2, 3))) text_printf(text_t *t, const char *fmt, ...) {
+    if (t->failed) return;
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(t->data + t->len, t->cap - t->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            t->failed = 1;
+            return;
+        }
+        if ((size_t)n < t->cap - t->len) {
+            t->len += (size_t)n;
+            return;
+        }
+        size_t cap = t->cap * 2 + (size_t)n + 1;
+        char *grown = realloc(t->data, cap);
+        if (grown == NULL) {
+            t->failed = 1;
+            return;
+        }
+        t->data = grown;
+        t->cap = cap;
+    }
+}
+
+// {label="value" plus 'extra' (e.g. quantile="0.5"), or nothing when both are empty.
+static void text_labels(text_t *t, const series_t *s, const char *extra) {
+    const char *key = families[s->family].label;
+    if (key == NULL && extra == NULL) return;
+    text_printf(t, "%s", "{");
+    if (key != NULL) {
+        text_printf(t, "%s=\"", key);
+        for (const char *p = s->label; *p; p++) {
+            if (*p == '\\' || *p == '"') text_printf(t, "\\%c", *p);
+            else if (*p == '\n') text_printf(t, "%s", "\\n");
+            else text_printf(t, "%c", *p);
+        }
+        text_printf(t, "%s", extra != NULL ? "\"," : "\"");
+    }
+    if (extra != NULL) text_printf(t, "%s", extra);
+    text_printf(t, "%s", "}");
+}
+
+static void render_prometheus(text_t *t) {
+    static const char *types[] = { "summary", "counter", "gauge" };
+    series_t *head = render_head();
+    for (int f = 0; f < METRIC_FAMILY_COUNT; f++) {
+        if (!family_used(head, f)) continue;
+        const char *name = families[f].name;
+        text_printf(t, "# HELP %s %s\n# TYPE %s %s\n", name, families[f].help, name, types[families[f].kind]);
+        for (series_t *s = head; s != NULL; s = s->next) {
+            if (s->family != (metric_family_t)f) continue;
+            if (s->hist == NULL) {
+                text_printf(t, "%s", name);
+                text_labels(t, s, NULL);
+                text_printf(t, " %lld\n", (long long)atomic_load_explicit(&s->value, memory_order_relaxed));
+                continue;
+            }
+            hist_view_t v;
+            hist_view(s->hist, &v);
+            for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+                char extra[32];
+                snprintf(extra, sizeof(extra), "quantile=\"%s\"", quantiles[i].name);
+                text_printf(t, "%s", name);
+                text_labels(t, s, extra);
+                text_printf(t, " %.9g\n", (double)v.values[i] / 1e9);
+            }
+            text_printf(t, "%s_sum", name);
+            text_labels(t, s, NULL);
+            text_printf(t, " %.9g\n%s_count", (double)v.sum_ns / 1e9, name);
+            text_labels(t, s, NULL);
+            text_printf(t, " %llu\n", (unsigned long long)v.count);
+        }
+    }
+}
+
+// {"<family>": {"type": ..., "help": ..., "series": [{"labels": {...}, ...}, ...]}, ...}
+static char *render_json(void) {
+    static const char *types[] = { "summary", "counter", "gauge" };
+    cJSON *root = cJSON_CreateObject();
+    if (root == NULL) return NULL;
+    series_t *head = render_head();
+    for (int f = 0; f < METRIC_FAMILY_COUNT; f++) {
+        if (!family_used(head, f)) continue;
+        cJSON *family = cJSON_AddObjectToObject(root, families[f].name);
+        cJSON_AddStringToObject(family, "type", types[families[f].kind]);
+        cJSON_AddStringToObject(family, "help", families[f].help);
+        cJSON *list = cJSON_AddArrayToObject(family, "series");
+        for (series_t *s = head; s != NULL; s = s->next) {
+            if (s->family != (metric_family_t)f) continue;
+            cJSON *item = cJSON_CreateObject();
+            cJSON_AddItemToArray(list, item);
+            cJSON *labels = cJSON_AddObjectToObject(item, "labels");
+            if (families[f].label != NULL) cJSON_AddStringToObject(labels, families[f].label, s->label);
+            if (s->hist == NULL) {
+                cJSON_AddNumberToObject(item, "value", (double)atomic_load_explicit(&s->value, memory_order_relaxed));
+                continue;
+            }
+            hist_view_t v;
+            hist_view(s->hist, &v);
+            cJSON_AddNumberToObject(item, "count", (double)v.count);
+            cJSON_AddNumberToObject(item, "sum", (double)v.sum_ns / 1e9);
+            cJSON *q = cJSON_AddObjectToObject(item, "quantiles");
+            for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+                cJSON_AddNumberToObject(q, quantiles[i].name, (double)v.values[i] / 1e9);
+            }
+        }
+    }
+    char *out = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return out;
+}
+
+// --- Server ---
+
+static void send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return; // Gone, or stopped reading (SO_SNDTIMEO)
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void send_reply(int fd, int http, const char *status, const char *type, const char *body, size_t len) {
+    if (http) {
+        char head[160];
+        int n = snprintf(head, sizeof(head),
+                         "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                         status, type, len);
+        send_all(fd, head, (size_t)n);
+    }
+    send_all(fd, body, len);
+}
+
+// Profiler commands: "" (the folded stacks), "start" with an optional rate, or "stop".
+static void serve_profile(int fd, int http, const char *cmd, int hz) {
+    char msg[160];
+    if (strcmp(cmd, "start") == 0) {
+        char err[128];
+        if (Profiler_start(hz, err, sizeof(err)) != 0) {
+            snprintf(msg, sizeof(msg), "error: %s\n", err);
+            send_reply(fd, http, "400 Bad Request", "text/plain", msg, strlen(msg));
+            return;
+        }
+        snprintf(msg, sizeof(msg), "profiling at %d Hz\n", Profiler_running());
+    } else if (strcmp(cmd, "stop") == 0) {
+        snprintf(msg, sizeof(msg), "stopped after %lu samples\n", Profiler_stop());
+    } else if (cmd[0] == '\0') {
+        size_t len = 0;
+        char *folded = Profiler_folded(&len);
+        if (folded == NULL) {
+            LOG_METRICS_ERROR("%s", "Out of memory rendering the profile.");
+            return;
+        }
+        send_reply(fd, http, "200 OK", "text/plain", folded, len);
+        free(folded);
+        return;
+    } else {
+        snprintf(msg, sizeof(msg), "error: unknown profiler command '%.40s'\n", cmd);
+        send_reply(fd, http, "404 Not Found", "text/plain", msg, strlen(msg));
+        return;
+    }
+    send_reply(fd, http, "200 OK", "text/plain", msg, strlen(msg));
+}
+
+static void serve_client(int fd) {
+    struct timeval tv = { SEND_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // The request is one line; a client that sends nothing gets the Prometheus text.
+    char req[512];
+    size_t len = 0;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (len < sizeof(req) - 1 && memchr(req, '\n', len) == NULL && poll(&pfd, 1, REQUEST_TIMEOUT_MS) > 0) {
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    req[len] = '\0';
+    char *eol = strpbrk(req, "\r\n");
+    if (eol != NULL) *eol = '\0';
+
+    int http = strstr(req, " HTTP/") != NULL;
+    int json;
+    if (http) {
+        if (strncmp(req, "GET ", 4) != 0) {
+            static const char reply[] = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            send_all(fd, reply, sizeof(reply) - 1);
+            return;
+        }
+        char *path = req + 4;
+        char *end = strchr(path, ' ');
+        if (end != NULL) *end = '\0';
+        if (strncmp(path, "/profile", 8) == 0 && (path[8] == '\0' || path[8] == '/' || path[8] == '?')) {
+            const char *query = strstr(path, "hz=");
+            char *q = strchr(path, '?');
+            if (q != NULL) *q = '\0';
+            serve_profile(fd, http, path[8] == '/' ? path + 9 : "", query != NULL ? atoi(query + 3) : 0);
+            return;
+        }
+        json = strstr(path, ".json") != NULL || strstr(path, "format=json") != NULL;
+    } else {
+        if (strncmp(req, "profile", 7) == 0 && (req[7] == '\0' || req[7] == ' ')) {
+            char cmd[16] = "";
+            int hz = 0;
+            sscanf(req + 7, "%15s %d", cmd, &hz);
+            serve_profile(fd, http, cmd, hz);
+            return;
+        }
+        json = strcmp(req, "json") == 0;
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    text_t t = { NULL, 0, 0, 0 };
+    if (json) {
+        body = render_json();
+        if (body != NULL) body_len = strlen(body);
+    } else {
+        t.cap = 4096;
+        t.data = malloc(t.cap);
+        if (t.data == NULL) t.failed = 1;
+        render_prometheus(&t);
+        if (!t.failed) {
+            body = t.data;
+            body_len = t.len;
+        }
+    }
+    if (body == NULL) {
+        LOG_METRICS_ERROR("%s", "Out of memory rendering metrics.");
+        free(t.data);
+        return;
+    }
+    if (http) {
+        char head[160];
+        int n = snprintf(head, sizeof(head),
+                         "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                         json ? "application/json" : "text/plain; version=0.0.4", body_len + (json ? 1 : 0));
+        send_all(fd, head, (size_t)n);
+    }
+    send_all(fd, body, body_len);
+    if (json) {
+        send_all(fd, "\n", 1);
+        cJSON_free(body);
+    } else {
+        free(t.data);
+    }
+}
+
+static void *server_main(void *arg) {
+    (void)arg;
+    struct pollfd fds[2] = { { wake_fd, POLLIN, 0 }, { listen_fd, POLLIN, 0 } };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            LOG_METRICS_ERROR("poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) break; // Stop requested
+        if (!(fds[1].revents & POLLIN)) continue;
+        // One client at a time: a scrape takes well under a millisecond.
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        serve_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int Metrics_start(const char *path) {
+    if (server_running) return 0;
+    if (path == NULL) path = getenv("WR_METRICS_SOCKET");
+    if (path == NULL || path[0] == '\0') path = METRICS_DEFAULT_SOCKET;
+    if (strlen(path) >= sizeof(socket_path)) {
+        LOG_METRICS_ERROR("Socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(socket_path, path);
+
+    // Create the parent directory (one level, e.g. /run/whiterails) if it is missing.
+    char dir[sizeof(socket_path)];
+    strcpy(dir, socket_path);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL && slash != dir) {
+        *slash = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            LOG_METRICS_ERROR("Cannot create %s: %s", dir, strerror(errno));
+            return -1;
+        }
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOG_METRICS_ERROR("socket failed: %s", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path); // Stale socket from a previous run
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+        LOG_METRICS_ERROR("Cannot listen on %s: %s", socket_path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    chmod(socket_path, 0660);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0 || pthread_create(&server_thread, NULL, server_main, NULL) != 0) {
+        LOG_METRICS_ERROR("%s", "Cannot start the metrics thread.");
+        if (wake_fd >= 0) close(wake_fd);
+        close(listen_fd);
+        wake_fd = listen_fd = -1;
+        unlink(socket_path);
+        return -1;
+    }
+    server_running = 1;
+    LOG_METRICS_INFO("Serving metrics on %s", socket_path);
+    return 0;
+}
+
+void Metrics_stop(void) {
+    if (!server_running) return;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) { /* Thread is awake anyway */ }
+    pthread_join(server_thread, NULL);
+    server_running = 0;
+    close(wake_fd);
+    close(listen_fd);
+    wake_fd = listen_fd = -1;
+    unlink(socket_path);
+}
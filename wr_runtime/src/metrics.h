@@ -0,0 +1,64 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_DEFAULT_SOCKET "/run/whiterails/metrics.sock"
+#define METRICS_SUB_BITS 5     // Histogram buckets per power of two: 2^5, i.e. ~3% resolution
+#define METRICS_MAX_EXP 45     // Durations are kept in nanoseconds, up to 2^46 ns (~19 hours)
+#define METRICS_MAX_SERIES 128 // Series per family, including the overflow one below
+#define METRICS_OVERFLOW_LABEL "_other"
+
+// Metric families. Each has at most one label; a series (family + label value) is created
+// on first use and lives until the daemon exits. Once a family has METRICS_MAX_SERIES
+// series, new label values share the METRICS_OVERFLOW_LABEL one, so memory stays bounded
+// however many services are loaded.
+typedef enum {
+    METRIC_CONDITION_SECONDS,   // Condition evaluation time, per service
+    METRIC_CONDITION_MET,       // Evaluations that were met, per service
+    METRIC_CONDITION_ERRORS,    // Evaluations that failed, per service
+    METRIC_SERVICE_RUN_SECONDS, // Time to run all actions of a triggered service, per service
+    METRIC_ACTION_SECONDS,      // Time in the action (dispatch to return), per action type
+    METRIC_ACTION_FAILURES,     // Actions whose command exited non-zero or was killed, per type
+    METRIC_SPAWN_SECONDS,       // Time to start a child, per path ("helper" or "fork")
+    METRIC_LOOP_LAG_SECONDS,    // How late the main loop woke up for its tick
+    METRIC_TICK_SECONDS,        // Time to process one main loop tick (all due services)
+    METRIC_ACTIONS_IN_FLIGHT,   // Actions currently running
+    METRIC_SERVICES_LOADED,     // Services in the last loaded configuration
+    METRIC_SPOOL_BACKLOG,       // Commands waiting in the spool's new/ directory
+    METRIC_SPOOL_COMMANDS,      // Spool commands handled, per outcome
+    METRIC_FAMILY_COUNT
+} metric_family_t;
+
+// Metrics registry. Updates are relaxed atomic adds (a histogram also keeps its maximum
+// with a CAS) and series lookups are lock-free, so hooks cost well under a microsecond.
+// Histograms are HDR-style: log-linear buckets with METRICS_SUB_BITS of precision.
+// A Unix stream socket ($WR_METRICS_SOCKET or METRICS_DEFAULT_SOCKET) serves them:
+//   - an HTTP GET ("curl --unix-socket <sock> http://localhost/metrics") gets the
+//     Prometheus text format; a path ending in ".json" (or "?format=json") gets JSON;
+//   - a plain "json" line gets JSON, anything else (or nothing) the Prometheus text,
+//     after which the connection is closed;
+//   - "/profile/start?hz=N", "/profile/stop" and "/profile" (or the lines "profile start
+//     [N]", "profile stop" and "profile") control the sampling profiler (profiler.h)
+//     and fetch its folded stacks.
+// Histograms are exported as Prometheus summaries (quantiles 0.5, 0.9, 0.99, 0.999 and 1,
+// the exact maximum), in seconds.
+
+// Monotonic clock, for measuring what is passed to Metrics_observe().
+uint64_t Metrics_now_ns(void);
+
+// Record one duration in a histogram family. 'label' is NULL for unlabelled families.
+void Metrics_observe(metric_family_t family, const char *label, uint64_t duration_ns);
+
+// Add to a counter, or to / set a gauge.
+void Metrics_add(metric_family_t family, const char *label, int64_t delta);
+void Metrics_set(metric_family_t family, const char *label, int64_t value);
+
+// Bind the socket ('socket_path' NULL: $WR_METRICS_SOCKET or METRICS_DEFAULT_SOCKET) and
+// start the serving thread. Returns 0 or -1; metrics are still collected then.
+int Metrics_start(const char *socket_path);
+
+// Stop serving and remove the socket.
+void Metrics_stop(void);
+
+#endif // METRICS_H
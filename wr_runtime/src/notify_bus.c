@@ -0,0 +1,441 @@
+#define _GNU_SOURCE // For accept4, SOCK_CLOEXEC, eventfd
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>  // For mkdir, chmod
+#include <sys/un.h>
+
+#include "cJSON.h" // Found via CFLAGS -I deps/cJSON
+#include "notify_bus.h"
+#include "logger.h"
+
+#define LOG_BUS_INFO(fmt, ...) WR_LOG_INFO("notify_bus", fmt, ##__VA_ARGS__)
+#define LOG_BUS_ERROR(fmt, ...) WR_LOG_ERROR("notify_bus", fmt, ##__VA_ARGS__)
+
+#define FRAME_HEADER 4 // Big-endian payload length
+
+// One distinct notification within the current window.
+typedef struct {
+    uint64_t hash;
+    char *service;
+    char *message;
+    unsigned count;
+    long long first_ms;
+    long long last_ms;
+} pending_t;
+
+typedef struct {
+    int fd;
+    char *queue;            // Framed batches not yet written
+    size_t capacity;
+    size_t queued;
+    size_t sent;            // Bytes of 'queue' already written
+    unsigned long dropped_batches;
+    unsigned long dropped_notifications;
+} subscriber_t;
+
+static pthread_mutex_t bus_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pending_t pending[NOTIFY_BUS_MAX_PENDING]; // Guarded by bus_mutex
+static int pending_count = 0;
+static unsigned long pending_overflow = 0;
+static int bus_running = 0;
+static int bus_stopping = 0;
+
+// Bus thread state
+static pthread_t bus_thread;
+static int wake_fd = -1;   // eventfd: a window opened, or stop was requested
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static subscriber_t subscribers[NOTIFY_BUS_MAX_SUBSCRIBERS];
+static int subscriber_count = 0;
+
+static long long wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long long mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a over service and message, so most lookups compare a single integer.
+static uint64_t notification_hash(const char *service, const char *message) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *p = service; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    h = (h ^ 0xff) * 1099511628211ULL;
+    for (const char *p = message; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    return h;
+}
+
+int NotifyBus_publish(const char *service, const char *message) {
+    if (service == NULL) service = "";
+    char truncated[NOTIFY_BUS_MAX_MESSAGE + 1];
+    if (strlen(message) > NOTIFY_BUS_MAX_MESSAGE) {
+        memcpy(truncated, message, NOTIFY_BUS_MAX_MESSAGE);
+        truncated[NOTIFY_BUS_MAX_MESSAGE] = '\0';
+        message = truncated;
+    }
+    uint64_t hash = notification_hash(service, message);
+    long long now = wall_ms();
+    int wake = 0;
+
+    pthread_mutex_lock(&bus_mutex);
+    if (!bus_running || bus_stopping) {
+        pthread_mutex_unlock(&bus_mutex);
+        return -1;
+    }
+    wake = pending_count == 0 && pending_overflow == 0;
+    int i;
+    for (i = 0; i < pending_count; i++) {
+        pending_t *p = &pending[i];
+        if (p->hash == hash && strcmp(p->message, message) == 0 && strcmp(p->service, service) == 0) {
+            p->count++;
+            p->last_ms = now;
+            break;
+        }
+    }
+    if (i == pending_count) {
+        pending_t *p = &pending[pending_count];
+        if (pending_count < NOTIFY_BUS_MAX_PENDING && (p->service = strdup(service)) != NULL) {
+            p->message = strdup(message);
+            if (p->message == NULL) {
+                free(p->service);
+                pending_overflow++;
+            } else {
+                p->hash = hash;
+                p->count = 1;
+                p->first_ms = p->last_ms = now;
+                pending_count++;
+            }
+        } else {
+            pending_overflow++;
+        }
+    }
+    pthread_mutex_unlock(&bus_mutex);
+
+    // Only the first notification of a window costs a syscall.
+    if (wake) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) { /* Counter saturated: already awake */ }
+    }
+    return 0;
+}
+
+// Build one framed batch from the pending table and reset it. Returns NULL if empty.
+static char *take_batch(size_t *frame_len, unsigned long *notifications) {
+    pthread_mutex_lock(&bus_mutex);
+    if (pending_count == 0 && pending_overflow == 0) {
+        pthread_mutex_unlock(&bus_mutex);
+        return NULL;
+    }
+    cJSON *root = cJSON_CreateObject();
+    cJSON *list = cJSON_AddArrayToObject(root, "notifications");
+    *notifications = pending_overflow;
+    for (int i = 0; i < pending_count; i++) {
+        pending_t *p = &pending[i];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "service", p->service);
+        cJSON_AddStringToObject(item, "message", p->message);
+        cJSON_AddNumberToObject(item, "count", p->count);
+        cJSON_AddNumberToObject(item, "first_ms", (double)p->first_ms);
+        cJSON_AddNumberToObject(item, "last_ms", (double)p->last_ms);
+        cJSON_AddItemToArray(list, item);
+        if (p->count > 1) {
+            LOG_BUS_INFO("Service '%s': %s (x%u)", p->service, p->message, p->count);
+        } else {
+            LOG_BUS_INFO("Service '%s': %s", p->service, p->message);
+        }
+        *notifications += p->count;
+        free(p->service);
+        free(p->message);
+    }
+    cJSON_AddNumberToObject(root, "overflow", (double)pending_overflow);
+    if (pending_overflow > 0) LOG_BUS_INFO("%lu more notifications in this window not logged.", pending_overflow);
+    pending_count = 0;
+    pending_overflow = 0;
+    pthread_mutex_unlock(&bus_mutex);
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json == NULL) return NULL;
+    size_t len = strlen(json);
+    char *frame = malloc(FRAME_HEADER + len);
+    if (frame != NULL) {
+        frame[0] = (char)(len >> 24);
+        frame[1] = (char)(len >> 16);
+        frame[2] = (char)(len >> 8);
+        frame[3] = (char)len;
+        memcpy(frame + FRAME_HEADER, json, len);
+        *frame_len = FRAME_HEADER + len;
+    }
+    cJSON_free(json);
+    return frame;
+}
+
+// Append raw bytes to a subscriber's queue, growing it as needed.
+static int queue_bytes(subscriber_t *s, const char *data, size_t len) {
+    if (s->sent > 0) {
+        memmove(s->queue, s->queue + s->sent, s->queued - s->sent);
+        s->queued -= s->sent;
+        s->sent = 0;
+    }
+    if (s->queued + len > s->capacity) {
+        size_t cap = s->queued + len > NOTIFY_BUS_QUEUE_BYTES ? s->queued + len : NOTIFY_BUS_QUEUE_BYTES;
+        char *grown = realloc(s->queue, cap);
+        if (grown == NULL) return -1;
+        s->queue = grown;
+        s->capacity = cap;
+    }
+    memcpy(s->queue + s->queued, data, len);
+    s->queued += len;
+    return 0;
+}
+
+// Unsent data is capped at NOTIFY_BUS_QUEUE_BYTES, except that an idle subscriber always
+// takes the next batch however large. Batches that do not fit are dropped whole and
+// summarized ahead of the next one that does.
+static void queue_batch(subscriber_t *s, const char *frame, size_t len, unsigned long notifications) {
+    char summary[96];
+    size_t summary_len = 0;
+    if (s->dropped_batches > 0) {
+        int n = snprintf(summary + FRAME_HEADER, sizeof(summary) - FRAME_HEADER,
+                         "{\"dropped\":{\"batches\":%lu,\"notifications\":%lu}}",
+                         s->dropped_batches, s->dropped_notifications);
+        summary[0] = summary[1] = 0;
+        summary[2] = (char)(n >> 8);
+        summary[3] = (char)n;
+        summary_len = FRAME_HEADER + (size_t)n;
+    }
+    size_t unsent = s->queued - s->sent;
+    if ((unsent == 0 || unsent + summary_len + len <= NOTIFY_BUS_QUEUE_BYTES) &&
+        (summary_len == 0 || queue_bytes(s, summary, summary_len) == 0)) {
+        s->dropped_batches = 0;
+        s->dropped_notifications = 0;
+        if (queue_bytes(s, frame, len) == 0) return;
+    }
+    s->dropped_batches++;
+    s->dropped_notifications += notifications;
+}
+
+static void drop_subscriber(int idx) {
+    close(subscribers[idx].fd);
+    free(subscribers[idx].queue);
+    subscribers[idx] = subscribers[--subscriber_count];
+}
+
+// Write as much of the queue as the socket takes. Returns -1 if the subscriber is gone.
+static int flush_subscriber(subscriber_t *s) {
+    while (s->sent < s->queued) {
+        ssize_t n = send(s->fd, s->queue + s->sent, s->queued - s->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        s->sent += (size_t)n;
+    }
+    s->queued = s->sent = 0;
+    if (s->capacity > NOTIFY_BUS_QUEUE_BYTES) { // Give back the room of an oversized batch
+        free(s->queue);
+        s->queue = NULL;
+        s->capacity = 0;
+    }
+    return 0;
+}
+
+static void accept_subscribers(void) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        if (subscriber_count == NOTIFY_BUS_MAX_SUBSCRIBERS) {
+            LOG_BUS_ERROR("Too many subscribers (%d), refusing connection.", NOTIFY_BUS_MAX_SUBSCRIBERS);
+            close(fd);
+            continue;
+        }
+        subscriber_t *s = &subscribers[subscriber_count];
+        memset(s, 0, sizeof(*s));
+        s->fd = fd;
+        subscriber_count++; // The queue is allocated with the first batch
+    }
+}
+
+static void publish_batch(void) {
+    size_t len = 0;
+    unsigned long notifications = 0;
+    char *frame = take_batch(&len, &notifications);
+    if (frame == NULL) return;
+    for (int i = subscriber_count - 1; i >= 0; i--) {
+        queue_batch(&subscribers[i], frame, len, notifications);
+        if (flush_subscriber(&subscribers[i]) != 0) drop_subscriber(i);
+    }
+    free(frame);
+}
+
+static void *bus_main(void *arg) {
+    (void)arg;
+    struct pollfd fds[2 + NOTIFY_BUS_MAX_SUBSCRIBERS];
+    long long window_end = -1; // Monotonic deadline of the open window, -1 if none
+
+    for (;;) {
+        fds[0].fd = wake_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = listen_fd;
+        fds[1].events = POLLIN;
+        for (int i = 0; i < subscriber_count; i++) {
+            fds[2 + i].fd = subscribers[i].fd;
+            fds[2 + i].events = POLLIN | (subscribers[i].queued > subscribers[i].sent ? POLLOUT : 0);
+        }
+        int timeout = -1;
+        if (window_end >= 0) {
+            long long left = window_end - mono_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        int nfds = 2 + subscriber_count;
+        int ready = poll(fds, (nfds_t)nfds, timeout);
+        if (ready < 0 && errno != EINTR) {
+            LOG_BUS_ERROR("poll failed: %s", strerror(errno));
+            break;
+        }
+
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0) { /* Spurious wakeup */ }
+            if (window_end < 0) window_end = mono_ms() + NOTIFY_BUS_WINDOW_MS;
+        }
+        pthread_mutex_lock(&bus_mutex);
+        int stopping = bus_stopping;
+        pthread_mutex_unlock(&bus_mutex);
+        if (stopping) {
+            publish_batch();
+            break;
+        }
+        if (window_end >= 0 && mono_ms() >= window_end) {
+            window_end = -1;
+            publish_batch();
+        }
+        if (ready <= 0) continue;
+
+        // Subscribers never send anything: readable means closed (or misbehaving).
+        for (int i = subscriber_count - 1; i >= 0; i--) {
+            short rev = fds[2 + i].revents;
+            if (fds[2 + i].fd != subscribers[i].fd) continue; // Slot reused this round
+            if (rev & (POLLERR | POLLHUP | POLLNVAL | POLLIN)) {
+                char sink[256];
+                if ((rev & (POLLERR | POLLNVAL)) || recv(subscribers[i].fd, sink, sizeof(sink), MSG_DONTWAIT) <= 0) {
+                    drop_subscriber(i);
+                    continue;
+                }
+            }
+            if ((rev & POLLOUT) && flush_subscriber(&subscribers[i]) != 0) {
+                drop_subscriber(i);
+            }
+        }
+        if (fds[1].revents & POLLIN) accept_subscribers();
+    }
+
+    // Give subscribers what is already queued, without waiting on slow ones.
+    while (subscriber_count > 0) {
+        flush_subscriber(&subscribers[subscriber_count - 1]);
+        drop_subscriber(subscriber_count - 1);
+    }
+    return NULL;
+}
+
+int NotifyBus_start(const char *path) {
+    if (bus_running) return 0;
+    if (path == NULL) path = getenv("WR_NOTIFY_SOCKET");
+    if (path == NULL || path[0] == '\0') path = NOTIFY_BUS_DEFAULT_SOCKET;
+    if (strlen(path) >= sizeof(socket_path)) {
+        LOG_BUS_ERROR("Socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(socket_path, path);
+
+    // Create the parent directory (one level, e.g. /run/whiterails) if it is missing.
+    char dir[sizeof(socket_path)];
+    strcpy(dir, socket_path);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL && slash != dir) {
+        *slash = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            LOG_BUS_ERROR("Cannot create %s: %s", dir, strerror(errno));
+            return -1;
+        }
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOG_BUS_ERROR("socket failed: %s", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path); // Stale socket from a previous run
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+        LOG_BUS_ERROR("Cannot listen on %s: %s", socket_path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    chmod(socket_path, 0660);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        LOG_BUS_ERROR("eventfd failed: %s", strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path);
+        return -1;
+    }
+    bus_stopping = 0;
+    bus_running = 1;
+    if (pthread_create(&bus_thread, NULL, bus_main, NULL) != 0) {
+        LOG_BUS_ERROR("%s", "Cannot start the bus thread.");
+        bus_running = 0;
+        close(wake_fd);
+        close(listen_fd);
+        wake_fd = listen_fd = -1;
+        unlink(socket_path);
+        return -1;
+    }
+    LOG_BUS_INFO("Listening for subscribers on %s", socket_path);
+    return 0;
+}
+
+void NotifyBus_stop(void) {
+    if (!bus_running) return;
+    pthread_mutex_lock(&bus_mutex);
+    bus_stopping = 1;
+    pthread_mutex_unlock(&bus_mutex);
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) { /* Thread is awake anyway */ }
+    pthread_join(bus_thread, NULL);
+
+    pthread_mutex_lock(&bus_mutex);
+    bus_running = 0;
+    for (int i = 0; i < pending_count; i++) {
+        free(pending[i].service);
+        free(pending[i].message);
+    }
+    pending_count = 0;
+    pending_overflow = 0;
+    pthread_mutex_unlock(&bus_mutex);
+
+    close(wake_fd);
+    close(listen_fd);
+    wake_fd = listen_fd = -1;
+    unlink(socket_path);
+}
@@ -0,0 +1,34 @@
+#ifndef NOTIFY_BUS_H
+#define NOTIFY_BUS_H
+
+#define NOTIFY_BUS_DEFAULT_SOCKET "/run/whiterails/notify.sock"
+#define NOTIFY_BUS_WINDOW_MS 200           // Coalescing window: at most one batch per window
+#define NOTIFY_BUS_MAX_PENDING 256         // Distinct notifications held per window
+#define NOTIFY_BUS_MAX_MESSAGE 1024        // Longer messages are truncated
+#define NOTIFY_BUS_MAX_SUBSCRIBERS 16
+#define NOTIFY_BUS_QUEUE_BYTES (256 * 1024) // Unsent data kept per subscriber
+
+// Notification bus. The notify action publishes here; subscribers (a desktop agent, the
+// UI runtime, ...) connect to a Unix stream socket and read batches. Each batch is a
+// 4-byte big-endian length followed by that many bytes of JSON:
+//   {"notifications":[{"service":..., "message":..., "count":N,
+//                      "first_ms":..., "last_ms":...}, ...], "overflow":N}
+// Identical (service, message) pairs published within one window arrive once with a
+// count; "overflow" counts notifications beyond NOTIFY_BUS_MAX_PENDING distinct ones.
+// A subscriber that does not keep up has whole batches dropped once its queue is full,
+// and then receives {"dropped":{"batches":N,"notifications":M}} before the next batch.
+
+// Bind the socket ('socket_path' NULL: $WR_NOTIFY_SOCKET or NOTIFY_BUS_DEFAULT_SOCKET) and
+// start the bus thread. Returns 0 or -1; notify keeps working without subscribers then.
+int NotifyBus_start(const char *socket_path);
+
+// Flush pending notifications, stop the thread, disconnect subscribers, remove the socket.
+void NotifyBus_stop(void);
+
+// Queue a notification for the next batch. Cheap and non-blocking: it only touches the
+// bus thread when a new window opens. Each batch is also logged, one INFO line per
+// distinct notification, so a flood costs a few lines per window rather than one per
+// call. Returns 0, or -1 (nothing queued or logged) while the bus is not running.
+int NotifyBus_publish(const char *service, const char *message);
+
+#endif // NOTIFY_BUS_H
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE // For memfd_create, splice, SPLICE_F_*
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>      // For splice
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>   // For memfd_create, mmap
+
+#include "output_ring.h"
+#include "service_loader.h" // For MAX_SERVICE_NAME_LEN, MAX_SERVICES
+#include "logger.h"
+
+#define LOG_RING_ERROR(fmt, ...) WR_LOG_ERROR("output_ring", fmt, ##__VA_ARGS__)
+
+#define RING_CHUNK_MAX 65536 // Default pipe capacity; one splice moves at most this much
+
+struct output_ring {
+    char name[MAX_SERVICE_NAME_LEN];
+    int in_use;
+    int memfd;          // Backing memfd, -1 when using the heap fallback
+    char *data;         // mmap of memfd (or malloc'd buffer)
+    size_t size;
+    uint64_t head;      // Total bytes ever written; data[head % size] is the next write slot
+    int forward;        // Also copy output to the daemon's stdout
+    unsigned long last_used;
+    pthread_mutex_t lock;
+};
+
+// Rings are allocated one by one so pointers handed out stay valid as the table grows.
+static output_ring_t **rings = NULL;
+static int ring_count = 0;
+static int ring_capacity = 0;
+static int ring_limit = MAX_OUTPUT_RINGS; // Rings kept before the least recently used is recycled
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long ring_clock = 0;
+
+static void ring_release_storage(output_ring_t *r) {
+    if (r->data) {
+        if (r->memfd >= 0) munmap(r->data, r->size);
+        else free(r->data);
+    }
+    if (r->memfd >= 0) close(r->memfd);
+    r->data = NULL;
+    r->memfd = -1;
+    r->size = 0;
+    r->head = 0;
+}
+
+static int ring_alloc_storage(output_ring_t *r, size_t size) {
+    char memfd_name[MAX_SERVICE_NAME_LEN + 8];
+    snprintf(memfd_name, sizeof(memfd_name), "wr_out:%s", r->name);
+    r->memfd = memfd_create(memfd_name, MFD_CLOEXEC);
+    if (r->memfd >= 0) {
+        if (ftruncate(r->memfd, (off_t)size) == 0) {
+            void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, r->memfd, 0);
+            if (map != MAP_FAILED) {
+                r->data = map;
+                r->size = size;
+                return 0;
+            }
+        }
+        close(r->memfd);
+        r->memfd = -1;
+    }
+    // No memfd (old kernel, seccomp): plain heap buffer filled with read().
+    r->data = malloc(size);
+    if (!r->data) return -1;
+    r->size = size;
+    return 0;
+}
+
+// Append a fresh slot to the registry. Caller holds registry_lock.
+static output_ring_t *ring_add_slot(void) {
+    if (ring_count == ring_capacity) {
+        int capacity = ring_capacity > 0 ? ring_capacity * 2 : 32;
+        output_ring_t **grown = realloc(rings, (size_t)capacity * sizeof(*grown));
+        if (grown == NULL) return NULL;
+        rings = grown;
+        ring_capacity = capacity;
+    }
+    output_ring_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) return NULL;
+    rings[ring_count++] = r;
+    return r;
+}
+
+void OutRing_reserve(int count) {
+    if (count < MAX_OUTPUT_RINGS) count = MAX_OUTPUT_RINGS;
+    if (count > MAX_SERVICES) count = MAX_SERVICES;
+    pthread_mutex_lock(&registry_lock);
+    ring_limit = count;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+output_ring_t *OutRing_get(const char *service_name, int size_kb, int forward) {
+    if (size_kb <= 0) size_kb = OUTPUT_RING_DEFAULT_KB;
+    if (size_kb > OUTPUT_RING_MAX_KB) size_kb = OUTPUT_RING_MAX_KB;
+    size_t size = (size_t)size_kb * 1024;
+
+    pthread_mutex_lock(&registry_lock);
+    output_ring_t *victim = NULL;
+    output_ring_t *found = NULL;
+    for (int i = 0; i < ring_count && !found; i++) {
+        output_ring_t *r = rings[i];
+        if (r->in_use && strcmp(r->name, service_name) == 0) {
+            found = r;
+        } else if (!r->in_use) {
+            if (!victim || victim->in_use) victim = r;
+        } else if (!victim || (victim->in_use && r->last_used < victim->last_used)) {
+            victim = r;
+        }
+    }
+
+    if (found) {
+        pthread_mutex_lock(&found->lock);
+        found->forward = forward;
+        found->last_used = ++ring_clock;
+        if (found->size != size) {
+            ring_release_storage(found);
+            if (ring_alloc_storage(found, size) != 0) {
+                LOG_RING_ERROR("Cannot resize output ring for '%s'.", service_name);
+                found->in_use = 0;
+                pthread_mutex_unlock(&found->lock);
+                pthread_mutex_unlock(&registry_lock);
+                return NULL;
+            }
+        }
+        pthread_mutex_unlock(&found->lock);
+        pthread_mutex_unlock(&registry_lock);
+        return found;
+    }
+
+    // Recycle only once the registry holds as many rings as there are services to serve.
+    output_ring_t *r = victim;
+    if ((r == NULL || r->in_use) && ring_count < ring_limit) {
+        output_ring_t *slot = ring_add_slot();
+        if (slot != NULL) r = slot;
+    }
+    if (r == NULL) {
+        LOG_RING_ERROR("Cannot allocate output ring for '%s'.", service_name);
+        pthread_mutex_unlock(&registry_lock);
+        return NULL;
+    }
+    if (r->in_use) {
+        pthread_mutex_lock(&r->lock);
+        ring_release_storage(r);
+        pthread_mutex_unlock(&r->lock);
+    } else {
+        pthread_mutex_init(&r->lock, NULL);
+        r->memfd = -1;
+    }
+    strncpy(r->name, service_name, sizeof(r->name) - 1);
+    r->name[sizeof(r->name) - 1] = '\0';
+    r->forward = forward;
+    r->head = 0;
+    r->last_used = ++ring_clock;
+    if (ring_alloc_storage(r, size) != 0) {
+        LOG_RING_ERROR("Cannot allocate %d KB output ring for '%s'.", size_kb, service_name);
+        r->in_use = 0;
+        pthread_mutex_unlock(&registry_lock);
+        return NULL;
+    }
+    r->in_use = 1;
+    pthread_mutex_unlock(&registry_lock);
+    return r;
+}
+
+output_ring_t *OutRing_find(const char *service_name) {
+    output_ring_t *found = NULL;
+    pthread_mutex_lock(&registry_lock);
+    for (int i = 0; i < ring_count; i++) {
+        if (rings[i]->in_use && strcmp(rings[i]->name, service_name) == 0) {
+            found = rings[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return found;
+}
+
+static void forward_span(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return; // Forwarding is best effort; the ring keeps the data
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// Move one chunk from 'fd' into the ring. Caller holds ring->lock.
+static ssize_t ring_fill_locked(output_ring_t *r, int fd) {
+    size_t pos = (size_t)(r->head % r->size);
+    size_t room = r->size - pos; // Never wrap inside one transfer
+    if (room > RING_CHUNK_MAX) room = RING_CHUNK_MAX;
+
+    ssize_t n;
+    if (r->memfd >= 0) {
+        loff_t off = (loff_t)pos;
+        n = splice(fd, NULL, r->memfd, &off, room, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINVAL) {
+            // Source is not a pipe (or the kernel refuses): keep the mapping, fill it with read().
+            n = read(fd, r->data + pos, room);
+        }
+    } else {
+        n = read(fd, r->data + pos, room);
+    }
+    if (n > 0) {
+        if (r->forward) forward_span(r->data + pos, (size_t)n);
+        r->head += (uint64_t)n;
+    }
+    return n;
+}
+
+long OutRing_drain_fd(output_ring_t *ring, int fd, int timeout_ms) {
+    long total = 0;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+            wait_ms = elapsed >= timeout_ms ? 0 : timeout_ms - (int)elapsed;
+        }
+        int ready = poll(&pfd, 1, wait_ms);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (ready == 0) {
+            errno = ETIMEDOUT; // Writers still hold the pipe open
+            return -1;
+        }
+        pthread_mutex_lock(&ring->lock);
+        ssize_t n = ring_fill_locked(ring, fd);
+        pthread_mutex_unlock(&ring->lock);
+        if (n > 0) {
+            total += n;
+        } else if (n == 0) {
+            return total; // EOF: every writer closed the pipe
+        } else if (errno != EAGAIN && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+void OutRing_write(output_ring_t *ring, const void *data, size_t len) {
+    const char *src = data;
+    pthread_mutex_lock(&ring->lock);
+    if (len > ring->size) { // Only the newest 'size' bytes can be retained
+        ring->head += len - ring->size;
+        src += len - ring->size;
+        if (ring->forward) forward_span(data, len - ring->size);
+        len = ring->size;
+    }
+    while (len > 0) {
+        size_t pos = (size_t)(ring->head % ring->size);
+        size_t chunk = ring->size - pos;
+        if (chunk > len) chunk = len;
+        memcpy(ring->data + pos, src, chunk);
+        if (ring->forward) forward_span(src, chunk);
+        ring->head += chunk;
+        src += chunk;
+        len -= chunk;
+    }
+    pthread_mutex_unlock(&ring->lock);
+}
+
+size_t OutRing_tail(output_ring_t *ring, char *buf, size_t max) {
+    pthread_mutex_lock(&ring->lock);
+    size_t avail = ring->head < ring->size ? (size_t)ring->head : ring->size;
+    size_t n = avail < max ? avail : max;
+    uint64_t start = ring->head - n;
+    size_t copied = 0;
+    while (copied < n) {
+        size_t pos = (size_t)((start + copied) % ring->size);
+        size_t chunk = ring->size - pos;
+        if (chunk > n - copied) chunk = n - copied;
+        memcpy(buf + copied, ring->data + pos, chunk);
+        copied += chunk;
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return n;
+}
+
+output_ring_t *OutRing_new(const char *label, int size_kb) {
+    if (size_kb <= 0) size_kb = OUTPUT_RING_DEFAULT_KB;
+    if (size_kb > OUTPUT_RING_MAX_KB) size_kb = OUTPUT_RING_MAX_KB;
+    output_ring_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) return NULL;
+    strncpy(r->name, label, sizeof(r->name) - 1);
+    r->memfd = -1;
+    if (ring_alloc_storage(r, (size_t)size_kb * 1024) != 0) {
+        free(r);
+        return NULL;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    r->in_use = 1;
+    return r;
+}
+
+void OutRing_clear(output_ring_t *ring) {
+    pthread_mutex_lock(&ring->lock);
+    ring->head = 0;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void OutRing_free(output_ring_t *ring) {
+    if (ring == NULL) return;
+    ring_release_storage(ring);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring);
+}
+
+void OutRing_free_all(void) {
+    pthread_mutex_lock(&registry_lock);
+    for (int i = 0; i < ring_count; i++) {
+        if (rings[i]->in_use) {
+            ring_release_storage(rings[i]);
+            pthread_mutex_destroy(&rings[i]->lock);
+        }
+        free(rings[i]);
+    }
+    free(rings);
+    rings = NULL;
+    ring_count = ring_capacity = 0;
+    pthread_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,52 @@
+#ifndef OUTPUT_RING_H
+#define OUTPUT_RING_H
+
+#include <stddef.h>  // For size_t
+#include <stdint.h>  // For uint64_t
+
+#define OUTPUT_RING_DEFAULT_KB 64
+#define OUTPUT_RING_MAX_KB 4096
+#define MAX_OUTPUT_RINGS 64 // Rings kept at least; rings outlive reloads, least recently used is recycled
+
+// Fixed-size, per-service capture buffer for action output (stdout and stderr).
+// The ring is backed by a memfd mapped into the daemon, so child output can be
+// moved from its pipe with splice() straight into the ring's pages: no per-line
+// reads, no allocation, one syscall per pipe-sized chunk. Older data is overwritten.
+typedef struct output_ring output_ring_t;
+
+// Get (or create) the ring for 'service_name'. Changing size_kb drops the old contents.
+// 'forward' copies captured output on to the daemon's stdout as it arrives.
+output_ring_t *OutRing_get(const char *service_name, int size_kb, int forward);
+
+// Keep up to 'count' named rings (at least MAX_OUTPUT_RINGS, at most MAX_SERVICES) before
+// recycling one, so every loaded service keeps its output. The scheduler passes its
+// service count.
+void OutRing_reserve(int count);
+
+// Drain a (non-blocking) pipe into the ring until EOF. Returns bytes captured or -1.
+// With timeout_ms >= 0, gives up after that long with errno ETIMEDOUT (call again to resume).
+long OutRing_drain_fd(output_ring_t *ring, int fd, int timeout_ms);
+
+// Append daemon-generated output (e.g. a native list_files result).
+void OutRing_write(output_ring_t *ring, const void *data, size_t len);
+
+// Copy up to 'max' of the most recent bytes into 'buf' (oldest first). Returns the count.
+size_t OutRing_tail(output_ring_t *ring, char *buf, size_t max);
+
+// Look up an existing ring by service name (NULL if the service never produced output).
+output_ring_t *OutRing_find(const char *service_name);
+
+// A ring outside the registry: never found by name or recycled, never forwarded. Used to
+// stage output before deciding whether it goes to a service's ring. NULL on failure.
+output_ring_t *OutRing_new(const char *label, int size_kb);
+
+// Drop the contents of a ring.
+void OutRing_clear(output_ring_t *ring);
+
+// Free a ring from OutRing_new().
+void OutRing_free(output_ring_t *ring);
+
+// Release every ring (daemon shutdown).
+void OutRing_free_all(void);
+
+#endif // OUTPUT_RING_H
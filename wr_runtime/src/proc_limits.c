@@ -0,0 +1,333 @@
+#define _GNU_SOURCE // For syscall(), O_DIRECTORY, O_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>        // For sweeping stale spawn groups
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>  // For setrlimit, setpriority
+#include <sys/stat.h>      // For mkdir
+#include <sys/syscall.h>
+
+#include "proc_limits.h"
+#include "logger.h"
+
+#define LOG_LIMITS_INFO(fmt, ...) WR_LOG_INFO("limits", fmt, ##__VA_ARGS__)
+#define LOG_LIMITS_ERROR(fmt, ...) WR_LOG_ERROR("limits", fmt, ##__VA_ARGS__)
+#define LOG_LIMITS_DEBUG(fmt, ...) WR_LOG_DEBUG("limits", fmt, ##__VA_ARGS__)
+
+#define CGROUP_MAX_LEFTOVERS 64 // Spawn groups still busy when their child was reaped, retried later
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+// struct clone_args up to CLONE_ARGS_SIZE_VER2 (the cgroup field); declared here because
+// <linux/sched.h> clashes with the libc's <sched.h> definitions.
+typedef struct {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+} wr_clone_args_t;
+
+long long ProcLimits_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int parse_size(const cJSON *item, long long *out) {
+    if (cJSON_IsNumber(item) && item->valuedouble >= 0) {
+        *out = (long long)item->valuedouble;
+        return 0;
+    }
+    if (!cJSON_IsString(item) || item->valuestring == NULL) return -1;
+    char *end = NULL;
+    long long value = strtoll(item->valuestring, &end, 10);
+    if (end == item->valuestring || value < 0) return -1;
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; end++; break;
+        case 'm': case 'M': value <<= 20; end++; break;
+        case 'g': case 'G': value <<= 30; end++; break;
+        default: break;
+    }
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end != '\0') return -1;
+    *out = value;
+    return 0;
+}
+
+static int parse_ioprio(const cJSON *item, proc_limits_t *out) {
+    if (cJSON_IsNumber(item) && item->valueint >= 0 && item->valueint <= 7) {
+        out->ioprio_class = 2; // Best effort
+        out->ioprio_level = item->valueint;
+        return 0;
+    }
+    if (!cJSON_IsString(item) || item->valuestring == NULL) return -1;
+    const char *s = item->valuestring;
+    if (strcmp(s, "idle") == 0) {
+        out->ioprio_class = 3;
+        out->ioprio_level = 0;
+        return 0;
+    }
+    int cls;
+    if (strncmp(s, "be:", 3) == 0) cls = 2;
+    else if (strncmp(s, "rt:", 3) == 0) cls = 1;
+    else return -1;
+    char *end = NULL;
+    long level = strtol(s + 3, &end, 10);
+    if (end == s + 3 || *end != '\0' || level < 0 || level > 7) return -1;
+    out->ioprio_class = cls;
+    out->ioprio_level = (int)level;
+    return 0;
+}
+
+int ProcLimits_from_json(const cJSON *action, proc_limits_t *out) {
+    memset(out, 0, sizeof(*out));
+    const cJSON *item;
+
+    item = cJSON_GetObjectItemCaseSensitive(action, "timeout_ms");
+    if (item) {
+        if (!cJSON_IsNumber(item) || item->valueint <= 0) {
+            LOG_LIMITS_ERROR("%s", "'timeout_ms' must be a positive number.");
+            return -1;
+        }
+        out->timeout_ms = item->valueint;
+    }
+    item = cJSON_GetObjectItemCaseSensitive(action, "max_rss");
+    if (item && (parse_size(item, &out->max_rss) != 0 || out->max_rss == 0)) {
+        LOG_LIMITS_ERROR("%s", "'max_rss' must be a byte count or a size like \"512M\".");
+        return -1;
+    }
+    item = cJSON_GetObjectItemCaseSensitive(action, "cpu_seconds");
+    if (item) {
+        if (!cJSON_IsNumber(item) || item->valueint <= 0) {
+            LOG_LIMITS_ERROR("%s", "'cpu_seconds' must be a positive number.");
+            return -1;
+        }
+        out->cpu_seconds = item->valueint;
+    }
+    item = cJSON_GetObjectItemCaseSensitive(action, "nice");
+    if (item) {
+        if (!cJSON_IsNumber(item) || item->valueint < -20 || item->valueint > 19) {
+            LOG_LIMITS_ERROR("%s", "'nice' must be a number between -20 and 19.");
+            return -1;
+        }
+        out->has_nice = 1;
+        out->nice = item->valueint;
+    }
+    item = cJSON_GetObjectItemCaseSensitive(action, "ioprio");
+    if (item && parse_ioprio(item, out) != 0) {
+        LOG_LIMITS_ERROR("%s", "'ioprio' must be \"idle\", \"be:0\"..\"be:7\", \"rt:0\"..\"rt:7\" or a number 0-7.");
+        return -1;
+    }
+    return 0;
+}
+
+static int write_file_at(int dirfd, const char *name, const char *value) {
+    int fd = openat(dirfd, name, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t len = (ssize_t)strlen(value);
+    ssize_t n = write(fd, value, (size_t)len);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n == len ? 0 : -1;
+}
+
+static atomic_ulong spawn_seq;
+static pthread_mutex_t leftover_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *leftovers[CGROUP_MAX_LEFTOVERS];
+static int swept = 0; // Guarded by leftover_lock
+
+// Remove the spawn groups of every service in 'root_fd', left by an earlier daemon. Busy
+// ones (their processes outlived it) stay.
+static void sweep_stale(int root_fd) {
+    int dup_fd = dup(root_fd);
+    DIR *root = dup_fd >= 0 ? fdopendir(dup_fd) : NULL;
+    if (root == NULL) {
+        if (dup_fd >= 0) close(dup_fd);
+        return;
+    }
+    struct dirent *svc;
+    while ((svc = readdir(root)) != NULL) {
+        if (svc->d_type != DT_DIR || svc->d_name[0] == '.') continue;
+        int svc_fd = openat(root_fd, svc->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *groups = svc_fd >= 0 ? fdopendir(svc_fd) : NULL;
+        if (groups == NULL) {
+            if (svc_fd >= 0) close(svc_fd);
+            continue;
+        }
+        struct dirent *g;
+        while ((g = readdir(groups)) != NULL) {
+            if (g->d_type == DT_DIR && g->d_name[0] != '.') unlinkat(svc_fd, g->d_name, AT_REMOVEDIR);
+        }
+        closedir(groups);
+    }
+    closedir(root);
+}
+
+// Open (creating it, with the memory controller delegated) the group of one service.
+// 'name' (128 bytes) receives its directory name.
+static int open_service_group(int root_fd, const char *service, char *name) {
+    // Names are sanitised so they stay a single path component.
+    size_t o = 0;
+    for (const char *s = service; *s && o + 1 < 128; s++) {
+        char ch = (*s == '/' || (o == 0 && *s == '.')) ? '_' : *s;
+        name[o++] = ch;
+    }
+    name[o] = '\0';
+    if (o == 0) strcpy(name, "_");
+    if (mkdirat(root_fd, name, 0755) != 0 && errno != EEXIST) {
+        LOG_LIMITS_ERROR("Cannot create cgroup '%s/%s': %s", PROC_LIMITS_CGROUP_ROOT, name, strerror(errno));
+        return -1;
+    }
+    int fd = openat(root_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    write_file_at(fd, "cgroup.subtree_control", "+memory"); // Best effort, as for the root
+    return fd;
+}
+
+int ProcLimits_cgroup_open(const char *service, const proc_limits_t *limits, char *path, size_t path_len) {
+    static int warned = 0;
+    if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) != 0) {
+        if (!warned) {
+            LOG_LIMITS_INFO("%s", "cgroup v2 not mounted at /sys/fs/cgroup, limits use rlimits only.");
+            warned = 1;
+        }
+        return -1;
+    }
+    if (mkdir(PROC_LIMITS_CGROUP_ROOT, 0755) != 0 && errno != EEXIST) {
+        if (!warned) {
+            LOG_LIMITS_INFO("Cannot create %s (%s), limits use rlimits only.", PROC_LIMITS_CGROUP_ROOT, strerror(errno));
+            warned = 1;
+        }
+        return -1;
+    }
+    // Delegate the memory controller down to the per-service groups (best effort: it may
+    // already be enabled, or be unavailable, in which case memory.max is missing below).
+    int root_fd = open(PROC_LIMITS_CGROUP_ROOT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) return -1;
+    write_file_at(root_fd, "cgroup.subtree_control", "+memory");
+    pthread_mutex_lock(&leftover_lock);
+    if (!swept) {
+        sweep_stale(root_fd);
+        swept = 1;
+    }
+    pthread_mutex_unlock(&leftover_lock);
+
+    // One directory per service, and in it one group per spawn: the limit is this
+    // action's alone, even with other actions of the service running at the same time.
+    char svc_name[128];
+    int svc_fd = open_service_group(root_fd, service, svc_name);
+    close(root_fd);
+    if (svc_fd < 0) return -1;
+    char name[32];
+    snprintf(name, sizeof(name), "%ld.%lu", (long)getpid(), (unsigned long)atomic_fetch_add(&spawn_seq, 1));
+    if (mkdirat(svc_fd, name, 0755) != 0) {
+        LOG_LIMITS_ERROR("Cannot create a cgroup for service '%s': %s", service, strerror(errno));
+        close(svc_fd);
+        return -1;
+    }
+    int fd = openat(svc_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        unlinkat(svc_fd, name, AT_REMOVEDIR);
+        close(svc_fd);
+        return -1;
+    }
+
+    char value[32];
+    if (limits->max_rss > 0) {
+        snprintf(value, sizeof(value), "%lld", limits->max_rss);
+    } else {
+        strcpy(value, "max");
+    }
+    if (write_file_at(fd, "memory.max", value) != 0) {
+        LOG_LIMITS_ERROR("Cannot set memory.max for service '%s': %s", service, strerror(errno));
+        close(fd);
+        unlinkat(svc_fd, name, AT_REMOVEDIR);
+        close(svc_fd);
+        return -1;
+    }
+    close(svc_fd);
+    if (path != NULL) snprintf(path, path_len, "%s/%s/%s", PROC_LIMITS_CGROUP_ROOT, svc_name, name);
+    return fd;
+}
+
+void ProcLimits_cgroup_remove(const char *path) {
+    pthread_mutex_lock(&leftover_lock);
+    // Groups whose background processes have exited since their child was reaped.
+    for (int i = 0; i < CGROUP_MAX_LEFTOVERS; i++) {
+        if (leftovers[i] != NULL && (rmdir(leftovers[i]) == 0 || errno == ENOENT)) {
+            free(leftovers[i]);
+            leftovers[i] = NULL;
+        }
+    }
+    if (rmdir(path) != 0 && errno == EBUSY) {
+        int kept = 0;
+        for (int i = 0; i < CGROUP_MAX_LEFTOVERS && !kept; i++) {
+            if (leftovers[i] == NULL) kept = (leftovers[i] = strdup(path)) != NULL;
+        }
+        LOG_LIMITS_DEBUG("cgroup '%s' still has processes, %s", path,
+                         kept ? "removed once they exit" : "left until the next start");
+    }
+    pthread_mutex_unlock(&leftover_lock);
+}
+
+pid_t ProcLimits_fork(int cgroup_fd, int *needs_join) {
+    *needs_join = 0;
+#ifdef SYS_clone3
+    if (cgroup_fd >= 0) {
+        // The child starts life inside the cgroup: no window where it runs unconstrained,
+        // and no cgroup.procs write (with its cgroup-wide lock) per spawn.
+        wr_clone_args_t args;
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_INTO_CGROUP;
+        args.exit_signal = SIGCHLD;
+        args.cgroup = (uint64_t)cgroup_fd;
+        long pid = syscall(SYS_clone3, &args, sizeof(args));
+        if (pid >= 0) return (pid_t)pid;
+        if (errno != ENOSYS && errno != E2BIG && errno != EINVAL) return -1;
+    }
+#endif
+    *needs_join = cgroup_fd >= 0; // Older kernel: the child moves itself before exec
+    return fork();
+}
+
+void ProcLimits_apply_child(const proc_limits_t *limits, int cgroup_fd, int needs_join) {
+    if (needs_join) {
+        write_file_at(cgroup_fd, "cgroup.procs", "0");
+    }
+    if (limits->has_nice) {
+        setpriority(PRIO_PROCESS, 0, limits->nice);
+    }
+    if (limits->ioprio_class != 0) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                (limits->ioprio_class << IOPRIO_CLASS_SHIFT) | limits->ioprio_level);
+    }
+    if (limits->cpu_seconds > 0) {
+        struct rlimit rl = { (rlim_t)limits->cpu_seconds, (rlim_t)limits->cpu_seconds + 1 };
+        setrlimit(RLIMIT_CPU, &rl);
+    }
+    if (limits->max_rss > 0 && cgroup_fd < 0) {
+        // Linux ignores RLIMIT_RSS; capping the address space is the closest rlimit.
+        struct rlimit rl = { (rlim_t)limits->max_rss, (rlim_t)limits->max_rss };
+        setrlimit(RLIMIT_AS, &rl);
+    }
+}
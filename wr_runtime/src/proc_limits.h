@@ -0,0 +1,50 @@
+#ifndef PROC_LIMITS_H
+#define PROC_LIMITS_H
+
+#include <sys/types.h> // For pid_t
+
+#include "cJSON.h"
+
+#define PROC_LIMITS_KILL_GRACE_MS 2000   // SIGTERM -> SIGKILL escalation delay
+#define PROC_LIMITS_CGROUP_ROOT "/sys/fs/cgroup/whiterails"
+
+// Per-action resource limits for spawned commands. Zero means "not set" for every field.
+// Plain data: the spawn helper receives it verbatim inside its request.
+typedef struct {
+    int timeout_ms;          // Watchdog: SIGTERM after this long, SIGKILL after the grace period
+    long long max_rss;       // Bytes; cgroup memory.max, or RLIMIT_AS when no cgroup is usable
+    int cpu_seconds;         // RLIMIT_CPU (SIGXCPU at the soft limit, SIGKILL one second later)
+    int has_nice;
+    int nice;                // -20..19
+    int ioprio_class;        // 0 = unchanged, else IOPRIO_CLASS_RT(1)/BE(2)/IDLE(3)
+    int ioprio_level;        // 0..7 within RT and BE
+} proc_limits_t;
+
+// Read timeout_ms, max_rss ("512M" or bytes), cpu_seconds, nice and ioprio ("idle",
+// "be:N", "rt:N" or a best-effort level) from an action. Logs and returns -1 if invalid.
+int ProcLimits_from_json(const cJSON *action, proc_limits_t *out);
+
+// Create and configure a cgroup v2 directory for one spawn, under the one of 'service' in
+// PROC_LIMITS_CGROUP_ROOT, so concurrent actions each get their own memory.max. Returns an
+// O_DIRECTORY fd for clone3(CLONE_INTO_CGROUP), or -1 when cgroup v2 is not mounted or not
+// writable, in which case rlimits are the only guard. The path is stored in 'path' (may be
+// NULL, but is needed for ProcLimits_cgroup_remove()).
+int ProcLimits_cgroup_open(const char *service, const proc_limits_t *limits, char *path, size_t path_len);
+
+// Remove a spawn's cgroup once its child was reaped. While processes it left behind still
+// run there, removal is retried by later calls (and at the next daemon start).
+void ProcLimits_cgroup_remove(const char *path);
+
+// Fork a child, placing it directly into the cgroup 'cgroup_fd' (-1: none) with clone3()
+// where the kernel supports it. Returns like fork(). In the child, call
+// ProcLimits_apply_child() next; it completes the cgroup move if clone3 was unavailable.
+pid_t ProcLimits_fork(int cgroup_fd, int *needs_join);
+
+// In the child, before exec: join the cgroup if needed, then apply nice, ioprio and rlimits.
+// Async-signal-safe. RLIMIT_AS stands in for max_rss only when 'cgroup_fd' is -1.
+void ProcLimits_apply_child(const proc_limits_t *limits, int cgroup_fd, int needs_join);
+
+// Monotonic milliseconds, for watchdog deadlines.
+long long ProcLimits_now_ms(void);
+
+#endif // PROC_LIMITS_H
@@ -0,0 +1,342 @@
+#define _GNU_SOURCE // For dladdr, dl_iterate_phdr, REG_RIP, open_memstream
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if !WR_PROFILE_FP && defined(__GLIBC__)
+#include <execinfo.h> // For backtrace
+#endif
+
+#include "profiler.h"
+#include "logger.h"
+
+#define LOG_PROF_INFO(fmt, ...) WR_LOG_INFO("profiler", fmt, ##__VA_ARGS__)
+
+// Set by 'make PROFILE=1', which also builds with -fno-omit-frame-pointer.
+#ifndef WR_PROFILE_FP
+#define WR_PROFILE_FP 0
+#endif
+
+#define FP_MAX_FRAME (256 * 1024) // A frame-pointer step larger than this is taken as garbage
+
+typedef struct {
+    _Atomic int ready;
+    int depth;
+    uintptr_t pc[PROFILER_MAX_DEPTH]; // Leaf first
+} sample_t;
+
+static sample_t *samples = NULL;
+static _Atomic unsigned long next_sample = 0; // Keeps counting once the buffer is full
+static _Atomic int rate = 0;
+static timer_t timer;
+static int timer_created = 0;
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --- Sampling (signal handler side) ---
+
+static uintptr_t context_pc(const ucontext_t *uc, uintptr_t *fp, uintptr_t *sp) {
+#if defined(__x86_64__)
+    *fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+    *sp = (uintptr_t)uc->uc_mcontext.gregs[REG_RSP];
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    *fp = (uintptr_t)uc->uc_mcontext.regs[29];
+    *sp = (uintptr_t)uc->uc_mcontext.sp;
+    return (uintptr_t)uc->uc_mcontext.pc;
+#else
+    (void)uc;
+    *fp = *sp = 0;
+    return 0;
+#endif
+}
+
+// Stack of the interrupted code, leaf first. Only async-signal-safe work.
+static int capture(const ucontext_t *uc, uintptr_t *out, int max) {
+    uintptr_t fp, sp;
+    uintptr_t pc = context_pc(uc, &fp, &sp);
+    int n = 0;
+#if WR_PROFILE_FP
+    if (pc != 0) {
+        out[n++] = pc;
+        // Each frame starts with the caller's frame pointer, then the return address.
+        // Callers live at higher addresses; the chain ends with 0 at the thread's entry.
+        if (fp <= sp || fp - sp > FP_MAX_FRAME) return n;
+        while (n < max && fp != 0 && (fp & (sizeof(uintptr_t) - 1)) == 0) {
+            const uintptr_t *frame = (const uintptr_t *)fp;
+            if (frame[1] == 0) break;
+            out[n++] = frame[1];
+            if (frame[0] <= fp || frame[0] - fp > FP_MAX_FRAME) break;
+            fp = frame[0];
+        }
+        return n;
+    }
+#elif defined(__GLIBC__)
+    void *frames[PROFILER_MAX_DEPTH + 8];
+    int got = backtrace(frames, PROFILER_MAX_DEPTH + 8);
+    int first = got > 2 ? 2 : got; // Without a pc to look for: skip this handler and the signal frame
+    for (int i = 0; i < got && pc != 0; i++) {
+        if ((uintptr_t)frames[i] == pc) {
+            first = i;
+            break;
+        }
+    }
+    for (int i = first; i < got && n < max; i++) out[n++] = (uintptr_t)frames[i];
+    if (n > 0) return n;
+#else
+    (void)max;
+#endif
+    if (pc != 0) out[n++] = pc;
+    return n;
+}
+
+static void on_sigprof(int sig, siginfo_t *si, void *ctx) {
+    (void)sig;
+    (void)si;
+    int saved_errno = errno;
+    unsigned long i = atomic_fetch_add_explicit(&next_sample, 1, memory_order_relaxed);
+    if (samples != NULL && i < PROFILER_MAX_SAMPLES) {
+        sample_t *s = &samples[i];
+        s->depth = capture((const ucontext_t *)ctx, s->pc, PROFILER_MAX_DEPTH);
+        atomic_store_explicit(&s->ready, 1, memory_order_release);
+    }
+    errno = saved_errno;
+}
+
+// --- Control ---
+
+static void arm(long interval_ns) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_sec = interval_ns / 1000000000L;
+    its.it_interval.tv_nsec = interval_ns % 1000000000L;
+    its.it_value = its.it_interval;
+    timer_settime(timer, 0, &its, NULL);
+}
+
+int Profiler_start(int hz, char *err, size_t err_len) {
+    if (hz == 0) hz = PROFILER_DEFAULT_HZ;
+    if (hz < 0 || hz > PROFILER_MAX_HZ) {
+        snprintf(err, err_len, "sample rate must be between 1 and %d Hz", PROFILER_MAX_HZ);
+        return -1;
+    }
+    pthread_mutex_lock(&control_lock);
+    if (timer_created) arm(0);
+    if (samples == NULL) samples = malloc(PROFILER_MAX_SAMPLES * sizeof(*samples));
+    if (samples == NULL) {
+        snprintf(err, err_len, "out of memory for %d samples", PROFILER_MAX_SAMPLES);
+        pthread_mutex_unlock(&control_lock);
+        return -1;
+    }
+    for (size_t i = 0; i < PROFILER_MAX_SAMPLES; i++) atomic_store_explicit(&samples[i].ready, 0, memory_order_relaxed);
+    atomic_store(&next_sample, 0);
+#if !WR_PROFILE_FP && defined(__GLIBC__)
+    void *warm[4];
+    backtrace(warm, 4); // The first call loads the unwinder: do it here, not in the handler
+#endif
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_sigprof;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGPROF;
+    if (sigaction(SIGPROF, &sa, NULL) != 0 ||
+        (!timer_created && timer_create(CLOCK_PROCESS_CPUTIME_ID, &sev, &timer) != 0)) {
+        snprintf(err, err_len, "cannot set up the SIGPROF timer: %s", strerror(errno));
+        pthread_mutex_unlock(&control_lock);
+        return -1;
+    }
+    timer_created = 1;
+    arm(1000000000L / hz);
+    atomic_store(&rate, hz);
+    pthread_mutex_unlock(&control_lock);
+    LOG_PROF_INFO("Profiling at %d Hz.", hz);
+    return 0;
+}
+
+unsigned long Profiler_stop(void) {
+    pthread_mutex_lock(&control_lock);
+    if (timer_created) arm(0);
+    atomic_store(&rate, 0);
+    unsigned long taken = atomic_load(&next_sample);
+    pthread_mutex_unlock(&control_lock);
+    LOG_PROF_INFO("Profiler stopped after %lu samples.", taken);
+    return taken;
+}
+
+int Profiler_running(void) {
+    return atomic_load(&rate);
+}
+
+// --- Symbols ---
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    const char *name;
+} func_t;
+
+// Functions of the executable itself, from its .symtab (present unless stripped).
+typedef struct {
+    func_t *funcs;
+    size_t count;
+    void *map;
+    size_t map_len;
+} symtab_t;
+
+static int compare_funcs(const void *a, const void *b) {
+    uintptr_t x = ((const func_t *)a)->start, y = ((const func_t *)b)->start;
+    return (x > y) - (x < y);
+}
+
+static int find_main_base(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    *(uintptr_t *)arg = (uintptr_t)info->dlpi_addr; // The first object is the executable
+    return 1;
+}
+
+static void symtab_load(symtab_t *t) {
+    memset(t, 0, sizeof(*t));
+    int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) return;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+    t->map = map;
+    t->map_len = (size_t)st.st_size;
+
+    const char *base = map;
+    const ElfW(Ehdr) *eh = map;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_shoff == 0 ||
+        eh->e_shoff + (size_t)eh->e_shnum * sizeof(ElfW(Shdr)) > t->map_len) {
+        return;
+    }
+    const ElfW(Shdr) *sh = (const ElfW(Shdr) *)(base + eh->e_shoff);
+    uintptr_t load_base = 0;
+    dl_iterate_phdr(find_main_base, &load_base);
+    for (unsigned i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+        const ElfW(Shdr) *strs = &sh[sh[i].sh_link];
+        if (sh[i].sh_offset + sh[i].sh_size > t->map_len || strs->sh_offset + strs->sh_size > t->map_len) continue;
+        const ElfW(Sym) *syms = (const ElfW(Sym) *)(base + sh[i].sh_offset);
+        size_t nsyms = sh[i].sh_size / sizeof(ElfW(Sym));
+        t->funcs = malloc(nsyms * sizeof(*t->funcs));
+        if (t->funcs == NULL) return;
+        for (size_t s = 0; s < nsyms; s++) {
+            if (ELF64_ST_TYPE(syms[s].st_info) != STT_FUNC || syms[s].st_value == 0 || syms[s].st_size == 0 ||
+                syms[s].st_name >= strs->sh_size) {
+                continue;
+            }
+            func_t *f = &t->funcs[t->count++];
+            f->start = load_base + syms[s].st_value;
+            f->end = f->start + syms[s].st_size;
+            f->name = base + strs->sh_offset + syms[s].st_name;
+        }
+        qsort(t->funcs, t->count, sizeof(*t->funcs), compare_funcs);
+        break;
+    }
+}
+
+static void symtab_free(symtab_t *t) {
+    free(t->funcs);
+    if (t->map != NULL) munmap(t->map, t->map_len);
+}
+
+// Name of the function containing 'addr'; 'buf' holds names that have to be made up.
+static const char *symbolize(const symtab_t *t, uintptr_t addr, char *buf, size_t len) {
+    size_t lo = 0, hi = t->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (t->funcs[mid].start <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo > 0 && addr < t->funcs[lo - 1].end) return t->funcs[lo - 1].name;
+    Dl_info info;
+    if (dladdr((void *)addr, &info) != 0) {
+        if (info.dli_sname != NULL) return info.dli_sname;
+        if (info.dli_fname != NULL) {
+            const char *slash = strrchr(info.dli_fname, '/');
+            snprintf(buf, len, "%s+0x%lx", slash != NULL ? slash + 1 : info.dli_fname,
+                     (unsigned long)(addr - (uintptr_t)info.dli_fbase));
+            return buf;
+        }
+    }
+    snprintf(buf, len, "0x%lx", (unsigned long)addr);
+    return buf;
+}
+
+// --- Folded output ---
+
+static int compare_samples(const void *a, const void *b) {
+    const sample_t *x = *(const sample_t *const *)a, *y = *(const sample_t *const *)b;
+    if (x->depth != y->depth) return x->depth - y->depth;
+    return memcmp(x->pc, y->pc, (size_t)x->depth * sizeof(x->pc[0]));
+}
+
+char *Profiler_folded(size_t *len) {
+    char *buf = NULL;
+    size_t buf_len = 0;
+    FILE *out = open_memstream(&buf, &buf_len);
+    if (out == NULL) return NULL;
+
+    pthread_mutex_lock(&control_lock);
+    unsigned long taken = atomic_load(&next_sample);
+    unsigned long kept = taken < PROFILER_MAX_SAMPLES ? taken : PROFILER_MAX_SAMPLES;
+    const sample_t **sorted = kept > 0 ? malloc(kept * sizeof(*sorted)) : NULL;
+    size_t n = 0;
+    for (unsigned long i = 0; sorted != NULL && i < kept; i++) {
+        if (atomic_load_explicit(&samples[i].ready, memory_order_acquire) && samples[i].depth > 0) {
+            sorted[n++] = &samples[i];
+        }
+    }
+    qsort(sorted, n, sizeof(*sorted), compare_samples);
+
+    symtab_t symtab;
+    symtab_load(&symtab);
+    char name[128];
+    for (size_t i = 0; i < n;) {
+        size_t same = i + 1;
+        while (same < n && compare_samples(&sorted[i], &sorted[same]) == 0) same++;
+        const sample_t *s = sorted[i];
+        for (int d = s->depth - 1; d >= 0; d--) {
+            // Return addresses point after the call: look up the call itself.
+            uintptr_t addr = d > 0 ? s->pc[d] - 1 : s->pc[d];
+            fputs(symbolize(&symtab, addr, name, sizeof(name)), out);
+            fputc(d > 0 ? ';' : ' ', out);
+        }
+        fprintf(out, "%zu\n", same - i);
+        i = same;
+    }
+    if (taken > kept) fprintf(out, "[dropped] %lu\n", taken - kept);
+    symtab_free(&symtab);
+    free(sorted);
+    pthread_mutex_unlock(&control_lock);
+
+    if (fclose(out) != 0) {
+        free(buf);
+        return NULL;
+    }
+    *len = buf_len;
+    return buf;
+}
@@ -0,0 +1,35 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h> // For size_t
+
+#define PROFILER_DEFAULT_HZ 99    // Not 100: keeps clear of anything that runs in lockstep
+#define PROFILER_MAX_HZ 1000
+#define PROFILER_MAX_DEPTH 30     // Frames kept per sample, from the leaf up
+#define PROFILER_MAX_SAMPLES 8192 // Preallocated; further samples are only counted
+
+// Sampling CPU profiler. A timer_create() timer on the process CPU clock sends SIGPROF at
+// the chosen rate while the daemon uses CPU; the handler records the interrupted stack
+// into a preallocated sample buffer (no allocation or locking in the handler).
+// Stacks come from the frame-pointer chain in builds with frame pointers ('make
+// PROFILE=1'), else from glibc's backtrace(), else only the interrupted function is kept.
+// The samples are aggregated into folded stacks ("main;tick;evaluate 12" per line, the
+// input of flamegraph.pl and speedscope) on request; 'make PROFILE=1' also keeps the
+// symbol table so that static functions get their names.
+// Controlled through the metrics socket (see metrics.h).
+
+// Start sampling at 'hz' (0: PROFILER_DEFAULT_HZ), discarding earlier samples.
+// Returns 0, or -1 with the reason in 'err'.
+int Profiler_start(int hz, char *err, size_t err_len);
+
+// Stop sampling; the samples are kept. Returns the number taken.
+unsigned long Profiler_stop(void);
+
+// Current rate, 0 while stopped.
+int Profiler_running(void);
+
+// The samples so far as folded stacks, in a malloc()ed string (NULL: out of memory).
+// Samples that did not fit in the buffer show up as one "[dropped]" stack.
+char *Profiler_folded(size_t *len);
+
+#endif // PROFILER_H
@@ -9,19 +9,23 @@
 
 #include "service_loader.h"
 #include "schema.h"       // For SERVICE_SCHEMA (used by validator)
+#include "output_ring.h"  // For OUTPUT_RING_DEFAULT_KB / OUTPUT_RING_MAX_KB
+#include "cbor.h"         // For *.cbor service files
+#include "logger.h"
 // #include "deps/cJSON/cJSON.h" // Already included via service_loader.h
 
 // Logging - temporary, replace with syslog later
-#define LOG_ERROR(fmt, ...) fprintf(stderr, "ERROR: SvcLoader: " fmt "\n", ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...) printf("INFO: SvcLoader: " fmt "\n", ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...) printf("DEBUG: SvcLoader: " fmt "\n", ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) WR_LOG_ERROR("SvcLoader", fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) WR_LOG_INFO("SvcLoader", fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) WR_LOG_DEBUG("SvcLoader", fmt, ##__VA_ARGS__)
 
 // Static storage for service configurations
-static service_config_t loaded_services[MAX_SERVICES];
+static service_config_t *loaded_services = NULL;
+static int services_capacity = 0; // Slots in loaded_services
 static int num_loaded_services = 0;
 
-// From previous step (Step 6)
-static char last_err[256];
+// From previous step (Step 6); per thread, since the control socket validates too
+static _Thread_local char last_err[256];
 
 int validate_json_with_hardcoded_schema(const cJSON *json_service_obj, const char *service_name_for_log) {
     last_err[0] = '\0';
@@ -60,6 +64,26 @@ int validate_json_with_hardcoded_schema(const cJSON *json_service_obj, const cha
          snprintf(last_err, sizeof(last_err), "Service '%s': Optional field 'interval' must be a non-negative integer.", service_name_for_log);
         return -1;
     }
+    const cJSON *ring_kb = cJSON_GetObjectItemCaseSensitive(json_service_obj, "output_ring_kb");
+    if (ring_kb && (!cJSON_IsNumber(ring_kb) || ring_kb->valueint <= 0 || ring_kb->valueint > OUTPUT_RING_MAX_KB)) {
+        snprintf(last_err, sizeof(last_err), "Service '%s': Optional field 'output_ring_kb' must be an integer between 1 and %d.", service_name_for_log, OUTPUT_RING_MAX_KB);
+        return -1;
+    }
+    const cJSON *forward_output = cJSON_GetObjectItemCaseSensitive(json_service_obj, "forward_output");
+    if (forward_output && !cJSON_IsBool(forward_output)) {
+        snprintf(last_err, sizeof(last_err), "Service '%s': Optional field 'forward_output' must be a boolean.", service_name_for_log);
+        return -1;
+    }
+    const cJSON *parallelism = cJSON_GetObjectItemCaseSensitive(json_service_obj, "parallelism");
+    if (parallelism && (!cJSON_IsNumber(parallelism) || parallelism->valueint < 1 || parallelism->valueint > ACTION_DAG_MAX_PARALLELISM)) {
+        snprintf(last_err, sizeof(last_err), "Service '%s': Optional field 'parallelism' must be an integer between 1 and %d.", service_name_for_log, ACTION_DAG_MAX_PARALLELISM);
+        return -1;
+    }
+    const cJSON *fuse_shell = cJSON_GetObjectItemCaseSensitive(json_service_obj, "fuse_shell");
+    if (fuse_shell && !cJSON_IsBool(fuse_shell)) {
+        snprintf(last_err, sizeof(last_err), "Service '%s': Optional field 'fuse_shell' must be a boolean.", service_name_for_log);
+        return -1;
+    }
     const cJSON *actions = cJSON_GetObjectItemCaseSensitive(json_service_obj, "actions");
     if (!actions) {
         snprintf(last_err, sizeof(last_err), "Service '%s': Missing required field 'actions'.", service_name_for_log);
@@ -89,7 +113,7 @@ int validate_json_with_hardcoded_schema(const cJSON *json_service_obj, const cha
             snprintf(last_err, sizeof(last_err), "Service '%s', Action #%d: Field 'type' must be a non-empty string.", service_name_for_log, action_idx);
             return -1;
         }
-        const char* optional_props[] = {"path", "command", "message"};
+        const char* optional_props[] = {"path", "command", "message", "glob", "format", "output", "src", "dest", "id", "pipe_from"};
         for (size_t i = 0; i < (sizeof(optional_props) / sizeof(optional_props[0])); ++i) {
             const cJSON* prop = cJSON_GetObjectItemCaseSensitive(action_item, optional_props[i]);
             if (prop) {
@@ -99,11 +123,108 @@ int validate_json_with_hardcoded_schema(const cJSON *json_service_obj, const cha
                 }
             }
         }
+        const cJSON* paths = cJSON_GetObjectItemCaseSensitive(action_item, "paths");
+        if (paths) {
+            const cJSON* path_item;
+            int paths_ok = cJSON_IsArray(paths);
+            cJSON_ArrayForEach(path_item, paths) {
+                if (!cJSON_IsString(path_item) || (path_item->valuestring == NULL) || (path_item->valuestring[0] == '\0')) {
+                    paths_ok = 0;
+                }
+            }
+            if (!paths_ok) {
+                snprintf(last_err, sizeof(last_err), "Service '%s', Action #%d: Optional field 'paths' must be an array of non-empty strings.", service_name_for_log, action_idx);
+                return -1;
+            }
+        }
+        const cJSON* depends_on = cJSON_GetObjectItemCaseSensitive(action_item, "depends_on");
+        if (depends_on) {
+            const cJSON* dep_item;
+            int deps_ok = cJSON_IsArray(depends_on) || (cJSON_IsString(depends_on) && depends_on->valuestring[0] != '\0');
+            if (cJSON_IsArray(depends_on)) {
+                cJSON_ArrayForEach(dep_item, depends_on) {
+                    if (!cJSON_IsString(dep_item) || (dep_item->valuestring == NULL) || (dep_item->valuestring[0] == '\0')) {
+                        deps_ok = 0;
+                    }
+                }
+            }
+            if (!deps_ok) {
+                snprintf(last_err, sizeof(last_err), "Service '%s', Action #%d: Optional field 'depends_on' must be an action id or an array of action ids.", service_name_for_log, action_idx);
+                return -1;
+            }
+        }
+        const char* numeric_props[] = {"timeout_ms", "cpu_seconds", "nice"};
+        for (size_t i = 0; i < (sizeof(numeric_props) / sizeof(numeric_props[0])); ++i) {
+            const cJSON* prop = cJSON_GetObjectItemCaseSensitive(action_item, numeric_props[i]);
+            if (prop && !cJSON_IsNumber(prop)) {
+                snprintf(last_err, sizeof(last_err), "Service '%s', Action #%d: Optional field '%s' must be a number if present.", service_name_for_log, action_idx, numeric_props[i]);
+                return -1;
+            }
+        }
+        const char* size_props[] = {"max_rss", "ioprio"}; // "512M" / "be:4" or plain numbers
+        for (size_t i = 0; i < (sizeof(size_props) / sizeof(size_props[0])); ++i) {
+            const cJSON* prop = cJSON_GetObjectItemCaseSensitive(action_item, size_props[i]);
+            if (prop && !cJSON_IsNumber(prop) && !cJSON_IsString(prop)) {
+                snprintf(last_err, sizeof(last_err), "Service '%s', Action #%d: Optional field '%s' must be a number or a string if present.", service_name_for_log, action_idx, size_props[i]);
+                return -1;
+            }
+        }
+        const cJSON* content = cJSON_GetObjectItemCaseSensitive(action_item, "content");
+        if (content && (!cJSON_IsString(content) || content->valuestring == NULL)) { // Empty content is allowed
+            snprintf(last_err, sizeof(last_err), "Service '%s', Action #%d: Optional field 'content' must be a string if present.", service_name_for_log, action_idx);
+            return -1;
+        }
         action_idx++;
     }
     return 0; // Success
 }
 
+static void free_change_filters(change_filter_t **filters, int count) {
+    if (filters == NULL) return;
+    for (int i = 0; i < count; i++) ChangeFilter_free(filters[i]);
+    free(filters);
+}
+
+// Per-action "on_change" state; *out stays NULL when no action uses it.
+static int build_change_filters(const char *service, const cJSON *actions, change_filter_t ***out, char *err,
+                                size_t err_len) {
+    int count = cJSON_GetArraySize(actions);
+    change_filter_t **filters = NULL;
+    *out = NULL;
+    const cJSON *action;
+    int idx = 0;
+    cJSON_ArrayForEach(action, actions) {
+        char filter_err[128];
+        change_filter_t *filter;
+        if (ChangeFilter_from_json(service, idx, action, &filter, filter_err, sizeof(filter_err)) != 0) {
+            snprintf(err, err_len, "Action #%d: %s", idx, filter_err);
+            free_change_filters(filters, count);
+            return -1;
+        }
+        if (filter != NULL) {
+            // A pipeline member's output is streamed to its neighbour as it is produced.
+            const cJSON *id = cJSON_GetObjectItemCaseSensitive(action, "id");
+            int piped = cJSON_GetObjectItemCaseSensitive(action, "pipe_from") != NULL;
+            const cJSON *other;
+            cJSON_ArrayForEach(other, actions) {
+                const cJSON *from = cJSON_GetObjectItemCaseSensitive(other, "pipe_from");
+                if (cJSON_IsString(id) && cJSON_IsString(from) && strcmp(from->valuestring, id->valuestring) == 0) piped = 1;
+            }
+            if (filters == NULL) filters = calloc((size_t)count, sizeof(*filters));
+            if (piped || filters == NULL) {
+                snprintf(err, err_len, "Action #%d: %s", idx, piped ? "'on_change' cannot be used on a pipe_from pipeline member." : "Out of memory.");
+                ChangeFilter_free(filter);
+                free_change_filters(filters, count);
+                return -1;
+            }
+            filters[idx] = filter;
+        }
+        idx++;
+    }
+    *out = filters;
+    return 0;
+}
+
 const char* get_service_validation_error() {
    return last_err;
 }
@@ -112,7 +233,7 @@ const char* get_service_validation_error() {
 void SvcLoader_init(void) {
     SvcLoader_free_all_services(); // Clear any existing services first
     num_loaded_services = 0;
-    for (int i = 0; i < MAX_SERVICES; i++) {
+    for (int i = 0; i < services_capacity; i++) {
         memset(&loaded_services[i], 0, sizeof(service_config_t));
         loaded_services[i].loaded = 0;
         loaded_services[i].interval_seconds = 0; // Default: run once or as per condition only
@@ -121,20 +242,110 @@ void SvcLoader_init(void) {
     LOG_DEBUG("Service loader initialized. Max services: %d", MAX_SERVICES);
 }
 
+void SvcLoader_release(service_config_t *svc) {
+    if (svc->config_json != NULL) {
+        cJSON_Delete(svc->config_json);
+        svc->config_json = NULL;
+    }
+    free_change_filters(svc->change_filters, ActionDag_count(svc->dag));
+    svc->change_filters = NULL;
+    ActionDag_free(svc->dag);
+    svc->dag = NULL;
+    ShellFuse_free(svc->fuse);
+    svc->fuse = NULL;
+    svc->loaded = 0; // Mark as free
+}
+
 void SvcLoader_free_all_services(void) {
     LOG_DEBUG("%s", "Freeing all loaded services...");
-    for (int i = 0; i < MAX_SERVICES; i++) {
-        if (loaded_services[i].loaded && loaded_services[i].config_json != NULL) {
-            cJSON_Delete(loaded_services[i].config_json);
-            loaded_services[i].config_json = NULL;
-        }
-        loaded_services[i].loaded = 0; // Mark as free
+    for (int i = 0; i < services_capacity; i++) {
+        SvcLoader_release(&loaded_services[i]);
     }
     num_loaded_services = 0;
     LOG_INFO("%s", "All services freed and unloaded.");
 }
 
-static char* read_file_to_string(const char *filepath) {
+// Make room for one more service in the table.
+static int grow_services(void) {
+    if (num_loaded_services < services_capacity) return 0;
+    int capacity = services_capacity > 0 ? services_capacity * 2 : 32;
+    if (capacity > MAX_SERVICES) capacity = MAX_SERVICES;
+    service_config_t *grown = realloc(loaded_services, (size_t)capacity * sizeof(*grown));
+    if (grown == NULL) return -1;
+    memset(grown + services_capacity, 0, (size_t)(capacity - services_capacity) * sizeof(*grown));
+    loaded_services = grown;
+    services_capacity = capacity;
+    return 0;
+}
+
+int SvcLoader_compile(cJSON *json_obj, const char *service_name_for_log, service_config_t *svc, char *err, size_t err_len) {
+    memset(svc, 0, sizeof(*svc));
+    if (validate_json_with_hardcoded_schema(json_obj, service_name_for_log) != 0) {
+        snprintf(err, err_len, "%s", get_service_validation_error());
+        return -1;
+    }
+    char dag_err[160];
+    const cJSON *actions = cJSON_GetObjectItemCaseSensitive(json_obj, "actions");
+    action_dag_t *dag = ActionDag_compile(actions, dag_err, sizeof(dag_err));
+    const cJSON *name_item = cJSON_GetObjectItemCaseSensitive(json_obj, "name");
+    change_filter_t **change_filters = NULL;
+    if (dag == NULL ||
+        build_change_filters(name_item->valuestring, actions, &change_filters, dag_err, sizeof(dag_err)) != 0) {
+        snprintf(err, err_len, "Service '%s', %s", service_name_for_log, dag_err);
+        ActionDag_free(dag);
+        return -1;
+    }
+
+    cJSON *name_json = cJSON_GetObjectItemCaseSensitive(json_obj, "name");
+    strncpy(svc->name, name_json->valuestring, MAX_SERVICE_NAME_LEN -1);
+    svc->name[MAX_SERVICE_NAME_LEN -1] = '\0';
+
+    cJSON *condition_json = cJSON_GetObjectItemCaseSensitive(json_obj, "condition");
+    strncpy(svc->condition_str, condition_json->valuestring, MAX_CONDITION_STR_LEN -1);
+    svc->condition_str[MAX_CONDITION_STR_LEN -1] = '\0';
+
+    cJSON *interval_json = cJSON_GetObjectItemCaseSensitive(json_obj, "interval");
+    if (interval_json && cJSON_IsNumber(interval_json)) {
+        svc->interval_seconds = interval_json->valueint;
+        if (svc->interval_seconds < 0) svc->interval_seconds = 0;
+    } else {
+        svc->interval_seconds = 0;
+    }
+
+    cJSON *ring_kb_json = cJSON_GetObjectItemCaseSensitive(json_obj, "output_ring_kb");
+    svc->output_ring_kb = cJSON_IsNumber(ring_kb_json) ? ring_kb_json->valueint : OUTPUT_RING_DEFAULT_KB;
+    cJSON *forward_json = cJSON_GetObjectItemCaseSensitive(json_obj, "forward_output");
+    svc->forward_output = cJSON_IsBool(forward_json) ? cJSON_IsTrue(forward_json) : 1;
+    cJSON *parallelism_json = cJSON_GetObjectItemCaseSensitive(json_obj, "parallelism");
+    svc->parallelism = cJSON_IsNumber(parallelism_json) ? parallelism_json->valueint : ACTION_DAG_DEFAULT_PARALLELISM;
+    svc->dag = dag;
+    svc->change_filters = change_filters;
+    cJSON *fuse_json = cJSON_GetObjectItemCaseSensitive(json_obj, "fuse_shell");
+    svc->fuse = NULL;
+    if (ActionDag_is_sequential(dag) && !cJSON_IsFalse(fuse_json)) {
+        svc->fuse = ShellFuse_plan(actions);
+    }
+
+    svc->config_json = json_obj;
+    svc->last_run_timestamp = 0;
+    svc->loaded = 1;
+    return 0;
+}
+
+int SvcLoader_add(service_config_t *svc) {
+    for (int i = 0; i < num_loaded_services; i++) {
+        if (loaded_services[i].loaded && strcmp(loaded_services[i].name, svc->name) == 0) {
+            SvcLoader_release(&loaded_services[i]);
+            loaded_services[i] = *svc;
+            return i;
+        }
+    }
+    if (num_loaded_services >= MAX_SERVICES || grow_services() != 0) return -1;
+    loaded_services[num_loaded_services] = *svc;
+    return num_loaded_services++;
+}
+
+static char* read_file_to_string(const char *filepath, size_t *len_out) {
     FILE *file = fopen(filepath, "rb");
     if (!file) {
         LOG_ERROR("Could not open file: %s", filepath);
@@ -171,6 +382,7 @@ static char* read_file_to_string(const char *filepath) {
 
     buffer[bytes_read] = '\0';
     fclose(file);
+    *len_out = bytes_read;
     return buffer;
 }
 
@@ -201,19 +413,27 @@ void SvcLoader_load_services(const char *services_dir_path) {
         if (entry->d_type == DT_REG) { // Regular file
             const char *filename = entry->d_name;
             const char *ext = strrchr(filename, '.');
-            if (ext && strcmp(ext, ".json") == 0) {
+            int is_cbor = ext && strcmp(ext, ".cbor") == 0; // Binary encoding, see cbor.h
+            if (ext && (strcmp(ext, ".json") == 0 || is_cbor)) {
                 snprintf(filepath, sizeof(filepath), "%s/%s", services_dir_path, filename);
                 LOG_DEBUG("Processing potential service file: %s", filepath);
 
-                char *file_content = read_file_to_string(filepath);
+                size_t file_len;
+                char *file_content = read_file_to_string(filepath, &file_len);
                 if (!file_content) {
                     LOG_ERROR("Failed to read content of service file: %s", filepath);
                     continue; 
                 }
 
-                cJSON *json_obj = cJSON_Parse(file_content);
+                char cbor_err[128];
+                cJSON *json_obj = is_cbor ? Cbor_decode((const unsigned char *)file_content, file_len, cbor_err, sizeof(cbor_err))
+                                          : cJSON_Parse(file_content);
                 free(file_content); 
 
+                if (!json_obj && is_cbor) {
+                    LOG_ERROR("Failed to decode CBOR from file %s: %s", filepath, cbor_err);
+                    continue;
+                }
                 if (!json_obj) {
                     const char *parse_error = cJSON_GetErrorPtr();
                     LOG_ERROR("Failed to parse JSON from file %s. Error (near): %s", filepath, parse_error ? parse_error : "unknown");
@@ -227,35 +447,20 @@ void SvcLoader_load_services(const char *services_dir_path) {
                 if (dot) *dot = '\0';
 
 
-                if (validate_json_with_hardcoded_schema(json_obj, temp_service_name_for_log) == 0) {
-                    service_config_t *svc = &loaded_services[num_loaded_services]; 
-                    svc->loaded = 0; 
-
-                    cJSON *name_json = cJSON_GetObjectItemCaseSensitive(json_obj, "name");
-                    strncpy(svc->name, name_json->valuestring, MAX_SERVICE_NAME_LEN -1);
-                    svc->name[MAX_SERVICE_NAME_LEN -1] = '\0';
-
-                    cJSON *condition_json = cJSON_GetObjectItemCaseSensitive(json_obj, "condition");
-                    strncpy(svc->condition_str, condition_json->valuestring, MAX_CONDITION_STR_LEN -1);
-                    svc->condition_str[MAX_CONDITION_STR_LEN -1] = '\0';
-                    
-                    cJSON *interval_json = cJSON_GetObjectItemCaseSensitive(json_obj, "interval");
-                    if (interval_json && cJSON_IsNumber(interval_json)) {
-                        svc->interval_seconds = interval_json->valueint;
-                        if (svc->interval_seconds < 0) svc->interval_seconds = 0; 
-                    } else {
-                        svc->interval_seconds = 0; 
-                    }
-                    
-                    svc->config_json = json_obj; 
-                    svc->last_run_timestamp = 0; 
-                    svc->loaded = 1;
+                service_config_t compiled;
+                char err[256];
+                if (SvcLoader_compile(json_obj, temp_service_name_for_log, &compiled, err, sizeof(err)) != 0) {
+                    LOG_ERROR("Service file %s failed validation: %s", filepath, err);
+                    cJSON_Delete(json_obj);
+                } else if (grow_services() != 0) {
+                    LOG_ERROR("Out of memory loading service file %s.", filepath);
+                    SvcLoader_release(&compiled);
+                } else {
+                    service_config_t *svc = &loaded_services[num_loaded_services];
+                    *svc = compiled;
                     num_loaded_services++;
                     LOG_INFO("Successfully loaded and validated service: %s (Interval: %ds, Condition: '%s')",
                                 svc->name, svc->interval_seconds, svc->condition_str);
-                } else {
-                    LOG_ERROR("Service file %s failed validation: %s", filepath, get_service_validation_error());
-                    cJSON_Delete(json_obj); 
                 }
             }
         }
@@ -2,9 +2,12 @@
 #define SERVICE_LOADER_H
 
 #include "cJSON.h" // Found via CFLAGS -I deps/cJSON
+#include "action_dag.h" // For action_dag_t
+#include "shell_fuse.h" // For shell_fuse_t
+#include "change_filter.h" // For change_filter_t
 #include <time.h> // For time_t
 
-#define MAX_SERVICES 32 // Max number of services that can be loaded
+#define MAX_SERVICES 200000 // Max number of services that can be loaded; the table grows as needed
 #define MAX_SERVICE_NAME_LEN 64
 #define MAX_CONDITION_STR_LEN 128
 #define DEFAULT_SERVICE_DIR "/var/lib/whiterails/services" // Default, can be overridden
@@ -15,6 +18,12 @@ typedef struct {
     char condition_str[MAX_CONDITION_STR_LEN]; // Store the condition string
     int interval_seconds;        // Service execution interval in seconds
     time_t last_run_timestamp;    // Timestamp of the last execution
+    int output_ring_kb;          // Size of the service's output capture ring
+    int forward_output;          // Copy captured output to the daemon's stdout as well
+    action_dag_t *dag;           // Execution plan of 'actions', compiled at load
+    int parallelism;             // Max actions running at once when the plan has dependencies
+    shell_fuse_t *fuse;          // Fused shell runs of a sequential plan, NULL if none or opted out
+    change_filter_t **change_filters; // Per action "on_change" state (entries may be NULL), NULL if none
     int loaded;                  // 0 if slot is free, 1 if service loaded
 } service_config_t;
 
@@ -28,6 +37,18 @@ void SvcLoader_load_services(const char *services_dir_path);
 void SvcLoader_reload_services(const char *services_dir_path); // For now, can just call init then load
 void SvcLoader_free_all_services(void); // Frees cJSON objects and resets service array
 
+// Validate and compile a parsed service into 'svc' (the action plan, on_change state and
+// shell fusion). On success 'svc' owns 'json_obj'; on failure the reason is in 'err' and
+// the caller still owns it.
+int SvcLoader_compile(cJSON *json_obj, const char *service_name_for_log, service_config_t *svc, char *err, size_t err_len);
+
+// Free what SvcLoader_compile() built, including the JSON.
+void SvcLoader_release(service_config_t *svc);
+
+// Add a compiled service to the table, replacing a loaded one of the same name. Returns
+// its index, or -1 when the table is full. Scheduler thread only.
+int SvcLoader_add(service_config_t *svc);
+
 // Accessors
 int SvcLoader_get_count(void);
 service_config_t* SvcLoader_get_service_by_index(int index);
@@ -0,0 +1,58 @@
+#include <stdatomic.h>
+
+#include "cJSON.h" // Found via CFLAGS -I deps/cJSON
+#include "service_run.h"
+#include "dispatcher.h"
+#include "action_dag.h"
+#include "shell_fuse.h"
+#include "logger.h"
+
+#define LOG_RUN_DEBUG(fmt, ...) WR_LOG_DEBUG("run", fmt, ##__VA_ARGS__)
+#define LOG_RUN_ERROR(fmt, ...) WR_LOG_ERROR("run", fmt, ##__VA_ARGS__)
+
+// One triggered run of a service, shared by the actions it executes.
+typedef struct {
+    service_config_t *svc;
+    output_ring_t *output;
+    _Atomic int actions;
+    _Atomic int failed;
+} service_run_t;
+
+// Runs one action of a service; with declared dependencies, several may run at once.
+static int run_service_action(const cJSON *action_item_json, int action_idx, const action_stdio_t *stdio, void *arg) {
+    service_run_t *run = arg;
+    cJSON *action_type_json = cJSON_GetObjectItemCaseSensitive(action_item_json, "type");
+    if (cJSON_IsString(action_type_json) && (action_type_json->valuestring != NULL)) {
+        const char *action_type_str = action_type_json->valuestring;
+        change_filter_t *change = run->svc->change_filters != NULL ? run->svc->change_filters[action_idx] : NULL;
+        action_ctx_t action_ctx = { .service_name = run->svc->name, .action_idx = action_idx, .output = run->output,
+                                    .exit_status = -1, .stdin_fd = stdio->in_fd, .stdout_fd = stdio->out_fd,
+                                    .change = change };
+        LOG_RUN_DEBUG("Service '%s', Action #%d: Dispatching type '%s'.", run->svc->name, action_idx, action_type_str);
+        dispatch_action(action_type_str, action_item_json, &action_ctx); // Pass the whole action object as params
+        atomic_fetch_add(&run->actions, 1);
+        if (action_ctx.exit_status > 0) atomic_fetch_add(&run->failed, 1);
+        if (action_ctx.unchanged) {
+            LOG_RUN_DEBUG("Service '%s', Action #%d: Result unchanged, skipping its follow-up actions.", run->svc->name, action_idx);
+            return ACTION_DAG_SKIP_FOLLOWUPS;
+        }
+    } else {
+        LOG_RUN_ERROR("Service '%s', Action #%d: 'type' is missing or not a string.", run->svc->name, action_idx);
+    }
+    return 0;
+}
+
+void ServiceRun_execute(service_config_t *svc, output_ring_t *output, service_run_stats_t *stats) {
+    service_run_t run = { svc, output, 0, 0 };
+    if (svc->fuse != NULL) {
+        int fused_failed = 0;
+        atomic_fetch_add(&run.actions, ShellFuse_run(svc->fuse, svc->name, output, run_service_action, &run, &fused_failed));
+        atomic_fetch_add(&run.failed, fused_failed);
+    } else {
+        ActionDag_run(svc->dag, svc->parallelism, run_service_action, &run);
+    }
+    if (stats != NULL) {
+        stats->actions = atomic_load(&run.actions);
+        stats->failed = atomic_load(&run.failed);
+    }
+}
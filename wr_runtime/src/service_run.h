@@ -0,0 +1,18 @@
+#ifndef SERVICE_RUN_H
+#define SERVICE_RUN_H
+
+#include "service_loader.h" // For service_config_t
+#include "output_ring.h"
+
+// Outcome of one run of a service's actions.
+typedef struct {
+    int actions;  // Actions dispatched
+    int failed;   // Of those, actions whose last command exited non-zero or was killed
+} service_run_stats_t;
+
+// Run every action of 'svc' once (fused shell runs, or the action plan), capturing their
+// output into 'output' (NULL: the daemon's stdout). Used by the scheduler and for
+// one-shot submissions; 'stats' may be NULL.
+void ServiceRun_execute(service_config_t *svc, output_ring_t *output, service_run_stats_t *stats);
+
+#endif // SERVICE_RUN_H
@@ -0,0 +1,259 @@
+#define _GNU_SOURCE // For MSG_NOSIGNAL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "shell_fuse.h"
+#include "condition.h" // For record_activity()
+#include "spawn.h"
+#include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define LOG_FUSE_INFO(fmt, ...) WR_LOG_INFO("shell_fuse", fmt, ##__VA_ARGS__)
+#define LOG_FUSE_ERROR(fmt, ...) WR_LOG_ERROR("shell_fuse", fmt, ##__VA_ARGS__)
+
+#define SIDE_FD 3 // Where the script finds the status channel
+
+struct shell_fuse {
+    int count;
+    const cJSON **items; // Action objects in array order
+    int *run_len;        // Fused run starting at i: its length; 1: not fused; 0: inside a run
+    char **scripts;      // Script of the run starting at i, NULL unless run_len[i] > 1
+};
+
+// Progress of one fused run, advanced by the side-channel callback.
+typedef struct {
+    const shell_fuse_t *plan;
+    const char *service;
+    int first;
+    int done;            // Commands whose status has been reported
+    int failed;          // Of those, commands with a non-zero status
+    uint64_t started_ns; // When the running command was started
+    char line[16];
+    size_t line_len;
+} fuse_progress_t;
+
+static const char *command_of(const cJSON *item) {
+    return cJSON_GetObjectItemCaseSensitive(item, "command")->valuestring;
+}
+
+static int is_shell(const cJSON *item) {
+    return strcmp(cJSON_GetObjectItemCaseSensitive(item, "type")->valuestring, "shell") == 0;
+}
+
+// The action logs as they would have been written by shell.c / run_command.c.
+static void log_start(const cJSON *item) {
+    if (is_shell(item)) {
+        WR_LOG_INFO("shell", "Executing shell command: %s", command_of(item));
+    } else {
+        WR_LOG_INFO("run_command", "Executing command: %s", command_of(item));
+    }
+}
+
+static void log_status(const cJSON *item, int code) {
+    if (is_shell(item)) {
+        WR_LOG_INFO("shell", "Shell command '%s' exited with status %d", command_of(item), code);
+    } else {
+        WR_LOG_INFO("run_command", "Command '%s' exited with status %d", command_of(item), code);
+    }
+}
+
+static int fusable(const cJSON *item) {
+    const cJSON *type = cJSON_GetObjectItemCaseSensitive(item, "type");
+    const cJSON *command = cJSON_GetObjectItemCaseSensitive(item, "command");
+    if (!cJSON_IsString(type) || type->valuestring == NULL ||
+        (strcmp(type->valuestring, "shell") != 0 && strcmp(type->valuestring, "run_command") != 0) ||
+        !cJSON_IsString(command) || command->valuestring == NULL) {
+        return 0;
+    }
+    // In a subshell $$ and $PPID name the script's shell, not the command's own.
+    if (strstr(command->valuestring, "$$") != NULL || strstr(command->valuestring, "PPID") != NULL) {
+        return 0;
+    }
+    // Anything beyond these (limits, depends_on, ...) needs a spawn of its own.
+    const cJSON *key;
+    cJSON_ArrayForEach(key, item) {
+        if (strcmp(key->string, "type") != 0 && strcmp(key->string, "command") != 0 &&
+            strcmp(key->string, "id") != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Append 's' to the buffer, growing it as needed. Returns 0 or -1.
+static int append(char **buf, size_t *len, size_t *cap, const char *s) {
+    size_t n = strlen(s);
+    if (*len + n + 1 > *cap) {
+        size_t new_cap = (*len + n + 1) * 2;
+        char *p = realloc(*buf, new_cap);
+        if (p == NULL) return -1;
+        *buf = p;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, s, n + 1);
+    *len += n;
+    return 0;
+}
+
+// One subshell per command, status line after each, and an acknowledgement wait between
+// commands so the daemon can log and account for one before the next starts. eval keeps
+// a syntax error inside the subshell; the side channel is closed for the command itself.
+static char *build_script(const cJSON **items, int count) {
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    for (int i = 0; i < count; i++) {
+        if (append(&buf, &len, &cap, "( eval '") != 0) goto fail;
+        for (const char *p = command_of(items[i]); *p; p++) {
+            char ch[2] = { *p, '\0' };
+            if (append(&buf, &len, &cap, *p == '\'' ? "'\\''" : ch) != 0) goto fail;
+        }
+        if (append(&buf, &len, &cap, "\n' ) 3>&-\necho $? >&3\n") != 0) goto fail;
+        if (i + 1 < count && append(&buf, &len, &cap, "read wr_ack <&3 || exit\n") != 0) goto fail;
+    }
+    return buf;
+fail:
+    free(buf);
+    return NULL;
+}
+
+shell_fuse_t *ShellFuse_plan(const cJSON *actions) {
+    int count = cJSON_GetArraySize(actions);
+    shell_fuse_t *plan = calloc(1, sizeof(*plan));
+    if (plan == NULL) return NULL;
+    plan->count = count;
+    plan->items = calloc((size_t)count + 1, sizeof(*plan->items));
+    plan->run_len = calloc((size_t)count + 1, sizeof(*plan->run_len));
+    plan->scripts = calloc((size_t)count + 1, sizeof(*plan->scripts));
+    if (plan->items == NULL || plan->run_len == NULL || plan->scripts == NULL) {
+        ShellFuse_free(plan);
+        return NULL;
+    }
+    int n = 0;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, actions) {
+        plan->items[n++] = item;
+    }
+
+    int fused = 0;
+    for (int i = 0; i < count;) {
+        int len = 0;
+        while (i + len < count && fusable(plan->items[i + len])) len++;
+        if (len < 2) {
+            plan->run_len[i] = 1;
+            i++;
+            continue;
+        }
+        plan->scripts[i] = build_script(plan->items + i, len);
+        if (plan->scripts[i] == NULL) {
+            ShellFuse_free(plan);
+            return NULL;
+        }
+        plan->run_len[i] = len;
+        fused += len;
+        i += len;
+    }
+    if (fused == 0) {
+        ShellFuse_free(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+static void report(fuse_progress_t *p, int code) {
+    const cJSON *item = p->plan->items[p->first + p->done];
+    const char *type = is_shell(item) ? "shell" : "run_command";
+    Metrics_observe(METRIC_ACTION_SECONDS, type, Metrics_now_ns() - p->started_ns);
+    if (code != 0) {
+        Metrics_add(METRIC_ACTION_FAILURES, type, 1);
+        p->failed++;
+    }
+    TRACE_SPAN("action", type, p->service, p->started_ns);
+    log_status(item, code);
+    record_activity();
+    p->done++;
+}
+
+static int on_status(int fd, void *arg) {
+    fuse_progress_t *p = arg;
+    int run_len = p->plan->run_len[p->first];
+    char buf[64];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) return 0;
+    if (n <= 0) return -1; // Script finished (or died)
+    for (ssize_t i = 0; i < n; i++) {
+        if (buf[i] != '\n') {
+            if (p->line_len + 1 < sizeof(p->line)) p->line[p->line_len++] = buf[i];
+            continue;
+        }
+        p->line[p->line_len] = '\0';
+        p->line_len = 0;
+        if (p->done >= run_len) continue;
+        report(p, atoi(p->line));
+        if (p->done < run_len) {
+            log_start(p->plan->items[p->first + p->done]);
+            p->started_ns = Metrics_now_ns();
+            if (send(fd, "\n", 1, MSG_NOSIGNAL) != 1) return -1;
+        }
+    }
+    return 0;
+}
+
+// Returns the number of commands run by the script; '*failed' is increased by those that failed.
+static int run_fused(const shell_fuse_t *plan, int first, const char *service, output_ring_t *output,
+                     action_dag_run_fn *run_one, void *arg, int *failed) {
+    int len = plan->run_len[first];
+    fuse_progress_t progress = { plan, service, first, 0, 0, Metrics_now_ns(), { 0 }, 0 };
+    log_start(plan->items[first]);
+    int status;
+    if (Spawn_run_script(plan->scripts[first], output, service, SIDE_FD, on_status, &progress, &status) != 0) {
+        LOG_FUSE_ERROR("Cannot start fused script for service '%s' (%s), running its actions one by one.",
+                       service, strerror(errno));
+        action_stdio_t stdio = { -1, -1 };
+        for (int i = first; i < first + len; i++) run_one(plan->items[i], i, &stdio, arg);
+        return 0;
+    }
+    if (progress.done < len) {
+        // The script itself was killed: attribute that to the command that was running.
+        if (WIFSIGNALED(status)) {
+            LOG_FUSE_INFO("Fused script of service '%s' killed by signal %d.", service, WTERMSIG(status));
+        }
+        report(&progress, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+        for (int i = first + progress.done; i < first + len; i++) {
+            LOG_FUSE_ERROR("Command '%s' not run: fused script ended early.", command_of(plan->items[i]));
+        }
+    }
+    *failed += progress.failed;
+    return progress.done;
+}
+
+int ShellFuse_run(const shell_fuse_t *plan, const char *service, output_ring_t *output,
+                  action_dag_run_fn *run_one, void *arg, int *fused_failed) {
+    action_stdio_t stdio = { -1, -1 };
+    int fused = 0, failed = 0;
+    for (int i = 0; i < plan->count; i += plan->run_len[i]) {
+        if (plan->run_len[i] > 1) {
+            fused += run_fused(plan, i, service, output, run_one, arg, &failed);
+        } else if (run_one(plan->items[i], i, &stdio, arg) == ACTION_DAG_SKIP_FOLLOWUPS) {
+            break;
+        }
+    }
+    if (fused_failed != NULL) *fused_failed = failed;
+    return fused;
+}
+
+void ShellFuse_free(shell_fuse_t *plan) {
+    if (plan == NULL) return;
+    if (plan->scripts != NULL) {
+        for (int i = 0; i < plan->count; i++) free(plan->scripts[i]);
+    }
+    free(plan->scripts);
+    free(plan->run_len);
+    free(plan->items);
+    free(plan);
+}
@@ -0,0 +1,32 @@
+#ifndef SHELL_FUSE_H
+#define SHELL_FUSE_H
+
+#include "cJSON.h"
+#include "action_dag.h"  // For action_dag_run_fn
+#include "output_ring.h"
+
+// Shell fusion: consecutive shell / run_command actions of a sequential service run as one
+// /bin/sh script instead of one spawn each. Each command still runs in its own subshell
+// (so 'cd', variables and 'exit' stay local to it) and is reported on its own: after each
+// command the script writes its exit status to a side channel and waits for the daemon to
+// acknowledge it, so logs, output order and activity tracking match unfused runs.
+// Only plain actions fuse: "type", "command" and an optional "id", no limits, and no
+// command that refers to $$ or $PPID.
+// A command killed by a signal is reported as exit status 128+N, as a shell reports it.
+typedef struct shell_fuse shell_fuse_t;
+
+// Optimizer pass run at load. Returns NULL when no two consecutive actions can be fused.
+// 'actions' must outlive the plan.
+shell_fuse_t *ShellFuse_plan(const cJSON *actions);
+
+// Run every action of the service in array order: fused runs as one script, the others
+// (and a run whose script cannot be started) through 'run_one', stopping early when it
+// returns ACTION_DAG_SKIP_FOLLOWUPS. Returns how many commands ran inside fused scripts
+// (they do not go through 'run_one'); '*fused_failed' (may be NULL) gets how many of
+// those reported a non-zero status.
+int ShellFuse_run(const shell_fuse_t *plan, const char *service, output_ring_t *output,
+                  action_dag_run_fn *run_one, void *arg, int *fused_failed);
+
+void ShellFuse_free(shell_fuse_t *plan);
+
+#endif // SHELL_FUSE_H
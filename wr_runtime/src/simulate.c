@@ -0,0 +1,187 @@
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simulate.h"
+#include "clock_source.h"
+#include "cJSON.h"
+#include "logger.h"
+
+#define LOG_SIM_INFO(fmt, ...) WR_LOG_INFO("simulate", fmt, ##__VA_ARGS__)
+#define LOG_SIM_ERROR(fmt, ...) WR_LOG_ERROR("simulate", fmt, ##__VA_ARGS__)
+
+#define NS_PER_SECOND 1000000000u
+
+typedef struct {
+    uint64_t fires;
+    uint64_t first_ns;     // Virtual times, since the start of the simulation
+    uint64_t last_ns;
+    uint64_t lag_sum_ns;   // How long after its interval was up the service fired
+    uint64_t lag_max_ns;
+} sim_service_t;
+
+// A peak: most fires in one tick or minute, and when (seconds into the simulation).
+typedef struct {
+    uint64_t fires;
+    double at;
+} sim_peak_t;
+
+static sim_service_t *services = NULL;
+static int service_count = 0;
+static time_t start;
+static uint64_t start_ns;
+static uint64_t end_ns;
+static uint64_t action_cost_ns;
+static struct timespec real_start;
+
+static uint64_t tick_start_ns;
+static uint64_t ticks, overrun_ticks, fires, busy_ns;
+static sim_peak_t peak_tick, peak_minute;
+static uint64_t minute = 0, minute_fires = 0;
+
+static uint64_t virtual_ns(void) {
+    struct timespec ts;
+    Clock_now_ts(&ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+long Sim_parse_duration(const char *text) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (end == text || value <= 0) return -1;
+    long unit = 1;
+    if (*end == 'm') unit = 60;
+    else if (*end == 'h') unit = 3600;
+    else if (*end == 'd') unit = 86400;
+    else if (*end != '\0' && *end != 's') return -1;
+    if (*end != '\0' && end[1] != '\0') return -1;
+    return value * unit;
+}
+
+int Sim_start(int count, long duration, uint64_t action_ns) {
+    services = calloc(count > 0 ? (size_t)count : 1, sizeof(*services));
+    if (services == NULL) {
+        LOG_SIM_ERROR("%s", "Out of memory starting the simulation.");
+        return -1;
+    }
+    service_count = count;
+    action_cost_ns = action_ns;
+    clock_gettime(CLOCK_MONOTONIC, &real_start);
+    start = time(NULL);
+    Clock_use_virtual(start);
+    start_ns = virtual_ns();
+    end_ns = start_ns + (uint64_t)duration * NS_PER_SECOND;
+    LOG_SIM_INFO("Simulating %ld seconds of %d services.", duration, count);
+    return 0;
+}
+
+int Sim_running(void) {
+    return virtual_ns() < end_ns;
+}
+
+void Sim_fire(int index, const service_config_t *svc) {
+    if (index < 0 || index >= service_count) return;
+    sim_service_t *s = &services[index];
+    uint64_t now = virtual_ns() - start_ns;
+    // Due once its interval is up; a service that never ran is due from the start.
+    uint64_t due = 0;
+    if (svc->last_run_timestamp != 0) {
+        due = ((uint64_t)(svc->last_run_timestamp - start) + (uint64_t)svc->interval_seconds) * NS_PER_SECOND;
+    }
+    uint64_t lag = now > due ? now - due : 0;
+    if (s->fires == 0) s->first_ns = now;
+    s->fires++;
+    s->last_ns = now;
+    s->lag_sum_ns += lag;
+    if (lag > s->lag_max_ns) s->lag_max_ns = lag;
+    fires++;
+
+    if (now / (60 * (uint64_t)NS_PER_SECOND) != minute) {
+        minute = now / (60 * (uint64_t)NS_PER_SECOND);
+        minute_fires = 0;
+    }
+    if (++minute_fires > peak_minute.fires) {
+        peak_minute.fires = minute_fires;
+        peak_minute.at = (double)(minute * 60);
+    }
+
+    // The actions run one after another on the scheduler thread: charge them all.
+    int actions = cJSON_GetArraySize(cJSON_GetObjectItemCaseSensitive(svc->config_json, "actions"));
+    uint64_t cost = (uint64_t)actions * action_cost_ns;
+    busy_ns += cost;
+    Clock_advance_ns(cost);
+}
+
+void Sim_tick_begin(void) {
+    tick_start_ns = virtual_ns();
+}
+
+void Sim_tick_done(int fired) {
+    ticks++;
+    if (virtual_ns() - tick_start_ns > NS_PER_SECOND) overrun_ticks++;
+    if ((uint64_t)fired > peak_tick.fires) {
+        peak_tick.fires = (uint64_t)fired;
+        peak_tick.at = (double)(tick_start_ns - start_ns) / NS_PER_SECOND;
+    }
+}
+
+static cJSON *peak_json(const sim_peak_t *peak) {
+    cJSON *p = cJSON_CreateObject();
+    cJSON_AddNumberToObject(p, "fires", (double)peak->fires);
+    cJSON_AddNumberToObject(p, "at", peak->at);
+    return p;
+}
+
+void Sim_report(FILE *out) {
+    struct timespec real_end;
+    clock_gettime(CLOCK_MONOTONIC, &real_end);
+    double simulated = (double)(virtual_ns() - start_ns) / NS_PER_SECOND;
+
+    cJSON *doc = cJSON_CreateObject();
+    cJSON_AddNumberToObject(doc, "start", (double)start);
+    cJSON_AddNumberToObject(doc, "simulated_seconds", simulated);
+    cJSON_AddNumberToObject(doc, "real_seconds", (double)(real_end.tv_sec - real_start.tv_sec) +
+                                                     (double)(real_end.tv_nsec - real_start.tv_nsec) / 1e9);
+    cJSON_AddNumberToObject(doc, "action_ms", (double)action_cost_ns / 1e6);
+    cJSON_AddNumberToObject(doc, "ticks", (double)ticks);
+    cJSON_AddNumberToObject(doc, "overrun_ticks", (double)overrun_ticks);
+    cJSON_AddNumberToObject(doc, "busy_fraction", simulated > 0 ? (double)busy_ns / 1e9 / simulated : 0);
+    cJSON_AddNumberToObject(doc, "fires", (double)fires);
+    cJSON_AddItemToObject(doc, "peak_tick", peak_json(&peak_tick));
+    cJSON_AddItemToObject(doc, "peak_minute", peak_json(&peak_minute));
+
+    cJSON *list = cJSON_AddArrayToObject(doc, "services");
+    for (int i = 0; i < service_count; i++) {
+        const service_config_t *svc = SvcLoader_get_service_by_index(i);
+        const sim_service_t *s = &services[i];
+        if (svc == NULL || !svc->loaded) continue;
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", svc->name);
+        cJSON_AddNumberToObject(item, "interval", svc->interval_seconds);
+        cJSON_AddNumberToObject(item, "fires", (double)s->fires);
+        if (s->fires > 0) {
+            cJSON_AddNumberToObject(item, "first_fire", (double)s->first_ns / NS_PER_SECOND);
+            cJSON_AddNumberToObject(item, "last_fire", (double)s->last_ns / NS_PER_SECOND);
+            if (s->fires > 1) {
+                cJSON_AddNumberToObject(item, "mean_period",
+                                        (double)(s->last_ns - s->first_ns) / NS_PER_SECOND / (double)(s->fires - 1));
+            }
+            cJSON_AddNumberToObject(item, "lag_mean", (double)s->lag_sum_ns / NS_PER_SECOND / (double)s->fires);
+            cJSON_AddNumberToObject(item, "lag_max", (double)s->lag_max_ns / NS_PER_SECOND);
+        }
+        cJSON_AddItemToArray(list, item);
+    }
+
+    char *text = cJSON_Print(doc);
+    if (text != NULL) {
+        fprintf(out, "%s\n", text);
+        fflush(out);
+        free(text);
+    }
+    cJSON_Delete(doc);
+    free(services);
+    services = NULL;
+    service_count = 0;
+}
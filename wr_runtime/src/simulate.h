@@ -0,0 +1,38 @@
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include <stdio.h>  // For FILE
+#include <stdint.h> // For uint64_t
+#include <time.h>   // For time_t
+
+#include "service_loader.h"
+
+// Scheduler simulation ('wr_runtime --simulate DURATION'). The main loop runs on the
+// virtual clock (see clock_source.h) with the loaded services; conditions are evaluated
+// for real but actions are not run: each one is charged a modelled cost instead, which
+// moves the virtual clock forward just as a real action delays the rest of the tick.
+// At the end a JSON report gives, per service, when it fired and how late, and for the
+// whole set the busiest tick and minute, ticks that overran their second and how busy
+// the scheduler was, so the load of a new service set can be predicted before deploying it.
+
+// Parse a duration such as "90", "15m", "12h" or "7d" into seconds; -1 if invalid.
+long Sim_parse_duration(const char *text);
+
+// Start a simulation of 'duration' seconds over the 'count' loaded services, charging
+// 'action_ns' per action. Switches to the virtual clock. Returns 0 or -1.
+int Sim_start(int count, long duration, uint64_t action_ns);
+
+// 1 while the simulated duration has not elapsed.
+int Sim_running(void);
+
+// Service 'index' fired at the current virtual time: record it and charge its actions.
+void Sim_fire(int index, const service_config_t *svc);
+
+// Bracket each scheduler tick; 'fired' is the number of services that fired in it.
+void Sim_tick_begin(void);
+void Sim_tick_done(int fired);
+
+// Write the report as JSON and free the simulation state.
+void Sim_report(FILE *out);
+
+#endif // SIMULATE_H
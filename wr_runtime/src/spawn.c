@@ -0,0 +1,365 @@
+#define _GNU_SOURCE // For pipe2, syscall(), SOCK_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "spawn.h"
+#include "spawn_helper.h"
+#include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+#include "stats_page.h"
+
+#define LOG_SPAWN_INFO(fmt, ...) WR_LOG_INFO("spawn", fmt, ##__VA_ARGS__)
+#define LOG_SPAWN_ERROR(fmt, ...) WR_LOG_ERROR("spawn", fmt, ##__VA_ARGS__)
+
+#define WAIT_POLL_MS 10 // Exit polling interval when pidfds are unavailable
+#define EXIT_CHECK_MS 50   // While the output pipe is quiet, check this often whether the child exited
+#define EXIT_GRACE_MS 100  // Output still read after the child exited; background jobs may keep the pipe
+
+// A started child and its watchdog state.
+typedef struct {
+    const char *command;
+    pid_t pid;
+    int via_helper;
+    uint32_t helper_id;
+    int pidfd;              // Direct path: becomes readable when the child exits (-1 if unsupported)
+    const spawn_redirect_t *redirects; // Installed in the child after the capture pipe
+    size_t nredirects;
+    int side_fd;            // Daemon end of the Spawn_run_script() side channel, -1 if none
+    int side_child_fd;      // Child's end; closed here once the child holds it
+    spawn_side_fn *on_side;
+    void *side_arg;
+    int timeout_ms;
+    int stage;              // 0 running, 1 SIGTERM sent, 2 SIGKILL sent, 3 stopped draining
+    long long deadline_ms;  // Next escalation, -1 for none
+    uint64_t cpu_ns;        // User + system time of the child, once it was reaped
+    int reaped;             // Reaped while draining its output; 'exit_status' holds its status
+    int exit_status;
+} child_t;
+
+static int remaining_ms(const child_t *c) {
+    if (c->deadline_ms < 0) return -1;
+    long long left = c->deadline_ms - ProcLimits_now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+// The child called setsid(), so its pid is also its process group: signal the whole group
+// so that pipelines and background jobs started by the shell go down with it.
+static void signal_child(const child_t *c, int sig) {
+    if (kill(-c->pid, sig) != 0) kill(c->pid, sig);
+}
+
+static void escalate(child_t *c) {
+    switch (c->stage) {
+        case 0:
+            LOG_SPAWN_INFO("'%s' exceeded timeout_ms=%d, sending SIGTERM.", c->command, c->timeout_ms);
+            signal_child(c, SIGTERM);
+            c->deadline_ms = ProcLimits_now_ms() + PROC_LIMITS_KILL_GRACE_MS;
+            break;
+        case 1:
+            LOG_SPAWN_INFO("'%s' still running %d ms after SIGTERM, sending SIGKILL.", c->command, PROC_LIMITS_KILL_GRACE_MS);
+            signal_child(c, SIGKILL);
+            c->deadline_ms = ProcLimits_now_ms() + PROC_LIMITS_KILL_GRACE_MS;
+            break;
+        default:
+            // Only processes that left the group (e.g. with setsid) can still hold the
+            // output pipe: stop reading it rather than wait on them.
+            c->deadline_ms = -1;
+            break;
+    }
+    c->stage++;
+}
+
+static int wait_once(child_t *c, int timeout_ms, int *status);
+
+// How long to wait for output in one go: until the next escalation, the next check for
+// the child's exit, or the end of the grace period after it ('grace_end', -1 before).
+static int output_slice_ms(const child_t *c, long long grace_end) {
+    long long now = ProcLimits_now_ms();
+    long long until = grace_end >= 0 ? grace_end : now + EXIT_CHECK_MS;
+    if (c->deadline_ms >= 0 && !c->reaped && c->deadline_ms < until) until = c->deadline_ms;
+    return until > now ? (int)(until - now) : 0;
+}
+
+// The output pipe was quiet for a slice: escalate if due and notice the child's exit.
+// Returns 1 once EXIT_GRACE_MS have passed since the exit: whatever still holds the pipe
+// was started in the background and is left running, uncaptured.
+static int output_wait_over(child_t *c, long long *grace_end) {
+    long long now = ProcLimits_now_ms();
+    if (*grace_end >= 0) {
+        if (now < *grace_end) return 0;
+        LOG_SPAWN_INFO("'%s' exited, its background processes are no longer captured.", c->command);
+        return 1;
+    }
+    if (!c->reaped && wait_once(c, 0, &c->exit_status) == 0) c->reaped = 1;
+    if (c->reaped) *grace_end = now + EXIT_GRACE_MS;
+    else if (c->deadline_ms >= 0 && now >= c->deadline_ms) escalate(c);
+    return 0;
+}
+
+static void drain_output(child_t *c, output_ring_t *output, int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); // Draining never stalls the ring lock
+    long long grace_end = -1;
+    while (c->stage < 3) {
+        if (OutRing_drain_fd(output, fd, output_slice_ms(c, grace_end)) >= 0) {
+            return;
+        }
+        if (errno != ETIMEDOUT) {
+            LOG_SPAWN_ERROR("Capturing output of '%s' failed: %s", c->command, strerror(errno));
+            return;
+        }
+        if (output_wait_over(c, &grace_end)) return;
+    }
+}
+
+// Capture output while serving the side channel. Before each on_side() call, whatever is
+// already in the output pipe is moved to the ring, so the callback sees the output the
+// child produced before it signalled. Returns once the child closed both.
+static void pump_with_side(child_t *c, output_ring_t *output, int fd) {
+    if (fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    long long grace_end = -1;
+    while (c->stage < 3 && c->side_fd >= 0) {
+        struct pollfd pfds[2] = { { c->side_fd, POLLIN, 0 }, { fd, POLLIN, 0 } };
+        int ready = poll(pfds, fd >= 0 ? 2 : 1, output_slice_ms(c, grace_end));
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            LOG_SPAWN_ERROR("poll failed for '%s': %s", c->command, strerror(errno));
+            return;
+        }
+        if (ready == 0) {
+            if (output_wait_over(c, &grace_end)) return;
+            continue;
+        }
+        if (fd >= 0 && (pfds[1].revents || pfds[0].revents)) {
+            // Timeout 0: take what is there now. EOF means every writer is gone.
+            if (OutRing_drain_fd(output, fd, 0) >= 0) {
+                fd = -1;
+            } else if (errno != ETIMEDOUT) {
+                LOG_SPAWN_ERROR("Capturing output of '%s' failed: %s", c->command, strerror(errno));
+                fd = -1;
+            }
+        }
+        if (pfds[0].revents && c->on_side(c->side_fd, c->side_arg) != 0) {
+            c->side_fd = -1;
+        }
+    }
+    if (fd >= 0) drain_output(c, output, fd);
+}
+
+// One bounded wait for the child: 0 exited (*status set), 1 timed out, -1 error.
+static int wait_once(child_t *c, int timeout_ms, int *status) {
+    if (c->via_helper) {
+        if (SpawnHelper_wait(c->helper_id, timeout_ms, status, &c->cpu_ns) == 0) return 0;
+        return errno == ETIMEDOUT ? 1 : -1;
+    }
+    struct rusage ru;
+    if (timeout_ms < 0) {
+        while (wait4(c->pid, status, 0, &ru) == -1) {
+            if (errno != EINTR) return -1;
+        }
+        c->cpu_ns = SpawnHelper_rusage_ns(&ru);
+        return 0;
+    }
+    if (c->pidfd >= 0) {
+        struct pollfd pfd = { c->pidfd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno != EINTR) return -1;
+        if (ready <= 0) return 1;
+        if (wait4(c->pid, status, 0, &ru) != c->pid) return -1;
+        c->cpu_ns = SpawnHelper_rusage_ns(&ru);
+        return 0;
+    }
+    long long end = ProcLimits_now_ms() + timeout_ms;
+    for (;;) {
+        pid_t r = wait4(c->pid, status, WNOHANG, &ru);
+        if (r == c->pid) {
+            c->cpu_ns = SpawnHelper_rusage_ns(&ru);
+            return 0;
+        }
+        if (r == -1 && errno != EINTR) return -1;
+        if (ProcLimits_now_ms() >= end) return 1;
+        struct timespec ts = { 0, WAIT_POLL_MS * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int wait_child(child_t *c, int *status) {
+    if (c->reaped) {
+        *status = c->exit_status;
+        return 0;
+    }
+    for (;;) {
+        int rc = wait_once(c, remaining_ms(c), status);
+        if (rc != 1) return rc;
+        escalate(c);
+    }
+}
+
+// Fork/exec in the daemon itself (no helper, or the helper could not take the request).
+static int start_direct(child_t *c, output_ring_t *output, const proc_limits_t *limits, int cgroup_fd, int *out_fd) {
+    int out_pipe[2] = {-1, -1};
+    if (output != NULL && pipe2(out_pipe, O_CLOEXEC) == -1) {
+        return -1;
+    }
+
+    int needs_join = 0;
+    pid_t pid = ProcLimits_fork(cgroup_fd, &needs_join);
+    if (pid == -1) {
+        int saved = errno;
+        if (output != NULL) {
+            close(out_pipe[0]);
+            close(out_pipe[1]);
+        }
+        errno = saved;
+        return -1;
+    } else if (pid == 0) { // Child process
+        if (setsid() == -1) { // Create new session and detach from terminal
+            LOG_SPAWN_ERROR("Child setsid failed: %s", strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+        if (output != NULL) {
+            // stdout and stderr share one pipe so their relative order is preserved.
+            if (dup2(out_pipe[1], STDOUT_FILENO) == -1 || dup2(out_pipe[1], STDERR_FILENO) == -1) {
+                _exit(EXIT_FAILURE);
+            }
+        }
+        if (SpawnHelper_redirect_child(c->redirects, c->nredirects) != 0) {
+            _exit(EXIT_FAILURE);
+        }
+        ProcLimits_apply_child(limits, cgroup_fd, needs_join);
+        execl("/bin/sh", "sh", "-c", c->command, (char *)0);
+        LOG_SPAWN_ERROR("execl failed for /bin/sh -c '%s': %s", c->command, strerror(errno));
+        _exit(EXIT_FAILURE); // Exit child if execl fails
+    }
+
+    // Parent process
+    c->pid = pid;
+#ifdef SYS_pidfd_open
+    c->pidfd = c->timeout_ms > 0 ? (int)syscall(SYS_pidfd_open, pid, 0) : -1;
+#endif
+    if (output != NULL) {
+        close(out_pipe[1]);
+        *out_fd = out_pipe[0];
+    }
+    return 0;
+}
+
+static int run_child(child_t *c, output_ring_t *output, const char *service, const proc_limits_t *limits, int *status) {
+    // Memory caps are enforced by a cgroup per spawn when cgroup v2 is writable.
+    char cgroup_path[320];
+    int cgroup_fd = -1;
+    if (limits->max_rss > 0 && service != NULL) {
+        cgroup_fd = ProcLimits_cgroup_open(service, limits, cgroup_path, sizeof(cgroup_path));
+    }
+
+    int out_fd = -1;
+    int started = 0;
+    uint64_t spawn_start = Metrics_now_ns();
+    if (SpawnHelper_available()) {
+        char *argv[] = { "/bin/sh", "-c", (char *)c->command, NULL };
+        if (SpawnHelper_spawn(argv, NULL, NULL, output != NULL, c->redirects, c->nredirects, limits,
+                              cgroup_fd >= 0 ? cgroup_path : NULL,
+                              &c->helper_id, &c->pid, &out_fd) == 0) {
+            c->via_helper = 1;
+            started = 1;
+        } else if (errno != EPIPE && errno != E2BIG) {
+            int saved = errno;
+            if (cgroup_fd >= 0) {
+                close(cgroup_fd);
+                ProcLimits_cgroup_remove(cgroup_path);
+            }
+            errno = saved;
+            return -1;
+        }
+        // Helper gone or request too large: fork directly below.
+    }
+    if (!started && start_direct(c, output, limits, cgroup_fd, &out_fd) != 0) {
+        int saved = errno;
+        if (cgroup_fd >= 0) {
+            close(cgroup_fd);
+            ProcLimits_cgroup_remove(cgroup_path);
+        }
+        errno = saved;
+        return -1;
+    }
+    int in_cgroup = cgroup_fd >= 0;
+    if (in_cgroup) close(cgroup_fd);
+    uint64_t spawned = Metrics_now_ns();
+    Metrics_observe(METRIC_SPAWN_SECONDS, c->via_helper ? "helper" : "fork", spawned - spawn_start);
+    TRACE_SPAN("process", "spawn", c->command, spawn_start);
+    StatsPage_child_started(service);
+    if (c->side_child_fd >= 0) {
+        close(c->side_child_fd); // The channel now reports EOF once the child is gone
+        c->side_child_fd = -1;
+    }
+
+    if (c->side_fd >= 0) {
+        pump_with_side(c, output, out_fd);
+    } else if (out_fd >= 0) {
+        drain_output(c, output, out_fd);
+    }
+    if (out_fd >= 0) close(out_fd);
+    int rc = wait_child(c, status);
+    if (in_cgroup) ProcLimits_cgroup_remove(cgroup_path);
+    TRACE_SPAN("process", "child", c->command, spawned);
+    StatsPage_child_exited(service, rc == 0 ? *status : -1, c->cpu_ns);
+    if (c->pidfd >= 0) close(c->pidfd);
+    return rc == 0 ? 0 : -1;
+}
+
+static void child_init(child_t *c, const char *command, const proc_limits_t *limits) {
+    memset(c, 0, sizeof(*c));
+    c->command = command;
+    c->pidfd = -1;
+    c->side_fd = -1;
+    c->side_child_fd = -1;
+    c->timeout_ms = limits->timeout_ms;
+    c->deadline_ms = limits->timeout_ms > 0 ? ProcLimits_now_ms() + limits->timeout_ms : -1;
+}
+
+int Spawn_run_shell(const char *command, output_ring_t *output, int stdin_fd, int stdout_fd,
+                    const char *service, const proc_limits_t *limits, int *status) {
+    static const proc_limits_t no_limits;
+    if (limits == NULL) limits = &no_limits;
+
+    child_t c;
+    child_init(&c, command, limits);
+    spawn_redirect_t redirects[2];
+    if (stdin_fd >= 0) redirects[c.nredirects++] = (spawn_redirect_t){ stdin_fd, STDIN_FILENO };
+    if (stdout_fd >= 0) redirects[c.nredirects++] = (spawn_redirect_t){ stdout_fd, STDOUT_FILENO };
+    c.redirects = redirects;
+    return run_child(&c, output, service, limits, status);
+}
+
+int Spawn_run_script(const char *script, output_ring_t *output, const char *service,
+                     int side_target, spawn_side_fn *on_side, void *arg, int *status) {
+    static const proc_limits_t no_limits;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        return -1;
+    }
+    child_t c;
+    child_init(&c, script, &no_limits);
+    spawn_redirect_t redirect = { sv[1], side_target };
+    c.redirects = &redirect;
+    c.nredirects = 1;
+    c.side_fd = sv[0];
+    c.side_child_fd = sv[1];
+    c.on_side = on_side;
+    c.side_arg = arg;
+
+    int rc = run_child(&c, output, service, &no_limits, status);
+    close(sv[0]);
+    if (c.side_child_fd >= 0) close(c.side_child_fd); // Start failed
+    return rc;
+}
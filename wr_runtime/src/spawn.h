@@ -0,0 +1,37 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <sys/types.h> // For pid_t
+
+#include "output_ring.h"
+#include "proc_limits.h"
+
+// Shared fork/exec path for the command-running actions (shell, run_command).
+
+// Run 'command' with /bin/sh -c in its own session and wait for it. The fork/exec is done
+// by the spawn helper when it is running, directly by the daemon otherwise.
+// When 'output' is non-NULL the child's stdout and stderr go through a pipe into
+// that ring; otherwise the child inherits the daemon's stdout/stderr.
+// 'stdin_fd' / 'stdout_fd' (-1: unchanged) replace the child's stdin / stdout, e.g. with
+// the ends of a pipe to another action; stderr is still captured. The caller keeps and
+// closes its copies.
+// 'limits' (may be NULL) are applied to the child; a memory cap places it in the cgroup
+// of 'service'. With a timeout the watchdog sends SIGTERM to the child's process group,
+// then SIGKILL after PROC_LIMITS_KILL_GRACE_MS; *status then reports the signal.
+// Returns 0 and stores the waitpid() status in *status, or -1 if the command could
+// not be started or waited for (errno set).
+int Spawn_run_shell(const char *command, output_ring_t *output, int stdin_fd, int stdout_fd,
+                    const char *service, const proc_limits_t *limits, int *status);
+
+// Called when the daemon's end of a Spawn_run_script() side channel is readable or was
+// closed. Return 0 to keep watching it, -1 to stop.
+typedef int (spawn_side_fn)(int fd, void *arg);
+
+// Run 'script' like Spawn_run_shell() (no redirections or limits), with one end of a
+// socket pair installed as descriptor 'side_target' in the child. 'on_side' is invoked
+// with the other end; before each call the output the child wrote so far is moved into
+// 'output', so a callback can tell which output came before a message.
+int Spawn_run_script(const char *script, output_ring_t *output, const char *service,
+                     int side_target, spawn_side_fn *on_side, void *arg, int *status);
+
+#endif // SPAWN_H
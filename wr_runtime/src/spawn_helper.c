@@ -0,0 +1,612 @@
+#define _GNU_SOURCE // For pipe2, SOCK_CLOEXEC, signalfd
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>     // For PR_SET_PDEATHSIG
+#include <sys/signalfd.h>
+#include <sys/resource.h>   // For struct rusage
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "spawn_helper.h"
+#include "proc_limits.h"
+#include "logger.h"
+
+#define LOG_HELPER_INFO(fmt, ...) WR_LOG_INFO("spawn_helper", fmt, ##__VA_ARGS__)
+#define LOG_HELPER_ERROR(fmt, ...) WR_LOG_ERROR("spawn_helper", fmt, ##__VA_ARGS__)
+
+#define HELPER_MSG_MAX 65536 // Largest request; bigger commands fall back to a direct fork
+#define HELPER_BATCH 32      // Requests handled (and replies sent) per wakeup
+
+// Request flags
+#define REQ_CAPTURE 1u
+#define REQ_HAS_ENV 2u
+
+// Request: header followed by NUL-terminated strings: argv[argc], env[envc], cwd ("" = keep)
+// and the cgroup directory to start the child in ("" = none). The fds of the redirects
+// travel with it (SCM_RIGHTS) in the order of 'redirect_to'.
+typedef struct {
+    uint32_t id;
+    uint32_t flags;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t nredirects;
+    int32_t redirect_to[SPAWN_MAX_REDIRECTS];
+    proc_limits_t limits;
+} helper_req_t;
+
+typedef enum {
+    REPLY_STARTED = 1,  // value = pid; has_fd if a capture pipe travels with the message
+    REPLY_FAILED,       // value = errno
+    REPLY_EXITED        // value = waitpid() status, cpu_ns = the child's user + system time
+} reply_kind_t;
+
+// Replies are batched: one message carries up to HELPER_BATCH records, and the fds of
+// records with has_fd set travel in a single SCM_RIGHTS control message, in order.
+typedef struct {
+    uint32_t id;
+    uint32_t kind;
+    int32_t value;
+    int32_t has_fd;
+    uint64_t cpu_ns;
+} helper_reply_t;
+
+int SpawnHelper_redirect_child(const spawn_redirect_t *redirects, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (redirects[i].fd == redirects[i].target) {
+            // Already in place: only the close-on-exec flag has to go.
+            if (fcntl(redirects[i].fd, F_SETFD, 0) == -1) return -1;
+        } else if (dup2(redirects[i].fd, redirects[i].target) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// --- Helper process side ---
+
+typedef struct {
+    pid_t pid;
+    uint32_t id;
+} child_slot_t;
+
+static int send_replies(int sock, const helper_reply_t *recs, size_t count, const int *fds, size_t nfds) {
+    if (count == 0) return 0;
+    struct iovec iov = { (void *)recs, count * sizeof(*recs) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        char buf[CMSG_SPACE(HELPER_BATCH * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    if (nfds > 0) {
+        memset(&ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+    while (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+// Parse one request and fork the child. Fills 'rec'; returns the capture fd to pass back or -1.
+// 'fds' are the descriptors that came with the request; the caller closes them.
+static int helper_spawn_one(const char *buf, size_t len, const int *fds, size_t nfds, const sigset_t *orig_mask,
+                            helper_reply_t *rec, pid_t *pid_out) {
+    helper_req_t req;
+    memset(rec, 0, sizeof(*rec));
+    rec->kind = REPLY_FAILED;
+    rec->value = EINVAL;
+    if (len < sizeof(req)) return -1;
+    memcpy(&req, buf, sizeof(req));
+    rec->id = req.id;
+    if (nfds != req.nredirects) return -1;
+    spawn_redirect_t redirects[SPAWN_MAX_REDIRECTS];
+    for (size_t i = 0; i < nfds; i++) {
+        redirects[i].fd = fds[i];
+        redirects[i].target = req.redirect_to[i];
+    }
+    if (req.argc == 0 || req.argc > HELPER_MSG_MAX / 2 || req.envc > HELPER_MSG_MAX / 2) return -1;
+
+    // Point argv/envp at the strings inside the request buffer.
+    char **vec = calloc(req.argc + req.envc + 2, sizeof(char *));
+    if (vec == NULL) {
+        rec->value = ENOMEM;
+        return -1;
+    }
+    char **argv = vec;
+    char **envp = vec + req.argc + 1;
+    const char *cwd = NULL;
+    const char *cgroup = NULL;
+    const char *p = buf + sizeof(req);
+    const char *end = buf + len;
+    for (uint32_t i = 0; i < req.argc + req.envc + 2; i++) {
+        const char *nul = memchr(p, '\0', (size_t)(end - p));
+        if (nul == NULL) {
+            free(vec);
+            return -1;
+        }
+        if (i < req.argc) argv[i] = (char *)p;
+        else if (i < req.argc + req.envc) envp[i - req.argc] = (char *)p;
+        else if (i == req.argc + req.envc) cwd = p[0] ? p : NULL;
+        else cgroup = p[0] ? p : NULL;
+        p = nul + 1;
+    }
+
+    int out_pipe[2] = {-1, -1};
+    if ((req.flags & REQ_CAPTURE) && pipe2(out_pipe, O_CLOEXEC) == -1) {
+        rec->value = errno;
+        free(vec);
+        return -1;
+    }
+
+    int cgroup_fd = cgroup ? open(cgroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    int needs_join = 0;
+    pid_t pid = ProcLimits_fork(cgroup_fd, &needs_join);
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, orig_mask, NULL);
+        if (setsid() == -1) _exit(127);
+        if (req.flags & REQ_CAPTURE) {
+            // stdout and stderr share one pipe so their relative order is preserved.
+            if (dup2(out_pipe[1], STDOUT_FILENO) == -1 || dup2(out_pipe[1], STDERR_FILENO) == -1) _exit(127);
+        }
+        if (SpawnHelper_redirect_child(redirects, nfds) != 0) _exit(127);
+        ProcLimits_apply_child(&req.limits, cgroup_fd, needs_join);
+        if (cwd != NULL && chdir(cwd) != 0) _exit(127);
+        if (req.flags & REQ_HAS_ENV) {
+            execve(argv[0], argv, envp);
+        } else {
+            execv(argv[0], argv);
+        }
+        _exit(127); // Same convention as sh for "command not found"
+    }
+    int saved = errno;
+    free(vec);
+    if (cgroup_fd >= 0) close(cgroup_fd);
+    if (out_pipe[1] >= 0) close(out_pipe[1]);
+    if (pid == -1) {
+        if (out_pipe[0] >= 0) close(out_pipe[0]);
+        rec->value = saved;
+        return -1;
+    }
+    rec->kind = REPLY_STARTED;
+    rec->value = (int32_t)pid;
+    rec->has_fd = out_pipe[0] >= 0;
+    *pid_out = pid;
+    return out_pipe[0];
+}
+
+// Receive one request and the fds attached to it (at most SPAWN_MAX_REDIRECTS).
+static ssize_t recv_request(int sock, char *buf, int *fds, size_t *nfds, int flags) {
+    union {
+        char buf[CMSG_SPACE(SPAWN_MAX_REDIRECTS * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = { buf, HELPER_MSG_MAX };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    *nfds = 0;
+    ssize_t n = recvmsg(sock, &msg, flags | MSG_CMSG_CLOEXEC);
+    if (n < 0) return n;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (count > SPAWN_MAX_REDIRECTS) count = SPAWN_MAX_REDIRECTS; // Truncated by MSG_CTRUNC otherwise
+            memcpy(fds, CMSG_DATA(cm), count * sizeof(int));
+            *nfds = count;
+        }
+    }
+    return n;
+}
+
+static void helper_main(int sock) {
+    // Exit reports are driven by a signalfd, so SIGCHLD stays blocked in the helper
+    // (children get the original mask back before exec).
+    sigset_t chld_mask, orig_mask;
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_mask, &orig_mask);
+    int sfd = signalfd(-1, &chld_mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sfd < 0) _exit(1);
+
+    char *buf = malloc(HELPER_MSG_MAX);
+    child_slot_t *children = NULL;
+    size_t nchildren = 0, children_cap = 0;
+    if (buf == NULL) _exit(1);
+
+    for (;;) {
+        struct pollfd pfds[2] = { { sock, POLLIN, 0 }, { sfd, POLLIN, 0 } };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            _exit(1);
+        }
+
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            helper_reply_t recs[HELPER_BATCH];
+            int fds[HELPER_BATCH];
+            size_t nrecs = 0, nfds = 0;
+            // Drain whatever requests are queued, then answer them in one message.
+            while (nrecs < HELPER_BATCH) {
+                int req_fds[SPAWN_MAX_REDIRECTS];
+                size_t nreq_fds = 0;
+                ssize_t n = recv_request(sock, buf, req_fds, &nreq_fds, nrecs == 0 ? 0 : MSG_DONTWAIT);
+                if (n == 0) _exit(0); // Daemon closed its end
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    _exit(1);
+                }
+                pid_t pid = -1;
+                int fd = helper_spawn_one(buf, (size_t)n, req_fds, nreq_fds, &orig_mask, &recs[nrecs], &pid);
+                for (size_t i = 0; i < nreq_fds; i++) close(req_fds[i]); // The child has its copies
+                if (fd >= 0) fds[nfds++] = fd;
+                if (pid > 0) {
+                    if (nchildren == children_cap) {
+                        size_t cap = children_cap ? children_cap * 2 : 16;
+                        child_slot_t *grown = realloc(children, cap * sizeof(*grown));
+                        if (grown == NULL) _exit(1);
+                        children = grown;
+                        children_cap = cap;
+                    }
+                    children[nchildren].pid = pid;
+                    children[nchildren].id = recs[nrecs].id;
+                    nchildren++;
+                }
+                nrecs++;
+            }
+            int rc = send_replies(sock, recs, nrecs, fds, nfds);
+            for (size_t i = 0; i < nfds; i++) close(fds[i]); // The daemon holds its own copies now
+            if (rc != 0) _exit(0);
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sfd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+                // Signals coalesce: the waitpid loop below reaps everything that exited.
+            }
+            helper_reply_t recs[HELPER_BATCH];
+            size_t nrecs = 0;
+            int status;
+            pid_t pid;
+            struct rusage ru;
+            while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+                for (size_t i = 0; i < nchildren; i++) {
+                    if (children[i].pid != pid) continue;
+                    recs[nrecs].id = children[i].id;
+                    recs[nrecs].kind = REPLY_EXITED;
+                    recs[nrecs].value = status;
+                    recs[nrecs].has_fd = 0;
+                    recs[nrecs].cpu_ns = SpawnHelper_rusage_ns(&ru);
+                    nrecs++;
+                    children[i] = children[--nchildren];
+                    break;
+                }
+                if (nrecs == HELPER_BATCH) {
+                    if (send_replies(sock, recs, nrecs, NULL, 0) != 0) _exit(0);
+                    nrecs = 0;
+                }
+            }
+            if (send_replies(sock, recs, nrecs, NULL, 0) != 0) _exit(0);
+        }
+    }
+}
+
+// --- Daemon side ---
+
+typedef struct {
+    uint32_t id;
+    uint32_t kind;
+    int32_t value;
+    int fd;
+    uint64_t cpu_ns;
+} pending_result_t;
+
+static pthread_mutex_t helper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t helper_cond; // CLOCK_MONOTONIC, initialised by SpawnHelper_start()
+static int helper_fd = -1;
+static pid_t helper_pid = -1;
+static uint32_t next_id = 1;
+static int reader_busy = 0;    // One waiter at a time reads the socket; others sleep on helper_cond
+static pending_result_t *results = NULL;
+static size_t results_len = 0, results_cap = 0;
+
+int SpawnHelper_start(void) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+        LOG_HELPER_ERROR("socketpair failed: %s", strerror(errno));
+        return -1;
+    }
+    fflush(NULL); // Unflushed stdio buffers would otherwise be duplicated in the helper
+    pid_t pid = fork();
+    if (pid == -1) {
+        LOG_HELPER_ERROR("fork failed: %s", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        prctl(PR_SET_PDEATHSIG, SIGKILL); // Never outlive the daemon
+        helper_main(sv[1]);
+        _exit(0);
+    }
+    close(sv[1]);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // Wait deadlines must not jump with the wall clock
+    pthread_cond_init(&helper_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    helper_fd = sv[0];
+    helper_pid = pid;
+    LOG_HELPER_INFO("Spawn helper started (pid %d).", (int)pid);
+    return 0;
+}
+
+void SpawnHelper_stop(void) {
+    if (helper_pid <= 0) return; // Never started
+    pthread_mutex_lock(&helper_lock);
+    if (helper_fd >= 0) {
+        close(helper_fd);
+        helper_fd = -1;
+    }
+    for (size_t i = 0; i < results_len; i++) {
+        if (results[i].fd >= 0) close(results[i].fd);
+    }
+    free(results);
+    results = NULL;
+    results_len = results_cap = 0;
+    pthread_cond_broadcast(&helper_cond);
+    pthread_mutex_unlock(&helper_lock);
+    if (helper_pid > 0) {
+        while (waitpid(helper_pid, NULL, 0) == -1 && errno == EINTR) {
+        }
+        helper_pid = -1;
+    }
+}
+
+int SpawnHelper_available(void) {
+    pthread_mutex_lock(&helper_lock);
+    int up = helper_fd >= 0;
+    pthread_mutex_unlock(&helper_lock);
+    return up;
+}
+
+// Caller holds helper_lock. Marks the helper as gone; waiters then fail with EPIPE.
+static void helper_lost(void) {
+    if (helper_fd >= 0) {
+        LOG_HELPER_ERROR("%s", "Spawn helper went away, falling back to direct fork.");
+        close(helper_fd);
+        helper_fd = -1;
+    }
+}
+
+// Receive one batch of replies and file them in 'results'. Called without the lock.
+// Returns 0, 1 if nothing arrived before 'deadline_ms' (-1: wait forever), or -1 on error.
+static int read_replies(int fd, long long deadline_ms) {
+    if (deadline_ms >= 0) {
+        long long left = deadline_ms - ProcLimits_now_ms();
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready;
+        while ((ready = poll(&pfd, 1, left > 0 ? (int)left : 0)) < 0 && errno == EINTR) {
+        }
+        if (ready == 0) return 1;
+    }
+    helper_reply_t recs[HELPER_BATCH];
+    union {
+        char buf[CMSG_SPACE(HELPER_BATCH * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = { recs, sizeof(recs) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    ssize_t n;
+    while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+    if (n <= 0) return -1;
+
+    int fds[HELPER_BATCH];
+    size_t nfds = 0, next_fd = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+        }
+    }
+
+    size_t count = (size_t)n / sizeof(helper_reply_t);
+    pthread_mutex_lock(&helper_lock);
+    if (results_len + count > results_cap) {
+        size_t cap = results_cap ? results_cap * 2 : 32;
+        while (cap < results_len + count) cap *= 2;
+        pending_result_t *grown = realloc(results, cap * sizeof(*grown));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&helper_lock);
+            for (size_t i = 0; i < nfds; i++) close(fds[i]);
+            return -1;
+        }
+        results = grown;
+        results_cap = cap;
+    }
+    for (size_t i = 0; i < count; i++) {
+        pending_result_t *r = &results[results_len++];
+        r->id = recs[i].id;
+        r->kind = recs[i].kind;
+        r->value = recs[i].value;
+        r->cpu_ns = recs[i].cpu_ns;
+        r->fd = (recs[i].has_fd && next_fd < nfds) ? fds[next_fd++] : -1;
+    }
+    pthread_mutex_unlock(&helper_lock);
+    return 0;
+}
+
+// Block until a result for 'id' matching 'want' (REPLY_EXITED, or STARTED/FAILED) arrives,
+// or until 'deadline_ms' passes (-1: no deadline; fails with ETIMEDOUT).
+static int wait_result(uint32_t id, int want_exit, long long deadline_ms, pending_result_t *out) {
+    int looked = 0; // A deadline already past still takes the replies that are waiting
+    pthread_mutex_lock(&helper_lock);
+    for (;;) {
+        for (size_t i = 0; i < results_len; i++) {
+            int is_exit = results[i].kind == REPLY_EXITED;
+            if (results[i].id == id && is_exit == want_exit) {
+                *out = results[i];
+                results[i] = results[--results_len];
+                pthread_mutex_unlock(&helper_lock);
+                return 0;
+            }
+        }
+        if (helper_fd < 0) {
+            pthread_mutex_unlock(&helper_lock);
+            errno = EPIPE;
+            return -1;
+        }
+        if (deadline_ms >= 0 && looked && ProcLimits_now_ms() >= deadline_ms) {
+            pthread_mutex_unlock(&helper_lock);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (reader_busy) {
+            if (deadline_ms < 0) {
+                pthread_cond_wait(&helper_cond, &helper_lock);
+            } else {
+                struct timespec ts = { (time_t)(deadline_ms / 1000), (long)(deadline_ms % 1000) * 1000000 };
+                pthread_cond_timedwait(&helper_cond, &helper_lock, &ts);
+            }
+            looked = 1;
+            continue;
+        }
+        reader_busy = 1;
+        int fd = helper_fd;
+        pthread_mutex_unlock(&helper_lock);
+        int rc = read_replies(fd, deadline_ms);
+        looked = 1;
+        pthread_mutex_lock(&helper_lock);
+        reader_busy = 0;
+        if (rc < 0) helper_lost();
+        pthread_cond_broadcast(&helper_cond);
+    }
+}
+
+int SpawnHelper_spawn(char *const argv[], char *const envp[], const char *cwd, int capture,
+                      const spawn_redirect_t *redirects, size_t nredirects,
+                      const proc_limits_t *limits, const char *cgroup_path,
+                      uint32_t *id, pid_t *pid, int *out_fd) {
+    *out_fd = -1;
+    helper_req_t req;
+    memset(&req, 0, sizeof(req));
+    req.flags = (capture ? REQ_CAPTURE : 0) | (envp ? REQ_HAS_ENV : 0);
+    if (nredirects > SPAWN_MAX_REDIRECTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    req.nredirects = (uint32_t)nredirects;
+    for (size_t i = 0; i < nredirects; i++) req.redirect_to[i] = redirects[i].target;
+    if (limits != NULL) req.limits = *limits;
+
+    size_t len = sizeof(req);
+    for (; argv[req.argc] != NULL; req.argc++) len += strlen(argv[req.argc]) + 1;
+    for (; envp && envp[req.envc] != NULL; req.envc++) len += strlen(envp[req.envc]) + 1;
+    len += (cwd ? strlen(cwd) : 0) + 1;
+    len += (cgroup_path ? strlen(cgroup_path) : 0) + 1;
+    if (len > HELPER_MSG_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    char *buf = malloc(len);
+    if (buf == NULL) return -1;
+    char *p = buf + sizeof(req);
+    for (uint32_t i = 0; i < req.argc; i++) p = stpcpy(p, argv[i]) + 1;
+    for (uint32_t i = 0; i < req.envc; i++) p = stpcpy(p, envp[i]) + 1;
+    p = stpcpy(p, cwd ? cwd : "") + 1;
+    stpcpy(p, cgroup_path ? cgroup_path : "");
+
+    pthread_mutex_lock(&helper_lock);
+    if (helper_fd < 0) {
+        pthread_mutex_unlock(&helper_lock);
+        free(buf);
+        errno = EPIPE;
+        return -1;
+    }
+    req.id = next_id++;
+    memcpy(buf, &req, sizeof(req));
+    struct iovec iov = { buf, len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        char buf[CMSG_SPACE(SPAWN_MAX_REDIRECTS * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    int fds[SPAWN_MAX_REDIRECTS];
+    size_t nfds = nredirects;
+    for (size_t i = 0; i < nredirects; i++) fds[i] = redirects[i].fd;
+    if (nfds > 0) {
+        memset(&ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+    ssize_t sent;
+    while ((sent = sendmsg(helper_fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    if (sent < 0) helper_lost();
+    pthread_mutex_unlock(&helper_lock);
+    free(buf);
+    if (sent < 0) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    pending_result_t r;
+    if (wait_result(req.id, 0, -1, &r) != 0) return -1;
+    if (r.kind == REPLY_FAILED) {
+        errno = r.value;
+        return -1;
+    }
+    *id = req.id;
+    *pid = (pid_t)r.value;
+    *out_fd = r.fd;
+    return 0;
+}
+
+int SpawnHelper_wait(uint32_t id, int timeout_ms, int *status, uint64_t *cpu_ns) {
+    pending_result_t r;
+    long long deadline = timeout_ms >= 0 ? ProcLimits_now_ms() + timeout_ms : -1;
+    if (wait_result(id, 1, deadline, &r) != 0) return -1;
+    *status = r.value;
+    if (cpu_ns != NULL) *cpu_ns = r.cpu_ns;
+    return 0;
+}
+
+uint64_t SpawnHelper_rusage_ns(const struct rusage *ru) {
+    return (uint64_t)(ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000u +
+           (uint64_t)(ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000u;
+}
@@ -0,0 +1,61 @@
+#ifndef SPAWN_HELPER_H
+#define SPAWN_HELPER_H
+
+#include <stdint.h>     // For uint32_t
+#include <sys/types.h>  // For pid_t
+#include <sys/resource.h> // For struct rusage
+
+#include "proc_limits.h"
+
+#define SPAWN_MAX_REDIRECTS 4
+
+// The caller's descriptor 'fd' becomes descriptor 'target' in the child (0 = stdin, ...).
+typedef struct {
+    int fd;
+    int target;
+} spawn_redirect_t;
+
+// Prewarmed spawn helper ("zygote"). A small process forked at boot, before any service is
+// loaded, does every fork/exec on the daemon's behalf so spawn cost does not grow with the
+// daemon's heap. Requests and replies travel over a SOCK_SEQPACKET socketpair; capture
+// pipes come back via SCM_RIGHTS. When the helper is not running, callers fork themselves.
+
+// Fork the helper. Call early in main(), before large allocations. Returns 0 or -1.
+int SpawnHelper_start(void);
+
+// Close the socket and reap the helper (it also exits on its own if the daemon dies).
+void SpawnHelper_stop(void);
+
+// 1 while the helper is up and answering.
+int SpawnHelper_available(void);
+
+// Ask the helper to start argv[0] with 'argv' (execv, so argv[0] must be a path).
+// 'envp' NULL inherits the helper's environment; 'cwd' NULL keeps the helper's.
+// 'limits' (may be NULL) are applied in the child; 'cgroup_path' (may be NULL) is the
+// cgroup v2 directory the child is created in.
+// With 'capture' set, the child's stdout and stderr go to one pipe whose read end is
+// returned in *out_fd (else *out_fd is -1). The fds of 'redirects' (at most
+// SPAWN_MAX_REDIRECTS) are passed to the helper and installed in the child after the
+// capture pipe; the caller keeps its copies.
+// On success *id identifies the child for SpawnHelper_wait(). Returns 0, or -1 with errno
+// set (E2BIG: request too large).
+int SpawnHelper_spawn(char *const argv[], char *const envp[], const char *cwd, int capture,
+                      const spawn_redirect_t *redirects, size_t nredirects,
+                      const proc_limits_t *limits, const char *cgroup_path,
+                      uint32_t *id, pid_t *pid, int *out_fd);
+
+// In a freshly forked child: dup2() each redirect into place. Returns 0 or -1.
+// Also used by callers that fork themselves.
+int SpawnHelper_redirect_child(const spawn_redirect_t *redirects, size_t count);
+
+// Wait for the exit report of a child started by SpawnHelper_spawn(). Safe to call from
+// several threads at once. Stores the waitpid() status and, if 'cpu_ns' is not NULL, the
+// CPU time (user + system) the child used. Returns 0, or -1 with errno ETIMEDOUT after
+// 'timeout_ms' (>= 0; the report can still be collected later) or EPIPE if the helper
+// is gone.
+int SpawnHelper_wait(uint32_t id, int timeout_ms, int *status, uint64_t *cpu_ns);
+
+// User + system time of 'ru', in nanoseconds.
+uint64_t SpawnHelper_rusage_ns(const struct rusage *ru);
+
+#endif // SPAWN_HELPER_H
@@ -0,0 +1,559 @@
+#define _GNU_SOURCE // For eventfd, inotify_init1, O_DIRECTORY, fdopendir
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+#include "control.h"
+#include "cbor.h"
+#include "metrics.h"
+#include "logger.h"
+
+#define LOG_SPOOL_INFO(fmt, ...) WR_LOG_INFO("spool", fmt, ##__VA_ARGS__)
+#define LOG_SPOOL_WARN(fmt, ...) WR_LOG_WARN("spool", fmt, ##__VA_ARGS__)
+#define LOG_SPOOL_ERROR(fmt, ...) WR_LOG_ERROR("spool", fmt, ##__VA_ARGS__)
+
+#define LOG_NAME "outcomes.log"
+#define LOG_OLD_NAME "outcomes.log.1"
+#define STATUS_NAME "status.json"
+#define STATUS_TMP_NAME ".status.json" // Written, then renamed over STATUS_NAME
+
+// One command file of a batch. 'result' is NULL once recorded (or if it already was).
+typedef struct {
+    char *name;
+    cJSON *result;
+    int ok;        // Succeeded: "ok" and no failed action
+} command_t;
+
+static char spool_dir[1024];
+static int root_fd = -1, new_fd = -1, cur_fd = -1, run_fd = -1, failed_fd = -1;
+static int log_fd = -1;
+static int inotify_fd = -1;
+static int wake_fd = -1; // eventfd: stop was requested
+static pthread_t spool_thread;
+static int spool_running = 0;
+static uint64_t counts[4]; // Per outcome, for status.json
+static const char *outcome_names[4] = { "done", "failed", "rejected", "interrupted" };
+enum { OUTCOME_DONE, OUTCOME_FAILED, OUTCOME_REJECTED, OUTCOME_INTERRUPTED };
+
+// Workers: the spool thread queues the commands it started, they hand back the finished.
+static pthread_t workers[SPOOL_WORKERS];
+static int worker_count = 0;
+static command_t *queue[SPOOL_WORKERS];
+static int queue_len = 0;
+static command_t *finished[SPOOL_WORKERS];
+static int finished_len = 0;
+static int pool_stop = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+static cJSON *error_result(const char *msg) {
+    cJSON *res = cJSON_CreateObject();
+    cJSON_AddBoolToObject(res, "ok", 0);
+    cJSON_AddStringToObject(res, "error", msg);
+    return res;
+}
+
+// Create (if needed) and open the subdirectory 'name' of the spool.
+static int open_subdir(const char *name) {
+    if (mkdirat(root_fd, name, 0700) != 0 && errno != EEXIST) return -1;
+    return openat(root_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static int open_log(void) {
+    return openat(root_fd, LOG_NAME, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600); // Read back by terminate_log()
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// The names of the files in 'dir_fd', sorted (Maildir names start with the time, so this
+// is roughly oldest first). Returns how many, or -1.
+static int list_dir(int dir_fd, char ***names) {
+    int fd = dup(dir_fd);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (d == NULL) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    rewinddir(d); // The offset is shared with 'dir_fd' and left at the end by the last scan
+    int count = 0, cap = 0;
+    *names = NULL;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.' || e->d_type == DT_DIR) continue;
+        if (count == cap) {
+            cap = cap > 0 ? cap * 2 : 64;
+            char **grown = realloc(*names, (size_t)cap * sizeof(char *));
+            if (grown == NULL) break;
+            *names = grown;
+        }
+        if (((*names)[count] = strdup(e->d_name)) != NULL) count++;
+    }
+    closedir(d);
+    qsort(*names, (size_t)count, sizeof(char *), compare_names);
+    return count;
+}
+
+static void free_names(char **names, int count) {
+    for (int i = 0; i < count; i++) free(names[i]);
+    free(names);
+}
+
+// Read a started command from run/. Returns a malloc()ed buffer, or NULL with the reason.
+static char *read_command(const char *name, size_t *len, const char **err) {
+    int fd = openat(run_fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        *err = "not a regular file";
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0 || st.st_size > CONTROL_MAX_REQUEST) {
+        *err = st.st_size == 0 ? "empty file" : "larger than a control request may be";
+        close(fd);
+        return NULL;
+    }
+    char *data = malloc((size_t)st.st_size);
+    size_t have = 0;
+    while (data != NULL && have < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + have, (size_t)st.st_size - have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        have += (size_t)n;
+    }
+    close(fd);
+    if (data == NULL || have == 0) {
+        *err = data == NULL ? "out of memory" : "cannot read the file";
+        free(data);
+        return NULL;
+    }
+    *len = have;
+    return data;
+}
+
+static void run_command(command_t *cmd) {
+    size_t len;
+    const char *why;
+    char *data = read_command(cmd->name, &len, &why);
+    if (data == NULL) {
+        cmd->result = error_result(why);
+        return;
+    }
+    char err[160];
+    cJSON *request = Control_parse_request(data, len, Cbor_is_start((unsigned char)data[0]), err, sizeof(err));
+    free(data);
+    cmd->result = request != NULL ? Control_handle_request(request) : error_result(err);
+    cJSON_Delete(request);
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (queue_len == 0 && !pool_stop) pthread_cond_wait(&job_ready, &pool_lock);
+        if (queue_len == 0) break;
+        command_t *cmd = queue[0];
+        memmove(queue, queue + 1, (size_t)--queue_len * sizeof(queue[0]));
+        pthread_mutex_unlock(&pool_lock);
+        run_command(cmd);
+        pthread_mutex_lock(&pool_lock);
+        finished[finished_len++] = cmd;
+        pthread_cond_signal(&job_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+// A "run" whose actions failed still has "ok":true; it only succeeded if none did.
+static int succeeded(const cJSON *result) {
+    const cJSON *failed = cJSON_GetObjectItemCaseSensitive(result, "failed");
+    return cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(result, "ok")) &&
+           !(cJSON_IsNumber(failed) && failed->valuedouble > 0);
+}
+
+// Keep only the last SPOOL_OUTPUT_MAX bytes of the output, from a character boundary.
+static void trim_output(cJSON *result) {
+    const cJSON *output = cJSON_GetObjectItemCaseSensitive(result, "output");
+    if (!cJSON_IsString(output) || strlen(output->valuestring) <= SPOOL_OUTPUT_MAX) return;
+    const char *tail = output->valuestring + strlen(output->valuestring) - SPOOL_OUTPUT_MAX;
+    while ((*tail & 0xc0) == 0x80) tail++;
+    cJSON_ReplaceItemInObjectCaseSensitive(result, "output", cJSON_CreateString(tail));
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Append the results of some commands to outcomes.log, one line each, starting with
+// "spool_file", and sync it. Frees the results. Returns 0 or -1.
+static int record(command_t *cmds, int count) {
+    size_t len = 0, cap = 0;
+    char *buf = NULL;
+    for (int i = 0; i < count; i++) {
+        if (cmds[i].result == NULL) continue;
+        cmds[i].ok = succeeded(cmds[i].result);
+        trim_output(cmds[i].result);
+        cJSON *file = cJSON_CreateString(cmds[i].name);
+        char *name = file != NULL ? cJSON_PrintUnformatted(file) : NULL;
+        char *text = cJSON_PrintUnformatted(cmds[i].result);
+        cJSON_Delete(file);
+        cJSON_Delete(cmds[i].result);
+        cmds[i].result = NULL;
+        if (name != NULL && text != NULL && text[0] == '{') {
+            size_t need = len + strlen(name) + strlen(text) + 16;
+            if (need > cap) {
+                cap = need * 2;
+                char *grown = realloc(buf, cap);
+                if (grown == NULL) cap = 0; // Skipped; the command is still finished off
+                else buf = grown;
+            }
+            if (need <= cap) {
+                len += (size_t)sprintf(buf + len, "{\"spool_file\":%s%s%s\n", name, text[1] == '}' ? "" : ",",
+                                       text + 1);
+            }
+        }
+        cJSON_free(name);
+        cJSON_free(text);
+    }
+    int rc = 0;
+    if (len > 0 && (write_all(log_fd, buf, len) != 0 || fdatasync(log_fd) != 0)) rc = -1;
+    free(buf);
+    if (rc != 0) LOG_SPOOL_ERROR("Cannot write %s/%s: %s", spool_dir, LOG_NAME, strerror(errno));
+    return rc;
+}
+
+// Unlink the recorded commands (in 'dir_fd') that succeeded and move the others to failed/.
+static void finish(command_t *cmds, int count, int dir_fd, int outcome_if_failed) {
+    for (int i = 0; i < count; i++) {
+        int outcome = cmds[i].ok ? OUTCOME_DONE : outcome_if_failed;
+        int rc = cmds[i].ok ? unlinkat(dir_fd, cmds[i].name, 0)
+                            : renameat(dir_fd, cmds[i].name, failed_fd, cmds[i].name);
+        if (rc != 0) LOG_SPOOL_WARN("Cannot finish spool command %s: %s", cmds[i].name, strerror(errno));
+        counts[outcome]++;
+        Metrics_add(METRIC_SPOOL_COMMANDS, outcome_names[outcome], 1);
+    }
+}
+
+static void rotate_log(void) {
+    struct stat st;
+    if (fstat(log_fd, &st) != 0 || st.st_size < SPOOL_LOG_MAX) return;
+    int fd;
+    if (renameat(root_fd, LOG_NAME, root_fd, LOG_OLD_NAME) != 0 || (fd = open_log()) < 0) {
+        LOG_SPOOL_WARN("Cannot rotate %s/%s: %s", spool_dir, LOG_NAME, strerror(errno));
+        return;
+    }
+    close(log_fd);
+    log_fd = fd;
+}
+
+static int stop_requested(void) {
+    struct pollfd pfd = { wake_fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Run claimed commands, at most one per worker at a time. Each is moved from cur/ to
+// run/, and run/ synced, before it is handed to a worker: after a crash, run/ holds
+// exactly the commands that may have run. Outcomes are recorded as commands finish.
+// Once a stop is requested no more are started; the rest stay in cur/.
+static void run_claimed(command_t *cmds, int count) {
+    int slots = worker_count > 0 ? worker_count : 1, next = 0, in_flight = 0;
+    while (next < count || in_flight > 0) {
+        command_t *group[SPOOL_WORKERS];
+        int n = 0, stopping = stop_requested();
+        while (!stopping && next < count && in_flight + n < slots) {
+            command_t *cmd = &cmds[next++];
+            if (renameat(cur_fd, cmd->name, run_fd, cmd->name) == 0) group[n++] = cmd;
+            else LOG_SPOOL_WARN("Cannot start spool command %s: %s", cmd->name, strerror(errno));
+        }
+        if (n > 0) {
+            if (fsync(run_fd) != 0) LOG_SPOOL_WARN("Cannot sync %s/run: %s", spool_dir, strerror(errno));
+            if (worker_count == 0) { // No workers: run it here
+                run_command(group[0]);
+                finished[finished_len++] = group[0];
+            } else {
+                pthread_mutex_lock(&pool_lock);
+                for (int i = 0; i < n; i++) queue[queue_len++] = group[i];
+                pthread_cond_broadcast(&job_ready);
+                pthread_mutex_unlock(&pool_lock);
+            }
+            in_flight += n;
+        }
+        if (in_flight == 0) {
+            if (stopping) break;
+            continue;
+        }
+        command_t done[SPOOL_WORKERS];
+        int ndone;
+        // Refill once half the slots are free: each round costs a log and a run/ sync
+        int want = in_flight < (slots + 1) / 2 ? in_flight : (slots + 1) / 2;
+        pthread_mutex_lock(&pool_lock);
+        while (finished_len < want) pthread_cond_wait(&job_done, &pool_lock);
+        for (ndone = 0; ndone < finished_len; ndone++) done[ndone] = *finished[ndone];
+        finished_len = 0;
+        pthread_mutex_unlock(&pool_lock);
+        in_flight -= ndone;
+        // Not recorded: left in run/, the next start records them as interrupted.
+        if (record(done, ndone) == 0) finish(done, ndone, run_fd, OUTCOME_FAILED);
+    }
+}
+
+// Claim, run, record and finish 'count' (<= SPOOL_BATCH) files of new/. 'reject': record
+// them as rejected instead of running them.
+static void process(char **names, int count, int reject) {
+    command_t cmds[SPOOL_BATCH];
+    int claimed = 0;
+    rotate_log(); // Before claiming: recovery only has to read the current log
+    for (int i = 0; i < count; i++) {
+        if (renameat(new_fd, names[i], cur_fd, names[i]) != 0) continue; // Taken away meanwhile
+        cmds[claimed++] = (command_t){ names[i], NULL, 0 };
+    }
+    if (claimed == 0) return;
+    if (!reject) {
+        run_claimed(cmds, claimed);
+        return;
+    }
+    for (int i = 0; i < claimed; i++) cmds[i].result = error_result("spool full");
+    if (record(cmds, claimed) == 0) finish(cmds, claimed, cur_fd, OUTCOME_REJECTED);
+}
+
+static void write_status(long backlog) {
+    char text[512];
+    int n = snprintf(text, sizeof(text),
+                     "{\"backlog\":%ld,\"max_backlog\":%d,\"accepting\":%s,\"done\":%llu,\"failed\":%llu,"
+                     "\"rejected\":%llu,\"interrupted\":%llu,\"updated\":%lld}\n",
+                     backlog, SPOOL_MAX_BACKLOG, backlog < SPOOL_MAX_BACKLOG ? "true" : "false",
+                     (unsigned long long)counts[OUTCOME_DONE], (unsigned long long)counts[OUTCOME_FAILED],
+                     (unsigned long long)counts[OUTCOME_REJECTED], (unsigned long long)counts[OUTCOME_INTERRUPTED],
+                     (long long)time(NULL));
+    int fd = openat(root_fd, STATUS_TMP_NAME, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    int rc = write_all(fd, text, (size_t)n);
+    close(fd);
+    if (rc == 0) renameat(root_fd, STATUS_TMP_NAME, root_fd, STATUS_NAME);
+    Metrics_set(METRIC_SPOOL_BACKLOG, NULL, backlog);
+}
+
+// Take everything in new/. Returns how many files were there.
+static int drain(void) {
+    char **names;
+    int count = list_dir(new_fd, &names);
+    if (count <= 0) {
+        if (count == 0) write_status(0);
+        free(names);
+        return count < 0 ? 0 : count;
+    }
+    int keep = count < SPOOL_MAX_BACKLOG ? count : SPOOL_MAX_BACKLOG;
+    if (keep < count) {
+        LOG_SPOOL_WARN("Spool full: %d commands waiting, rejecting the %d newest.", count, count - keep);
+        for (int i = keep; i < count; i += SPOOL_BATCH) {
+            process(names + i, count - i < SPOOL_BATCH ? count - i : SPOOL_BATCH, 1);
+        }
+    }
+    for (int i = 0; i < keep && !stop_requested(); i += SPOOL_BATCH) {
+        write_status(keep - i);
+        process(names + i, keep - i < SPOOL_BATCH ? keep - i : SPOOL_BATCH, 0);
+    }
+    free_names(names, count);
+    return count;
+}
+
+static void *spool_main(void *arg) {
+    (void)arg;
+    struct pollfd fds[2] = { { wake_fd, POLLIN, 0 }, { inotify_fd, POLLIN, 0 } };
+    for (;;) {
+        // Events are only a wake-up: new/ is listed anyway, which also covers overflows.
+        char events[4096];
+        while (read(inotify_fd, events, sizeof(events)) > 0) {
+        }
+        if (drain() > 0 && !stop_requested()) continue;
+        if (poll(fds, 2, SPOOL_RESCAN_MS) < 0 && errno != EINTR) break;
+        if (fds[0].revents & POLLIN) break;
+    }
+    return NULL;
+}
+
+// End a line torn by a crash, so the next outcome starts on its own line.
+static void terminate_log(void) {
+    char last;
+    struct stat st;
+    if (fstat(log_fd, &st) == 0 && st.st_size > 0 && pread(log_fd, &last, 1, st.st_size - 1) == 1 && last != '\n') {
+        if (write_all(log_fd, "\n", 1) != 0) LOG_SPOOL_WARN("Cannot write %s/%s", spool_dir, LOG_NAME);
+    }
+}
+
+// Look up the outcomes recorded in outcomes.log for the files of 'nlists' sorted name
+// lists: recorded[l][i] is 1 (succeeded), -1 (failed) or 0 (none). Outcomes of commands
+// that can still be in cur/ or run/ are all in the current log: it is only rotated
+// before a batch is claimed.
+static void find_outcomes(char **lists[], const int lens[], signed char *recorded[], int nlists) {
+    int fd = openat(root_fd, LOG_NAME, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    char *log = NULL;
+    size_t len = 0;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0 && (log = malloc((size_t)st.st_size)) != NULL) {
+        ssize_t n;
+        while (len < (size_t)st.st_size && (n = read(fd, log + len, (size_t)st.st_size - len)) > 0) len += (size_t)n;
+    }
+    if (fd >= 0) close(fd);
+    for (char *line = log, *end = log + len, *nl; line != NULL && line < end; line = nl + 1) {
+        if ((nl = memchr(line, '\n', (size_t)(end - line))) == NULL) break; // Torn last line
+        if (strncmp(line, "{\"spool_file\":", 14) != 0) continue;
+        cJSON *outcome = cJSON_ParseWithLength(line, (size_t)(nl - line));
+        const cJSON *file = cJSON_GetObjectItemCaseSensitive(outcome, "spool_file");
+        for (int l = 0; l < nlists && cJSON_IsString(file); l++) {
+            char **found = bsearch(&file->valuestring, lists[l], (size_t)lens[l], sizeof(char *), compare_names);
+            if (found != NULL) recorded[l][found - lists[l]] = succeeded(outcome) ? 1 : -1;
+        }
+        cJSON_Delete(outcome);
+    }
+    free(log);
+}
+
+// Settle what a previous run left behind. run/ holds the commands it started: those with
+// a recorded outcome are finished off, the others recorded as interrupted. cur/ holds
+// commands it claimed but never started: they go back to new/ (unless recorded, as
+// rejected ones may be).
+static void recover(void) {
+    char **names[2] = { NULL, NULL };
+    int lens[2] = { list_dir(run_fd, &names[0]), list_dir(cur_fd, &names[1]) };
+    signed char *recorded[2] = { NULL, NULL };
+    command_t *cmds = NULL;
+    for (int l = 0; l < 2; l++) {
+        if (lens[l] < 0) lens[l] = 0;
+        recorded[l] = calloc((size_t)lens[l] + 1, 1);
+    }
+    if (lens[0] + lens[1] == 0) goto out;
+    if (recorded[0] == NULL || recorded[1] == NULL || (cmds = calloc((size_t)lens[0] + 1, sizeof(command_t))) == NULL) {
+        LOG_SPOOL_ERROR("%s", "Out of memory recovering the spool.");
+        goto out;
+    }
+    find_outcomes(names, lens, recorded, 2);
+
+    int interrupted = 0, returned = 0;
+    for (int i = 0; i < lens[0]; i++) {
+        cmds[i] = (command_t){ names[0][i], NULL, recorded[0][i] > 0 };
+        if (recorded[0][i] == 0) {
+            cmds[i].result = error_result("interrupted: the daemon stopped while it ran, it may have partly run");
+            interrupted++;
+        }
+    }
+    if (record(cmds, lens[0]) == 0) {
+        for (int i = 0; i < lens[0]; i++) {
+            finish(&cmds[i], 1, run_fd, recorded[0][i] == 0 ? OUTCOME_INTERRUPTED : OUTCOME_FAILED);
+        }
+    }
+    for (int i = 0; i < lens[1]; i++) {
+        command_t cmd = { names[1][i], NULL, recorded[1][i] > 0 };
+        if (recorded[1][i] != 0) finish(&cmd, 1, cur_fd, OUTCOME_REJECTED);
+        else if (renameat(cur_fd, cmd.name, new_fd, cmd.name) == 0) returned++;
+        else LOG_SPOOL_WARN("Cannot return spool command %s to new/: %s", cmd.name, strerror(errno));
+    }
+    if (interrupted > 0) LOG_SPOOL_WARN("%d spool commands were interrupted by the last stop.", interrupted);
+    if (returned > 0) LOG_SPOOL_INFO("%d spool commands claimed before the last stop are queued again.", returned);
+out:
+    for (int l = 0; l < 2; l++) {
+        free(recorded[l]);
+        free_names(names[l], lens[l]);
+    }
+    free(cmds);
+}
+
+static void close_all(void) {
+    int *fds[] = { &root_fd, &new_fd, &cur_fd, &run_fd, &failed_fd, &log_fd, &inotify_fd, &wake_fd };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0) close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
+
+static void stop_workers(void) {
+    pthread_mutex_lock(&pool_lock);
+    pool_stop = 1;
+    pthread_cond_broadcast(&job_ready);
+    pthread_mutex_unlock(&pool_lock);
+    for (int i = 0; i < worker_count; i++) pthread_join(workers[i], NULL);
+    worker_count = 0;
+}
+
+int Spool_start(const char *dir) {
+    if (spool_running) return 0;
+    if (dir == NULL) dir = getenv("WR_SPOOL_DIR");
+    if (dir == NULL || dir[0] == '\0') dir = SPOOL_DEFAULT_DIR;
+    snprintf(spool_dir, sizeof(spool_dir), "%s", dir);
+
+    if (mkdir(spool_dir, 0700) != 0 && errno != EEXIST) {
+        LOG_SPOOL_ERROR("Cannot create %s: %s", spool_dir, strerror(errno));
+        return -1;
+    }
+    int tmp_fd = -1;
+    root_fd = open(spool_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0 || (tmp_fd = open_subdir("tmp")) < 0 || (new_fd = open_subdir("new")) < 0 ||
+        (cur_fd = open_subdir("cur")) < 0 || (run_fd = open_subdir("run")) < 0 ||
+        (failed_fd = open_subdir("failed")) < 0 || (log_fd = open_log()) < 0) {
+        LOG_SPOOL_ERROR("Cannot set up the spool in %s: %s", spool_dir, strerror(errno));
+        if (tmp_fd >= 0) close(tmp_fd);
+        close_all();
+        return -1;
+    }
+    close(tmp_fd); // Only the producers use it
+
+    char new_path[sizeof(spool_dir) + 8];
+    snprintf(new_path, sizeof(new_path), "%s/new", spool_dir);
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, new_path, IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        // Still picked up, every SPOOL_RESCAN_MS.
+        LOG_SPOOL_WARN("Cannot watch %s (%s), scanning it every %d ms instead.", new_path, strerror(errno),
+                       SPOOL_RESCAN_MS);
+    }
+
+    terminate_log();
+    recover();
+
+    pool_stop = 0;
+    for (worker_count = 0; worker_count < SPOOL_WORKERS; worker_count++) {
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0) break;
+    }
+    if (worker_count == 0) LOG_SPOOL_WARN("%s", "No worker threads: spool commands run one at a time.");
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0 || pthread_create(&spool_thread, NULL, spool_main, NULL) != 0) {
+        LOG_SPOOL_ERROR("%s", "Cannot start the spool thread.");
+        stop_workers();
+        close_all();
+        return -1;
+    }
+    spool_running = 1;
+    LOG_SPOOL_INFO("Taking commands from %s", new_path);
+    return 0;
+}
+
+void Spool_stop(void) {
+    if (!spool_running) return;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) { /* Thread is awake anyway */ }
+    pthread_join(spool_thread, NULL); // After the commands it started
+    spool_running = 0;
+    stop_workers();
+    close_all();
+}
@@ -0,0 +1,43 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#define SPOOL_DEFAULT_DIR "/var/lib/whiterails/spool"
+#define SPOOL_BATCH 256                     // Commands claimed from new/ at once
+#define SPOOL_WORKERS 8                     // Threads running commands, so at most this many in run/
+#define SPOOL_MAX_BACKLOG 10000             // Commands waiting in new/; newer ones are rejected
+#define SPOOL_RESCAN_MS 5000                // new/ is also scanned this often, events or not
+#define SPOOL_LOG_MAX (16 * 1024 * 1024)    // outcomes.log is rotated to outcomes.log.1 past this
+#define SPOOL_OUTPUT_MAX 4096               // Output kept per command in outcomes.log
+
+// Spool directory: one-shot commands dropped as files, for producers that cannot keep a
+// control connection open, or must not lose a command when the daemon is down. The
+// layout is Maildir's ($WR_SPOOL_DIR or SPOOL_DEFAULT_DIR, mode 0700):
+//   tmp/     a producer writes a command here under a unique name...
+//   new/     ...then rename()s it here; the daemon only ever sees complete files
+//   cur/     commands taken from new/, waiting for a worker
+//   run/     commands started (that may have run)
+//   failed/  commands that failed, were rejected or were interrupted, kept for inspection
+//   outcomes.log   one JSON line per command: its result (see control.h), "spool_file" first
+//   status.json    {"backlog":N,"max_backlog":N,"accepting":true|false,"done":N,...}
+// A command is any control socket document, JSON or CBOR (see control.h, cbor.h), of up
+// to CONTROL_MAX_REQUEST bytes. The daemon watches new/ with inotify and takes what is
+// there in batches of SPOOL_BATCH, oldest name first, into cur/. Up to SPOOL_WORKERS run
+// at a time (in no set order): each is moved to run/, and run/ synced, before it starts.
+// As commands finish their results are appended to outcomes.log, which is synced, then
+// the ones that succeeded ("ok" and no failed action) are unlinked and the others moved
+// to failed/.
+// Restarts: files in new/, and in cur/ (never started), are run. A command left in run/
+// is never run twice: it is finished off if its outcome was recorded, and otherwise
+// recorded as interrupted (it may have partly run) and moved to failed/.
+// Backpressure: once more than SPOOL_MAX_BACKLOG commands wait, the newest are rejected
+// ("spool full" in outcomes.log, moved to failed/) and status.json says "accepting":false
+// until the backlog is back under the limit. Producers should check it before a burst.
+
+// Create the directories, recover what a previous run left in cur/ and run/, and start
+// watching. 'dir' NULL: $WR_SPOOL_DIR or SPOOL_DEFAULT_DIR. Returns 0 or -1.
+int Spool_start(const char *dir);
+
+// Stop once the commands already started have finished.
+void Spool_stop(void);
+
+#endif // SPOOL_H
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE // For shm_open, ftruncate
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "stats_page.h"
+#include "service_loader.h"
+#include "logger.h"
+
+#define LOG_STATS_INFO(fmt, ...) WR_LOG_INFO("stats", fmt, ##__VA_ARGS__)
+#define LOG_STATS_ERROR(fmt, ...) WR_LOG_ERROR("stats", fmt, ##__VA_ARGS__)
+
+static char shm_name[256];
+static int shm_fd = -1;
+static stats_header_t *header = NULL;
+static stats_record_t *records = NULL;
+static size_t mapped_size = 0;
+
+// Service name -> record index, for updates that only know the service's name.
+// Open addressing, rebuilt by StatsPage_publish(); -1 marks a free slot.
+static int *name_index = NULL;
+static size_t name_slots = 0;
+// Held for writing while the records are reassigned or remapped, for reading by the
+// updates that find their record by name (they may come from control socket threads).
+static pthread_rwlock_t layout_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static size_t segment_size(uint32_t capacity) {
+    return sizeof(stats_header_t) + (size_t)capacity * sizeof(stats_record_t);
+}
+
+// --- Seqlock ---
+
+static void record_lock(stats_record_t *r) {
+    uint32_t seq = atomic_load_explicit(&r->seq, memory_order_relaxed);
+    for (;;) {
+        if (!(seq & 1) && atomic_compare_exchange_weak_explicit(&r->seq, &seq, seq + 1, memory_order_acquire,
+                                                                memory_order_relaxed)) {
+            break;
+        }
+        seq = atomic_load_explicit(&r->seq, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release); // The odd seq is visible before the new data
+}
+
+static void record_unlock(stats_record_t *r) {
+    atomic_fetch_add_explicit(&r->seq, 1, memory_order_release);
+}
+
+// --- Segment ---
+
+static int map_segment(uint32_t capacity) {
+    size_t size = segment_size(capacity);
+    if (ftruncate(shm_fd, (off_t)size) != 0) return -1;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (p == MAP_FAILED) return -1;
+    if (header != NULL) munmap(header, mapped_size);
+    header = p;
+    records = (stats_record_t *)(header + 1);
+    mapped_size = size;
+    atomic_store(&header->capacity, capacity);
+    return 0;
+}
+
+int StatsPage_start(const char *name) {
+    if (name == NULL) name = getenv("WR_STATS_SHM");
+    if (name == NULL || name[0] == '\0') name = STATS_PAGE_DEFAULT_NAME;
+    snprintf(shm_name, sizeof(shm_name), "%s", name);
+    shm_fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+    if (shm_fd < 0) {
+        LOG_STATS_ERROR("Cannot create shared memory '%s': %s", shm_name, strerror(errno));
+        return -1;
+    }
+    if (map_segment(64) != 0) {
+        LOG_STATS_ERROR("Cannot map shared memory '%s': %s", shm_name, strerror(errno));
+        StatsPage_stop();
+        return -1;
+    }
+    header->version = STATS_PAGE_VERSION;
+    header->record_size = sizeof(stats_record_t);
+    header->pid = (int32_t)getpid();
+    header->started = (int64_t)time(NULL);
+    atomic_store_explicit(&header->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&header->generation, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    header->magic = STATS_PAGE_MAGIC; // Last: readers check it before anything else
+    LOG_STATS_INFO("Publishing service state in shared memory '%s'.", shm_name);
+    return 0;
+}
+
+void StatsPage_stop(void) {
+    if (header != NULL) munmap(header, mapped_size);
+    header = NULL;
+    records = NULL;
+    if (shm_fd >= 0) {
+        close(shm_fd);
+        shm_unlink(shm_name);
+        shm_fd = -1;
+    }
+    free(name_index);
+    name_index = NULL;
+    name_slots = 0;
+}
+
+// --- Records ---
+
+static size_t name_hash(const char *name) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (; *name; name++) h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+static stats_record_t *record_by_name(const char *name) {
+    if (records == NULL || name == NULL || name_slots == 0) return NULL;
+    for (size_t i = name_hash(name) & (name_slots - 1);; i = (i + 1) & (name_slots - 1)) {
+        int idx = name_index[i];
+        if (idx < 0) return NULL;
+        if (strcmp(records[idx].name, name) == 0) return &records[idx];
+    }
+}
+
+static stats_record_t *record_at(int index) {
+    if (records == NULL || index < 0 || (uint32_t)index >= atomic_load_explicit(&header->count, memory_order_relaxed)) {
+        return NULL;
+    }
+    return &records[index];
+}
+
+void StatsPage_publish(void) {
+    if (header == NULL) return;
+    pthread_rwlock_wrlock(&layout_lock);
+    int count = SvcLoader_get_count();
+    uint32_t capacity = atomic_load(&header->capacity);
+    if ((uint32_t)count > capacity) {
+        while (capacity < (uint32_t)count) capacity *= 2;
+        if (map_segment(capacity) != 0) {
+            LOG_STATS_ERROR("Cannot grow shared memory '%s': %s", shm_name, strerror(errno));
+            count = (int)atomic_load(&header->capacity);
+        }
+    }
+
+    size_t slots = 16;
+    while (slots < (size_t)count * 2) slots *= 2;
+    int *index = malloc(slots * sizeof(*index));
+    if (index != NULL) {
+        for (size_t i = 0; i < slots; i++) index[i] = -1;
+    }
+
+    atomic_store_explicit(&header->count, 0, memory_order_release); // Readers skip the records meanwhile
+    int64_t now = (int64_t)time(NULL);
+    for (int i = 0; i < count; i++) {
+        const service_config_t *svc = SvcLoader_get_service_by_index(i);
+        stats_record_t *r = &records[i];
+        record_lock(r);
+        memset((char *)r + sizeof(r->seq), 0, sizeof(*r) - sizeof(r->seq));
+        if (svc != NULL) {
+            snprintf(r->name, sizeof(r->name), "%s", svc->name);
+            r->interval = svc->interval_seconds;
+            r->last_run = (int64_t)svc->last_run_timestamp;
+            r->next_due = r->last_run != 0 ? r->last_run + svc->interval_seconds : now;
+        }
+        r->last_exit = -1;
+        record_unlock(r);
+        if (index != NULL && svc != NULL) {
+            size_t s = name_hash(r->name) & (slots - 1);
+            while (index[s] >= 0) s = (s + 1) & (slots - 1);
+            index[s] = i;
+        }
+    }
+    free(name_index);
+    name_index = index;
+    name_slots = index != NULL ? slots : 0;
+    atomic_fetch_add_explicit(&header->generation, 1, memory_order_relaxed);
+    atomic_store_explicit(&header->count, (uint32_t)count, memory_order_release);
+    pthread_rwlock_unlock(&layout_lock);
+}
+
+void StatsPage_run_begin(int index, int64_t now) {
+    stats_record_t *r = record_at(index);
+    if (r == NULL) return;
+    record_lock(r);
+    r->last_run = now;
+    record_unlock(r);
+}
+
+void StatsPage_run_end(int index, uint64_t duration_ns, int64_t next_due) {
+    stats_record_t *r = record_at(index);
+    if (r == NULL) return;
+    record_lock(r);
+    r->runs++;
+    r->last_duration_ns = duration_ns;
+    r->next_due = next_due;
+    record_unlock(r);
+}
+
+void StatsPage_child_started(const char *service) {
+    pthread_rwlock_rdlock(&layout_lock);
+    stats_record_t *r = record_by_name(service);
+    if (r != NULL) {
+        record_lock(r);
+        r->in_flight++;
+        record_unlock(r);
+    }
+    pthread_rwlock_unlock(&layout_lock);
+}
+
+void StatsPage_child_exited(const char *service, int status, uint64_t cpu_ns) {
+    pthread_rwlock_rdlock(&layout_lock);
+    stats_record_t *r = record_by_name(service);
+    if (r != NULL) {
+        record_lock(r);
+        if (r->in_flight > 0) r->in_flight--;
+        r->last_exit = status;
+        r->cpu_ns += cpu_ns;
+        record_unlock(r);
+    }
+    pthread_rwlock_unlock(&layout_lock);
+}
@@ -0,0 +1,67 @@
+#ifndef STATS_PAGE_H
+#define STATS_PAGE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define STATS_PAGE_DEFAULT_NAME "/whiterails-stats" // shm_open() name: /dev/shm/whiterails-stats
+#define STATS_PAGE_MAGIC 0x57525354u                 // "WRST"
+#define STATS_PAGE_VERSION 1
+#define STATS_NAME_LEN 64
+
+// Live per-service state in a shared-memory segment ($WR_STATS_SHM or
+// STATS_PAGE_DEFAULT_NAME), for wr_top and other read-only viewers. The daemon only
+// writes to memory, so looking costs it nothing. The segment is a header followed by
+// one cache-aligned record per loaded service, in load order.
+//
+// Every record is guarded by a seqlock: a writer makes 'seq' odd (with a CAS, since an
+// action thread and the scheduler may update the same record), writes, then makes it
+// even again. A reader copies the record and retries if 'seq' was odd or changed.
+// When services are reloaded the records are reassigned and 'generation' is bumped;
+// if 'capacity' grew, readers must map the segment again.
+
+typedef struct {
+    _Alignas(64) uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;          // sizeof(stats_record_t)
+    _Atomic uint32_t capacity;     // Records the segment has room for
+    _Atomic uint32_t count;        // Records in use
+    int32_t pid;                   // The daemon's
+    int64_t started;               // Unix time the daemon started
+    _Atomic uint64_t generation;   // Bumped on every (re)load
+} stats_header_t;
+
+typedef struct {
+    _Alignas(64) _Atomic uint32_t seq;
+    int32_t interval;              // Seconds
+    int64_t next_due;              // Unix time the interval is next up
+    int64_t last_run;              // Unix time the last run started, 0 if never
+    uint64_t last_duration_ns;     // Wall time of the last run
+    uint64_t runs;
+    uint64_t cpu_ns;               // User + system time of all its children so far
+    int32_t last_exit;             // waitpid() status of its last child, -1 if none
+    int32_t in_flight;             // Children running now
+    char name[STATS_NAME_LEN];
+} stats_record_t;
+
+// Create the segment ('name' NULL: $WR_STATS_SHM or STATS_PAGE_DEFAULT_NAME). Returns
+// 0 or -1; updates are no-ops without a segment.
+int StatsPage_start(const char *name);
+
+// Remove the segment.
+void StatsPage_stop(void);
+
+// Assign the records to the loaded services (after every load). Scheduler thread only,
+// while no action runs.
+void StatsPage_publish(void);
+
+// Service 'index' (in load order) starts a run / finished it after 'duration_ns'.
+void StatsPage_run_begin(int index, int64_t now);
+void StatsPage_run_end(int index, uint64_t duration_ns, int64_t next_due);
+
+// A child of 'service' was started / exited with waitpid() status 'status' after using
+// 'cpu_ns' of CPU. Called from whichever thread runs the action.
+void StatsPage_child_started(const char *service);
+void StatsPage_child_exited(const char *service, int status, uint64_t cpu_ns);
+
+#endif // STATS_PAGE_H
@@ -0,0 +1,175 @@
+#define _GNU_SOURCE // For memfd_create, MFD_ALLOW_SEALING, F_ADD_SEALS
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>   // For memfd_create, mmap
+
+#include "submit_ring.h"
+
+struct submit_ring_owner {
+    submit_ring_t r;
+    void *base;
+    size_t size;
+    int memfd;
+    // The shared copies of these can be overwritten by the client; these are the truth.
+    uint64_t sq_head;
+    uint64_t cq_tail;
+    pthread_mutex_t cq_lock;  // Completions come from several workers
+};
+
+static uint32_t queue_size(uint32_t kb) {
+    if (kb == 0) kb = SUBMIT_RING_DEFAULT_KB;
+    uint32_t size = SUBMIT_RING_MIN_KB;
+    while (size < kb && size < SUBMIT_RING_MAX_KB) size *= 2;
+    return size * 1024;
+}
+
+submit_ring_owner_t *SubmitRing_create(uint32_t sq_kb, uint32_t cq_kb, int fds[3], size_t *map_size) {
+    submit_ring_owner_t *o = calloc(1, sizeof(*o));
+    if (o == NULL) return NULL;
+    uint32_t sq_size = queue_size(sq_kb), cq_size = queue_size(cq_kb);
+    o->size = SUBMIT_RING_HEADER_SIZE + (size_t)sq_size + cq_size;
+    o->memfd = memfd_create("whiterails-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    o->r.sq_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    o->r.cq_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    o->base = MAP_FAILED;
+    // Sealed at its size: a client cannot shrink it under the daemon's mapping (SIGBUS).
+    if (o->memfd < 0 || o->r.sq_fd < 0 || o->r.cq_fd < 0 || ftruncate(o->memfd, (off_t)o->size) != 0 ||
+        fcntl(o->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0 ||
+        (o->base = mmap(NULL, o->size, PROT_READ | PROT_WRITE, MAP_SHARED, o->memfd, 0)) == MAP_FAILED) {
+        int saved_errno = errno;
+        if (o->memfd >= 0) close(o->memfd);
+        if (o->r.sq_fd >= 0) close(o->r.sq_fd);
+        if (o->r.cq_fd >= 0) close(o->r.cq_fd);
+        free(o);
+        errno = saved_errno;
+        return NULL;
+    }
+    submit_ring_header_t *h = o->base; // Zero-filled by ftruncate
+    h->magic = SUBMIT_RING_MAGIC;
+    h->version = SUBMIT_RING_VERSION;
+    h->sq_offset = SUBMIT_RING_HEADER_SIZE;
+    h->sq_size = sq_size;
+    h->cq_offset = SUBMIT_RING_HEADER_SIZE + sq_size;
+    h->cq_size = cq_size;
+    SubmitRing_init(&o->r, o->base, o->size, o->r.sq_fd, o->r.cq_fd);
+    pthread_mutex_init(&o->cq_lock, NULL);
+    fds[0] = o->memfd;
+    fds[1] = o->r.sq_fd;
+    fds[2] = o->r.cq_fd;
+    *map_size = o->size;
+    return o;
+}
+
+void SubmitRing_destroy(submit_ring_owner_t *o) {
+    if (o == NULL) return;
+    munmap(o->base, o->size);
+    close(o->memfd);
+    close(o->r.sq_fd);
+    close(o->r.cq_fd);
+    pthread_mutex_destroy(&o->cq_lock);
+    free(o);
+}
+
+int SubmitRing_doorbell(submit_ring_owner_t *o) {
+    return o->r.sq_fd;
+}
+
+int SubmitRing_take(submit_ring_owner_t *o, uint32_t *type, uint64_t *user_data, char **buf, size_t *cap,
+                    size_t *len) {
+    uint32_t size = o->r.sq_size;
+    for (;;) {
+        uint32_t off = (uint32_t)(o->sq_head & (size - 1));
+        submit_ring_record_t *rec = (submit_ring_record_t *)(o->r.sq + off);
+        uint32_t n = atomic_load_explicit(&rec->len, memory_order_acquire);
+        if (n == 0) return 0;
+        uint32_t used = n == SUBMIT_RING_PAD ? size - off : SubmitRing_record_size(n);
+        if (n != SUBMIT_RING_PAD) {
+            if (n > size - off - sizeof(*rec)) return -1; // Crosses the end: not from SubmitRing_submit()
+            if (*cap < (size_t)n + 1) {
+                char *grown = realloc(*buf, (size_t)n + 1);
+                if (grown == NULL) return -1;
+                *buf = grown;
+                *cap = (size_t)n + 1;
+            }
+            // Copied out before anything looks at it: producers can still write to the ring.
+            *type = rec->type;
+            *user_data = rec->user_data;
+            memcpy(*buf, rec + 1, n);
+            (*buf)[n] = '\0';
+            *len = n;
+        }
+        // Zeroed so that a record later placed anywhere in this space reads as uncommitted.
+        memset(rec, 0, used);
+        o->sq_head += used;
+        atomic_store_explicit(&o->r.header->sq_head, o->sq_head, memory_order_release);
+        if (n != SUBMIT_RING_PAD) return 1;
+    }
+}
+
+int SubmitRing_sleep(submit_ring_owner_t *o) {
+    atomic_store_explicit(&o->r.header->sq_sleeping, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    const submit_ring_record_t *rec = (const submit_ring_record_t *)(o->r.sq + (o->sq_head & (o->r.sq_size - 1)));
+    if (atomic_load_explicit(&((submit_ring_record_t *)rec)->len, memory_order_acquire) == 0) return 0;
+    atomic_store_explicit(&o->r.header->sq_sleeping, 0, memory_order_relaxed);
+    return 1;
+}
+
+void SubmitRing_wake(submit_ring_owner_t *o) {
+    atomic_store_explicit(&o->r.header->sq_sleeping, 0, memory_order_relaxed);
+    uint64_t n;
+    if (read(o->r.sq_fd, &n, sizeof(n)) < 0) { /* Not signalled */ }
+}
+
+int SubmitRing_complete(submit_ring_owner_t *o, uint64_t user_data, const char *data, uint32_t len,
+                        int timeout_ms) {
+    uint32_t size = o->r.cq_size;
+    uint32_t need = SubmitRing_record_size(len);
+    if (len == 0 || need > size / 2) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    pthread_mutex_lock(&o->cq_lock);
+    uint32_t off, pad;
+    for (int waited = 0;; waited++) {
+        uint64_t head = atomic_load_explicit(&o->r.header->cq_head, memory_order_acquire);
+        if (o->cq_tail - head > size) {
+            pthread_mutex_unlock(&o->cq_lock);
+            errno = EPROTO; // Consumed past what was completed
+            return -1;
+        }
+        off = (uint32_t)(o->cq_tail & (size - 1));
+        pad = off + need > size ? size - off : 0;
+        if (o->cq_tail + pad + need - head <= size) break;
+        if (waited >= timeout_ms) {
+            pthread_mutex_unlock(&o->cq_lock);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        usleep(1000); // Full: the consumer has no doorbell towards the daemon
+    }
+    if (pad > 0) {
+        atomic_store_explicit(&((submit_ring_record_t *)(o->r.cq + off))->len, SUBMIT_RING_PAD, memory_order_relaxed);
+        off = 0;
+    }
+    submit_ring_record_t *rec = (submit_ring_record_t *)(o->r.cq + off);
+    rec->type = SUBMIT_RING_JSON;
+    rec->user_data = user_data;
+    memcpy(rec + 1, data, len);
+    atomic_store_explicit(&rec->len, len, memory_order_relaxed);
+    o->cq_tail += pad + need;
+    atomic_store_explicit(&o->r.header->cq_tail, o->cq_tail, memory_order_release);
+    pthread_mutex_unlock(&o->cq_lock);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&o->r.header->cq_sleeping, memory_order_relaxed)) {
+        uint64_t one = 1;
+        if (write(o->r.cq_fd, &one, sizeof(one)) < 0) { /* Already signalled */ }
+    }
+    return 0;
+}
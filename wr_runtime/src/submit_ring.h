@@ -0,0 +1,227 @@
+#ifndef SUBMIT_RING_H
+#define SUBMIT_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define SUBMIT_RING_MAGIC 0x57525352u        // "WRSR"
+#define SUBMIT_RING_VERSION 1
+#define SUBMIT_RING_HEADER_SIZE 4096         // The queues start on the next page
+#define SUBMIT_RING_ALIGN 16                 // Records start at multiples of this
+#define SUBMIT_RING_DEFAULT_KB 1024          // Per queue
+#define SUBMIT_RING_MIN_KB 64
+#define SUBMIT_RING_MAX_KB (64 * 1024)
+#define SUBMIT_RING_PAD UINT32_MAX           // Record 'len': skip to the end of the queue
+
+// Record types
+#define SUBMIT_RING_JSON 1                   // A control socket document (see control.h)
+#define SUBMIT_RING_CBOR 2                   // The same, in the binary encoding (see cbor.h)
+
+// Shared-memory submission ring, for local producers that submit too often for a socket
+// write per command. A client asks for one on the control socket with {"op":"ring"} and
+// gets back a memfd (mmap() it shared, read-write, whole) and two eventfds. The memfd
+// holds this header, then a submission queue (producers -> daemon), then a completion
+// queue (daemon -> client). Both are byte rings of variable-length records:
+// a submit_ring_record_t, then 'len' payload bytes, padded to SUBMIT_RING_ALIGN. A record
+// that would cross the end of a queue is preceded by a SUBMIT_RING_PAD record filling it.
+//
+// Submission queue: any number of producers (threads or processes sharing the mapping)
+// reserve space by advancing 'sq_tail' with a CAS, write the record and commit it by
+// storing its 'len' last. The daemon takes committed records in order, zeroes their
+// space and advances 'sq_head'. A producer that dies between reserving and committing
+// blocks the queue, so producers should not be killed mid-submit.
+// Completion queue: the daemon writes one record per submission, carrying its
+// 'user_data', with the result line as payload; results arrive in completion order.
+// One consumer advances 'cq_head'.
+//
+// Doorbells: the daemon sets 'sq_sleeping' before it waits on the submission eventfd,
+// so producers only write it then (SubmitRing_notify); likewise the daemon writes the
+// completion eventfd only while the consumer has 'cq_sleeping' set (SubmitRing_wait).
+// Under load neither side makes a system call per command.
+//
+// The ring lives as long as the control connection that asked for it: closing that
+// connection detaches it. The producer side needs only this header.
+
+typedef struct {
+    _Atomic uint32_t len;      // Payload bytes, 0 until committed, or SUBMIT_RING_PAD
+    uint32_t type;             // SUBMIT_RING_JSON or SUBMIT_RING_CBOR
+    uint64_t user_data;        // The producer's; echoed in the completion
+} submit_ring_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sq_offset;        // From the start of the mapping
+    uint32_t sq_size;          // Bytes, a power of two
+    uint32_t cq_offset;
+    uint32_t cq_size;
+    _Alignas(64) _Atomic uint64_t sq_tail;     // Producers: bytes reserved so far
+    _Alignas(64) _Atomic uint64_t sq_head;     // Daemon: bytes consumed so far
+    _Atomic uint32_t sq_sleeping;              // Daemon: waiting on the submission eventfd
+    _Alignas(64) _Atomic uint64_t cq_tail;     // Daemon: bytes completed so far
+    _Alignas(64) _Atomic uint64_t cq_head;     // Consumer: bytes read so far
+    _Atomic uint32_t cq_sleeping;              // Consumer: waiting on the completion eventfd
+} submit_ring_header_t;
+
+// A process's view of a mapped ring.
+typedef struct {
+    submit_ring_header_t *header;
+    unsigned char *sq;
+    unsigned char *cq;
+    uint32_t sq_size;
+    uint32_t cq_size;
+    int sq_fd;                 // Submission eventfd (doorbell)
+    int cq_fd;                 // Completion eventfd
+} submit_ring_t;
+
+static inline uint32_t SubmitRing_record_size(uint32_t len) {
+    return (uint32_t)((sizeof(submit_ring_record_t) + len + SUBMIT_RING_ALIGN - 1) & ~(size_t)(SUBMIT_RING_ALIGN - 1));
+}
+
+// Fill 'r' from a mapping of 'size' bytes and the two eventfds. Returns 0, or -1 if the
+// mapping is not a ring of this version.
+static inline int SubmitRing_init(submit_ring_t *r, void *base, size_t size, int sq_fd, int cq_fd) {
+    submit_ring_header_t *h = base;
+    if (size < SUBMIT_RING_HEADER_SIZE || h->magic != SUBMIT_RING_MAGIC || h->version != SUBMIT_RING_VERSION ||
+        (uint64_t)h->sq_offset + h->sq_size > size || (uint64_t)h->cq_offset + h->cq_size > size) {
+        errno = EINVAL;
+        return -1;
+    }
+    r->header = h;
+    r->sq = (unsigned char *)base + h->sq_offset;
+    r->cq = (unsigned char *)base + h->cq_offset;
+    r->sq_size = h->sq_size;
+    r->cq_size = h->cq_size;
+    r->sq_fd = sq_fd;
+    r->cq_fd = cq_fd;
+    return 0;
+}
+
+// Producer: submit 'len' bytes of 'type'. Returns 0, or -1 with errno EAGAIN (the queue
+// is full: retry once the daemon has caught up) or EMSGSIZE (never fits). Thread-safe.
+static inline int SubmitRing_submit(submit_ring_t *r, uint32_t type, uint64_t user_data, const void *data,
+                                    uint32_t len) {
+    submit_ring_header_t *h = r->header;
+    uint32_t need = SubmitRing_record_size(len);
+    if (len == 0 || len >= SUBMIT_RING_PAD || need > r->sq_size / 2) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    // 'head' first: it never passes the tail read after it. A stale one only means "full".
+    uint64_t head = atomic_load_explicit(&h->sq_head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&h->sq_tail, memory_order_relaxed);
+    uint32_t off, pad;
+    do {
+        off = (uint32_t)(tail & (r->sq_size - 1));
+        pad = off + need > r->sq_size ? r->sq_size - off : 0;
+        if (tail + pad + need - head > r->sq_size) {
+            errno = EAGAIN;
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&h->sq_tail, &tail, tail + pad + need, memory_order_acq_rel,
+                                                    memory_order_relaxed));
+    if (pad > 0) {
+        atomic_store_explicit(&((submit_ring_record_t *)(r->sq + off))->len, SUBMIT_RING_PAD, memory_order_release);
+        off = 0;
+    }
+    submit_ring_record_t *rec = (submit_ring_record_t *)(r->sq + off);
+    rec->type = type;
+    rec->user_data = user_data;
+    memcpy(rec + 1, data, len);
+    atomic_store_explicit(&rec->len, len, memory_order_release);
+    return 0;
+}
+
+// Producer: wake the daemon if it is waiting. Call after a batch of submits.
+static inline void SubmitRing_notify(submit_ring_t *r) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->header->sq_sleeping, memory_order_relaxed)) {
+        uint64_t one = 1;
+        if (write(r->sq_fd, &one, sizeof(one)) < 0) { /* Already signalled */ }
+    }
+}
+
+// Consumer: the next completion, or NULL if there is none yet. Its payload is the result
+// line ('len' bytes, no NUL); it stays valid until SubmitRing_complete_next() is called.
+static inline const submit_ring_record_t *SubmitRing_complete_peek(submit_ring_t *r) {
+    submit_ring_header_t *h = r->header;
+    uint64_t head = atomic_load_explicit(&h->cq_head, memory_order_relaxed);
+    for (;;) {
+        if (head == atomic_load_explicit(&h->cq_tail, memory_order_acquire)) return NULL;
+        const submit_ring_record_t *rec = (const submit_ring_record_t *)(r->cq + (head & (r->cq_size - 1)));
+        uint32_t len = atomic_load_explicit(&((submit_ring_record_t *)rec)->len, memory_order_relaxed);
+        if (len != SUBMIT_RING_PAD) return rec;
+        head += r->cq_size - (head & (r->cq_size - 1));
+        atomic_store_explicit(&h->cq_head, head, memory_order_release);
+    }
+}
+
+// Consumer: release the completion returned by SubmitRing_complete_peek().
+static inline void SubmitRing_complete_next(submit_ring_t *r, const submit_ring_record_t *rec) {
+    submit_ring_header_t *h = r->header;
+    uint32_t len = atomic_load_explicit(&((submit_ring_record_t *)rec)->len, memory_order_relaxed);
+    atomic_store_explicit(&h->cq_head, atomic_load_explicit(&h->cq_head, memory_order_relaxed) +
+                          SubmitRing_record_size(len), memory_order_release);
+}
+
+// Consumer: wait up to 'timeout_ms' (-1: forever) for a completion. Returns 1 if there
+// is one, 0 on timeout. A doorbell left over from completions already taken restarts
+// the wait.
+static inline int SubmitRing_wait(submit_ring_t *r, int timeout_ms) {
+    submit_ring_header_t *h = r->header;
+    int ready;
+    for (;;) {
+        atomic_store_explicit(&h->cq_sleeping, 1, memory_order_seq_cst);
+        if ((ready = SubmitRing_complete_peek(r) != NULL)) break;
+        struct pollfd pfd = { r->cq_fd, POLLIN, 0 };
+        int n = poll(&pfd, 1, timeout_ms);
+        if (n == 0 || (n < 0 && errno != EINTR)) break;
+        uint64_t count;
+        if (n > 0 && read(r->cq_fd, &count, sizeof(count)) < 0) { /* Drained by another waiter */ }
+    }
+    atomic_store_explicit(&h->cq_sleeping, 0, memory_order_relaxed);
+    return ready;
+}
+
+// Daemon side (submit_ring.c).
+
+// The daemon's private state of one ring.
+typedef struct submit_ring_owner submit_ring_owner_t;
+
+// Create a ring with queues of 'sq_kb' and 'cq_kb' (0: SUBMIT_RING_DEFAULT_KB; rounded up
+// to a power of two within SUBMIT_RING_MIN_KB..SUBMIT_RING_MAX_KB). 'fds' receives the
+// memfd and the two eventfds, to hand to the client. Returns NULL on failure (errno set).
+submit_ring_owner_t *SubmitRing_create(uint32_t sq_kb, uint32_t cq_kb, int fds[3], size_t *map_size);
+
+// Close the ring; the client keeps its own mapping.
+void SubmitRing_destroy(submit_ring_owner_t *o);
+
+// The submission eventfd, to poll while waiting.
+int SubmitRing_doorbell(submit_ring_owner_t *o);
+
+// Take the next submission: its payload is copied into '*buf' (grown as needed, NUL
+// added). Returns 1 with the record's type, user_data and length filled in, 0 if the
+// queue is empty, or -1 if the producers corrupted it or out of memory (the ring should
+// be detached). One thread only.
+int SubmitRing_take(submit_ring_owner_t *o, uint32_t *type, uint64_t *user_data, char **buf, size_t *cap,
+                    size_t *len);
+
+// Before waiting on the doorbell: announce it, then check once more. Returns 1 if a
+// submission arrived meanwhile (do not wait), 0 if it is safe to wait.
+int SubmitRing_sleep(submit_ring_owner_t *o);
+
+// After the doorbell rang or the wait ended: clear the announcement and the eventfd.
+void SubmitRing_wake(submit_ring_owner_t *o);
+
+// Post a completion for 'user_data'. Waits up to 'timeout_ms' for the consumer to make
+// room. Returns 0, or -1 with errno EMSGSIZE (never fits), ETIMEDOUT (the consumer did
+// not make room) or EPROTO (it corrupted the queue). Thread-safe.
+int SubmitRing_complete(submit_ring_owner_t *o, uint64_t user_data, const char *data, uint32_t len,
+                        int timeout_ms);
+
+#endif // SUBMIT_RING_H
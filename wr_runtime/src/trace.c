@@ -0,0 +1,238 @@
+#define _GNU_SOURCE // For sigaction
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "logger.h"
+
+#define LOG_TRACE_INFO(fmt, ...) WR_LOG_INFO("trace", fmt, ##__VA_ARGS__)
+#define LOG_TRACE_ERROR(fmt, ...) WR_LOG_ERROR("trace", fmt, ##__VA_ARGS__)
+
+enum { RING_OWNED, RING_ORPHANED };
+
+// One span. 'seq' works as a per-slot seqlock: odd while the owner rewrites the slot,
+// 2 * (index + 1) once span number 'index' is complete.
+typedef struct {
+    _Atomic uint64_t seq;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    const char *cat;
+    const char *name;
+    char arg[TRACE_ARG_MAX];
+} trace_event_t;
+
+typedef struct trace_ring {
+    struct trace_ring *next;
+    int lane;                 // Shown as the thread id
+    _Atomic int state;
+    uint64_t written;         // Owner only: spans ever written
+    trace_event_t events[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+_Atomic int trace_enabled = 0;
+static _Atomic uint64_t enabled_since = 0;   // Spans older than this are not dumped
+static volatile sig_atomic_t toggled = 0;    // Set by the signal handler, seen by Trace_poll()
+
+static _Atomic(trace_ring_t *) rings = NULL;
+static int ring_count = 0;                   // Under register_lock
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static int key_created = 0;
+static _Thread_local trace_ring_t *my_ring = NULL;
+
+uint64_t Trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// --- Rings ---
+
+static void ring_orphan(void *arg) {
+    atomic_store_explicit(&((trace_ring_t *)arg)->state, RING_ORPHANED, memory_order_release);
+}
+
+static trace_ring_t *ring_acquire(void) {
+    // A ring outlives its thread (its spans are still wanted); the next new thread takes it over.
+    for (trace_ring_t *r = atomic_load_explicit(&rings, memory_order_acquire); r != NULL; r = r->next) {
+        int expected = RING_ORPHANED;
+        if (atomic_compare_exchange_strong(&r->state, &expected, RING_OWNED)) return r;
+    }
+    trace_ring_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) return NULL;
+    atomic_init(&r->state, RING_OWNED);
+    pthread_mutex_lock(&register_lock);
+    r->lane = ++ring_count;
+    r->next = atomic_load_explicit(&rings, memory_order_relaxed);
+    atomic_store_explicit(&rings, r, memory_order_release);
+    pthread_mutex_unlock(&register_lock);
+    return r;
+}
+
+void Trace_span(const char *cat, const char *name, const char *arg, uint64_t start_ns) {
+    uint64_t end_ns = Trace_now_ns();
+    if (my_ring == NULL) {
+        my_ring = ring_acquire();
+        if (my_ring == NULL) return;
+        if (key_created) pthread_setspecific(ring_key, my_ring);
+    }
+    uint64_t n = my_ring->written++;
+    trace_event_t *e = &my_ring->events[n % TRACE_RING_EVENTS];
+    atomic_store_explicit(&e->seq, 2 * n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->start_ns = start_ns;
+    e->dur_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    e->cat = cat;
+    e->name = name;
+    size_t i = 0;
+    if (arg != NULL) {
+        for (; i < TRACE_ARG_MAX - 1 && arg[i] != '\0'; i++) e->arg[i] = arg[i];
+    }
+    e->arg[i] = '\0';
+    atomic_store_explicit(&e->seq, 2 * n + 2, memory_order_release);
+}
+
+// --- Dump ---
+
+static void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+// Copy slot 'e' into 'out' unless it is being rewritten. Returns 1 if 'out' is a span.
+static int read_event(const trace_event_t *e, trace_event_t *out) {
+    uint64_t seq = atomic_load_explicit(&((trace_event_t *)e)->seq, memory_order_acquire);
+    if (seq == 0 || (seq & 1)) return 0;
+    out->start_ns = e->start_ns;
+    out->dur_ns = e->dur_ns;
+    out->cat = e->cat;
+    out->name = e->name;
+    memcpy(out->arg, e->arg, sizeof(out->arg));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&((trace_event_t *)e)->seq, memory_order_relaxed) != seq) return 0;
+    out->arg[TRACE_ARG_MAX - 1] = '\0';
+    return 1;
+}
+
+int Trace_dump(const char *path) {
+    if (path == NULL) path = getenv("WR_TRACE_FILE");
+    if (path == NULL || path[0] == '\0') path = TRACE_DEFAULT_FILE;
+    char tmp[4096];
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)) {
+        LOG_TRACE_ERROR("Trace file path too long: %s", path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&dump_lock);
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) {
+        LOG_TRACE_ERROR("Cannot write %s: %s", tmp, strerror(errno));
+        pthread_mutex_unlock(&dump_lock);
+        return -1;
+    }
+    int pid = (int)getpid();
+    uint64_t since = atomic_load(&enabled_since);
+    unsigned long spans = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"wr_runtime\"}}", pid);
+    for (trace_ring_t *r = atomic_load_explicit(&rings, memory_order_acquire); r != NULL; r = r->next) {
+        for (size_t i = 0; i < TRACE_RING_EVENTS; i++) {
+            trace_event_t ev;
+            if (!read_event(&r->events[i], &ev) || ev.start_ns < since) continue;
+            fprintf(f, ",\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"cat\":", pid, r->lane,
+                    (double)ev.start_ns / 1000.0, (double)ev.dur_ns / 1000.0);
+            write_json_string(f, ev.cat);
+            fputs(",\"name\":", f);
+            write_json_string(f, ev.name);
+            if (ev.arg[0] != '\0') {
+                fputs(",\"args\":{\"detail\":", f);
+                write_json_string(f, ev.arg);
+                fputc('}', f);
+            }
+            fputc('}', f);
+            spans++;
+        }
+    }
+    fputs("\n]}\n", f);
+    int failed = ferror(f);
+    if (fclose(f) != 0) failed = 1;
+    if (failed || rename(tmp, path) != 0) {
+        LOG_TRACE_ERROR("Cannot write %s: %s", path, strerror(errno));
+        unlink(tmp);
+        pthread_mutex_unlock(&dump_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&dump_lock);
+    LOG_TRACE_INFO("Wrote %lu spans to %s", spans, path);
+    return 0;
+}
+
+// --- Control ---
+
+static void set_enabled(int on) {
+    if (on) atomic_store(&enabled_since, Trace_now_ns());
+    atomic_store(&trace_enabled, on);
+}
+
+static void on_sigusr2(int sig) {
+    (void)sig;
+    set_enabled(!atomic_load(&trace_enabled)); // Only atomics and clock_gettime: signal-safe
+    toggled = 1;
+}
+
+void Trace_init(void) {
+    if (!key_created && pthread_key_create(&ring_key, ring_orphan) == 0) key_created = 1;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigusr2;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR2, &sa, NULL) != 0) {
+        LOG_TRACE_ERROR("Cannot install the SIGUSR2 handler: %s", strerror(errno));
+    }
+    const char *env = getenv("WR_TRACE");
+    if (env != NULL && strcmp(env, "1") == 0) {
+        Trace_set(1);
+    }
+}
+
+void Trace_set(int on) {
+    int was = atomic_load(&trace_enabled);
+    if (!WR_TRACE) {
+        LOG_TRACE_ERROR("%s", "Tracing is compiled out (make TRACE=0).");
+        return;
+    }
+    if (on == was) return;
+    set_enabled(on);
+    if (on) {
+        LOG_TRACE_INFO("%s", "Tracing on.");
+    } else {
+        Trace_dump(NULL);
+    }
+}
+
+void Trace_poll(void) {
+    if (!toggled) return;
+    toggled = 0;
+    if (!WR_TRACE) {
+        LOG_TRACE_ERROR("%s", "Tracing is compiled out (make TRACE=0).");
+        atomic_store(&trace_enabled, 0);
+    } else if (atomic_load(&trace_enabled)) {
+        LOG_TRACE_INFO("%s", "Tracing on.");
+    } else {
+        Trace_dump(NULL);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define TRACE_DEFAULT_FILE "/run/whiterails/trace.json"
+#define TRACE_RING_EVENTS 8192 // Per-thread spans kept; older ones are overwritten
+#define TRACE_ARG_MAX 24       // Longer span arguments (service, command) are truncated
+
+// Set with 'make TRACE=0' to compile every span out.
+#ifndef WR_TRACE
+#define WR_TRACE 1
+#endif
+
+// Span recorder. While tracing is on, each span is one 64-byte slot written to a ring
+// owned by the calling thread (a flight recorder: the newest TRACE_RING_EVENTS per
+// thread are kept). While it is off, a span costs one relaxed load.
+// SIGUSR2 toggles tracing (as does $WR_TRACE=1 at startup); turning it off writes the
+// spans recorded since it was turned on as Chrome Trace Event JSON, for Perfetto or
+// chrome://tracing, to $WR_TRACE_FILE or TRACE_DEFAULT_FILE.
+// 'cat' and 'name' must be string literals (or otherwise live forever); 'arg' is copied.
+
+extern _Atomic int trace_enabled;
+
+#if WR_TRACE
+// Start a span: declares 'var' holding its start time (0 while tracing is off).
+#define TRACE_BEGIN(var) \
+    uint64_t var = atomic_load_explicit(&trace_enabled, memory_order_relaxed) ? Trace_now_ns() : 0
+// End the span started with TRACE_BEGIN(var).
+#define TRACE_END(var, cat, name, arg) \
+    do { if ((var) != 0) Trace_span((cat), (name), (arg), (var)); } while (0)
+// Record a span that started at 'start_ns' (a Trace_now_ns() time) and ends now.
+#define TRACE_SPAN(cat, name, arg, start_ns) \
+    do { if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) Trace_span((cat), (name), (arg), (start_ns)); } while (0)
+#else
+#define TRACE_BEGIN(var) uint64_t var = 0
+#define TRACE_END(var, cat, name, arg) do { (void)(var); } while (0)
+#define TRACE_SPAN(cat, name, arg, start_ns) do { } while (0)
+#endif
+
+// Install the SIGUSR2 toggle and honour $WR_TRACE. Call once, from the main thread.
+void Trace_init(void);
+
+// Called from the main loop: reports toggles and writes the trace file once tracing
+// was turned off. Signal handlers cannot do either.
+void Trace_poll(void);
+
+// Turn tracing on or off (off writes the trace file).
+void Trace_set(int on);
+
+// Write the spans recorded since tracing was last turned on to 'path' (NULL: the
+// default), through a temporary file renamed into place. Returns 0 or -1.
+int Trace_dump(const char *path);
+
+// CLOCK_MONOTONIC, in nanoseconds.
+uint64_t Trace_now_ns(void);
+
+// Use the macros above.
+void Trace_span(const char *cat, const char *name, const char *arg, uint64_t start_ns);
+
+#endif // TRACE_H
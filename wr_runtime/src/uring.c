@@ -0,0 +1,279 @@
+#define _GNU_SOURCE // For syscall(), MAP_POPULATE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "logger.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define WR_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef WR_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+#define LOG_URING_INFO(fmt, ...) WR_LOG_INFO("uring", fmt, ##__VA_ARGS__)
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+    unsigned queued;     // Written to the SQ but not yet handed to the kernel
+    unsigned in_flight;  // Submitted, completion not reaped yet
+    long syscalls;
+};
+
+// The kernel side of the rings is updated concurrently: head/tail need acquire/release.
+#define RING_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+static unsigned char supported_ops[IORING_OP_LAST];
+
+static void probe_ops(void) {
+    // Opt-in: statx/mkdirat are executed by io_uring worker threads, which cuts syscalls by
+    // two orders of magnitude but is not faster on a warm dentry cache.
+    const char *env = getenv("WR_IO_URING");
+    if (env == NULL || strcmp(env, "1") != 0) {
+        return;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = sys_setup(4, &params);
+    if (fd < 0) {
+        // ENOSYS: old kernel; EPERM: disabled by sysctl or a container's seccomp profile.
+        LOG_URING_INFO("io_uring unavailable (%s), using synchronous syscalls.", strerror(errno));
+        return;
+    }
+    size_t len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (probe != NULL && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+        for (unsigned i = 0; i < probe->ops_len && i < IORING_OP_LAST; i++) {
+            supported_ops[i] = (probe->ops[i].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+    }
+    free(probe);
+    close(fd);
+}
+
+int Uring_supported(uring_op_t op) {
+    pthread_once(&probe_once, probe_ops);
+    switch (op) {
+        case URING_OP_STATX:   return supported_ops[IORING_OP_STATX];
+        case URING_OP_MKDIRAT: return supported_ops[IORING_OP_MKDIRAT];
+    }
+    return 0;
+}
+
+uring_t *Uring_create(unsigned entries) {
+    uring_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) return NULL;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_setup(entries, &p);
+    r->syscalls++;
+    if (r->fd < 0) {
+        free(r);
+        return NULL;
+    }
+    r->sq_entries = p.sq_entries;
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        if (r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->syscalls++;
+    if (r->sq_map == MAP_FAILED) goto fail;
+    if (single) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        r->syscalls++;
+        if (r->cq_map == MAP_FAILED) goto fail;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    r->syscalls++;
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    char *sq = r->sq_map;
+    char *cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return r;
+
+fail:
+    {
+        int saved = errno;
+        Uring_destroy(r);
+        errno = saved;
+    }
+    return NULL;
+}
+
+void Uring_destroy(uring_t *r) {
+    if (r == NULL) return;
+    if (r->sqes != NULL && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+    if (r->cq_map != NULL && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map != NULL && r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_map_len);
+    if (r->fd >= 0) close(r->fd);
+    free(r);
+}
+
+unsigned Uring_space(const uring_t *r) {
+    return r->sq_entries - r->queued - r->in_flight;
+}
+
+long Uring_syscalls(const uring_t *r) {
+    return r->syscalls;
+}
+
+static struct io_uring_sqe *next_sqe(uring_t *r) {
+    if (Uring_space(r) == 0) return NULL; // Also keeps the CQ (2x the SQ) from overflowing
+    unsigned idx = (*r->sq_tail + r->queued) & *r->sq_mask;
+    r->sq_array[idx] = idx;
+    r->queued++;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int Uring_queue_mkdirat(uring_t *r, int dirfd, const char *path, mode_t mode, uint64_t user_data, int flags) {
+    struct io_uring_sqe *sqe = next_sqe(r);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_MKDIRAT;
+    sqe->fd = dirfd;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = mode;
+    sqe->user_data = user_data;
+    if (flags & URING_HARDLINK) sqe->flags |= IOSQE_IO_HARDLINK;
+    return 0;
+}
+
+int Uring_queue_statx(uring_t *r, int dirfd, const char *path, int at_flags, unsigned mask,
+                      void *statx_buf, uint64_t user_data) {
+    struct io_uring_sqe *sqe = next_sqe(r);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dirfd;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = mask;
+    sqe->off = (uint64_t)(uintptr_t)statx_buf;
+    sqe->statx_flags = (uint32_t)at_flags;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+static void reap(uring_t *r, uring_complete_fn *cb, void *arg) {
+    unsigned head = *r->cq_head;
+    unsigned tail = RING_LOAD(r->cq_tail);
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        cb(arg, cqe->user_data, cqe->res);
+        head++;
+        r->in_flight--;
+    }
+    RING_STORE(r->cq_head, head);
+}
+
+int Uring_run(uring_t *r, uring_complete_fn *cb, void *arg) {
+    // Publish the queued SQEs; the kernel consumes them on io_uring_enter().
+    RING_STORE(r->sq_tail, *r->sq_tail + r->queued);
+    unsigned to_submit = r->queued;
+    r->queued = 0;
+
+    while (to_submit > 0 || r->in_flight > 0) {
+        // Submitting and waiting for every completion is usually one syscall. On a short
+        // submit the kernel returns without waiting and the loop tries again.
+        int ret = sys_enter(r->fd, to_submit, to_submit + r->in_flight, IORING_ENTER_GETEVENTS);
+        r->syscalls++;
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                reap(r, cb, arg);
+                continue;
+            }
+            return -1;
+        }
+        to_submit -= (unsigned)ret;
+        r->in_flight += (unsigned)ret;
+        reap(r, cb, arg);
+    }
+    return 0;
+}
+
+#else // !WR_HAVE_IO_URING: built without io_uring headers, every caller takes its sync path
+
+int Uring_supported(uring_op_t op) {
+    (void)op;
+    return 0;
+}
+
+uring_t *Uring_create(unsigned entries) {
+    (void)entries;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void Uring_destroy(uring_t *ring) {
+    (void)ring;
+}
+
+unsigned Uring_space(const uring_t *ring) {
+    (void)ring;
+    return 0;
+}
+
+int Uring_queue_mkdirat(uring_t *ring, int dirfd, const char *path, mode_t mode, uint64_t user_data, int flags) {
+    (void)ring; (void)dirfd; (void)path; (void)mode; (void)user_data; (void)flags;
+    return -1;
+}
+
+int Uring_queue_statx(uring_t *ring, int dirfd, const char *path, int at_flags, unsigned mask,
+                      void *statx_buf, uint64_t user_data) {
+    (void)ring; (void)dirfd; (void)path; (void)at_flags; (void)mask; (void)statx_buf; (void)user_data;
+    return -1;
+}
+
+int Uring_run(uring_t *ring, uring_complete_fn *cb, void *arg) {
+    (void)ring; (void)cb; (void)arg;
+    errno = ENOSYS;
+    return -1;
+}
+
+long Uring_syscalls(const uring_t *ring) {
+    (void)ring;
+    return 0;
+}
+
+#endif // WR_HAVE_IO_URING
@@ -0,0 +1,51 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>     // For uint64_t
+#include <sys/types.h>  // For mode_t
+
+// Minimal io_uring wrapper (raw syscalls, no liburing) used by the filesystem engines to
+// batch many small operations into one io_uring_enter(). Each ring is owned by one thread.
+// Everything degrades to "unavailable" on kernels, containers or builds without io_uring,
+// and callers keep their synchronous path for that case.
+
+typedef struct uring uring_t;
+
+typedef enum {
+    URING_OP_STATX,
+    URING_OP_MKDIRAT
+} uring_op_t;
+
+#define URING_HARDLINK 1 // Run the next queued op after this one, whatever this one's result
+
+#define URING_DEFAULT_ENTRIES 256
+#define URING_MIN_BATCH 8 // Below this, ring setup costs more syscalls than it saves
+
+// Completion callback: 'res' is the syscall result (>= 0) or -errno.
+typedef void (uring_complete_fn)(void *arg, uint64_t user_data, int res);
+
+// 1 if io_uring is enabled (environment variable WR_IO_URING=1), usable and supports 'op'.
+// Probed once per process; otherwise every caller stays on its synchronous path.
+int Uring_supported(uring_op_t op);
+
+uring_t *Uring_create(unsigned entries);
+void Uring_destroy(uring_t *ring);
+
+// Queue one operation. Returns -1 when the submission queue is full (call Uring_run first).
+// Strings and buffers must stay valid until Uring_run() returns.
+int Uring_queue_mkdirat(uring_t *ring, int dirfd, const char *path, mode_t mode, uint64_t user_data, int flags);
+int Uring_queue_statx(uring_t *ring, int dirfd, const char *path, int at_flags, unsigned mask,
+                      void *statx_buf, uint64_t user_data);
+
+// Number of ops that can still be queued before Uring_run() is needed.
+unsigned Uring_space(const uring_t *ring);
+
+// Submit everything queued and wait until all of it has completed, calling 'cb' once per op.
+// Returns 0, or -1 (errno set) if the ring itself failed; ops not yet reported then never ran
+// or have unknown results.
+int Uring_run(uring_t *ring, uring_complete_fn *cb, void *arg);
+
+// Syscalls issued by this ring so far (setup, mmaps and io_uring_enter calls).
+long Uring_syscalls(const uring_t *ring);
+
+#endif // URING_H
@@ -0,0 +1,107 @@
+// wr_cbor: converts services and control requests between JSON and the compact binary
+// encoding (CBOR, src/cbor.h). Input may hold several documents back to back (NDJSON);
+// each becomes one output item, so the output can be piped to the control socket as is.
+//
+// Usage: wr_cbor [-d] [FILE]
+//   Encodes JSON from FILE (default stdin) to CBOR on stdout.
+//   -d: decodes CBOR to JSON instead, one line per item.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "cbor.h"
+
+static unsigned char *read_all(FILE *in, size_t *len) {
+    size_t cap = 65536;
+    unsigned char *data = malloc(cap);
+    *len = 0;
+    while (data != NULL) {
+        *len += fread(data + *len, 1, cap - *len, in);
+        if (*len < cap) break;
+        unsigned char *grown = realloc(data, cap * 2);
+        if (grown == NULL) free(data);
+        data = grown;
+        cap *= 2;
+    }
+    if (data != NULL && ferror(in)) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static int encode(const unsigned char *data, size_t len) {
+    const char *p = (const char *)data, *end = p + len;
+    for (int n = 1;; n++) {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+        if (p == end) return 0;
+        const char *parse_end;
+        cJSON *doc = cJSON_ParseWithLengthOpts(p, (size_t)(end - p), &parse_end, 0);
+        if (doc == NULL) {
+            fprintf(stderr, "wr_cbor: document %d: invalid JSON near byte %ld\n", n, (long)(parse_end - (const char *)data));
+            return 1;
+        }
+        size_t out_len;
+        unsigned char *out = Cbor_encode(doc, &out_len);
+        cJSON_Delete(doc);
+        if (out == NULL || fwrite(out, 1, out_len, stdout) != out_len) {
+            fprintf(stderr, "wr_cbor: cannot write document %d\n", n);
+            free(out);
+            return 1;
+        }
+        free(out);
+        p = parse_end;
+    }
+}
+
+static int decode(const unsigned char *data, size_t len) {
+    size_t off = 0;
+    for (int n = 1; off < len; n++) {
+        long item_len = Cbor_item_length(data + off, len - off);
+        char err[128];
+        // A malformed item is decoded anyway, for the reason.
+        cJSON *doc = Cbor_decode(data + off, item_len > 0 ? (size_t)item_len : len - off, err, sizeof(err));
+        if (doc == NULL) {
+            fprintf(stderr, "wr_cbor: item %d: %s\n", n, err);
+            return 1;
+        }
+        char *text = cJSON_PrintUnformatted(doc);
+        cJSON_Delete(doc);
+        if (text == NULL) return 1;
+        printf("%s\n", text);
+        cJSON_free(text);
+        off += (size_t)item_len;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int decoding = 0;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
+            decoding = 1;
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-d] [FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+    FILE *in = path != NULL ? fopen(path, "rb") : stdin;
+    if (in == NULL) {
+        perror(path);
+        return 1;
+    }
+    size_t len;
+    unsigned char *data = read_all(in, &len);
+    if (in != stdin) fclose(in);
+    if (data == NULL) {
+        fprintf(stderr, "wr_cbor: cannot read %s\n", path != NULL ? path : "stdin");
+        return 1;
+    }
+    int rc = decoding ? decode(data, len) : encode(data, len);
+    free(data);
+    return rc;
+}
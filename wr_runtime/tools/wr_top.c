@@ -0,0 +1,245 @@
+// wr_top: live table of the daemon's services, read from its shared-memory stats page
+// (src/stats_page.h). Attaches read-only: the daemon does no work for it.
+//
+// Usage: wr_top [-s cpu|latency|runs|due|name] [-d SECONDS] [-n ROWS] [-1] [--shm NAME]
+//   -s: sort order (default cpu: CPU share since the previous refresh)
+//   -d: refresh interval (default 1); -n: rows shown (default: the terminal's height)
+//   -1: print the table once, without clearing the screen; --shm: segment name
+#define _GNU_SOURCE // For shm_open
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "stats_page.h"
+
+typedef enum { SORT_CPU, SORT_LATENCY, SORT_RUNS, SORT_DUE, SORT_NAME } sort_key_t;
+
+typedef struct {
+    stats_record_t rec;
+    double cpu_share;  // Of one CPU, since the previous refresh
+} row_t;
+
+static const char *sort_names[] = { "cpu", "latency", "runs", "due", "name" };
+static sort_key_t sort_key = SORT_CPU;
+
+static stats_header_t *header = NULL; // Mapped read-only
+static size_t mapped_size = 0;
+static int shm_fd = -1;
+
+static int attach(const char *name) {
+    if (shm_fd < 0) {
+        shm_fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+        if (shm_fd < 0) {
+            fprintf(stderr, "wr_top: cannot open shared memory '%s': %s (is wr_runtime running?)\n", name,
+                    strerror(errno));
+            return -1;
+        }
+    }
+    struct stat st;
+    if (fstat(shm_fd, &st) != 0 || (size_t)st.st_size < sizeof(stats_header_t)) {
+        fprintf(stderr, "wr_top: '%s' is not a stats page\n", name);
+        return -1;
+    }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, shm_fd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "wr_top: cannot map '%s': %s\n", name, strerror(errno));
+        return -1;
+    }
+    if (header != NULL) munmap(header, mapped_size);
+    header = p;
+    mapped_size = (size_t)st.st_size;
+    if (header->magic != STATS_PAGE_MAGIC || header->version != STATS_PAGE_VERSION ||
+        header->record_size != sizeof(stats_record_t)) {
+        fprintf(stderr, "wr_top: '%s' has an unknown layout (version %u)\n", name, header->version);
+        return -1;
+    }
+    return 0;
+}
+
+// Seqlock read: copy the record, and retry while the daemon is rewriting it.
+static int read_record(stats_record_t *r, stats_record_t *out) {
+    for (int tries = 0; tries < 1000; tries++) {
+        uint32_t seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if (seq & 1) continue;
+        memcpy((char *)out + sizeof(out->seq), (const char *)r + sizeof(r->seq), sizeof(*r) - sizeof(r->seq));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&r->seq, memory_order_relaxed) == seq) {
+            out->name[STATS_NAME_LEN - 1] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int compare_rows(const void *pa, const void *pb) {
+    const row_t *a = pa, *b = pb;
+    switch (sort_key) {
+        case SORT_CPU:
+            if (a->cpu_share != b->cpu_share) return a->cpu_share < b->cpu_share ? 1 : -1;
+            if (a->rec.cpu_ns != b->rec.cpu_ns) return a->rec.cpu_ns < b->rec.cpu_ns ? 1 : -1;
+            break;
+        case SORT_LATENCY:
+            if (a->rec.last_duration_ns != b->rec.last_duration_ns) {
+                return a->rec.last_duration_ns < b->rec.last_duration_ns ? 1 : -1;
+            }
+            break;
+        case SORT_RUNS:
+            if (a->rec.runs != b->rec.runs) return a->rec.runs < b->rec.runs ? 1 : -1;
+            break;
+        case SORT_DUE:
+            if (a->rec.next_due != b->rec.next_due) return a->rec.next_due < b->rec.next_due ? -1 : 1;
+            break;
+        case SORT_NAME:
+            break;
+    }
+    return strcmp(a->rec.name, b->rec.name);
+}
+
+static void format_duration(char *buf, size_t len, uint64_t ns) {
+    if (ns == 0) snprintf(buf, len, "-");
+    else if (ns < 1000000u) snprintf(buf, len, "%lluus", (unsigned long long)(ns / 1000u));
+    else if (ns < 1000000000u) snprintf(buf, len, "%.1fms", (double)ns / 1e6);
+    else snprintf(buf, len, "%.2fs", (double)ns / 1e9);
+}
+
+static void format_exit(char *buf, size_t len, int status) {
+    if (status < 0) snprintf(buf, len, "-");
+    else if (WIFEXITED(status)) snprintf(buf, len, "%d", WEXITSTATUS(status));
+    else if (WIFSIGNALED(status)) snprintf(buf, len, "sig %d", WTERMSIG(status));
+    else snprintf(buf, len, "?");
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    const char *name = getenv("WR_STATS_SHM");
+    double delay = 1.0;
+    int rows_wanted = 0, once = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            const char *key = argv[++i];
+            size_t k = 0;
+            while (k < sizeof(sort_names) / sizeof(sort_names[0]) && strcmp(key, sort_names[k]) != 0) k++;
+            if (k == sizeof(sort_names) / sizeof(sort_names[0])) {
+                fprintf(stderr, "wr_top: unknown sort key '%s'\n", key);
+                return 2;
+            }
+            sort_key = (sort_key_t)k;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            delay = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            rows_wanted = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-1") == 0) {
+            once = 1;
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [-s cpu|latency|runs|due|name] [-d SECONDS] [-n ROWS] [-1] [--shm NAME]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (name == NULL || name[0] == '\0') name = STATS_PAGE_DEFAULT_NAME;
+    if (delay < 0.1) delay = 0.1;
+    if (attach(name) != 0) return 1;
+
+    row_t *rows = NULL;
+    uint64_t *prev_cpu = NULL;   // Per record, at the previous refresh
+    size_t rows_cap = 0;
+    uint64_t prev_generation = 0;
+    double prev_time = 0;
+    int interactive = !once && isatty(STDOUT_FILENO);
+
+    for (int first = 1;; first = 0) {
+        if ((size_t)atomic_load(&header->capacity) * sizeof(stats_record_t) +
+                sizeof(stats_header_t) > mapped_size && attach(name) != 0) {
+            return 1;
+        }
+        uint32_t count = atomic_load_explicit(&header->count, memory_order_acquire);
+        if (count > (mapped_size - sizeof(stats_header_t)) / sizeof(stats_record_t)) {
+            count = (uint32_t)((mapped_size - sizeof(stats_header_t)) / sizeof(stats_record_t)); // Grew meanwhile
+        }
+        uint64_t generation = atomic_load(&header->generation);
+        if (count > rows_cap) {
+            row_t *r = realloc(rows, count * sizeof(*rows));
+            uint64_t *c = realloc(prev_cpu, count * sizeof(*prev_cpu));
+            if (r != NULL) rows = r;
+            if (c != NULL) prev_cpu = c;
+            if (r == NULL || c == NULL) {
+                fprintf(stderr, "wr_top: out of memory\n");
+                return 1;
+            }
+            memset(prev_cpu + rows_cap, 0, (count - rows_cap) * sizeof(*prev_cpu));
+            rows_cap = count;
+        }
+        if (generation != prev_generation) {
+            if (rows_cap > 0) memset(prev_cpu, 0, rows_cap * sizeof(*prev_cpu)); // Records were reassigned
+            first = 1;
+        }
+
+        double now = now_seconds();
+        double elapsed = now - prev_time;
+        stats_record_t *records = (stats_record_t *)(header + 1);
+        size_t n = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            row_t *row = &rows[n];
+            if (read_record(&records[i], &row->rec) != 0) continue;
+            row->cpu_share = first || elapsed <= 0 ? 0
+                                                   : (double)(row->rec.cpu_ns - prev_cpu[i]) / 1e9 / elapsed;
+            prev_cpu[i] = row->rec.cpu_ns;
+            n++;
+        }
+        prev_generation = generation;
+        prev_time = now;
+        qsort(rows, n, sizeof(*rows), compare_rows);
+
+        int limit = rows_wanted;
+        if (limit <= 0 && interactive) {
+            struct winsize ws;
+            limit = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 4 ? ws.ws_row - 4 : 20;
+        }
+        if (limit <= 0 || (size_t)limit > n) limit = (int)n;
+
+        time_t wall = time(NULL);
+        int alive = kill(header->pid, 0) == 0 || errno == EPERM;
+        long up = (long)(wall - header->started);
+        if (interactive) fputs("\033[H\033[J", stdout);
+        printf("wr_runtime pid %d%s  up %ldd %02ld:%02ld:%02ld  services %u  sorted by %s\n", (int)header->pid,
+               alive ? "" : " (not running)", up / 86400, up / 3600 % 24, up / 60 % 60, up % 60, count,
+               sort_names[sort_key]);
+        printf("\n%-32s %8s %9s %8s %4s %6s %9s %6s %9s\n", "SERVICE", "INTERVAL", "NEXT DUE", "RUNS", "RUN",
+               "EXIT", "LAST RUN", "CPU%", "CPU TIME");
+        for (int i = 0; i < limit; i++) {
+            const stats_record_t *r = &rows[i].rec;
+            char due[24], exit_text[16], last[16];
+            long in = (long)(r->next_due - (int64_t)wall);
+            if (in > 0) snprintf(due, sizeof(due), "%lds", in);
+            else snprintf(due, sizeof(due), "now");
+            format_exit(exit_text, sizeof(exit_text), r->last_exit);
+            format_duration(last, sizeof(last), r->last_duration_ns);
+            printf("%-32.32s %7ds %9s %8llu %4d %6s %9s %5.1f%% %8.2fs\n", r->name, r->interval, due,
+                   (unsigned long long)r->runs, r->in_flight, exit_text, last, rows[i].cpu_share * 100.0,
+                   (double)r->cpu_ns / 1e9);
+        }
+        fflush(stdout);
+        if (once) break;
+        struct timespec ts = { (time_t)delay, (long)((delay - (double)(time_t)delay) * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+    free(rows);
+    free(prev_cpu);
+    return 0;
+}